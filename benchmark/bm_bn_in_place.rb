@@ -0,0 +1,59 @@
+# Compares BN operators, which return a new BN every time, with the
+# in-place variants and the add_all!/mul_all! accumulators, and prints how
+# many Ruby objects each allocated.
+#
+#   ruby -Ilib benchmark/bm_bn_in_place.rb [count] [bits]
+
+require_relative 'utils'
+
+n = (ARGV[0] || 100_000).to_i
+bits = (ARGV[1] || 1024).to_i
+m = OpenSSL::BN.generate_prime(bits)
+xs = Array.new(n) { OpenSSL::BN.rand_range(m) }
+
+def allocations
+  stat = GC.stat
+  stat[:total_allocated_objects] || stat[:total_allocated_object]
+end
+
+results = {}
+Benchmark.bm(20) do |x|
+  run = proc {|label, &block|
+    before = allocations
+    ret = nil
+    x.report(label) { ret = block.call }
+    results[label] = [ret, before && allocations - before]
+  }
+  run.call("mod_mul") {
+    xs.inject(1.to_bn) {|acc, v| acc.mod_mul(v, m) }
+  }
+  run.call("mod_mul!") {
+    acc = 1.to_bn
+    xs.each {|v| acc.mod_mul!(v, m) }
+    acc
+  }
+  run.call("mul_all!") {
+    1.to_bn.mul_all!(xs, m)
+  }
+  run.call("+") {
+    xs.inject(0.to_bn) {|acc, v| acc + v }
+  }
+  run.call("add!") {
+    acc = 0.to_bn
+    xs.each {|v| acc.add!(v) }
+    acc
+  }
+  run.call("add_all!") {
+    0.to_bn.add_all!(xs)
+  }
+end
+
+puts
+results.each {|label, (ret, allocated)|
+  printf("%-20s %10s objects\n", label, allocated || "?")
+}
+products = results.values_at("mod_mul", "mod_mul!", "mul_all!").map(&:first)
+sums = results.values_at("+", "add!", "add_all!").map(&:first)
+unless products.all? {|v| v == products[0] } && sums.all? {|v| v == sums[0] }
+  abort "in-place results disagree"
+end
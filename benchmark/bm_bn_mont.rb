@@ -0,0 +1,43 @@
+# Compares BN#mod_exp and BN#mod_mul, which set up the modulus on every
+# call, with the same operations on a BN::MontContext, and one mod_exp
+# per base with a single mod_exp_many or multi_exp.
+#
+#   ruby -Ilib benchmark/bm_bn_mont.rb [count] [bits]
+
+require_relative 'utils'
+
+n = (ARGV[0] || 10_000).to_i
+bits = (ARGV[1] || 1024).to_i
+m = OpenSSL::BN.generate_prime(bits)
+mont = OpenSSL::BN::MontContext.new(m)
+bases = Array.new(n) { OpenSSL::BN.rand_range(m) }
+e = 65537.to_bn
+small = Array.new(n) { OpenSSL::BN.rand(64) }
+
+unless mont.mod_exp_many(bases, e) == bases.map {|b| b.mod_exp(e, m) }
+  abort "MontContext#mod_exp_many disagrees with BN#mod_exp"
+end
+
+Benchmark.bm(24) do |x|
+  x.report("BN#mod_exp") {
+    bases.each {|b| b.mod_exp(e, m) }
+  }
+  x.report("MontContext#mod_exp") {
+    bases.each {|b| mont.mod_exp(b, e) }
+  }
+  x.report("MontContext#mod_exp_many") {
+    mont.mod_exp_many(bases, e)
+  }
+  x.report("BN#mod_mul") {
+    bases.each {|b| b.mod_mul(b, m) }
+  }
+  x.report("MontContext#mod_mul") {
+    bases.each {|b| mont.mod_mul(b, b) }
+  }
+  x.report("product of mod_exp") {
+    bases.zip(small).inject(1.to_bn) {|acc, (b, s)| acc.mod_mul(b.mod_exp(s, m), m) }
+  }
+  x.report("MontContext#multi_exp") {
+    mont.multi_exp(bases, small)
+  }
+end
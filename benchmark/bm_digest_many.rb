@@ -0,0 +1,27 @@
+# Compares hashing many small messages one at a time with
+# OpenSSL::Digest.digest_many, which takes the multi-buffer SHA-256 kernel
+# on CPUs with AVX2.
+#
+#   ruby -Ilib benchmark/bm_digest_many.rb [messages] [size]
+
+require_relative 'utils'
+
+n = (ARGV[0] || 100_000).to_i
+size = (ARGV[1] || 64).to_i
+msgs = Array.new(n) {|i| i.to_s.rjust(size, "x") }
+
+unless OpenSSL::Digest.digest_many("SHA256", msgs) == msgs.map {|m| OpenSSL::Digest::SHA256.digest(m) }
+  abort "digest_many disagrees with SHA256.digest"
+end
+
+Benchmark.bm(20) do |x|
+  x.report("SHA256.digest") {
+    msgs.each {|m| OpenSSL::Digest::SHA256.digest(m) }
+  }
+  x.report("digest_many") {
+    OpenSSL::Digest::SHA256.digest_many(msgs)
+  }
+  x.report("digest_many packed") {
+    OpenSSL::Digest::SHA256.digest_many(msgs, :packed => true)
+  }
+end
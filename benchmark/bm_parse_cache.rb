@@ -0,0 +1,34 @@
+# Parses the same few certificates over and over, as an OCSP responder or
+# a log pipeline would, with OpenSSL::ParseCache off and on.
+#
+#   ruby -Ilib benchmark/bm_parse_cache.rb [count] [distinct]
+
+require_relative 'utils'
+
+n = (ARGV[0] || 100_000).to_i
+distinct = (ARGV[1] || 100).to_i
+
+key = OpenSSL::PKey::RSA.new(1024)
+ders = (1..distinct).map {|serial|
+  cert = OpenSSL::X509::Certificate.new
+  cert.version = 2
+  cert.serial = serial
+  cert.subject = cert.issuer = OpenSSL::X509::Name.parse("/CN=host#{serial}")
+  cert.public_key = key.public_key
+  cert.not_before = Time.now
+  cert.not_after = Time.now + 3600
+  cert.sign(key, OpenSSL::Digest::SHA1.new)
+  cert.to_der
+}
+
+Benchmark.bm(12) do |x|
+  x.report("uncached") {
+    n.times {|i| OpenSSL::X509::Certificate.new(ders[i % distinct]) }
+  }
+  OpenSSL::ParseCache.size = distinct
+  x.report("cached") {
+    n.times {|i| OpenSSL::X509::Certificate.new(ders[i % distinct]) }
+  }
+end
+
+p OpenSSL::ParseCache.stats
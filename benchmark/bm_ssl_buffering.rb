@@ -0,0 +1,52 @@
+# Compares the buffered reads and writes of SSLSocket with the pure Ruby
+# implementation in OpenSSL::Buffering.
+#
+#   ruby -Ilib benchmark/bm_ssl_buffering.rb [lines]
+
+require_relative 'utils'
+include OpenSSL::BenchmarkUtils
+
+# SSLSocket with the methods of the Ruby mixin put back in place.
+class RubyBufferedSSLSocket < OpenSSL::SSL::SSLSocket
+  [:read, :readpartial, :read_nonblock, :gets, :ungetc, :eof?, :eof,
+   :write, :flush, :do_write].each do |name|
+    define_method(name, OpenSSL::Buffering.instance_method(name))
+  end
+  private :do_write
+end
+
+def run(klass, label, x, lines)
+  line = "x" * 80 + "\n"
+  chunk = "y" * 1000
+
+  c, s = ssl_pair(klass)
+  writer = Thread.new { lines.times { s.write(line) }; s.flush }
+  x.report("#{label} gets") { lines.times { c.gets } }
+  writer.join
+
+  writer = Thread.new { s.write(line * lines); s.flush }
+  x.report("#{label} gets(limit)") { (lines * 2).times { c.gets(41) } }
+  writer.join
+
+  writer = Thread.new { (lines / 10).times { s.write(chunk) }; s.flush }
+  x.report("#{label} read(100)") { (lines / 10 * 10).times { c.read(100) } }
+  writer.join
+
+  s.sync = false
+  reader = Thread.new { c.read(lines * 10 + 1) }
+  x.report("#{label} write") {
+    lines.times { s.write("0123456789") }
+    s.write("\n")
+    s.flush
+  }
+  reader.join
+ensure
+  c.close if c
+  s.close if s
+end
+
+lines = (ARGV[0] || 100_000).to_i
+Benchmark.bm(22) do |x|
+  run(OpenSSL::SSL::SSLSocket, "native", x, lines)
+  run(RubyBufferedSSLSocket, "ruby", x, lines)
+end
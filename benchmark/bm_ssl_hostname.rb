@@ -0,0 +1,79 @@
+# Compares OpenSSL::SSL.verify_certificate_identity with the Ruby version
+# it replaced, on a fresh Certificate every time (as on a new connection)
+# and on the same one again.
+#
+#   ruby -Ilib benchmark/bm_ssl_hostname.rb [count]
+
+require_relative 'utils'
+
+# lib/openssl/ssl-internal.rb before the check was done in C
+def ruby_verify_certificate_identity(cert, hostname)
+  should_verify_common_name = true
+  cert.extensions.each{|ext|
+    next if ext.oid != "subjectAltName"
+    ext.value.split(/,\s+/).each{|general_name|
+      if /\ADNS:(.*)/ =~ general_name
+        should_verify_common_name = false
+        reg = Regexp.escape($1).gsub(/\\\*/, "[^.]+")
+        return true if /\A#{reg}\z/i =~ hostname
+      elsif /\AIP Address:(.*)/ =~ general_name
+        should_verify_common_name = false
+        return true if $1 == hostname
+      end
+    }
+  }
+  if should_verify_common_name
+    cert.subject.to_a.each{|oid, value|
+      if oid == "CN"
+        reg = Regexp.escape(value).gsub(/\\\*/, "[^.]+")
+        return true if /\A#{reg}\z/i =~ hostname
+      end
+    }
+  end
+  return false
+end
+
+n = (ARGV[0] || 100_000).to_i
+
+key = OpenSSL::PKey::RSA.new(1024)
+cert = OpenSSL::X509::Certificate.new
+cert.version = 2
+cert.serial = 1
+cert.subject = cert.issuer = OpenSSL::X509::Name.parse("/CN=www.example.com")
+cert.public_key = key.public_key
+cert.not_before = Time.now
+cert.not_after = Time.now + 3600
+ef = OpenSSL::X509::ExtensionFactory.new(cert, cert)
+cert.add_extension(ef.create_extension("subjectAltName",
+  "DNS:example.com,DNS:*.example.com,DNS:*.cdn.example.net,IP:192.0.2.1"))
+cert.sign(key, OpenSSL::Digest::SHA1.new)
+der = cert.to_der
+
+hosts = %w[static.cdn.example.net 192.0.2.1 www.example.org]
+hosts.each {|host|
+  if ruby_verify_certificate_identity(cert, host) !=
+     OpenSSL::SSL.verify_certificate_identity(cert, host)
+    abort "results differ for #{host}"
+  end
+}
+
+Benchmark.bm(24) do |x|
+  x.report("ruby, new cert") {
+    n.times {|i|
+      ruby_verify_certificate_identity(OpenSSL::X509::Certificate.new(der),
+                                       hosts[i % hosts.size])
+    }
+  }
+  x.report("native, new cert") {
+    n.times {|i|
+      OpenSSL::SSL.verify_certificate_identity(OpenSSL::X509::Certificate.new(der),
+                                               hosts[i % hosts.size])
+    }
+  }
+  x.report("ruby, same cert") {
+    n.times {|i| ruby_verify_certificate_identity(cert, hosts[i % hosts.size]) }
+  }
+  x.report("native, same cert") {
+    n.times {|i| OpenSSL::SSL.verify_certificate_identity(cert, hosts[i % hosts.size]) }
+  }
+end
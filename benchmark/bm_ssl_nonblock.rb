@@ -0,0 +1,27 @@
+# Measures what raising IO::WaitReadable costs a non-blocking reader, by
+# polling an idle SSLSocket with and without :exception => false.
+#
+#   ruby -Ilib benchmark/bm_ssl_nonblock.rb [polls]
+
+require_relative 'utils'
+include OpenSSL::BenchmarkUtils
+
+n = (ARGV[0] || 200_000).to_i
+c, s = ssl_pair
+
+Benchmark.bm(20) do |x|
+  x.report("rescue WaitReadable") {
+    n.times {
+      begin
+        c.read_nonblock(1024)
+      rescue IO::WaitReadable
+      end
+    }
+  }
+  x.report(":exception => false") {
+    n.times { c.read_nonblock(1024, :exception => false) }
+  }
+end
+
+c.close
+s.close
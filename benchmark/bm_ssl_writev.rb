@@ -0,0 +1,39 @@
+# Compares writing an HTTP-like response piece by piece with #syswrite
+# against gathering it with #syswritev, and prints the records and socket
+# writes each way took.
+#
+#   ruby -Ilib benchmark/bm_ssl_writev.rb [responses]
+
+require_relative 'utils'
+include OpenSSL::BenchmarkUtils
+
+header = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n" +
+  "Content-Length: 30000\r\n\r\n"
+body = ["<html>", "x" * 10000, "y" * 10000, "z" * 9987, "</html>"]
+n = (ARGV[0] || 2000).to_i
+
+Benchmark.bm(10) do |x|
+  [:syswrite, :syswritev].each do |meth|
+    c, s = ssl_pair
+    size = (header.size + body.join.size) * n
+    reader = Thread.new { c.read(size) }
+    before = s.write_stats
+    x.report(meth.to_s) {
+      n.times {
+        if meth == :syswritev
+          s.syswritev(header, *body)
+        else
+          s.syswrite(header)
+          body.each {|b| s.syswrite(b) }
+        end
+      }
+    }
+    reader.join
+    after = s.write_stats
+    printf("%-10s records: %d, syscalls: %d\n", meth,
+           after[:records] - before[:records],
+           after[:syscalls] - before[:syscalls])
+    c.close
+    s.close
+  end
+end
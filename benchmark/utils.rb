@@ -0,0 +1,29 @@
+require 'openssl'
+require 'socket'
+require 'benchmark'
+
+module OpenSSL::BenchmarkUtils
+  DH = OpenSSL::PKey::DH.new(512)
+
+  # Returns a connected client and server SSLSocket of class +klass+.
+  def ssl_pair(klass = OpenSSL::SSL::SSLSocket)
+    tcps = TCPServer.new("127.0.0.1", 0)
+    ctx = OpenSSL::SSL::SSLContext.new
+    ctx.ciphers = "ADH"
+    ctx.tmp_dh_callback = proc { DH }
+    th = Thread.new {
+      s = klass.new(tcps.accept, ctx)
+      s.sync_close = true
+      s.accept
+    }
+    ctx = OpenSSL::SSL::SSLContext.new
+    ctx.ciphers = "ADH"
+    c = klass.new(TCPSocket.new("127.0.0.1", tcps.addr[1]), ctx)
+    c.sync_close = true
+    c.connect
+    return c, th.value
+  ensure
+    tcps.close
+  end
+  module_function :ssl_pair
+end
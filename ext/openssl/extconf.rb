@@ -62,7 +62,19 @@ unless have_header("openssl/conf_api.h")
   exit 1
 end
 
-%w"rb_str_set_len rb_block_call".each {|func| have_func(func, "ruby.h")}
+%w"rb_str_set_len rb_block_call rb_str_modify_expand rb_integer_pack".each {|func| have_func(func, "ruby.h")}
+have_header("ruby/thread.h") && have_func("rb_thread_call_without_gvl", "ruby/thread.h")
+have_func("rb_thread_blocking_region", "ruby.h")
+have_func("rb_thread_call_with_gvl")
+have_header("pthread.h")
+have_func("poll", "poll.h")
+have_func("inet_pton", "arpa/inet.h")
+have_func("mmap", "sys/mman.h")
+have_func("madvise", "sys/mman.h")
+have_func("posix_fadvise", "fcntl.h")
+have_struct_member("rb_io_t", "rbuf_len", "ruby/io.h")
+have_func("pthread_mutexattr_setpshared", "pthread.h")
+have_func("pthread_mutexattr_setrobust", "pthread.h")
 
 message "=== Checking for OpenSSL features... ===\n"
 have_func("ERR_peek_last_error")
@@ -70,6 +82,10 @@ have_func("BN_mod_add")
 have_func("BN_mod_sqr")
 have_func("BN_mod_sub")
 have_func("BN_pseudo_rand_range")
+have_func("BN_generate_prime_ex")
+have_func("RSA_generate_key_ex")
+have_func("DSA_generate_parameters_ex")
+have_func("DH_generate_parameters_ex")
 have_func("BN_rand_range")
 have_func("CONF_get1_default_config_file")
 have_func("EVP_CIPHER_CTX_copy")
@@ -124,6 +140,15 @@ if checking_for('OpenSSL version is 0.9.7 or later') {
   }
   have_header("openssl/ocsp.h")
 end
+if checking_for("multi-buffer SHA-256 kernel") {
+    try_compile(<<-SRC)
+      typedef unsigned int v8u __attribute__((vector_size(32)));
+      __attribute__((target("avx2"))) static v8u f(v8u a) { return (a >> 7) | (a << 25); }
+      int main(void) { v8u a = {0}; return __builtin_cpu_supports("avx2") ? (int)f(a)[0] : 0; }
+    SRC
+  }
+  $defs.push("-DOSSL_DIGEST_MB_ENABLED")
+end
 have_struct_member("EVP_CIPHER_CTX", "flags", "openssl/evp.h")
 have_struct_member("EVP_CIPHER_CTX", "engine", "openssl/evp.h")
 have_struct_member("X509_ATTRIBUTE", "single", "openssl/x509.h")
@@ -29,7 +29,7 @@ end # OpenSSL
 #
 class Integer
   def to_bn
-    OpenSSL::BN::new(self.to_s(16), 16)
+    OpenSSL::BN::new(self)
   end
 end # Integer
 
@@ -287,9 +287,12 @@ module Buffering
   # See openssl FAQ for more details.
   # http://www.openssl.org/support/faq.html
   #
-  def write_nonblock(s)
+  # With <tt>:exception => false</tt> in _opts_, :wait_readable or
+  # :wait_writable is returned instead of raising.
+  #
+  def write_nonblock(s, opts = {})
     flush
-    syswrite_nonblock(s)
+    syswrite_nonblock(s, opts)
   end
 
   def << (s)
@@ -44,6 +44,7 @@ module OpenSSL
       singleton.class_eval{
         define_method(:digest){|data| Digest.digest(name, data) }
         define_method(:hexdigest){|data| Digest.hexdigest(name, data) }
+        define_method(:digest_many){|*args| Digest.digest_many(name, *args) }
       }
       const_set(name, klass)
     }
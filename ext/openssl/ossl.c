@@ -10,6 +10,14 @@
  */
 #include "ossl.h"
 #include <stdarg.h> /* for ossl_raise */
+#if defined(HAVE_UNISTD_H)
+#  include <unistd.h> /* for sysconf() */
+#endif
+#include <sys/stat.h>
+#include <fcntl.h>
+#if defined(HAVE_MMAP)
+#  include <sys/mman.h>
+#endif
 
 /*
  * String to HEXString conversion
@@ -138,6 +146,327 @@ ossl_buf2str(char *buf, int len)
     return str;
 }
 
+/*
+ * Makes room in +str+ for +len+ bytes at +offset+ and returns where they
+ * go.  What comes before +offset+ is kept and the length is left alone;
+ * the caller sets it once the data is in.  The capacity only ever grows,
+ * so a String reused for a stream stops being reallocated once it is
+ * large enough.
+ */
+char *
+ossl_str_reserve(VALUE str, long offset, long len)
+{
+    long olen;
+
+    StringValue(str);
+    olen = RSTRING_LEN(str);
+    if (offset < 0 || offset > olen)
+	rb_raise(rb_eArgError, "offset %ld outside of buffer of %ld bytes",
+		 offset, olen);
+    if (offset + len <= olen) {
+	rb_str_modify(str);
+    }
+    else {
+#if defined(HAVE_RB_STR_MODIFY_EXPAND)
+	rb_str_modify_expand(str, offset + len - olen);
+#else
+	rb_str_modify(str);
+	if (rb_str_capacity(str) < (size_t)(offset + len)) {
+	    rb_str_resize(str, offset + len);
+	    rb_str_set_len(str, olen);
+	}
+#endif
+    }
+
+    return RSTRING_PTR(str) + offset;
+}
+
+/*
+ * Returns 1 if the +len+ bytes at +a+ and +b+ are equal, 0 otherwise, in
+ * time that depends only on +len+.  For comparing MACs and the like.
+ */
+int
+ossl_secure_compare(const void *a, const void *b, size_t len)
+{
+    const volatile unsigned char *p = a, *q = b;
+    unsigned char diff = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	diff |= p[i] ^ q[i];
+
+    return diff == 0;
+}
+
+/*
+ * Returns the descriptor of +file+, an IO or a path.  A path is opened,
+ * and *close_fd set to tell the caller to close it again.  An IO is taken
+ * from its current position, which is put in *off where it can be told.
+ * Its read buffer would be skipped, so an IO holding buffered data raises.
+ */
+static int
+ossl_file_open(VALUE file, int *close_fd, off_t *off)
+{
+    VALUE io;
+    rb_io_t *fptr;
+    int fd;
+
+    *close_fd = 0;
+    *off = 0;
+    io = rb_check_convert_type(file, T_FILE, "IO", "to_io");
+    if (!NIL_P(io)) {
+	GetOpenFile(io, fptr);
+	rb_io_check_readable(fptr);
+	if (FPTR_RBUF_LEN(fptr) > 0)
+	    rb_raise(rb_eIOError, "IO has buffered data; use sysread or seek first");
+	fd = FPTR_TO_FD(fptr);
+	/* pipes and sockets have no position, they go on where they are */
+	if ((*off = lseek(fd, 0, SEEK_CUR)) < 0)
+	    *off = 0;
+	return fd;
+    }
+    FilePathValue(file);
+    if ((fd = open(RSTRING_PTR(file), O_RDONLY)) < 0)
+	rb_sys_fail(RSTRING_PTR(file));
+    *close_fd = 1;
+
+    return fd;
+}
+
+#if defined(HAVE_MMAP)
+/*
+ * Maps +len+ bytes of +fd+ from +off+, which needn't be on a page
+ * boundary.  Returns -1 and leaves errno if mmap(2) fails.
+ */
+static int
+ossl_file_mmap(struct ossl_file_map *map, int fd, off_t off, size_t len)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t skip = page > 0 ? (size_t)(off % page) : 0;
+    char *p;
+
+    p = mmap(NULL, len + skip, PROT_READ, MAP_PRIVATE, fd, off - skip);
+    if (p == MAP_FAILED)
+	return -1;
+#  if defined(HAVE_MADVISE)
+    madvise(p, len + skip, MADV_SEQUENTIAL);
+#  endif
+    map->ptr = p + skip;
+    map->len = len;
+    map->skip = skip;
+
+    return 0;
+}
+#endif
+
+/*
+ * Maps +file+, a path or an IO of a regular file, into memory so it can
+ * be hashed without copying it into Strings; an IO from its position on,
+ * which is moved to the end.  Where mmap(2) isn't available the file is
+ * read into a malloc'ed buffer instead.  The mapping must be released with
+ * ossl_file_unmap().
+ */
+void
+ossl_file_map(VALUE file, struct ossl_file_map *map)
+{
+    struct stat st;
+    off_t off;
+    int fd, close_fd, e;
+
+    map->ptr = NULL;
+    map->len = 0;
+    map->skip = 0;
+    fd = ossl_file_open(file, &close_fd, &off);
+    if (fstat(fd, &st) < 0) {
+	e = errno;
+	if (close_fd) close(fd);
+	errno = e;
+	rb_sys_fail("fstat");
+    }
+    if (!S_ISREG(st.st_mode)) {
+	if (close_fd) close(fd);
+	rb_raise(rb_eArgError, "not a regular file");
+    }
+    map->len = st.st_size > off ? st.st_size - off : 0;
+    if (map->len > 0) {
+#if defined(HAVE_MMAP)
+	if (ossl_file_mmap(map, fd, off, map->len) < 0) {
+	    e = errno;
+	    map->len = 0;
+	    if (close_fd) close(fd);
+	    errno = e;
+	    rb_sys_fail("mmap");
+	}
+#else
+	size_t done = 0;
+	ssize_t n;
+
+	map->ptr = xmalloc(map->len);
+	while (done < map->len) {
+	    n = pread(fd, map->ptr + done, map->len - done, off + done);
+	    if (n <= 0) {
+		e = n < 0 ? errno : EIO;
+		xfree(map->ptr);
+		map->ptr = NULL;
+		if (close_fd) close(fd);
+		errno = e;
+		rb_sys_fail("read");
+	    }
+	    done += n;
+	}
+#endif
+    }
+    /* the mapping stays valid without the descriptor */
+    if (close_fd)
+	close(fd);
+    else
+	lseek(fd, off + map->len, SEEK_SET);
+}
+
+void
+ossl_file_unmap(struct ossl_file_map *map)
+{
+    if (!map->ptr) return;
+#if defined(HAVE_MMAP)
+    munmap(map->ptr - map->skip, map->len + map->skip);
+#else
+    xfree(map->ptr);
+#endif
+    map->ptr = NULL;
+}
+
+#define OSSL_FILE_BUFSIZE (64 * 1024)
+
+struct ossl_file_update_args {
+    VALUE file;
+    int fd, close_fd;
+    struct ossl_file_map map;
+    char *buf;
+    ssize_t nread;
+    int err;
+    int (*update)(void *, const void *, size_t);
+    void *ctx;
+    int ok;
+};
+
+static void *
+ossl_file_update_mapped(void *ptr)
+{
+    struct ossl_file_update_args *args = ptr;
+
+    args->ok = args->update(args->ctx, args->map.ptr, args->map.len);
+
+    return NULL;
+}
+
+static void *
+ossl_file_update_read(void *ptr)
+{
+    struct ossl_file_update_args *args = ptr;
+
+    args->nread = read(args->fd, args->buf, OSSL_FILE_BUFSIZE);
+    args->err = errno;
+    if (args->nread > 0)
+	args->ok = args->update(args->ctx, args->buf, args->nread);
+
+    return NULL;
+}
+
+static VALUE
+ossl_file_update0(VALUE ptr)
+{
+    struct ossl_file_update_args *args = (struct ossl_file_update_args *)ptr;
+    struct stat st;
+    off_t off;
+
+    args->fd = ossl_file_open(args->file, &args->close_fd, &off);
+    if (fstat(args->fd, &st) < 0)
+	rb_sys_fail("fstat");
+#if defined(HAVE_MMAP)
+    if (S_ISREG(st.st_mode) && st.st_size > off &&
+	ossl_file_mmap(&args->map, args->fd, off, st.st_size - off) == 0) {
+	ossl_nogvl(ossl_file_update_mapped, args, RUBY_UBF_IO, 0);
+	/* as far as reading it would have gone */
+	if (!args->close_fd)
+	    lseek(args->fd, st.st_size, SEEK_SET);
+	return Qnil;
+    }
+#endif
+#if defined(HAVE_POSIX_FADVISE)
+    if (S_ISREG(st.st_mode))
+	posix_fadvise(args->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    /* pipes, sockets and the like are read in chunks into one buffer */
+    args->buf = ALLOC_N(char, OSSL_FILE_BUFSIZE);
+    for (;;) {
+	ossl_nogvl(ossl_file_update_read, args, RUBY_UBF_IO, 0);
+	if (args->nread > 0) {
+	    if (!args->ok) break;
+	    continue;
+	}
+	if (args->nread == 0)
+	    break;
+	switch (args->err) {
+	case EINTR:
+	    rb_thread_check_ints();
+	    continue;
+	case EAGAIN:
+#if defined(EWOULDBLOCK) && EWOULDBLOCK != EAGAIN
+	case EWOULDBLOCK:
+#endif
+	    rb_io_wait_readable(args->fd);
+	    continue;
+	default:
+	    errno = args->err;
+	    rb_sys_fail("read");
+	}
+    }
+
+    return Qnil;
+}
+
+static VALUE
+ossl_file_update_ensure(VALUE ptr)
+{
+    struct ossl_file_update_args *args = (struct ossl_file_update_args *)ptr;
+
+    ossl_file_unmap(&args->map);
+    xfree(args->buf);
+    if (args->close_fd) close(args->fd);
+
+    return Qnil;
+}
+
+/*
+ * Feeds all of +file+, a path or an IO from its position on, to
+ * update(ctx, ptr, len) without the GVL.  Regular files are mapped and
+ * passed in one piece, anything else is read into a reused buffer until
+ * EOF.  Returns 0 as soon as update() does.  +ctx+ must not be touched by
+ * anyone else meanwhile, and a mapped file that is truncated under us
+ * faults with SIGBUS.
+ */
+int
+ossl_file_update(VALUE file, int (*update)(void *, const void *, size_t),
+		 void *ctx)
+{
+    struct ossl_file_update_args args;
+
+    args.file = file;
+    args.fd = -1;
+    args.close_fd = 0;
+    args.map.ptr = NULL;
+    args.map.len = 0;
+    args.map.skip = 0;
+    args.buf = NULL;
+    args.update = update;
+    args.ctx = ctx;
+    args.ok = 1;
+    rb_ensure(ossl_file_update0, (VALUE)&args,
+	      ossl_file_update_ensure, (VALUE)&args);
+
+    return args.ok;
+}
+
 /*
  * our default PEM callback
  */
@@ -185,6 +514,223 @@ ossl_pem_passwd_cb(char *buf, int max_len, int flag, void *pwd)
     return len;
 }
 
+/*
+ * GVL release
+ */
+#if defined(OSSL_NOGVL_ENABLED)
+static pthread_key_t ossl_nogvl_key;
+static pthread_mutex_t *ossl_locks;
+
+struct ossl_nogvl_args {
+    void *(*func)(void *);
+    void *data;
+    void *ret;
+    int state;
+    VALUE errinfo;
+};
+
+struct ossl_with_gvl_args {
+    void *(*func)(void *);
+    void *data;
+    void *ret;
+    int state;
+    VALUE errinfo;
+};
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+static void *
+#else
+static VALUE
+#endif
+ossl_nogvl_func(void *ptr)
+{
+    struct ossl_nogvl_args *args = ptr;
+
+    pthread_setspecific(ossl_nogvl_key, args);
+    args->ret = args->func(args->data);
+    pthread_setspecific(ossl_nogvl_key, NULL);
+
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+    return NULL;
+#else
+    return Qnil;
+#endif
+}
+
+static VALUE
+ossl_with_gvl_call(VALUE ptr)
+{
+    struct ossl_with_gvl_args *args = (struct ossl_with_gvl_args *)ptr;
+
+    args->ret = args->func(args->data);
+
+    return Qnil;
+}
+
+static void *
+ossl_with_gvl_func(void *ptr)
+{
+    struct ossl_with_gvl_args *args = ptr;
+
+    rb_protect(ossl_with_gvl_call, (VALUE)args, &args->state);
+    if (args->state)
+	args->errinfo = rb_errinfo();
+
+    return NULL;
+}
+#endif /* OSSL_NOGVL_ENABLED */
+
+void *
+ossl_nogvl(void *(*func)(void *), void *data, rb_unblock_function_t *ubf, void *data2)
+{
+#if defined(OSSL_NOGVL_ENABLED)
+    struct ossl_nogvl_args args;
+
+    args.func = func;
+    args.data = data;
+    args.ret = NULL;
+    args.state = 0;
+    args.errinfo = Qnil;
+#if defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL)
+    rb_thread_call_without_gvl(ossl_nogvl_func, &args, ubf, data2);
+#else
+    rb_thread_blocking_region(ossl_nogvl_func, &args, ubf, data2);
+#endif
+    if (args.state) {
+	if (rb_obj_is_kind_of(args.errinfo, rb_eException))
+	    rb_exc_raise(args.errinfo);
+	rb_jump_tag(args.state);
+    }
+
+    return args.ret;
+#else
+    return func(data);
+#endif
+}
+
+void *
+ossl_with_gvl(void *(*func)(void *), void *data)
+{
+#if defined(OSSL_NOGVL_ENABLED)
+    struct ossl_nogvl_args *nogvl;
+    struct ossl_with_gvl_args args;
+
+    nogvl = pthread_getspecific(ossl_nogvl_key);
+    if (nogvl) {
+	args.func = func;
+	args.data = data;
+	args.ret = NULL;
+	args.state = 0;
+	args.errinfo = Qnil;
+	pthread_setspecific(ossl_nogvl_key, NULL);
+	rb_thread_call_with_gvl(ossl_with_gvl_func, &args);
+	pthread_setspecific(ossl_nogvl_key, nogvl);
+	if (args.state && !nogvl->state) {
+	    /* keep the first exception, it is raised by ossl_nogvl() */
+	    nogvl->state = args.state;
+	    nogvl->errinfo = args.errinfo;
+	}
+	return args.ret;
+    }
+#endif
+    return func(data);
+}
+
+#if defined(OSSL_NOGVL_ENABLED)
+#define OSSL_PARALLEL_MAX 64
+
+struct ossl_parallel_args {
+    void (*func)(void *, long, long);
+    void *data;
+    long beg, end;
+};
+
+static void *
+ossl_parallel_func(void *ptr)
+{
+    struct ossl_parallel_args *args = ptr;
+
+    args->func(args->data, args->beg, args->end);
+
+    return NULL;
+}
+#endif
+
+void
+ossl_parallel(void (*func)(void *, long, long), void *data, long num, long grain)
+{
+#if defined(OSSL_NOGVL_ENABLED) && defined(_SC_NPROCESSORS_ONLN)
+    struct ossl_parallel_args args[OSSL_PARALLEL_MAX];
+    pthread_t threads[OSSL_PARALLEL_MAX];
+    int started[OSSL_PARALLEL_MAX];
+    long n, i, ncpu;
+
+    ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    n = grain > 0 ? num / grain : num;
+    if (n > ncpu) n = ncpu;
+    if (n > OSSL_PARALLEL_MAX) n = OSSL_PARALLEL_MAX;
+    if (n > 1) {
+	for (i = 0; i < n; i++) {
+	    args[i].func = func;
+	    args[i].data = data;
+	    args[i].beg = num * i / n;
+	    args[i].end = num * (i + 1) / n;
+	}
+	/* the first slice is done by the calling thread */
+	for (i = 1; i < n; i++)
+	    started[i] = pthread_create(&threads[i], NULL, ossl_parallel_func,
+					&args[i]) == 0;
+	ossl_parallel_func(&args[0]);
+	for (i = 1; i < n; i++) {
+	    if (started[i])
+		pthread_join(threads[i], NULL);
+	    else
+		ossl_parallel_func(&args[i]);
+	}
+	return;
+    }
+#endif
+    if (num > 0)
+	func(data, 0, num);
+}
+
+#if defined(OSSL_NOGVL_ENABLED)
+static void
+ossl_lock_cb(int mode, int type, const char *file, int line)
+{
+    if (mode & CRYPTO_LOCK)
+	pthread_mutex_lock(&ossl_locks[type]);
+    else
+	pthread_mutex_unlock(&ossl_locks[type]);
+}
+
+static unsigned long
+ossl_thread_id_cb(void)
+{
+    return (unsigned long)pthread_self();
+}
+#endif
+
+static void
+Init_ossl_locks(void)
+{
+#if defined(OSSL_NOGVL_ENABLED)
+    int i, num;
+
+    if (pthread_key_create(&ossl_nogvl_key, NULL) != 0)
+	rb_raise(rb_eRuntimeError, "pthread_key_create failed");
+    /* somebody else in this process may have set up locking already */
+    if (CRYPTO_get_locking_callback())
+	return;
+    num = CRYPTO_num_locks();
+    ossl_locks = ALLOC_N(pthread_mutex_t, num);
+    for (i = 0; i < num; i++)
+	pthread_mutex_init(&ossl_locks[i], NULL);
+    CRYPTO_set_id_callback(ossl_thread_id_cb);
+    CRYPTO_set_locking_callback(ossl_lock_cb);
+#endif
+}
+
 /*
  * Verify callback
  */
@@ -197,9 +743,18 @@ ossl_call_verify_cb_proc(struct ossl_verify_cb_args *args)
                       args->preverify_ok, args->store_ctx);
 }
 
-int
-ossl_verify_cb(int ok, X509_STORE_CTX *ctx)
+struct ossl_verify_cb0_args {
+    int ok;
+    X509_STORE_CTX *ctx;
+    int ret;
+};
+
+static void *
+ossl_verify_cb0(void *ptr)
 {
+    struct ossl_verify_cb0_args *cb_args = ptr;
+    X509_STORE_CTX *ctx = cb_args->ctx;
+    int ok = cb_args->ok;
     VALUE proc, rctx, ret;
     struct ossl_verify_cb_args args;
     int state = 0;
@@ -207,8 +762,10 @@ ossl_verify_cb(int ok, X509_STORE_CTX *ctx)
     proc = (VALUE)X509_STORE_CTX_get_ex_data(ctx, ossl_verify_cb_idx);
     if ((void*)proc == 0)
 	proc = (VALUE)X509_STORE_get_ex_data(ctx->ctx, ossl_verify_cb_idx);
-    if ((void*)proc == 0)
-	return ok;
+    if ((void*)proc == 0) {
+	cb_args->ret = ok;
+	return NULL;
+    }
     if (!NIL_P(proc)) {
 	rctx = rb_protect((VALUE(*)(VALUE))ossl_x509stctx_new,
 			  (VALUE)ctx, &state);
@@ -231,8 +788,22 @@ ossl_verify_cb(int ok, X509_STORE_CTX *ctx)
 	    ok = 0;
 	}
     }
+    cb_args->ret = ok;
 
-    return ok;
+    return NULL;
+}
+
+int
+ossl_verify_cb(int ok, X509_STORE_CTX *ctx)
+{
+    struct ossl_verify_cb0_args args;
+
+    args.ok = ok;
+    args.ctx = ctx;
+    args.ret = 0; /* reject if the callback raised */
+    ossl_with_gvl(ossl_verify_cb0, &args);
+
+    return args.ret;
 }
 
 /*
@@ -813,6 +1384,11 @@ Init_openssl()
     ERR_free_strings();
 #endif
 
+    /*
+     * Allow OpenSSL to be used from several native threads
+     */
+    Init_ossl_locks();
+
     /*
      * Init main module
      */
@@ -853,6 +1429,7 @@ Init_openssl()
     /*
      * Init components
      */
+    Init_ossl_parse_cache();
     Init_ossl_bn();
     Init_ossl_cipher();
     Init_ossl_config();
@@ -70,6 +70,16 @@ extern "C" {
 #  include <openssl/ocsp.h>
 #endif
 
+/*
+ * The GVL can only be given up around OpenSSL calls if we are able to get it
+ * back for the callbacks and OpenSSL can be told how to lock itself.
+ */
+#if (defined(HAVE_RB_THREAD_CALL_WITHOUT_GVL) || defined(HAVE_RB_THREAD_BLOCKING_REGION)) && \
+    defined(HAVE_RB_THREAD_CALL_WITH_GVL) && defined(HAVE_PTHREAD_H)
+#  define OSSL_NOGVL_ENABLED
+#  include <pthread.h>
+#endif
+
 /*
  * Common Module
  */
@@ -124,6 +134,17 @@ STACK_OF(X509) *ossl_protect_x509_ary2sk(VALUE,int*);
 VALUE ossl_x509_sk2ary(STACK_OF(X509) *certs);
 VALUE ossl_x509crl_sk2ary(STACK_OF(X509_CRL) *crl);
 VALUE ossl_buf2str(char *buf, int len);
+char *ossl_str_reserve(VALUE str, long offset, long len);
+int ossl_secure_compare(const void *, const void *, size_t);
+
+struct ossl_file_map {
+    char *ptr;
+    size_t len;
+    size_t skip;	/* mapped before ptr, to start on a page */
+};
+void ossl_file_map(VALUE, struct ossl_file_map *);
+void ossl_file_unmap(struct ossl_file_map *);
+int ossl_file_update(VALUE, int (*)(void *, const void *, size_t), void *);
 #define ossl_str_adjust(str, p) \
 do{\
     int len = RSTRING_LEN(str);\
@@ -144,6 +165,24 @@ int ossl_pem_passwd_cb(char *, int, int, void *);
 NORETURN(void ossl_raise(VALUE, const char *, ...));
 VALUE ossl_exc_new(VALUE, const char *, ...);
 
+/*
+ * GVL release
+ *
+ * ossl_nogvl() runs func(data) without the GVL when possible.  Callbacks
+ * OpenSSL invokes meanwhile must reach Ruby through ossl_with_gvl(); an
+ * exception raised there is re-raised when ossl_nogvl() returns and the
+ * callback sees NULL as the result.
+ */
+void *ossl_nogvl(void *(*)(void *), void *, rb_unblock_function_t *, void *);
+void *ossl_with_gvl(void *(*)(void *), void *);
+
+/*
+ * ossl_parallel() calls func(data, beg, end) on slices of 0...num, from as
+ * many threads as there are CPUs but with no fewer than +grain+ items each.
+ * It must be called without the GVL; func must not touch Ruby.
+ */
+void ossl_parallel(void (*)(void *, long, long), void *, long, long);
+
 /*
  * Verify callback
  */
@@ -209,6 +248,7 @@ void ossl_debug(const char *, ...);
 #include "ossl_hmac.h"
 #include "ossl_ns_spki.h"
 #include "ossl_ocsp.h"
+#include "ossl_parse_cache.h"
 #include "ossl_pkcs12.h"
 #include "ossl_pkcs7.h"
 #include "ossl_pkcs5.h"
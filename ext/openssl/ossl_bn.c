@@ -36,6 +36,112 @@
 VALUE cBN;
 VALUE eBNError;
 
+/*
+ * Integer conversion
+ *
+ * Integers are moved to and from BIGNUMs a word at a time: with
+ * rb_integer_pack() and rb_integer_unpack() straight into and out of the
+ * BIGNUM's words, or on older rubies with rb_big_pack()/rb_big_unpack(),
+ * which use two's complement, when BN_ULONG is a long.  Failing both,
+ * hex strings are used.
+ */
+static BIGNUM *
+ossl_bn_set_integer(BIGNUM *bn, VALUE num)
+{
+    if (FIXNUM_P(num)) {
+	long v = FIX2LONG(num);
+
+	if (!BN_set_word(bn, v < 0 ? -(unsigned long)v : (unsigned long)v))
+	    return NULL;
+	BN_set_negative(bn, v < 0);
+	return bn;
+    }
+    else {
+#if defined(HAVE_RB_INTEGER_PACK)
+	size_t nwords = rb_absint_numwords(num, BN_BYTES * 8, NULL);
+	int sign;
+
+	if (!bn_wexpand(bn, (int)nwords))
+	    return NULL;
+	sign = rb_integer_pack(num, bn->d, nwords, BN_BYTES, 0,
+			       INTEGER_PACK_LSWORD_FIRST|INTEGER_PACK_NATIVE_BYTE_ORDER);
+	bn->top = (int)nwords;
+	bn->neg = 0;
+	bn_correct_top(bn);
+	BN_set_negative(bn, sign < 0);
+	return bn;
+#elif BN_BYTES == SIZEOF_LONG
+	long i, n = (RBIGNUM_LEN(num) * SIZEOF_BDIGITS + SIZEOF_LONG - 1) / SIZEOF_LONG + 1;
+	int neg = RBIGNUM_NEGATIVE_P(num);
+	BN_ULONG carry = 1;
+
+	if (!bn_wexpand(bn, (int)n))
+	    return NULL;
+	rb_big_pack(num, (unsigned long *)bn->d, n);
+	if (neg) {
+	    for (i = 0; i < n; i++) {
+		bn->d[i] = ~bn->d[i] + carry;
+		carry = carry && !bn->d[i];
+	    }
+	}
+	bn->top = (int)n;
+	bn->neg = 0;
+	bn_correct_top(bn);
+	BN_set_negative(bn, neg);
+	return bn;
+#else
+	VALUE str = rb_big2str(num, 16);
+
+	return BN_hex2bn(&bn, StringValueCStr(str)) ? bn : NULL;
+#endif
+    }
+}
+
+static VALUE
+ossl_bn_get_integer(const BIGNUM *bn)
+{
+    BN_ULONG w;
+
+    if (BN_num_bits(bn) < (int)sizeof(long) * 8 &&
+	BN_num_bytes(bn) <= (int)sizeof(BN_ULONG)) {
+	w = BN_get_word(bn);
+	return LONG2NUM(BN_is_negative(bn) ? -(long)w : (long)w);
+    }
+#if defined(HAVE_RB_INTEGER_PACK)
+    return rb_integer_unpack(bn->d, bn->top, BN_BYTES, 0,
+			     INTEGER_PACK_LSWORD_FIRST|INTEGER_PACK_NATIVE_BYTE_ORDER|
+			     (BN_is_negative(bn) ? INTEGER_PACK_NEGATIVE : 0));
+#elif BN_BYTES == SIZEOF_LONG
+    {
+	/* one more word, so that the top bit is the sign */
+	VALUE tmp = rb_str_new(0, (bn->top + 1) * sizeof(BN_ULONG));
+	BN_ULONG *d = (BN_ULONG *)RSTRING_PTR(tmp), carry = 1;
+	int i;
+
+	memcpy(d, bn->d, bn->top * sizeof(BN_ULONG));
+	d[bn->top] = 0;
+	if (BN_is_negative(bn)) {
+	    for (i = 0; i <= bn->top; i++) {
+		d[i] = ~d[i] + carry;
+		carry = carry && !d[i];
+	    }
+	}
+	return rb_big_unpack((unsigned long *)d, bn->top + 1);
+    }
+#else
+    {
+	char *txt;
+	VALUE num;
+
+	if (!(txt = BN_bn2hex(bn)))
+	    ossl_raise(eBNError, NULL);
+	num = rb_cstr_to_inum(txt, 16, Qtrue);
+	OPENSSL_free(txt);
+	return num;
+    }
+#endif
+}
+
 /*
  * Public
  */
@@ -64,8 +170,11 @@ GetBNPtr(VALUE obj)
     } else switch (TYPE(obj)) {
     case T_FIXNUM:
     case T_BIGNUM:
-	obj = rb_String(obj);
-	if (!BN_dec2bn(&bn, StringValuePtr(obj))) {
+	if (!(bn = BN_new())) {
+	    ossl_raise(eBNError, NULL);
+	}
+	if (!ossl_bn_set_integer(bn, obj)) {
+	    BN_free(bn);
 	    ossl_raise(eBNError, NULL);
 	}
 	WrapBN(cBN, obj, bn); /* Handle potencial mem leaks */
@@ -83,10 +192,61 @@ GetBNPtr(VALUE obj)
  */
 /*
  * BN_CTX - is used in more difficult math. ops
- * (Why just 1? Because Ruby itself isn't thread safe,
- *  we don't need to care about threads)
+ * Every native thread has its own, made on first use and freed when the
+ * thread exits, so that BN math can run without the GVL and from the
+ * threads of ossl_parallel().
  */
-BN_CTX *ossl_bn_ctx;
+#if defined(OSSL_NOGVL_ENABLED)
+static pthread_key_t ossl_bn_ctx_key;
+
+static void
+ossl_bn_ctx_free(void *ctx)
+{
+    BN_CTX_free(ctx);
+}
+#else
+static BN_CTX *ossl_bn_ctx_global;
+#endif
+
+/*
+ * Returns the calling thread's BN_CTX, or NULL if it can't be made.
+ * Doesn't need the GVL.
+ */
+BN_CTX *
+ossl_bn_ctx_nogvl(void)
+{
+    BN_CTX *ctx;
+
+#if defined(OSSL_NOGVL_ENABLED)
+    if (!(ctx = pthread_getspecific(ossl_bn_ctx_key))) {
+	if (!(ctx = BN_CTX_new()))
+	    return NULL;
+	if (pthread_setspecific(ossl_bn_ctx_key, ctx) != 0) {
+	    BN_CTX_free(ctx);
+	    return NULL;
+	}
+    }
+#else
+    if (!(ctx = ossl_bn_ctx_global))
+	ctx = ossl_bn_ctx_global = BN_CTX_new();
+#endif
+
+    return ctx;
+}
+
+/*
+ * As ossl_bn_ctx_nogvl(), but raises instead of returning NULL.
+ */
+BN_CTX *
+ossl_bn_ctx_get(void)
+{
+    BN_CTX *ctx;
+
+    if (!(ctx = ossl_bn_ctx_nogvl()))
+	ossl_raise(eBNError, "Cannot init BN_CTX");
+
+    return ctx;
+}
 
 static VALUE
 ossl_bn_alloc(VALUE klass)
@@ -106,6 +266,7 @@ ossl_bn_alloc(VALUE klass)
  * call-seq:
  *    BN.new => aBN
  *    BN.new(bn) => aBN
+ *    BN.new(integer) => aBN
  *    BN.new(string) => aBN
  *    BN.new(string, 0 | 2 | 10 | 16) => aBN
  */
@@ -119,7 +280,6 @@ ossl_bn_initialize(int argc, VALUE *argv, VALUE self)
     if (rb_scan_args(argc, argv, "11", &str, &bs) == 2) {
 	base = NUM2INT(bs);
     }
-    StringValue(str);
     GetBN(self, bn);
     if (RTEST(rb_obj_is_kind_of(str, cBN))) {
 	BIGNUM *other;
@@ -130,6 +290,13 @@ ossl_bn_initialize(int argc, VALUE *argv, VALUE self)
 	}
 	return self;
     }
+    if (FIXNUM_P(str) || TYPE(str) == T_BIGNUM) {
+	if (!ossl_bn_set_integer(bn, str)) {
+	    ossl_raise(eBNError, NULL);
+	}
+	return self;
+    }
+    StringValue(str);
 
     switch (base) {
     case 0:
@@ -219,18 +386,10 @@ static VALUE
 ossl_bn_to_i(VALUE self)
 {
     BIGNUM *bn;
-    char *txt;
-    VALUE num;
 
     GetBN(self, bn);
 
-    if (!(txt = BN_bn2dec(bn))) {
-	ossl_raise(eBNError, NULL);
-    }
-    num = rb_cstr_to_inum(txt, 10, Qtrue);
-    OPENSSL_free(txt);
-
-    return num;
+    return ossl_bn_get_integer(bn);
 }
 
 static VALUE
@@ -293,7 +452,7 @@ BIGNUM_BOOL1(is_odd)
 	if (!(result = BN_new())) {			\
 	    ossl_raise(eBNError, NULL);			\
 	}						\
-	if (!BN_##func(result, bn, ossl_bn_ctx)) {	\
+	if (!BN_##func(result, bn, ossl_bn_ctx_get())) { \
 	    BN_free(result);				\
 	    ossl_raise(eBNError, NULL);			\
 	}						\
@@ -342,7 +501,7 @@ BIGNUM_2(sub)
 	if (!(result = BN_new())) {				\
 	    ossl_raise(eBNError, NULL);				\
 	}							\
-	if (!BN_##func(result, bn1, bn2, ossl_bn_ctx)) {	\
+	if (!BN_##func(result, bn1, bn2, ossl_bn_ctx_get())) {	\
 	    BN_free(result);					\
 	    ossl_raise(eBNError, NULL);				\
 	}							\
@@ -375,7 +534,7 @@ ossl_bn_div(VALUE self, VALUE other)
 	BN_free(r1);
 	ossl_raise(eBNError, NULL);
     }
-    if (!BN_div(r1, r2, bn1, bn2, ossl_bn_ctx)) {
+    if (!BN_div(r1, r2, bn1, bn2, ossl_bn_ctx_get())) {
 	BN_free(r1);
 	BN_free(r2);
 	ossl_raise(eBNError, NULL);
@@ -402,7 +561,7 @@ ossl_bn_div(VALUE self, VALUE other)
 	if (!(result = BN_new())) {				\
 	    ossl_raise(eBNError, NULL);				\
 	}							\
-	if (!BN_##func(result, bn1, bn2, bn3, ossl_bn_ctx)) {	\
+	if (!BN_##func(result, bn1, bn2, bn3, ossl_bn_ctx_get())) { \
 	    BN_free(result);					\
 	    ossl_raise(eBNError, NULL);				\
 	}							\
@@ -414,6 +573,178 @@ BIGNUM_3c(mod_sub)
 BIGNUM_3c(mod_mul)
 BIGNUM_3c(mod_exp)
 
+/*
+ * The in-place operations below write the result over the receiver.
+ * OpenSSL allows that for the first operand, but not for moduli or
+ * exponents, which are still read after the result has been started.
+ * Any of those that is the receiver itself is copied to a temporary of
+ * +ctx+ first, between BN_CTX_start() and BN_CTX_end().
+ */
+static BIGNUM *
+ossl_bn_unalias(BIGNUM *self, BIGNUM *bn, BN_CTX *ctx)
+{
+    BIGNUM *tmp;
+
+    if (bn != self)
+	return bn;
+    if (!(tmp = BN_CTX_get(ctx)) || !BN_copy(tmp, bn))
+	return NULL;
+
+    return tmp;
+}
+
+#define BIGNUM_SELF_1c(func)					\
+    /*								\
+     * call-seq:						\
+     *   bn.##func! -> self					\
+     *								\
+     */								\
+    static VALUE						\
+    ossl_bn_self_##func(VALUE self)				\
+    {								\
+	BIGNUM *bn;						\
+	GetBN(self, bn);					\
+	if (!BN_##func(bn, bn, ossl_bn_ctx_get()))		\
+	    ossl_raise(eBNError, NULL);				\
+	return self;						\
+    }
+BIGNUM_SELF_1c(sqr)
+
+#define BIGNUM_SELF_2(func)					\
+    /*								\
+     * call-seq:						\
+     *   bn.##func!(bn2) -> self				\
+     *								\
+     */								\
+    static VALUE						\
+    ossl_bn_self_##func(VALUE self, VALUE other)		\
+    {								\
+	BIGNUM *bn1, *bn2 = GetBNPtr(other);			\
+	GetBN(self, bn1);					\
+	if (!BN_##func(bn1, bn1, bn2))				\
+	    ossl_raise(eBNError, NULL);				\
+	return self;						\
+    }
+BIGNUM_SELF_2(add)
+BIGNUM_SELF_2(sub)
+
+#define BIGNUM_SELF_2c(func)					\
+    /*								\
+     * call-seq:						\
+     *   bn.##func!(bn2) -> self				\
+     *								\
+     */								\
+    static VALUE						\
+    ossl_bn_self_##func(VALUE self, VALUE other)		\
+    {								\
+	BIGNUM *bn1, *bn2 = GetBNPtr(other);			\
+	BN_CTX *ctx = ossl_bn_ctx_get();			\
+	int ok;							\
+	GetBN(self, bn1);					\
+	BN_CTX_start(ctx);					\
+	ok = (bn2 = ossl_bn_unalias(bn1, bn2, ctx)) &&		\
+	    BN_##func(bn1, bn1, bn2, ctx);			\
+	BN_CTX_end(ctx);					\
+	if (!ok)						\
+	    ossl_raise(eBNError, NULL);				\
+	return self;						\
+    }
+BIGNUM_SELF_2c(mul)
+BIGNUM_SELF_2c(mod)
+BIGNUM_SELF_2c(mod_sqr)
+
+#define BIGNUM_SELF_3c(func)					\
+    /*								\
+     * call-seq:						\
+     *   bn.##func!(bn1, bn2) -> self				\
+     *								\
+     */								\
+    static VALUE						\
+    ossl_bn_self_##func(VALUE self, VALUE other1, VALUE other2)	\
+    {								\
+	BIGNUM *bn1, *bn2 = GetBNPtr(other1);			\
+	BIGNUM *bn3 = GetBNPtr(other2);				\
+	BN_CTX *ctx = ossl_bn_ctx_get();			\
+	int ok;							\
+	GetBN(self, bn1);					\
+	BN_CTX_start(ctx);					\
+	ok = (bn2 = ossl_bn_unalias(bn1, bn2, ctx)) &&		\
+	    (bn3 = ossl_bn_unalias(bn1, bn3, ctx)) &&		\
+	    BN_##func(bn1, bn1, bn2, bn3, ctx);			\
+	BN_CTX_end(ctx);					\
+	if (!ok)						\
+	    ossl_raise(eBNError, NULL);				\
+	return self;						\
+    }
+BIGNUM_SELF_3c(mod_add)
+BIGNUM_SELF_3c(mod_sub)
+BIGNUM_SELF_3c(mod_mul)
+BIGNUM_SELF_3c(mod_exp)
+
+/*
+ * call-seq:
+ *    bn.add_all!(array) -> self
+ *
+ * Adds every element of +array+ to +bn+.  Same as
+ * <tt>array.each {|x| bn.add!(x) }</tt>, in one call.
+ */
+static VALUE
+ossl_bn_add_all(VALUE self, VALUE ary)
+{
+    BIGNUM *bn;
+    long i;
+
+    Check_Type(ary, T_ARRAY);
+    GetBN(self, bn);
+    for (i = 0; i < RARRAY_LEN(ary); i++) {
+	if (!BN_add(bn, bn, GetBNPtr(RARRAY_PTR(ary)[i])))
+	    ossl_raise(eBNError, NULL);
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *    bn.mul_all!(array) -> self
+ *    bn.mul_all!(array, modulus) -> self
+ *
+ * Multiplies +bn+ by every element of +array+, reducing modulo +modulus+
+ * after each step if one is given.  Same as
+ * <tt>array.each {|x| bn.mod_mul!(x, modulus) }</tt>, in one call.
+ *
+ *    acc = 1.to_bn
+ *    acc.mul_all!(shares, p)
+ */
+static VALUE
+ossl_bn_mul_all(int argc, VALUE *argv, VALUE self)
+{
+    BIGNUM *bn, *m = NULL;
+    BN_CTX *ctx = ossl_bn_ctx_get();
+    VALUE ary, modulus;
+    long i;
+    int ok;
+
+    if (rb_scan_args(argc, argv, "11", &ary, &modulus) == 2)
+	m = GetBNPtr(modulus);
+    Check_Type(ary, T_ARRAY);
+    GetBN(self, bn);
+    if (m == bn) {
+	modulus = ossl_bn_new(m);
+	m = GetBNPtr(modulus);
+    }
+    for (i = 0; i < RARRAY_LEN(ary); i++) {
+	if (m)
+	    ok = BN_mod_mul(bn, bn, GetBNPtr(RARRAY_PTR(ary)[i]), m, ctx);
+	else
+	    ok = BN_mul(bn, bn, GetBNPtr(RARRAY_PTR(ary)[i]), ctx);
+	if (!ok)
+	    ossl_raise(eBNError, NULL);
+    }
+
+    return self;
+}
+
 #define BIGNUM_BIT(func)				\
     /*							\
      * call-seq:					\
@@ -557,15 +888,42 @@ BIGNUM_RAND(pseudo_rand)
 BIGNUM_RAND_RANGE(rand)
 BIGNUM_RAND_RANGE(pseudo_rand)
 
+#if defined(HAVE_BN_GENERATE_PRIME_EX)
+struct bn_blocking_prime_arg {
+    BIGNUM *result;
+    int num;
+    int safe;
+    BIGNUM *add;
+    BIGNUM *rem;
+    BN_GENCB *cb;
+};
+
+static void *
+bn_blocking_prime(void *arg)
+{
+    struct bn_blocking_prime_arg *gen = arg;
+
+    if (!BN_generate_prime_ex(gen->result, gen->num, gen->safe,
+			      gen->add, gen->rem, gen->cb))
+	return NULL;
+
+    return gen->result;
+}
+#endif
+
 /*
  * call-seq:
  *    BN.generate_prime(bits, [, safe [, add [, rem]]]) => bn
+ *    BN.generate_prime(bits, [, safe [, add [, rem]]]) { |p, n| ... } => bn
  *
  * === Parameters
  * * +bits+ - integer
  * * +safe+ - boolean
  * * +add+ - BN
  * * +rem+ - BN
+ *
+ * The search runs without the GVL and can be interrupted.  If a block is
+ * given it receives the progress of the search like PKey::RSA.generate.
  */
 static VALUE
 ossl_bn_s_generate_prime(int argc, VALUE *argv, VALUE klass)
@@ -573,6 +931,12 @@ ossl_bn_s_generate_prime(int argc, VALUE *argv, VALUE klass)
     BIGNUM *add = NULL, *rem = NULL, *result;
     int safe = 1, num;
     VALUE vnum, vsafe, vadd, vrem, obj;
+#if defined(HAVE_BN_GENERATE_PRIME_EX)
+    BN_GENCB cb;
+    struct ossl_generate_cb_arg cb_arg;
+    struct bn_blocking_prime_arg gen_arg;
+    int state = 0;
+#endif
 
     rb_scan_args(argc, argv, "13", &vnum, &vsafe, &vadd, &vrem);
 
@@ -588,10 +952,36 @@ ossl_bn_s_generate_prime(int argc, VALUE *argv, VALUE klass)
     if (!(result = BN_new())) {
 	ossl_raise(eBNError, NULL);
     }
+#if defined(HAVE_BN_GENERATE_PRIME_EX)
+    /* add and rem may be owned by temporaries, use private copies */
+    gen_arg.add = add ? BN_dup(add) : NULL;
+    gen_arg.rem = rem ? BN_dup(rem) : NULL;
+    if ((add && !gen_arg.add) || (rem && !gen_arg.rem)) {
+	if (gen_arg.add) BN_free(gen_arg.add);
+	BN_free(result);
+	ossl_raise(eBNError, NULL);
+    }
+    gen_arg.result = result;
+    gen_arg.num = num;
+    gen_arg.safe = safe;
+    gen_arg.cb = &cb;
+    BN_GENCB_set(&cb, ossl_generate_cb_2, &cb_arg);
+
+    if (!ossl_generate(bn_blocking_prime, &gen_arg, &cb_arg, &state) || state) {
+	if (gen_arg.add) BN_free(gen_arg.add);
+	if (gen_arg.rem) BN_free(gen_arg.rem);
+	BN_free(result);
+	if (state) rb_jump_tag(state);
+	ossl_raise(eBNError, NULL);
+    }
+    if (gen_arg.add) BN_free(gen_arg.add);
+    if (gen_arg.rem) BN_free(gen_arg.rem);
+#else
     if (!BN_generate_prime(result, num, safe, add, rem, NULL, NULL)) {
 	BN_free(result);
 	ossl_raise(eBNError, NULL);
     }
+#endif
     WrapBN(klass, obj, result);
 
     return obj;
@@ -675,7 +1065,7 @@ ossl_bn_is_prime(int argc, VALUE *argv, VALUE self)
 	checks = NUM2INT(vchecks);
     }
     GetBN(self, bn);
-    switch (BN_is_prime(bn, checks, NULL, ossl_bn_ctx, NULL)) {
+    switch (BN_is_prime(bn, checks, NULL, ossl_bn_ctx_get(), NULL)) {
     case 1:
 	return Qtrue;
     case 0:
@@ -714,7 +1104,7 @@ ossl_bn_is_prime_fasttest(int argc, VALUE *argv, VALUE self)
     if (vtrivdiv == Qfalse) {
 	do_trial_division = 0;
     }
-    switch (BN_is_prime_fasttest(bn, checks, NULL, ossl_bn_ctx, NULL, do_trial_division)) {
+    switch (BN_is_prime_fasttest(bn, checks, NULL, ossl_bn_ctx_get(), NULL, do_trial_division)) {
     case 1:
 	return Qtrue;
     case 0:
@@ -737,9 +1127,11 @@ Init_ossl_bn()
     mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
 #endif
 
-    if (!(ossl_bn_ctx = BN_CTX_new())) {
+#if defined(OSSL_NOGVL_ENABLED)
+    if (pthread_key_create(&ossl_bn_ctx_key, ossl_bn_ctx_free) != 0) {
 	ossl_raise(rb_eRuntimeError, "Cannot init BN_CTX");
     }
+#endif
 
     eBNError = rb_define_class_under(mOSSL, "BNError", eOSSLError);
 
@@ -773,6 +1165,19 @@ Init_ossl_bn()
     rb_define_method(cBN, "mod_exp", ossl_bn_mod_exp, 2);
     rb_define_method(cBN, "gcd", ossl_bn_gcd, 1);
 
+    rb_define_method(cBN, "add!", ossl_bn_self_add, 1);
+    rb_define_method(cBN, "sub!", ossl_bn_self_sub, 1);
+    rb_define_method(cBN, "mul!", ossl_bn_self_mul, 1);
+    rb_define_method(cBN, "sqr!", ossl_bn_self_sqr, 0);
+    rb_define_method(cBN, "mod!", ossl_bn_self_mod, 1);
+    rb_define_method(cBN, "mod_add!", ossl_bn_self_mod_add, 2);
+    rb_define_method(cBN, "mod_sub!", ossl_bn_self_mod_sub, 2);
+    rb_define_method(cBN, "mod_mul!", ossl_bn_self_mod_mul, 2);
+    rb_define_method(cBN, "mod_sqr!", ossl_bn_self_mod_sqr, 1);
+    rb_define_method(cBN, "mod_exp!", ossl_bn_self_mod_exp, 2);
+    rb_define_method(cBN, "add_all!", ossl_bn_add_all, 1);
+    rb_define_method(cBN, "mul_all!", ossl_bn_mul_all, -1);
+
     /* add_word
      * sub_word
      * mul_word
@@ -850,5 +1255,7 @@ Init_ossl_bn()
      * Where to belong these?
      */
     rb_define_method(cBN, "prime_fasttest?", ossl_bn_is_prime_fasttest, -1);
+
+    Init_ossl_bn_mont();
 }
 
@@ -13,12 +13,15 @@
 
 extern VALUE cBN;
 extern VALUE eBNError;
+extern VALUE cBNMont;
 
-extern BN_CTX *ossl_bn_ctx;
+BN_CTX *ossl_bn_ctx_get(void);
+BN_CTX *ossl_bn_ctx_nogvl(void);
 
 VALUE ossl_bn_new(const BIGNUM *);
 BIGNUM *GetBNPtr(VALUE);
 void Init_ossl_bn(void);
+void Init_ossl_bn_mont(void);
 
 
 #endif /* _OSS_BN_H_ */
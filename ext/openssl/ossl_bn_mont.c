@@ -0,0 +1,377 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#include "ossl.h"
+
+/*
+ * Montgomery contexts
+ *
+ * BN#mod_exp sets up a BN_MONT_CTX for the modulus on every call, a
+ * division and an inversion that show up for short exponents and small
+ * moduli.  A BN::MontContext does that once.  The context is only read while
+ * exponentiating, so batches can be worked on from several threads at
+ * once, each with its own BN_CTX.
+ */
+#define GetBNMont(obj, k) do { \
+    Data_Get_Struct((obj), struct ossl_bn_mont, (k)); \
+    if (!(k) || !(k)->mont) { \
+	ossl_raise(rb_eRuntimeError, "BN::MontContext wasn't initialized!"); \
+    } \
+} while (0)
+
+VALUE cBNMont;
+
+struct ossl_bn_mont {
+    BN_MONT_CTX *mont;
+    BIGNUM *m;
+};
+
+/*
+ * Batches are costed in exponentiations with a 256-bit modulus, about 15us
+ * each.  The GVL is released from OSSL_BN_MONT_NOGVL of them on, and
+ * each thread gets at least OSSL_BN_MONT_GRAIN worth of work.
+ */
+#define OSSL_BN_MONT_NOGVL 8
+#define OSSL_BN_MONT_GRAIN 16
+
+struct ossl_bn_mont_args {
+    struct ossl_bn_mont *k;
+    VALUE bases, exps, ret;
+    BIGNUM **a, **p, **out;
+    long nin, num;
+    int pairs;
+    int failed;
+};
+
+static void
+ossl_bn_mont_free(struct ossl_bn_mont *k)
+{
+    if (k) {
+	if (k->mont) BN_MONT_CTX_free(k->mont);
+	if (k->m) BN_clear_free(k->m);
+	xfree(k);
+    }
+}
+
+static VALUE
+ossl_bn_mont_alloc(VALUE klass)
+{
+    return Data_Wrap_Struct(klass, 0, ossl_bn_mont_free, 0);
+}
+
+/*
+ *  call-seq:
+ *     BN::MontContext.new(modulus) -> mont
+ *
+ *  Precomputes the Montgomery form of +modulus+, which must be odd and
+ *  positive, for repeated arithmetic modulo it.
+ *
+ *     mont = OpenSSL::BN::MontContext.new(prime)
+ *     mont.mod_exp(g, x)    # same as g.to_bn.mod_exp(x, prime)
+ */
+static VALUE
+ossl_bn_mont_initialize(VALUE self, VALUE modulus)
+{
+    struct ossl_bn_mont *k;
+    BIGNUM *m = GetBNPtr(modulus);
+
+    if (!m || !BN_is_odd(m) || BN_is_negative(m) || BN_is_one(m))
+	ossl_raise(rb_eArgError, "modulus must be odd and greater than 1");
+    if (DATA_PTR(self))
+	ossl_raise(rb_eRuntimeError, "BN::MontContext already initialized");
+    DATA_PTR(self) = k = ALLOC(struct ossl_bn_mont);
+    k->m = NULL;
+    if (!(k->mont = BN_MONT_CTX_new()))
+	ossl_raise(eBNError, NULL);
+    if (!(k->m = BN_dup(m)) ||
+	!BN_MONT_CTX_set(k->mont, k->m, ossl_bn_ctx_get())) {
+	BN_MONT_CTX_free(k->mont);
+	k->mont = NULL;
+	ossl_raise(eBNError, NULL);
+    }
+
+    return self;
+}
+
+/*
+ *  call-seq:
+ *     mont.modulus -> aBN
+ *
+ */
+static VALUE
+ossl_bn_mont_get_modulus(VALUE self)
+{
+    struct ossl_bn_mont *k;
+
+    GetBNMont(self, k);
+
+    return ossl_bn_new(k->m);
+}
+
+/*
+ *  call-seq:
+ *     mont.mod_exp(base, exponent) -> aBN
+ *
+ *  Same as <tt>base.mod_exp(exponent, modulus)</tt>.
+ */
+static VALUE
+ossl_bn_mont_mod_exp(VALUE self, VALUE base, VALUE exponent)
+{
+    struct ossl_bn_mont *k;
+    BIGNUM *a = GetBNPtr(base), *p = GetBNPtr(exponent), *result;
+    VALUE obj;
+
+    GetBNMont(self, k);
+    obj = ossl_bn_new(NULL);
+    result = GetBNPtr(obj);
+    if (!BN_mod_exp_mont(result, a, p, k->m, ossl_bn_ctx_get(), k->mont))
+	ossl_raise(eBNError, NULL);
+
+    return obj;
+}
+
+/*
+ * Returns +a+ reduced into [0, m), in +tmp+ if it wasn't already.
+ */
+static BIGNUM *
+ossl_bn_mont_reduce(struct ossl_bn_mont *k, BIGNUM *a, BIGNUM *tmp, BN_CTX *ctx)
+{
+    if (!BN_is_negative(a) && BN_ucmp(a, k->m) < 0)
+	return a;
+
+    return BN_nnmod(tmp, a, k->m, ctx) ? tmp : NULL;
+}
+
+/*
+ *  call-seq:
+ *     mont.mod_mul(a, b) -> aBN
+ *
+ *  Same as <tt>a.mod_mul(b, modulus)</tt>, with two Montgomery
+ *  multiplications in place of a division.
+ */
+static VALUE
+ossl_bn_mont_mod_mul(VALUE self, VALUE a, VALUE b)
+{
+    struct ossl_bn_mont *k;
+    BIGNUM *bn1 = GetBNPtr(a), *bn2 = GetBNPtr(b), *t1, *t2, *result;
+    BN_CTX *ctx = ossl_bn_ctx_get();
+    VALUE obj;
+    int ok;
+
+    GetBNMont(self, k);
+    obj = ossl_bn_new(NULL);
+    result = GetBNPtr(obj);
+    BN_CTX_start(ctx);
+    ok = (t1 = BN_CTX_get(ctx)) && (t2 = BN_CTX_get(ctx)) &&
+	(bn1 = ossl_bn_mont_reduce(k, bn1, t1, ctx)) &&
+	(bn2 = ossl_bn_mont_reduce(k, bn2, t2, ctx)) &&
+	BN_to_montgomery(t1, bn1, k->mont, ctx) &&
+	BN_mod_mul_montgomery(result, t1, bn2, k->mont, ctx);
+    BN_CTX_end(ctx);
+    if (!ok)
+	ossl_raise(eBNError, NULL);
+
+    return obj;
+}
+
+static void
+ossl_bn_mont_slice(void *ptr, long beg, long end)
+{
+    struct ossl_bn_mont_args *args = ptr;
+    struct ossl_bn_mont *k = args->k;
+    BN_CTX *ctx;
+    long i, j;
+    int ok;
+
+    if (!(ctx = ossl_bn_ctx_nogvl())) {
+	args->failed = 1;
+	return;
+    }
+    for (i = beg; i < end; i++) {
+	j = args->pairs ? 2 * i : i;
+	if (args->pairs && j + 1 < args->nin)
+	    ok = BN_mod_exp2_mont(args->out[i], args->a[j], args->p[j],
+				  args->a[j + 1], args->p[j + 1],
+				  k->m, ctx, k->mont);
+	else
+	    ok = BN_mod_exp_mont(args->out[i], args->a[j], args->p[j],
+				 k->m, ctx, k->mont);
+	if (!ok) {
+	    args->failed = 1;
+	    return;
+	}
+    }
+}
+
+static void *
+ossl_bn_mont_nogvl(void *ptr)
+{
+    struct ossl_bn_mont_args *args = ptr;
+    long w = (BN_num_bits(args->k->m) + 255) / 256;
+
+    ossl_parallel(ossl_bn_mont_slice, args, args->num,
+		  OSSL_BN_MONT_GRAIN / (w * w * w) + 1);
+
+    return NULL;
+}
+
+static VALUE
+ossl_bn_mont_run(VALUE ptr)
+{
+    struct ossl_bn_mont_args *args = (struct ossl_bn_mont_args *)ptr;
+    long i, w;
+    VALUE obj;
+
+    for (i = 0; i < args->nin; i++) {
+	args->a[i] = GetBNPtr(RARRAY_PTR(args->bases)[i]);
+	args->p[i] = GetBNPtr(RARRAY_PTR(args->exps)[i]);
+    }
+    for (i = 0; i < args->num; i++) {
+	obj = ossl_bn_new(NULL);
+	rb_ary_push(args->ret, obj);
+	args->out[i] = GetBNPtr(obj);
+    }
+    w = (BN_num_bits(args->k->m) + 255) / 256;
+    if (args->num * w * w * w < OSSL_BN_MONT_NOGVL)
+	ossl_bn_mont_slice(args, 0, args->num);
+    else
+	ossl_nogvl(ossl_bn_mont_nogvl, args, RUBY_UBF_IO, 0);
+    if (args->failed)
+	ossl_raise(eBNError, NULL);
+
+    return args->ret;
+}
+
+static VALUE
+ossl_bn_mont_ensure(VALUE ptr)
+{
+    struct ossl_bn_mont_args *args = (struct ossl_bn_mont_args *)ptr;
+
+    xfree(args->a);
+    xfree(args->p);
+    xfree(args->out);
+
+    return Qnil;
+}
+
+/*
+ * Copies +bases+ and +exps+ into Arrays of BNs of their own, so that
+ * neither Integers being converted nor other threads changing a BN get in
+ * the way while the GVL is released, and runs the batch.
+ */
+static VALUE
+ossl_bn_mont_batch(VALUE self, VALUE bases, VALUE exps, int pairs)
+{
+    struct ossl_bn_mont_args args;
+    VALUE exp = Qnil;
+    long i, n;
+
+    Check_Type(bases, T_ARRAY);
+    GetBNMont(self, args.k);
+    n = RARRAY_LEN(bases);
+    if (TYPE(exps) != T_ARRAY)
+	exp = ossl_bn_new(GetBNPtr(exps));
+    else if (RARRAY_LEN(exps) != n)
+	ossl_raise(rb_eArgError, "%ld bases but %ld exponents",
+		   n, RARRAY_LEN(exps));
+    args.bases = rb_ary_new2(n);
+    args.exps = rb_ary_new2(n);
+    for (i = 0; i < n; i++) {
+	rb_ary_push(args.bases, ossl_bn_new(GetBNPtr(rb_ary_entry(bases, i))));
+	rb_ary_push(args.exps, NIL_P(exp) ?
+		    ossl_bn_new(GetBNPtr(rb_ary_entry(exps, i))) : exp);
+    }
+    args.nin = n;
+    args.pairs = pairs;
+    args.num = pairs ? (n + 1) / 2 : n;
+    args.failed = 0;
+    args.ret = rb_ary_new2(args.num);
+    args.a = ALLOC_N(BIGNUM *, n);
+    args.p = ALLOC_N(BIGNUM *, n);
+    args.out = ALLOC_N(BIGNUM *, args.num);
+
+    return rb_ensure(ossl_bn_mont_run, (VALUE)&args,
+		     ossl_bn_mont_ensure, (VALUE)&args);
+}
+
+/*
+ *  call-seq:
+ *     mont.mod_exp_many(bases, exponents) -> array
+ *     mont.mod_exp_many(bases, exponent) -> array
+ *
+ *  Returns <tt>bases[i]</tt> to the power of <tt>exponents[i]</tt>, or
+ *  of the single +exponent+, modulo the modulus, for every base.  Large
+ *  batches are computed without the GVL, from as many threads as there
+ *  are CPUs.
+ */
+static VALUE
+ossl_bn_mont_mod_exp_many(VALUE self, VALUE bases, VALUE exps)
+{
+    return ossl_bn_mont_batch(self, bases, exps, 0);
+}
+
+/*
+ *  call-seq:
+ *     mont.multi_exp(bases, exponents) -> aBN
+ *
+ *  Returns the product of <tt>bases[i]</tt> to the power of
+ *  <tt>exponents[i]</tt> modulo the modulus.  Powers are computed two at a
+ *  time with BN_mod_exp2_mont(), which shares the squarings between them,
+ *  and the pairs are worked on in parallel as in #mod_exp_many.
+ *
+ *     mont.multi_exp([g, h], [m, r])    # Pedersen commitment g^m * h^r
+ */
+static VALUE
+ossl_bn_mont_multi_exp(VALUE self, VALUE bases, VALUE exps)
+{
+    struct ossl_bn_mont *k;
+    BN_CTX *ctx = ossl_bn_ctx_get();
+    BIGNUM *acc, *bn;
+    VALUE ary, obj;
+    long i;
+
+    Check_Type(exps, T_ARRAY);
+    GetBNMont(self, k);
+    ary = ossl_bn_mont_batch(self, bases, exps, 1);
+    obj = ossl_bn_new(NULL);
+    acc = GetBNPtr(obj);
+    if (!BN_one(acc))
+	ossl_raise(eBNError, NULL);
+    for (i = 0; i < RARRAY_LEN(ary); i++) {
+	bn = GetBNPtr(RARRAY_PTR(ary)[i]);
+	if (!BN_to_montgomery(acc, acc, k->mont, ctx) ||
+	    !BN_mod_mul_montgomery(acc, acc, bn, k->mont, ctx))
+	    ossl_raise(eBNError, NULL);
+    }
+
+    return obj;
+}
+
+void
+Init_ossl_bn_mont()
+{
+#if 0
+    mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
+    cBN = rb_define_class_under(mOSSL, "BN", rb_cObject);
+#endif
+
+    /*
+     * Document-class: OpenSSL::BN::MontContext
+     *
+     * An odd modulus prepared for Montgomery multiplication, for doing many
+     * exponentiations modulo the same number.
+     */
+    cBNMont = rb_define_class_under(cBN, "MontContext", rb_cObject);
+    rb_define_alloc_func(cBNMont, ossl_bn_mont_alloc);
+    rb_define_method(cBNMont, "initialize", ossl_bn_mont_initialize, 1);
+    rb_define_method(cBNMont, "modulus", ossl_bn_mont_get_modulus, 0);
+    rb_define_method(cBNMont, "mod_exp", ossl_bn_mont_mod_exp, 2);
+    rb_define_method(cBNMont, "mod_mul", ossl_bn_mont_mod_mul, 2);
+    rb_define_method(cBNMont, "mod_exp_many", ossl_bn_mont_mod_exp_many, 2);
+    rb_define_method(cBNMont, "multi_exp", ossl_bn_mont_multi_exp, 2);
+}
@@ -312,40 +312,47 @@ ossl_cipher_pkcs5_keyivgen(int argc, VALUE *argv, VALUE self)
 
 /*
  *  call-seq:
- *     cipher.update(data [, buffer]) -> string or buffer
+ *     cipher.update(data [, buffer [, offset]]) -> string or buffer
  *
  *  === Parameters
  *  +data+ is a nonempty string.
  *  +buffer+ is an optional string to store the result.
+ *  +offset+ is where in +buffer+ the result goes; what precedes it is kept.
+ *  Pass buffer.bytesize to append.  +buffer+ only grows, so reusing it
+ *  doesn't reallocate once it is large enough.
  */
 static VALUE
 ossl_cipher_update(int argc, VALUE *argv, VALUE self)
 {
     EVP_CIPHER_CTX *ctx;
-    unsigned char *in;
+    unsigned char *in, *out;
     int in_len, out_len;
-    VALUE data, str;
+    long offset;
+    VALUE data, str, off;
 
-    rb_scan_args(argc, argv, "11", &data, &str);
+    rb_scan_args(argc, argv, "12", &data, &str, &off);
 
     StringValue(data);
-    in = (unsigned char *)RSTRING_PTR(data);
     if ((in_len = RSTRING_LEN(data)) == 0)
         rb_raise(rb_eArgError, "data must not be empty");
     GetCipher(self, ctx);
     out_len = in_len+EVP_CIPHER_CTX_block_size(ctx);
+    offset = NIL_P(off) ? 0 : NUM2LONG(off);
 
     if (NIL_P(str)) {
+	if (offset != 0)
+	    rb_raise(rb_eArgError, "offset given without a buffer");
         str = rb_str_new(0, out_len);
+	out = (unsigned char *)RSTRING_PTR(str);
     } else {
-        StringValue(str);
-        rb_str_resize(str, out_len);
+	out = (unsigned char *)ossl_str_reserve(str, offset, out_len);
     }
+    /* after the output is set up, in case data is the buffer itself */
+    in = (unsigned char *)RSTRING_PTR(data);
 
-    if (!EVP_CipherUpdate(ctx, (unsigned char *)RSTRING_PTR(str), &out_len, in, in_len))
+    if (!EVP_CipherUpdate(ctx, out, &out_len, in, in_len))
 	ossl_raise(eCipherError, NULL);
-    assert(out_len < RSTRING_LEN(str));
-    rb_str_set_len(str, out_len);
+    rb_str_set_len(str, offset + out_len);
 
     return str;
 }
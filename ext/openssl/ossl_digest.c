@@ -159,6 +159,73 @@ ossl_digest_update(VALUE self, VALUE data)
     return self;
 }
 
+static int
+ossl_digest_update_func(void *ctx, const void *data, size_t len)
+{
+    return EVP_DigestUpdate(ctx, data, len);
+}
+
+struct ossl_digest_file_args {
+    VALUE file;
+    EVP_MD_CTX *ctx;
+    EVP_MD_CTX *copy;
+};
+
+static VALUE
+ossl_digest_file0(VALUE ptr)
+{
+    struct ossl_digest_file_args *args = (struct ossl_digest_file_args *)ptr;
+
+    if (!ossl_file_update(args->file, ossl_digest_update_func, args->copy))
+	ossl_raise(eDigestError, "EVP_DigestUpdate");
+    if (!EVP_MD_CTX_copy_ex(args->ctx, args->copy))
+	ossl_raise(eDigestError, "EVP_MD_CTX_copy_ex");
+
+    return Qnil;
+}
+
+static VALUE
+ossl_digest_file_ensure(VALUE ptr)
+{
+    EVP_MD_CTX_destroy(((struct ossl_digest_file_args *)ptr)->copy);
+
+    return Qnil;
+}
+
+/*
+ *  call-seq:
+ *     digest.file(path_or_io) -> self
+ *
+ *  Updates the digest with the contents of a file, given by its path or as
+ *  an IO, without reading it into Strings and without holding the GVL.
+ *  Regular files are mapped into memory, anything else is read until EOF.
+ *  The read buffer of an IO is bypassed.  A regular file must not shrink
+ *  while it is hashed: touching the part of the mapping that is gone
+ *  kills the process with SIGBUS.
+ *
+ *  The file is hashed into a copy of the digest that replaces it at the
+ *  end, so other threads may use the digest meanwhile, though what they
+ *  add is lost.
+ */
+static VALUE
+ossl_digest_file(VALUE self, VALUE file)
+{
+    struct ossl_digest_file_args args;
+
+    GetDigest(self, args.ctx);
+    args.file = file;
+    if (!(args.copy = EVP_MD_CTX_create()))
+	ossl_raise(eDigestError, "EVP_MD_CTX_create");
+    if (!EVP_MD_CTX_copy_ex(args.copy, args.ctx)) {
+	EVP_MD_CTX_destroy(args.copy);
+	ossl_raise(eDigestError, "EVP_MD_CTX_copy_ex");
+    }
+    rb_ensure(ossl_digest_file0, (VALUE)&args,
+	      ossl_digest_file_ensure, (VALUE)&args);
+
+    return self;
+}
+
 /*
  *  call-seq:
  *      digest.finish -> aString
@@ -227,6 +294,175 @@ ossl_digest_block_length(VALUE self)
     return INT2NUM(EVP_MD_CTX_block_size(ctx));
 }
 
+/*
+ * Batches of at least OSSL_DIGEST_MANY_NOGVL bytes are hashed without the
+ * GVL, and from several threads once there are OSSL_DIGEST_MANY_GRAIN
+ * bytes per thread.  Batches with no message longer than
+ * OSSL_DIGEST_MANY_MB_MAX bytes go to the multi-buffer kernel if there is
+ * one; its lanes all wait for the longest message, so a single long one
+ * would stall the rest.
+ */
+#define OSSL_DIGEST_MANY_NOGVL (64 * 1024)
+#define OSSL_DIGEST_MANY_GRAIN (1024 * 1024)
+#define OSSL_DIGEST_MANY_MB_MAX 1024
+
+struct ossl_digest_many_args {
+    const EVP_MD *md;
+    VALUE ary;
+    long num;
+    const char **ptrs;
+    long *lens;
+    unsigned char *out;
+    int size;
+    long grain;
+    int mb;
+    int failed;
+};
+
+static void
+ossl_digest_many_slice(void *ptr, long beg, long end)
+{
+    struct ossl_digest_many_args *args = ptr;
+    EVP_MD_CTX *ctx;
+    long i;
+
+    if (args->mb) {
+	ossl_digest_mb(args->md, args->ptrs + beg, args->lens + beg, end - beg,
+		       args->out + beg * args->size);
+	return;
+    }
+    if (!(ctx = EVP_MD_CTX_create())) {
+	args->failed = 1;
+	return;
+    }
+    for (i = beg; i < end; i++) {
+	if (!EVP_DigestInit_ex(ctx, args->md, NULL) ||
+	    !EVP_DigestUpdate(ctx, args->ptrs[i], args->lens[i]) ||
+	    !EVP_DigestFinal_ex(ctx, args->out + i * args->size, NULL)) {
+	    args->failed = 1;
+	    break;
+	}
+    }
+    EVP_MD_CTX_destroy(ctx);
+}
+
+static void *
+ossl_digest_many_nogvl(void *ptr)
+{
+    struct ossl_digest_many_args *args = ptr;
+
+    ossl_parallel(ossl_digest_many_slice, args, args->num, args->grain);
+
+    return NULL;
+}
+
+static VALUE
+ossl_digest_many_run(VALUE ptr)
+{
+    struct ossl_digest_many_args *args = (struct ossl_digest_many_args *)ptr;
+    VALUE str, ret;
+    long i, total = 0, max = 0, avg;
+
+    /*
+     * #to_str of a later element may change an earlier String, and without
+     * the GVL they must neither change nor move: take frozen copies first,
+     * lengths only once nothing can run any more
+     */
+    for (i = 0; i < args->num; i++) {
+	str = RARRAY_PTR(args->ary)[i];
+	StringValue(str);
+	rb_ary_store(args->ary, i, rb_str_new_frozen(str));
+    }
+    ret = rb_str_new(0, args->num * args->size);
+    args->out = (unsigned char *)RSTRING_PTR(ret);
+    for (i = 0; i < args->num; i++) {
+	str = RARRAY_PTR(args->ary)[i];
+	args->ptrs[i] = RSTRING_PTR(str);
+	args->lens[i] = RSTRING_LEN(str);
+	total += args->lens[i];
+	if (args->lens[i] > max) max = args->lens[i];
+    }
+    i = ossl_digest_mb_lanes(args->md);
+    args->mb = i > 0 && args->num >= i && max <= OSSL_DIGEST_MANY_MB_MAX;
+    if (total < OSSL_DIGEST_MANY_NOGVL) {
+	ossl_digest_many_slice(args, 0, args->num);
+    }
+    else {
+	avg = total / args->num;
+	args->grain = OSSL_DIGEST_MANY_GRAIN / (avg > 0 ? avg : 1) + 1;
+	ossl_nogvl(ossl_digest_many_nogvl, args, RUBY_UBF_IO, 0);
+    }
+    if (args->failed)
+	ossl_raise(eDigestError, NULL);
+
+    return ret;
+}
+
+static VALUE
+ossl_digest_many_ensure(VALUE ptr)
+{
+    struct ossl_digest_many_args *args = (struct ossl_digest_many_args *)ptr;
+
+    xfree(args->ptrs);
+    xfree(args->lens);
+
+    return Qnil;
+}
+
+/*
+ *  call-seq:
+ *     Digest.digest_many(name, messages) -> array
+ *     Digest.digest_many(name, messages, :packed => true) -> string
+ *
+ *  Returns the digests of all Strings in the Array +messages+, computed
+ *  with the algorithm +name+ (a String or a Digest).  With :packed, they
+ *  are returned concatenated in one String of
+ *  <tt>messages.size * digest_length</tt> bytes.
+ *
+ *  This costs one call for the whole batch: a single context is reused for
+ *  all messages, large batches are hashed without the GVL, and very large
+ *  ones are split across threads.  Small SHA256 messages are hashed eight
+ *  at a time with AVX2 where the CPU has it.
+ *
+ *     OpenSSL::Digest.digest_many("SHA256", blobs)
+ */
+static VALUE
+ossl_digest_s_digest_many(int argc, VALUE *argv, VALUE klass)
+{
+    struct ossl_digest_many_args args;
+    VALUE name, ary, opts, str, ret;
+    int packed = 0;
+    long i;
+
+    if (argc > 0 && TYPE(argv[argc - 1]) == T_HASH) {
+	opts = argv[--argc];
+	packed = RTEST(rb_hash_aref(opts, ID2SYM(rb_intern("packed"))));
+    }
+    rb_scan_args(argc, argv, "20", &name, &ary);
+    Check_Type(ary, T_ARRAY);
+    /* work on a copy, the caller's Array may change under us */
+    ary = rb_ary_dup(ary);
+
+    args.md = GetDigestPtr(name);
+    args.ary = ary;
+    args.num = RARRAY_LEN(ary);
+    args.size = EVP_MD_size(args.md);
+    args.grain = args.num;
+    args.failed = 0;
+    args.ptrs = ALLOC_N(const char *, args.num);
+    args.lens = ALLOC_N(long, args.num);
+    str = rb_ensure(ossl_digest_many_run, (VALUE)&args,
+		    ossl_digest_many_ensure, (VALUE)&args);
+    if (packed)
+	return str;
+
+    ret = rb_ary_new2(args.num);
+    for (i = 0; i < args.num; i++)
+	rb_ary_push(ret, rb_str_substr(str, i * args.size, args.size));
+
+    return ret;
+}
+
 /*
  * INIT
  */
@@ -243,15 +479,19 @@ Init_ossl_digest()
     eDigestError = rb_define_class_under(cDigest, "DigestError", eOSSLError);
 
     rb_define_alloc_func(cDigest, ossl_digest_alloc);
+    rb_define_singleton_method(cDigest, "digest_many", ossl_digest_s_digest_many, -1);
 
     rb_define_method(cDigest, "initialize", ossl_digest_initialize, -1);
     rb_define_copy_func(cDigest, ossl_digest_copy);
     rb_define_method(cDigest, "reset", ossl_digest_reset, 0);
     rb_define_method(cDigest, "update", ossl_digest_update, 1);
     rb_define_alias(cDigest, "<<", "update");
+    rb_define_method(cDigest, "file", ossl_digest_file, 1);
     rb_define_private_method(cDigest, "finish", ossl_digest_finish, -1);
     rb_define_method(cDigest, "digest_length", ossl_digest_size, 0);
     rb_define_method(cDigest, "block_length", ossl_digest_block_length, 0);
 
     rb_define_method(cDigest, "name", ossl_digest_name, 0);
+
+    Init_ossl_digest_tree();
 }
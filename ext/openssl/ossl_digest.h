@@ -13,10 +13,14 @@
 
 extern VALUE cDigest;
 extern VALUE eDigestError;
+extern VALUE cDigestTree;
 
 const EVP_MD *GetDigestPtr(VALUE);
 VALUE ossl_digest_new(const EVP_MD *);
+int ossl_digest_mb_lanes(const EVP_MD *);
+void ossl_digest_mb(const EVP_MD *, const char **, const long *, long, unsigned char *);
 void Init_ossl_digest(void);
+void Init_ossl_digest_tree(void);
 
 #endif /* _OSSL_DIGEST_H_ */
 
@@ -0,0 +1,190 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#include "ossl.h"
+
+#if defined(OSSL_DIGEST_MB_ENABLED)
+/*
+ * Multi-buffer SHA-256
+ *
+ * Hashes eight independent messages at once, one per 32-bit lane of an
+ * AVX2 register.  OpenSSL only does this inside its TLS record layer, so
+ * the compression function is written here with GCC vector extensions.
+ * It is only used when the CPU has AVX2; with SSE2 alone it is no faster
+ * than EVP, so that is used instead.
+ *
+ * Lanes whose message is shorter than the others in the group keep their
+ * state once they have run out of blocks, so mixed lengths are correct,
+ * but the speedup comes from batches of similarly sized messages.
+ */
+#define OSSL_MB_LANES 8
+
+typedef uint32_t ossl_mb_vec __attribute__((vector_size(4 * OSSL_MB_LANES)));
+
+static const uint32_t ossl_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t ossl_sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/* a lane's message, followed by padding and the length in bits */
+struct ossl_mb_lane {
+    const unsigned char *msg;
+    long len;
+    long nblocks;
+    unsigned char tail[128];
+    long tail_start;		/* first block taken from tail */
+};
+
+static void
+ossl_mb_lane_init(struct ossl_mb_lane *lane, const unsigned char *msg, long len)
+{
+    long rest = len % 64, i;
+    unsigned long long bits = (unsigned long long)len * 8;
+    int tlen = rest < 56 ? 64 : 128;
+
+    lane->msg = msg;
+    lane->len = len;
+    lane->tail_start = len / 64;
+    lane->nblocks = lane->tail_start + tlen / 64;
+    memset(lane->tail, 0, tlen);
+    memcpy(lane->tail, msg + len - rest, rest);
+    lane->tail[rest] = 0x80;
+    for (i = 0; i < 8; i++)
+	lane->tail[tlen - 1 - i] = (unsigned char)(bits >> (8 * i));
+}
+
+static const unsigned char *
+ossl_mb_lane_block(const struct ossl_mb_lane *lane, long b)
+{
+    if (b < lane->tail_start)
+	return lane->msg + b * 64;
+    return lane->tail + (b - lane->tail_start) * 64;
+}
+
+__attribute__((target("avx2")))
+static void
+ossl_sha256_mb8(struct ossl_mb_lane *lanes, unsigned char **outs)
+{
+    ossl_mb_vec s[8], w[16], a, b, c, d, e, f, g, h, t1, t2, live;
+    const unsigned char *p;
+    long nblocks = 0, blk;
+    int i, j, t;
+
+    for (i = 0; i < OSSL_MB_LANES; i++)
+	if (lanes[i].nblocks > nblocks) nblocks = lanes[i].nblocks;
+    for (i = 0; i < 8; i++)
+	for (j = 0; j < OSSL_MB_LANES; j++)
+	    s[i][j] = ossl_sha256_iv[i];
+
+    for (blk = 0; blk < nblocks; blk++) {
+	for (j = 0; j < OSSL_MB_LANES; j++) {
+	    live[j] = blk < lanes[j].nblocks ? 0xffffffff : 0;
+	    p = ossl_mb_lane_block(&lanes[j], live[j] ? blk : 0);
+	    for (t = 0; t < 16; t++, p += 4)
+		w[t][j] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+			  ((uint32_t)p[2] << 8) | p[3];
+	}
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+	for (t = 0; t < 64; t++) {
+	    if (t >= 16) {
+		ossl_mb_vec w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+		w[t & 15] += (ROTR(w15, 7) ^ ROTR(w15, 18) ^ (w15 >> 3)) +
+			     w[(t - 7) & 15] +
+			     (ROTR(w2, 17) ^ ROTR(w2, 19) ^ (w2 >> 10));
+	    }
+	    t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+		 ((e & f) ^ (~e & g)) + ossl_sha256_k[t] + w[t & 15];
+	    t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+		 ((a & b) ^ (a & c) ^ (b & c));
+	    h = g; g = f; f = e; e = d + t1;
+	    d = c; c = b; b = a; a = t1 + t2;
+	}
+	/* lanes that are done already keep their state */
+	s[0] += a & live; s[1] += b & live; s[2] += c & live; s[3] += d & live;
+	s[4] += e & live; s[5] += f & live; s[6] += g & live; s[7] += h & live;
+    }
+
+    for (j = 0; j < OSSL_MB_LANES; j++) {
+	if (!outs[j]) continue;
+	for (i = 0; i < 8; i++) {
+	    outs[j][4 * i] = (unsigned char)(s[i][j] >> 24);
+	    outs[j][4 * i + 1] = (unsigned char)(s[i][j] >> 16);
+	    outs[j][4 * i + 2] = (unsigned char)(s[i][j] >> 8);
+	    outs[j][4 * i + 3] = (unsigned char)s[i][j];
+	}
+    }
+}
+
+/*
+ * Returns how many messages of +md+ are hashed together, or 0 if there is
+ * no multi-buffer kernel for it on this CPU.
+ */
+int
+ossl_digest_mb_lanes(const EVP_MD *md)
+{
+    if (EVP_MD_type(md) != NID_sha256 || !__builtin_cpu_supports("avx2"))
+	return 0;
+    return OSSL_MB_LANES;
+}
+
+/*
+ * Writes the SHA-256 digests of the +num+ messages ptrs[i] of lens[i]
+ * bytes to out, 32 bytes each.  Doesn't need the GVL.
+ */
+void
+ossl_digest_mb(const EVP_MD *md, const char **ptrs, const long *lens,
+	       long num, unsigned char *out)
+{
+    struct ossl_mb_lane lanes[OSSL_MB_LANES];
+    unsigned char *outs[OSSL_MB_LANES];
+    long i;
+    int j;
+
+    for (i = 0; i < num; i += OSSL_MB_LANES) {
+	for (j = 0; j < OSSL_MB_LANES; j++) {
+	    if (i + j < num) {
+		ossl_mb_lane_init(&lanes[j], (const unsigned char *)ptrs[i + j],
+				  lens[i + j]);
+		outs[j] = out + (i + j) * 32;
+	    }
+	    else {
+		ossl_mb_lane_init(&lanes[j], (const unsigned char *)"", 0);
+		outs[j] = NULL;
+	    }
+	}
+	ossl_sha256_mb8(lanes, outs);
+    }
+}
+#else
+int
+ossl_digest_mb_lanes(const EVP_MD *md)
+{
+    return 0;
+}
+
+void
+ossl_digest_mb(const EVP_MD *md, const char **ptrs, const long *lens,
+	       long num, unsigned char *out)
+{
+    rb_bug("ossl_digest_mb: no multi-buffer kernel");
+}
+#endif /* OSSL_DIGEST_MB_ENABLED */
@@ -0,0 +1,449 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#include "ossl.h"
+
+/*
+ * Tree hashing
+ *
+ * The input is cut into leaves of leaf_size bytes which are hashed
+ * independently, from as many threads as there are CPUs, and the leaf
+ * hashes are then combined pairwise up to a single root.  As in RFC 6962,
+ * leaves are hashed with a 0x00 prefix and inner nodes with 0x01, and a
+ * node without a sibling is promoted unchanged to the next level.
+ *
+ * The leaf hashes are kept, so that after a change only the leaves that
+ * were touched need hashing again.
+ */
+#define GetDigestTree(obj, tree) do { \
+    Data_Get_Struct((obj), struct ossl_digest_tree, (tree)); \
+    if (!(tree)) { \
+	ossl_raise(rb_eRuntimeError, "Digest::Tree wasn't initialized!"); \
+    } \
+} while (0)
+
+VALUE cDigestTree;
+
+struct ossl_digest_tree {
+    const EVP_MD *md;
+    int size;
+    long leaf_size;
+    long nleaves;
+    unsigned long long length;
+    unsigned char *leaves;
+    unsigned char root[EVP_MAX_MD_SIZE];
+    int busy;			/* the leaves are being hashed */
+};
+
+struct ossl_digest_tree_args {
+    struct ossl_digest_tree *tree;
+    const char *data;
+    unsigned long long length;
+    long *todo;
+    long ntodo;
+    int failed;
+};
+
+static void
+ossl_digest_tree_free(struct ossl_digest_tree *tree)
+{
+    if (tree) {
+	xfree(tree->leaves);
+	xfree(tree);
+    }
+}
+
+static VALUE
+ossl_digest_tree_alloc(VALUE klass)
+{
+    return Data_Wrap_Struct(klass, 0, ossl_digest_tree_free, 0);
+}
+
+static int
+ossl_digest_tree_node(EVP_MD_CTX *ctx, const EVP_MD *md, unsigned char prefix,
+		      const void *p1, size_t l1, const void *p2, size_t l2,
+		      unsigned char *out)
+{
+    return EVP_DigestInit_ex(ctx, md, NULL) &&
+	EVP_DigestUpdate(ctx, &prefix, 1) &&
+	EVP_DigestUpdate(ctx, p1, l1) &&
+	(!l2 || EVP_DigestUpdate(ctx, p2, l2)) &&
+	EVP_DigestFinal_ex(ctx, out, NULL);
+}
+
+static void
+ossl_digest_tree_leaves(void *ptr, long beg, long end)
+{
+    struct ossl_digest_tree_args *args = ptr;
+    struct ossl_digest_tree *tree = args->tree;
+    EVP_MD_CTX *ctx;
+    unsigned long long off;
+    long i, n;
+
+    if (!(ctx = EVP_MD_CTX_create())) {
+	args->failed = 1;
+	return;
+    }
+    for (i = beg; i < end; i++) {
+	n = args->todo[i];
+	off = (unsigned long long)n * tree->leaf_size;
+	if (!ossl_digest_tree_node(ctx, tree->md, 0x00, args->data + off,
+				   args->length - off < (unsigned long long)tree->leaf_size ?
+				   args->length - off : tree->leaf_size,
+				   NULL, 0, tree->leaves + n * tree->size)) {
+	    args->failed = 1;
+	    break;
+	}
+    }
+    EVP_MD_CTX_destroy(ctx);
+}
+
+/* folds the leaves to the root, in a scratch copy */
+static int
+ossl_digest_tree_root(struct ossl_digest_tree *tree, unsigned char *buf)
+{
+    EVP_MD_CTX *ctx;
+    long n = tree->nleaves, i;
+    int size = tree->size, ok = 1;
+
+    memcpy(buf, tree->leaves, n * size);
+    if (!(ctx = EVP_MD_CTX_create()))
+	return 0;
+    while (n > 1 && ok) {
+	for (i = 0; i + 1 < n && ok; i += 2)
+	    ok = ossl_digest_tree_node(ctx, tree->md, 0x01, buf + i * size, size,
+				       buf + (i + 1) * size, size,
+				       buf + (i / 2) * size);
+	if (n % 2)
+	    memmove(buf + (n / 2) * size, buf + (n - 1) * size, size);
+	n = (n + 1) / 2;
+    }
+    EVP_MD_CTX_destroy(ctx);
+    if (ok)
+	memcpy(tree->root, buf, size);
+
+    return ok;
+}
+
+static void *
+ossl_digest_tree_nogvl(void *ptr)
+{
+    struct ossl_digest_tree_args *args = ptr;
+
+    ossl_parallel(ossl_digest_tree_leaves, args, args->ntodo, 1);
+
+    return NULL;
+}
+
+struct ossl_digest_tree_hash_args {
+    struct ossl_digest_tree *tree;
+    const char *data;
+    unsigned long long len;
+    VALUE changed;
+};
+
+static VALUE
+ossl_digest_tree_hash0(VALUE ptr)
+{
+    struct ossl_digest_tree_hash_args *hargs = (struct ossl_digest_tree_hash_args *)ptr;
+    struct ossl_digest_tree *tree = hargs->tree;
+    const char *data = hargs->data;
+    unsigned long long len = hargs->len;
+    VALUE changed = hargs->changed;
+    struct ossl_digest_tree_args args;
+    VALUE ary, marks = Qnil;
+    unsigned char *scratch;
+    long nleaves, old = tree->nleaves, i, n;
+    char *mark = NULL;
+
+    nleaves = len ? (long)((len + tree->leaf_size - 1) / tree->leaf_size) : 1;
+    if (!NIL_P(changed) && old > 0) {
+	ary = rb_Array(changed);
+	marks = rb_str_new(0, nleaves);
+	mark = RSTRING_PTR(marks);
+	memset(mark, 0, nleaves);
+	for (i = 0; i < RARRAY_LEN(ary); i++) {
+	    n = NUM2LONG(RARRAY_PTR(ary)[i]);
+	    if (n >= 0 && n < nleaves) mark[n] = 1;
+	}
+	if (len != tree->length) {
+	    for (i = (old < nleaves ? old : nleaves) - 1; i < nleaves; i++)
+		mark[i] = 1;
+	}
+    }
+
+    REALLOC_N(tree->leaves, unsigned char, nleaves * tree->size);
+    args.todo = ALLOC_N(long, nleaves);
+    for (i = n = 0; i < nleaves; i++)
+	if (!mark || mark[i]) args.todo[n++] = i;
+    RB_GC_GUARD(marks);
+    args.tree = tree;
+    args.data = data;
+    args.length = len;
+    args.ntodo = n;
+    args.failed = 0;
+    tree->nleaves = nleaves;
+    tree->length = len;
+    ossl_nogvl(ossl_digest_tree_nogvl, &args, RUBY_UBF_IO, 0);
+    xfree(args.todo);
+
+    scratch = ALLOC_N(unsigned char, nleaves * tree->size);
+    if (!ossl_digest_tree_root(tree, scratch))
+	args.failed = 1;
+    xfree(scratch);
+    if (args.failed) {
+	/* the leaves can't be trusted for an incremental update any more */
+	tree->nleaves = 0;
+	ossl_raise(eDigestError, NULL);
+    }
+
+    return Qnil;
+}
+
+static VALUE
+ossl_digest_tree_hash_done(VALUE ptr)
+{
+    ((struct ossl_digest_tree *)ptr)->busy = 0;
+
+    return Qnil;
+}
+
+/*
+ * Hashes +len+ bytes at +data+, or only the leaves listed in +changed+ if
+ * that isn't nil and the tree already holds leaves of the same input.
+ * Leaves past the previous end, and the previous last one, are always
+ * hashed since they changed with the length.
+ *
+ * The leaves are written without the GVL, so another thread must not
+ * start hashing with the same tree meanwhile.
+ */
+static void
+ossl_digest_tree_hash(struct ossl_digest_tree *tree, const char *data,
+		      unsigned long long len, VALUE changed)
+{
+    struct ossl_digest_tree_hash_args args;
+
+    if (tree->busy)
+	ossl_raise(rb_eRuntimeError, "Digest::Tree is already hashing");
+    tree->busy = 1;
+    args.tree = tree;
+    args.data = data;
+    args.len = len;
+    args.changed = changed;
+    rb_ensure(ossl_digest_tree_hash0, (VALUE)&args,
+	      ossl_digest_tree_hash_done, (VALUE)tree);
+}
+
+/*
+ *  call-seq:
+ *     Digest::Tree.new(name) -> tree
+ *     Digest::Tree.new(name, leaf_size) -> tree
+ *
+ *  Creates a tree hash with the digest algorithm +name+ (a String or a
+ *  Digest) and leaves of +leaf_size+ bytes, 1MB by default.
+ *
+ *     tree = OpenSSL::Digest::Tree.new("SHA256", 4 * 1024 * 1024)
+ *     tree.file("backup.tar")        # => root
+ *     tree.leaves.size               # => one hash per 4MB
+ *     tree.file("backup.tar", [3])   # only leaf 3 changed
+ */
+static VALUE
+ossl_digest_tree_initialize(int argc, VALUE *argv, VALUE self)
+{
+    struct ossl_digest_tree *tree;
+    const EVP_MD *md;
+    VALUE name, leaf_size;
+    long lsize;
+
+    if (DATA_PTR(self))
+	ossl_raise(rb_eRuntimeError, "Digest::Tree already initialized");
+    rb_scan_args(argc, argv, "11", &name, &leaf_size);
+    lsize = NIL_P(leaf_size) ? 1024 * 1024 : NUM2LONG(leaf_size);
+    if (lsize <= 0)
+	rb_raise(rb_eArgError, "leaf_size must be positive");
+
+    md = GetDigestPtr(name);
+
+    tree = ALLOC(struct ossl_digest_tree);
+    tree->md = md;
+    tree->size = EVP_MD_size(md);
+    tree->leaf_size = lsize;
+    tree->nleaves = 0;
+    tree->length = 0;
+    tree->leaves = NULL;
+    tree->busy = 0;
+    DATA_PTR(self) = tree;
+
+    return self;
+}
+
+/*
+ *  call-seq:
+ *     tree.digest(string) -> root
+ *     tree.digest(string, changed) -> root
+ *
+ *  Hashes +string+ and returns the root hash.  If an Array of leaf indices
+ *  is given as +changed+, only those leaves are hashed again and the others
+ *  are taken from the previous call.
+ */
+static VALUE
+ossl_digest_tree_digest(int argc, VALUE *argv, VALUE self)
+{
+    struct ossl_digest_tree *tree;
+    VALUE str, changed;
+
+    rb_scan_args(argc, argv, "11", &str, &changed);
+    GetDigestTree(self, tree);
+    /* it must neither change nor move while we are without the GVL */
+    str = rb_str_new_frozen(StringValue(str));
+    ossl_digest_tree_hash(tree, RSTRING_PTR(str), RSTRING_LEN(str), changed);
+    RB_GC_GUARD(str);
+
+    return rb_str_new((char *)tree->root, tree->size);
+}
+
+struct ossl_digest_tree_file_args {
+    struct ossl_digest_tree *tree;
+    struct ossl_file_map map;
+    VALUE changed;
+};
+
+static VALUE
+ossl_digest_tree_file0(VALUE ptr)
+{
+    struct ossl_digest_tree_file_args *args = (struct ossl_digest_tree_file_args *)ptr;
+
+    ossl_digest_tree_hash(args->tree, args->map.ptr, args->map.len, args->changed);
+
+    return Qnil;
+}
+
+static VALUE
+ossl_digest_tree_file_unmap(VALUE ptr)
+{
+    ossl_file_unmap(&((struct ossl_digest_tree_file_args *)ptr)->map);
+
+    return Qnil;
+}
+
+/*
+ *  call-seq:
+ *     tree.file(path_or_io) -> root
+ *     tree.file(path_or_io, changed) -> root
+ *
+ *  Like #digest, but hashes the contents of a regular file.  The file is
+ *  mapped into memory rather than read into Strings; it must not shrink
+ *  while it is hashed.
+ */
+static VALUE
+ossl_digest_tree_file(int argc, VALUE *argv, VALUE self)
+{
+    struct ossl_digest_tree_file_args args;
+    VALUE file;
+
+    rb_scan_args(argc, argv, "11", &file, &args.changed);
+    GetDigestTree(self, args.tree);
+    ossl_file_map(file, &args.map);
+    rb_ensure(ossl_digest_tree_file0, (VALUE)&args,
+	      ossl_digest_tree_file_unmap, (VALUE)&args);
+
+    return rb_str_new((char *)args.tree->root, args.tree->size);
+}
+
+/*
+ *  call-seq:
+ *     tree.root -> string or nil
+ *
+ *  Returns the root hash of what was hashed last.
+ */
+static VALUE
+ossl_digest_tree_get_root(VALUE self)
+{
+    struct ossl_digest_tree *tree;
+
+    GetDigestTree(self, tree);
+    if (tree->nleaves == 0) return Qnil;
+
+    return rb_str_new((char *)tree->root, tree->size);
+}
+
+/*
+ *  call-seq:
+ *     tree.leaves -> array
+ *
+ *  Returns the hashes of the leaves, in order.
+ */
+static VALUE
+ossl_digest_tree_get_leaves(VALUE self)
+{
+    struct ossl_digest_tree *tree;
+    VALUE ary;
+    long i;
+
+    GetDigestTree(self, tree);
+    ary = rb_ary_new2(tree->nleaves);
+    for (i = 0; i < tree->nleaves; i++)
+	rb_ary_push(ary, rb_str_new((char *)tree->leaves + i * tree->size,
+				    tree->size));
+
+    return ary;
+}
+
+/*
+ *  call-seq:
+ *     tree.leaf_size -> integer
+ */
+static VALUE
+ossl_digest_tree_get_leaf_size(VALUE self)
+{
+    struct ossl_digest_tree *tree;
+
+    GetDigestTree(self, tree);
+
+    return LONG2NUM(tree->leaf_size);
+}
+
+/*
+ *  call-seq:
+ *     tree.name -> string
+ */
+static VALUE
+ossl_digest_tree_name(VALUE self)
+{
+    struct ossl_digest_tree *tree;
+
+    GetDigestTree(self, tree);
+
+    return rb_str_new2(EVP_MD_name(tree->md));
+}
+
+void
+Init_ossl_digest_tree()
+{
+#if 0
+    mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
+    cDigest = rb_define_class_under(mOSSL, "Digest", rb_path2class("Digest::Class"));
+#endif
+
+    /*
+     * Document-class: OpenSSL::Digest::Tree
+     *
+     * Hashes large inputs in parallel as a tree of fixed-size leaves, and
+     * re-hashes only what changed.  The root differs from the plain digest
+     * of the same data.
+     */
+    cDigestTree = rb_define_class_under(cDigest, "Tree", rb_cObject);
+    rb_define_alloc_func(cDigestTree, ossl_digest_tree_alloc);
+    rb_define_method(cDigestTree, "initialize", ossl_digest_tree_initialize, -1);
+    rb_define_method(cDigestTree, "digest", ossl_digest_tree_digest, -1);
+    rb_define_method(cDigestTree, "file", ossl_digest_tree_file, -1);
+    rb_define_method(cDigestTree, "root", ossl_digest_tree_get_root, 0);
+    rb_define_method(cDigestTree, "leaves", ossl_digest_tree_get_leaves, 0);
+    rb_define_method(cDigestTree, "leaf_size", ossl_digest_tree_get_leaf_size, 0);
+    rb_define_method(cDigestTree, "name", ossl_digest_tree_name, 0);
+}
@@ -108,6 +108,65 @@ ossl_hmac_update(VALUE self, VALUE data)
     return self;
 }
 
+static int
+ossl_hmac_update_func(void *ctx, const void *data, size_t len)
+{
+    HMAC_Update(ctx, data, len);
+
+    return 1;
+}
+
+struct ossl_hmac_file_args {
+    VALUE file;
+    HMAC_CTX *ctx;
+    HMAC_CTX copy;
+};
+
+static VALUE
+ossl_hmac_file0(VALUE ptr)
+{
+    struct ossl_hmac_file_args *args = (struct ossl_hmac_file_args *)ptr;
+
+    ossl_file_update(args->file, ossl_hmac_update_func, &args->copy);
+    /* HMAC_CTX_copy() doesn't free what the destination held */
+    HMAC_CTX_cleanup(args->ctx);
+    HMAC_CTX_init(args->ctx);
+    HMAC_CTX_copy(args->ctx, &args->copy);
+
+    return Qnil;
+}
+
+static VALUE
+ossl_hmac_file_ensure(VALUE ptr)
+{
+    HMAC_CTX_cleanup(&((struct ossl_hmac_file_args *)ptr)->copy);
+
+    return Qnil;
+}
+
+/*
+ *  call-seq:
+ *     hmac.file(path_or_io) -> self
+ *
+ *  Updates the HMAC with the contents of a file, as Digest#file does, and
+ *  with the same caveats: the HMAC is worked on in a copy, and a mapped
+ *  file that shrinks meanwhile kills the process with SIGBUS.
+ */
+static VALUE
+ossl_hmac_file(VALUE self, VALUE file)
+{
+    struct ossl_hmac_file_args args;
+
+    GetHMAC(self, args.ctx);
+    args.file = file;
+    HMAC_CTX_init(&args.copy);
+    HMAC_CTX_copy(&args.copy, args.ctx);
+    rb_ensure(ossl_hmac_file0, (VALUE)&args,
+	      ossl_hmac_file_ensure, (VALUE)&args);
+
+    return self;
+}
+
 static void
 hmac_final(HMAC_CTX *ctx, unsigned char **buf, unsigned int *buf_len)
 {
@@ -230,6 +289,482 @@ ossl_hmac_s_hexdigest(VALUE klass, VALUE digest, VALUE key, VALUE data)
     return hexdigest;
 }
 
+static int
+ossl_hmac_hex_value(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int
+ossl_hmac_base64_value(int c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+' || c == '-') return 62;
+    if (c == '/' || c == '_') return 63;
+    return -1;
+}
+
+/*
+ * Decodes the +len+ characters at +str+ into exactly +size+ bytes at
+ * +out+.  Returns 0 if they don't encode that many bytes.  Only the
+ * expected MAC goes through here, so branching on it gives nothing away.
+ */
+static int
+ossl_hmac_decode_hex(const char *str, long len, unsigned char *out, int size)
+{
+    int i, hi, lo;
+
+    if (len != 2 * size)
+	return 0;
+    for (i = 0; i < size; i++) {
+	hi = ossl_hmac_hex_value((unsigned char)str[2 * i]);
+	lo = ossl_hmac_hex_value((unsigned char)str[2 * i + 1]);
+	if (hi < 0 || lo < 0)
+	    return 0;
+	out[i] = (unsigned char)(hi << 4 | lo);
+    }
+
+    return 1;
+}
+
+static int
+ossl_hmac_decode_base64(const char *str, long len, unsigned char *out, int size)
+{
+    unsigned long bits = 0;
+    int i, n = 0, nbits = 0, v;
+
+    /* padding is optional, but there mustn't be too much of it */
+    if (len == (size + 2) / 3 * 4) {
+	while (len > 0 && str[len - 1] == '=')
+	    len--;
+    }
+    if (len != (size * 4 + 2) / 3)
+	return 0;
+    for (i = 0; i < len; i++) {
+	if ((v = ossl_hmac_base64_value((unsigned char)str[i])) < 0)
+	    return 0;
+	bits = bits << 6 | v;
+	if ((nbits += 6) >= 8) {
+	    nbits -= 8;
+	    out[n++] = (unsigned char)(bits >> nbits);
+	}
+    }
+
+    return n == size;
+}
+
+/*
+ *  call-seq:
+ *     HMAC.verify(digest, key, data, mac) -> true or false
+ *     HMAC.verify(digest, key, data, mac, :encoding => :hex) -> true or false
+ *
+ *  Whether +mac+ is the HMAC of +data+ under +key+.  +mac+ is compared
+ *  as it is by default; :encoding => :hex or :base64 (standard or
+ *  URL-safe, padding optional) decode it first.  A +mac+ that doesn't
+ *  decode to a MAC of the right length is just false.
+ *
+ *  The MAC is computed and +mac+ decoded into buffers on the stack,
+ *  without allocating any Strings, and the two are compared in constant
+ *  time.  Use this instead of
+ *
+ *     OpenSSL::HMAC.hexdigest("SHA256", secret, body) == signature
+ *
+ *  which leaks through its timing how much of +signature+ is right.
+ */
+static VALUE
+ossl_hmac_s_verify(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE digest, key, data, mac, opts, enc;
+    unsigned char buf[EVP_MAX_MD_SIZE], expected[EVP_MAX_MD_SIZE];
+    const EVP_MD *md;
+    unsigned int buf_len;
+    int size, ok;
+    ID id;
+
+    enc = Qnil;
+    if (argc > 0 && TYPE(argv[argc - 1]) == T_HASH) {
+	opts = argv[--argc];
+	enc = rb_hash_aref(opts, ID2SYM(rb_intern("encoding")));
+    }
+    rb_scan_args(argc, argv, "40", &digest, &key, &data, &mac);
+    StringValue(key);
+    StringValue(data);
+    StringValue(mac);
+    md = GetDigestPtr(digest);
+    size = EVP_MD_size(md);
+
+    if (NIL_P(enc))
+	id = rb_intern("raw");
+    else {
+	Check_Type(enc, T_SYMBOL);
+	id = SYM2ID(enc);
+    }
+    if (id == rb_intern("raw")) {
+	if (RSTRING_LEN(mac) != size)
+	    return Qfalse;
+	memcpy(expected, RSTRING_PTR(mac), size);
+    }
+    else if (id == rb_intern("hex")) {
+	if (!ossl_hmac_decode_hex(RSTRING_PTR(mac), RSTRING_LEN(mac), expected, size))
+	    return Qfalse;
+    }
+    else if (id == rb_intern("base64")) {
+	if (!ossl_hmac_decode_base64(RSTRING_PTR(mac), RSTRING_LEN(mac), expected, size))
+	    return Qfalse;
+    }
+    else {
+	ossl_raise(rb_eArgError, "unknown encoding: %s", rb_id2name(id));
+    }
+
+    if (!HMAC(md, RSTRING_PTR(key), RSTRING_LEN(key),
+	      (unsigned char *)RSTRING_PTR(data), RSTRING_LEN(data), buf, &buf_len))
+	ossl_raise(eHMACError, NULL);
+    ok = ossl_secure_compare(buf, expected, size);
+    OPENSSL_cleanse(expected, sizeof(expected));
+    OPENSSL_cleanse(buf, sizeof(buf));
+
+    return ok ? Qtrue : Qfalse;
+}
+
+/*
+ * HMAC::Key
+ *
+ * Keeps a keyed HMAC_CTX as a template.  Its inner and outer digest states
+ * already have the padded key absorbed, and HMAC_Init_ex() without a key
+ * only restores the inner one, so each message costs just its own blocks
+ * plus the outer hash.  The template is never written after #initialize;
+ * calls holding the GVL use the scratch context, and threads hashing a
+ * batch without it each take their own copy.
+ */
+struct ossl_hmac_key {
+    HMAC_CTX tmpl;
+    HMAC_CTX work;
+    int size;
+};
+
+#define GetHMACKey(obj, key) do { \
+    Data_Get_Struct(obj, struct ossl_hmac_key, key); \
+    if (!key->size) { \
+	ossl_raise(rb_eRuntimeError, "HMAC::Key wasn't initialized"); \
+    } \
+} while (0)
+
+VALUE cHMACKey;
+
+/* see Digest.digest_many */
+#define OSSL_HMAC_MANY_NOGVL (64 * 1024)
+#define OSSL_HMAC_MANY_GRAIN (1024 * 1024)
+
+static void
+ossl_hmac_key_free(struct ossl_hmac_key *key)
+{
+    HMAC_CTX_cleanup(&key->tmpl);
+    HMAC_CTX_cleanup(&key->work);
+    ruby_xfree(key);
+}
+
+static VALUE
+ossl_hmac_key_alloc(VALUE klass)
+{
+    struct ossl_hmac_key *key;
+    VALUE obj;
+
+    obj = Data_Make_Struct(klass, struct ossl_hmac_key, 0, ossl_hmac_key_free, key);
+    HMAC_CTX_init(&key->tmpl);
+    HMAC_CTX_init(&key->work);
+
+    return obj;
+}
+
+/*
+ *  call-seq:
+ *     HMAC::Key.new(key, digest) -> hmac_key
+ *
+ *  Prepares +key+ for signing many messages with +digest+.  Unlike
+ *  HMAC.digest, the key is only padded and hashed here, once.
+ *
+ *     signer = OpenSSL::HMAC::Key.new(secret, "SHA256")
+ *     signer.digest(request_body)
+ */
+static VALUE
+ossl_hmac_key_initialize(VALUE self, VALUE key, VALUE digest)
+{
+    struct ossl_hmac_key *k;
+    const EVP_MD *md;
+
+    StringValue(key);
+    md = GetDigestPtr(digest);
+    Data_Get_Struct(self, struct ossl_hmac_key, k);
+    /* sign_many workers may be copying the template right now */
+    if (k->size)
+	ossl_raise(rb_eRuntimeError, "HMAC::Key already initialized");
+    rb_check_frozen(self);
+    HMAC_Init_ex(&k->tmpl, RSTRING_PTR(key), RSTRING_LEN(key), md, NULL);
+    HMAC_CTX_cleanup(&k->work);
+    HMAC_CTX_init(&k->work);
+    HMAC_CTX_copy(&k->work, &k->tmpl);
+    k->size = EVP_MD_size(md);
+
+    return self;
+}
+
+static void
+ossl_hmac_key_sign(HMAC_CTX *ctx, const char *data, long len, unsigned char *out)
+{
+    HMAC_Init_ex(ctx, NULL, 0, NULL, NULL);
+    HMAC_Update(ctx, (const unsigned char *)data, len);
+    HMAC_Final(ctx, out, NULL);
+}
+
+/*
+ *  call-seq:
+ *     hmac_key.digest(data) -> aString
+ *
+ */
+static VALUE
+ossl_hmac_key_digest(VALUE self, VALUE data)
+{
+    struct ossl_hmac_key *k;
+    VALUE str;
+
+    StringValue(data);
+    GetHMACKey(self, k);
+    str = rb_str_new(0, k->size);
+    ossl_hmac_key_sign(&k->work, RSTRING_PTR(data), RSTRING_LEN(data),
+		       (unsigned char *)RSTRING_PTR(str));
+
+    return str;
+}
+
+/*
+ *  call-seq:
+ *     hmac_key.hexdigest(data) -> aString
+ *
+ */
+static VALUE
+ossl_hmac_key_hexdigest(VALUE self, VALUE data)
+{
+    struct ossl_hmac_key *k;
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    char *hexbuf;
+
+    StringValue(data);
+    GetHMACKey(self, k);
+    ossl_hmac_key_sign(&k->work, RSTRING_PTR(data), RSTRING_LEN(data), buf);
+    if (string2hex(buf, k->size, &hexbuf, NULL) != 2 * k->size) {
+	ossl_raise(eHMACError, "Cannot convert buf to hexbuf");
+    }
+
+    return ossl_buf2str(hexbuf, 2 * k->size);
+}
+
+/*
+ *  call-seq:
+ *     hmac_key.verify(data, mac) -> true or false
+ *
+ *  Whether +mac+ is the HMAC of +data+.  The comparison takes the same
+ *  time wherever the two differ.
+ */
+static VALUE
+ossl_hmac_key_verify(VALUE self, VALUE data, VALUE mac)
+{
+    struct ossl_hmac_key *k;
+    unsigned char buf[EVP_MAX_MD_SIZE];
+
+    StringValue(data);
+    StringValue(mac);
+    GetHMACKey(self, k);
+    ossl_hmac_key_sign(&k->work, RSTRING_PTR(data), RSTRING_LEN(data), buf);
+    if (RSTRING_LEN(mac) != k->size)
+	return Qfalse;
+
+    return ossl_secure_compare(buf, RSTRING_PTR(mac), k->size) ? Qtrue : Qfalse;
+}
+
+struct ossl_hmac_many_args {
+    struct ossl_hmac_key *key;
+    VALUE ary;
+    long num;
+    const char **ptrs;
+    long *lens;
+    unsigned char *out;
+    long grain;
+};
+
+static void
+ossl_hmac_many_slice(void *ptr, long beg, long end)
+{
+    struct ossl_hmac_many_args *args = ptr;
+    HMAC_CTX ctx;
+    long i;
+
+    HMAC_CTX_init(&ctx);
+    HMAC_CTX_copy(&ctx, &args->key->tmpl);
+    for (i = beg; i < end; i++)
+	ossl_hmac_key_sign(&ctx, args->ptrs[i], args->lens[i],
+			   args->out + i * args->key->size);
+    HMAC_CTX_cleanup(&ctx);
+}
+
+static void *
+ossl_hmac_many_nogvl(void *ptr)
+{
+    struct ossl_hmac_many_args *args = ptr;
+
+    ossl_parallel(ossl_hmac_many_slice, args, args->num, args->grain);
+
+    return NULL;
+}
+
+static VALUE
+ossl_hmac_many_run(VALUE ptr)
+{
+    struct ossl_hmac_many_args *args = (struct ossl_hmac_many_args *)ptr;
+    int size = args->key->size;
+    VALUE str, ret;
+    long i, total = 0, avg;
+
+    /*
+     * #to_str of a later element may change an earlier String, and without
+     * the GVL they must neither change nor move: take frozen copies first,
+     * lengths only once nothing can run any more
+     */
+    for (i = 0; i < args->num; i++) {
+	str = RARRAY_PTR(args->ary)[i];
+	StringValue(str);
+	rb_ary_store(args->ary, i, rb_str_new_frozen(str));
+    }
+    ret = rb_str_new(0, args->num * size);
+    args->out = (unsigned char *)RSTRING_PTR(ret);
+    for (i = 0; i < args->num; i++) {
+	str = RARRAY_PTR(args->ary)[i];
+	args->ptrs[i] = RSTRING_PTR(str);
+	args->lens[i] = RSTRING_LEN(str);
+	total += args->lens[i];
+    }
+    if (total < OSSL_HMAC_MANY_NOGVL) {
+	for (i = 0; i < args->num; i++)
+	    ossl_hmac_key_sign(&args->key->work, args->ptrs[i],
+			       args->lens[i], args->out + i * size);
+    }
+    else {
+	avg = total / args->num;
+	args->grain = OSSL_HMAC_MANY_GRAIN / (avg > 0 ? avg : 1) + 1;
+	ossl_nogvl(ossl_hmac_many_nogvl, args, RUBY_UBF_IO, 0);
+    }
+
+    return ret;
+}
+
+static VALUE
+ossl_hmac_many_ensure(VALUE ptr)
+{
+    struct ossl_hmac_many_args *args = (struct ossl_hmac_many_args *)ptr;
+
+    xfree(args->ptrs);
+    xfree(args->lens);
+
+    return Qnil;
+}
+
+/*
+ * Returns the HMACs of all Strings in +ary+, concatenated.
+ */
+static VALUE
+ossl_hmac_many(VALUE self, VALUE ary)
+{
+    struct ossl_hmac_many_args args;
+
+    Check_Type(ary, T_ARRAY);
+    GetHMACKey(self, args.key);
+    /* work on a copy, the caller's Array may change under us */
+    args.ary = rb_ary_dup(ary);
+    args.num = RARRAY_LEN(args.ary);
+    args.grain = args.num;
+    args.ptrs = ALLOC_N(const char *, args.num);
+    args.lens = ALLOC_N(long, args.num);
+
+    return rb_ensure(ossl_hmac_many_run, (VALUE)&args,
+		     ossl_hmac_many_ensure, (VALUE)&args);
+}
+
+/*
+ *  call-seq:
+ *     hmac_key.sign_many(messages) -> array
+ *     hmac_key.sign_many(messages, :packed => true) -> string
+ *
+ *  Returns the HMACs of all Strings in the Array +messages+, or with
+ *  :packed, all of them concatenated in one String.  Large batches are
+ *  signed without the GVL and split across threads, as in
+ *  Digest.digest_many.
+ */
+static VALUE
+ossl_hmac_key_sign_many(int argc, VALUE *argv, VALUE self)
+{
+    struct ossl_hmac_key *k;
+    VALUE ary, opts, str, ret;
+    int packed = 0;
+    long i, num;
+
+    if (argc > 0 && TYPE(argv[argc - 1]) == T_HASH) {
+	opts = argv[--argc];
+	packed = RTEST(rb_hash_aref(opts, ID2SYM(rb_intern("packed"))));
+    }
+    rb_scan_args(argc, argv, "10", &ary);
+    GetHMACKey(self, k);
+    str = ossl_hmac_many(self, ary);
+    if (packed)
+	return str;
+
+    num = RSTRING_LEN(str) / k->size;
+    ret = rb_ary_new2(num);
+    for (i = 0; i < num; i++)
+	rb_ary_push(ret, rb_str_substr(str, i * k->size, k->size));
+
+    return ret;
+}
+
+/*
+ *  call-seq:
+ *     hmac_key.verify_many(messages, macs) -> array
+ *
+ *  Checks each of +macs+ against the HMAC of the message at the same
+ *  index, as #verify does, and returns an Array of true or false.
+ */
+static VALUE
+ossl_hmac_key_verify_many(VALUE self, VALUE msgs, VALUE macs)
+{
+    struct ossl_hmac_key *k;
+    VALUE str, mac, ret;
+    const char *p;
+    long i, num;
+
+    Check_Type(macs, T_ARRAY);
+    GetHMACKey(self, k);
+    str = ossl_hmac_many(self, msgs);
+    num = RSTRING_LEN(str) / k->size;
+    if (RARRAY_LEN(macs) != num)
+	ossl_raise(rb_eArgError, "%ld messages but %ld MACs",
+		   num, RARRAY_LEN(macs));
+
+    ret = rb_ary_new2(num);
+    for (i = 0; i < num; i++) {
+	mac = rb_ary_entry(macs, i);
+	StringValue(mac);
+	p = RSTRING_PTR(str) + i * k->size;
+	rb_ary_push(ret, RSTRING_LEN(mac) == k->size &&
+		    ossl_secure_compare(p, RSTRING_PTR(mac), k->size) ?
+		    Qtrue : Qfalse);
+    }
+
+    return ret;
+}
+
 /*
  * INIT
  */
@@ -247,6 +782,7 @@ Init_ossl_hmac()
     rb_define_alloc_func(cHMAC, ossl_hmac_alloc);
     rb_define_singleton_method(cHMAC, "digest", ossl_hmac_s_digest, 3);
     rb_define_singleton_method(cHMAC, "hexdigest", ossl_hmac_s_hexdigest, 3);
+    rb_define_singleton_method(cHMAC, "verify", ossl_hmac_s_verify, -1);
 
     rb_define_method(cHMAC, "initialize", ossl_hmac_initialize, 2);
     rb_define_copy_func(cHMAC, ossl_hmac_copy);
@@ -254,10 +790,20 @@ Init_ossl_hmac()
     rb_define_method(cHMAC, "reset", ossl_hmac_reset, 0);
     rb_define_method(cHMAC, "update", ossl_hmac_update, 1);
     rb_define_alias(cHMAC, "<<", "update");
+    rb_define_method(cHMAC, "file", ossl_hmac_file, 1);
     rb_define_method(cHMAC, "digest", ossl_hmac_digest, 0);
     rb_define_method(cHMAC, "hexdigest", ossl_hmac_hexdigest, 0);
     rb_define_alias(cHMAC, "inspect", "hexdigest");
     rb_define_alias(cHMAC, "to_s", "hexdigest");
+
+    cHMACKey = rb_define_class_under(cHMAC, "Key", rb_cObject);
+    rb_define_alloc_func(cHMACKey, ossl_hmac_key_alloc);
+    rb_define_method(cHMACKey, "initialize", ossl_hmac_key_initialize, 2);
+    rb_define_method(cHMACKey, "digest", ossl_hmac_key_digest, 1);
+    rb_define_method(cHMACKey, "hexdigest", ossl_hmac_key_hexdigest, 1);
+    rb_define_method(cHMACKey, "verify", ossl_hmac_key_verify, 2);
+    rb_define_method(cHMACKey, "sign_many", ossl_hmac_key_sign_many, -1);
+    rb_define_method(cHMACKey, "verify_many", ossl_hmac_key_verify_many, 2);
 }
 
 #else /* NO_HMAC */
@@ -12,6 +12,7 @@
 #define _OSSL_HMAC_H_
 
 extern VALUE cHMAC;
+extern VALUE cHMACKey;
 extern VALUE eHMACError;
 
 void Init_ossl_hmac(void);
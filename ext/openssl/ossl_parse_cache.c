@@ -0,0 +1,275 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#include "ossl.h"
+
+/*
+ * Parse cache
+ *
+ * Classes registered with ossl_parse_cache_register() get a new() that,
+ * while the cache is on and it is given nothing but a String, looks up
+ * the SHA-256 of the String (and the class) first.  What was parsed from
+ * the same bytes before comes back as it is; anything parsed is frozen,
+ * since everybody who parses those bytes shares it.
+ *
+ * Private keys are never shared: whoever has the bytes of an encrypted
+ * one would get it back without the passphrase.  They, encrypted PEM and
+ * calls with a block, which supplies a passphrase, go straight to the
+ * class.
+ *
+ * The table is a Hash, which keeps its keys in the order they were put
+ * in: a hit moves its entry to the end, and the entry at the front, the
+ * one least recently used, goes when the table is full.  The table is
+ * only touched with the GVL held and never across a call into Ruby, so
+ * threads need no lock of their own; two of them that miss on the same
+ * input at once both parse it, and the first to finish stores it.
+ */
+VALUE mParseCache;
+
+#define OSSL_PARSE_CACHE_CLASSES 8
+
+static VALUE ossl_parse_cache_table;
+static long ossl_parse_cache_max;
+static unsigned long ossl_parse_cache_hits;
+static unsigned long ossl_parse_cache_misses;
+static unsigned long ossl_parse_cache_evictions;
+static VALUE ossl_parse_cache_classes[OSSL_PARSE_CACHE_CLASSES];
+static int ossl_parse_cache_nclasses;
+static ID id_shift;
+
+static void
+ossl_parse_cache_trim(long max)
+{
+    while (RHASH_SIZE(ossl_parse_cache_table) > max) {
+	rb_funcall(ossl_parse_cache_table, id_shift, 0);
+	ossl_parse_cache_evictions++;
+    }
+}
+
+static VALUE
+ossl_parse_cache_key(VALUE klass, VALUE str)
+{
+    unsigned char key[EVP_MAX_MD_SIZE + sizeof(VALUE)];
+    unsigned int len;
+    VALUE ret;
+
+    if (!EVP_Digest(RSTRING_PTR(str), RSTRING_LEN(str), key, &len,
+		    EVP_sha256(), NULL)) {
+	ossl_raise(eOSSLError, NULL);
+    }
+    memcpy(key + len, &klass, sizeof(VALUE));
+    ret = rb_str_new((const char *)key, len + sizeof(VALUE));
+    OBJ_FREEZE(ret);
+
+    return ret;
+}
+
+static int
+ossl_parse_cache_encrypted_p(VALUE str)
+{
+    static const char tag[] = "ENCRYPTED";
+    const char *p = RSTRING_PTR(str), *end = p + RSTRING_LEN(str);
+
+    while ((p = memchr(p, 'E', end - p)) != NULL) {
+	if ((size_t)(end - p) < sizeof(tag) - 1) break;
+	if (memcmp(p, tag, sizeof(tag) - 1) == 0) return 1;
+	p++;
+    }
+
+    return 0;
+}
+
+static int
+ossl_parse_cache_private_p(VALUE obj)
+{
+    EVP_PKEY *pkey;
+
+    if (!rb_obj_is_kind_of(obj, cPKey)) return 0;
+    GetPKey(obj, pkey);
+    switch (EVP_PKEY_type(pkey->type)) {
+    case EVP_PKEY_RSA:
+	return pkey->pkey.rsa->d != NULL;
+    case EVP_PKEY_DSA:
+	return pkey->pkey.dsa->priv_key != NULL;
+#if !defined(OPENSSL_NO_EC) && (OPENSSL_VERSION_NUMBER >= 0x0090802fL)
+    case EVP_PKEY_EC:
+	return EC_KEY_get0_private_key(pkey->pkey.ec) != NULL;
+#endif
+    }
+
+    return 1;
+}
+
+static VALUE
+ossl_parse_cache_s_new(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE key, obj, cached;
+    int i;
+
+    if (ossl_parse_cache_max == 0 || argc != 1 || TYPE(argv[0]) != T_STRING ||
+	rb_block_given_p() || ossl_parse_cache_encrypted_p(argv[0])) {
+	return rb_class_new_instance(argc, argv, klass);
+    }
+    /* subclasses may give new() other meanings */
+    for (i = 0; i < ossl_parse_cache_nclasses; i++) {
+	if (ossl_parse_cache_classes[i] == klass) break;
+    }
+    if (i == ossl_parse_cache_nclasses) {
+	return rb_class_new_instance(argc, argv, klass);
+    }
+
+    key = ossl_parse_cache_key(klass, argv[0]);
+    obj = rb_hash_lookup(ossl_parse_cache_table, key);
+    if (!NIL_P(obj)) {
+	ossl_parse_cache_hits++;
+	rb_hash_delete(ossl_parse_cache_table, key);
+	rb_hash_aset(ossl_parse_cache_table, key, obj);
+	return obj;
+    }
+    ossl_parse_cache_misses++;
+    obj = rb_class_new_instance(argc, argv, klass);
+    if (ossl_parse_cache_private_p(obj)) {
+	return obj;
+    }
+    OBJ_FREEZE(obj);
+    /* another thread may have parsed the same while this one did */
+    cached = rb_hash_lookup(ossl_parse_cache_table, key);
+    if (!NIL_P(cached)) {
+	return cached;
+    }
+    if (ossl_parse_cache_max > 0) {
+	rb_hash_aset(ossl_parse_cache_table, key, obj);
+	ossl_parse_cache_trim(ossl_parse_cache_max);
+    }
+
+    return obj;
+}
+
+/*
+ * Makes +klass+.new go through the parse cache.
+ */
+void
+ossl_parse_cache_register(VALUE klass)
+{
+    if (ossl_parse_cache_nclasses == OSSL_PARSE_CACHE_CLASSES) {
+	rb_bug("ossl_parse_cache_register: too many classes");
+    }
+    ossl_parse_cache_classes[ossl_parse_cache_nclasses++] = klass;
+    rb_define_singleton_method(klass, "new", ossl_parse_cache_s_new, -1);
+}
+
+/*
+ * call-seq:
+ *    ParseCache.size => integer
+ */
+static VALUE
+ossl_parse_cache_get_size(VALUE self)
+{
+    return LONG2NUM(ossl_parse_cache_max);
+}
+
+/*
+ * call-seq:
+ *    ParseCache.size = integer
+ *
+ * Keeps up to +integer+ parsed objects; 0, the default, turns the cache
+ * off.  Making the cache smaller drops the least recently used objects.
+ */
+static VALUE
+ossl_parse_cache_set_size(VALUE self, VALUE size)
+{
+    long max = NUM2LONG(size);
+
+    if (max < 0) {
+	ossl_raise(rb_eArgError, "negative cache size");
+    }
+    ossl_parse_cache_max = max;
+    ossl_parse_cache_trim(max);
+
+    return size;
+}
+
+/*
+ * call-seq:
+ *    ParseCache.clear => self
+ *
+ * Empties the cache and sets the counters of ParseCache.stats back to 0.
+ */
+static VALUE
+ossl_parse_cache_clear(VALUE self)
+{
+    rb_funcall(ossl_parse_cache_table, rb_intern("clear"), 0);
+    ossl_parse_cache_hits = 0;
+    ossl_parse_cache_misses = 0;
+    ossl_parse_cache_evictions = 0;
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *    ParseCache.stats => hash
+ *
+ * Returns a Hash with these keys:
+ *
+ * :size:: Number of objects in the cache
+ * :hits:: Number of times a parsed object was found in the cache
+ * :misses:: Number of times the input had to be parsed
+ * :evictions:: Number of objects dropped to make room for another one
+ * :hit_rate:: hits / (hits + misses), as a Float
+ */
+static VALUE
+ossl_parse_cache_stats(VALUE self)
+{
+    unsigned long lookups = ossl_parse_cache_hits + ossl_parse_cache_misses;
+    VALUE hash;
+
+    hash = rb_hash_new();
+    rb_hash_aset(hash, ID2SYM(rb_intern("size")),
+		 LONG2NUM(RHASH_SIZE(ossl_parse_cache_table)));
+    rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULONG2NUM(ossl_parse_cache_hits));
+    rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULONG2NUM(ossl_parse_cache_misses));
+    rb_hash_aset(hash, ID2SYM(rb_intern("evictions")), ULONG2NUM(ossl_parse_cache_evictions));
+    rb_hash_aset(hash, ID2SYM(rb_intern("hit_rate")),
+		 rb_float_new(lookups ? (double)ossl_parse_cache_hits / lookups : 0.0));
+
+    return hash;
+}
+
+void
+Init_ossl_parse_cache()
+{
+#if 0
+    mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
+#endif
+
+    id_shift = rb_intern("shift");
+    ossl_parse_cache_table = rb_hash_new();
+    rb_global_variable(&ossl_parse_cache_table);
+
+    /*
+     * Document-module: OpenSSL::ParseCache
+     *
+     * A cache of certificates, CRLs and keys by what they were parsed
+     * from.  With ParseCache.size set, X509::Certificate.new,
+     * X509::CRL.new and PKey::RSA.new, PKey::DSA.new and PKey::EC.new
+     * given a DER or PEM String return the same frozen object for the
+     * same String, until it hasn't been asked for in so long that it had
+     * to make room for others.
+     *
+     *   OpenSSL::ParseCache.size = 10_000
+     *   cert = OpenSSL::X509::Certificate.new(der)
+     *   cert.equal?(OpenSSL::X509::Certificate.new(der)) # => true
+     *   OpenSSL::ParseCache.stats[:hit_rate]             # => 0.5
+     */
+    mParseCache = rb_define_module_under(mOSSL, "ParseCache");
+    rb_define_module_function(mParseCache, "size", ossl_parse_cache_get_size, 0);
+    rb_define_module_function(mParseCache, "size=", ossl_parse_cache_set_size, 1);
+    rb_define_module_function(mParseCache, "clear", ossl_parse_cache_clear, 0);
+    rb_define_module_function(mParseCache, "stats", ossl_parse_cache_stats, 0);
+}
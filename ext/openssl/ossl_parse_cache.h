@@ -0,0 +1,17 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#if !defined(_OSSL_PARSE_CACHE_H_)
+#define _OSSL_PARSE_CACHE_H_
+
+extern VALUE mParseCache;
+
+void ossl_parse_cache_register(VALUE);
+void Init_ossl_parse_cache(void);
+
+#endif /* _OSSL_PARSE_CACHE_H_ */
@@ -33,6 +33,179 @@ ossl_generate_cb(int p, int n, void *arg)
     rb_yield(ary);
 }
 
+static void *
+ossl_generate_cb_flush(void *ptr)
+{
+    struct ossl_generate_cb_arg *arg = ptr;
+    int i, n = arg->nevents;
+
+    arg->nevents = 0;
+    for (i = 0; i < n; i++)
+	ossl_generate_cb(arg->events[i][0], arg->events[i][1], NULL);
+
+    return arg;
+}
+
+/*
+ * BN_GENCB callback, runs without the GVL.  Returning 0 makes OpenSSL give
+ * up the generation.
+ */
+int
+ossl_generate_cb_2(int p, int n, BN_GENCB *cb)
+{
+    struct ossl_generate_cb_arg *arg = (struct ossl_generate_cb_arg *)cb->arg;
+
+    if (arg->interrupted)
+	return 0;
+    if (arg->yield) {
+	arg->events[arg->nevents][0] = p;
+	arg->events[arg->nevents][1] = n;
+	arg->nevents++;
+	/* p >= 2 ends a phase, worth reporting right away */
+	if (arg->nevents == OSSL_GENERATE_CB_BATCH || p >= 2) {
+	    if (!ossl_with_gvl(ossl_generate_cb_flush, arg))
+		return 0; /* the block raised */
+	}
+    }
+
+    return !arg->interrupted;
+}
+
+static void
+ossl_generate_cb_stop(void *ptr)
+{
+    struct ossl_generate_cb_arg *arg = ptr;
+
+    arg->interrupted = 1;
+}
+
+struct ossl_generate_args {
+    void *(*func)(void *);
+    void *data;
+    struct ossl_generate_cb_arg *cb_arg;
+    void *ret;
+};
+
+static VALUE
+ossl_generate0(VALUE ptr)
+{
+    struct ossl_generate_args *args = (struct ossl_generate_args *)ptr;
+    struct ossl_generate_cb_arg *cb_arg = args->cb_arg;
+
+    for (;;) {
+	cb_arg->interrupted = 0;
+	cb_arg->nevents = 0;
+	args->ret = ossl_nogvl(args->func, args->data,
+			       ossl_generate_cb_stop, cb_arg);
+	if (args->ret || !cb_arg->interrupted)
+	    break;
+	/* the interrupt did not raise (a trap handler?), start over */
+	rb_thread_check_ints();
+	ERR_clear_error();
+    }
+    ossl_generate_cb_flush(cb_arg);
+
+    return Qnil;
+}
+
+/*
+ * Runs the generator +func+ with +data+ without the GVL.  +func+ has to use
+ * ossl_generate_cb_2 with +cb_arg+ as its BN_GENCB and return NULL on
+ * failure.  Exceptions are caught and reported through +state+ so the
+ * caller can free what it allocated.
+ */
+void *
+ossl_generate(void *(*func)(void *), void *data,
+	      struct ossl_generate_cb_arg *cb_arg, int *state)
+{
+    struct ossl_generate_args args;
+
+    args.func = func;
+    args.data = data;
+    args.cb_arg = cb_arg;
+    args.ret = NULL;
+    cb_arg->yield = rb_block_given_p();
+    rb_protect(ossl_generate0, (VALUE)&args, state);
+
+    return args.ret;
+}
+
+/*
+ * Keys in use without the GVL, counted by the RSA, DSA, DH or EC_KEY they
+ * wrap.  The table is only touched with the GVL held.  Whatever frees or
+ * replaces parts of a key waits with ossl_pkey_wait_idle() until no
+ * operation is running on it.
+ */
+static st_table *ossl_pkey_busy;
+
+struct ossl_pkey_nogvl_args {
+    void *key;
+    void *(*func)(void *);
+    void *data;
+    void *ret;
+};
+
+static VALUE
+ossl_pkey_nogvl0(VALUE ptr)
+{
+    struct ossl_pkey_nogvl_args *args = (struct ossl_pkey_nogvl_args *)ptr;
+
+    args->ret = ossl_nogvl(args->func, args->data, NULL, NULL);
+
+    return Qnil;
+}
+
+static VALUE
+ossl_pkey_nogvl_done(VALUE ptr)
+{
+    struct ossl_pkey_nogvl_args *args = (struct ossl_pkey_nogvl_args *)ptr;
+    st_data_t key = (st_data_t)args->key, n = 0;
+
+    st_lookup(ossl_pkey_busy, key, &n);
+    if (n > 1)
+	st_insert(ossl_pkey_busy, key, n - 1);
+    else
+	st_delete(ossl_pkey_busy, &key, NULL);
+
+    return Qnil;
+}
+
+/*
+ * Runs func(data), an operation on +key+, without the GVL.
+ */
+void *
+ossl_pkey_nogvl(void *key, void *(*func)(void *), void *data)
+{
+    struct ossl_pkey_nogvl_args args;
+    st_data_t n = 0;
+
+    args.key = key;
+    args.func = func;
+    args.data = data;
+    args.ret = NULL;
+    st_lookup(ossl_pkey_busy, (st_data_t)key, &n);
+    st_insert(ossl_pkey_busy, (st_data_t)key, n + 1);
+    rb_ensure(ossl_pkey_nogvl0, (VALUE)&args, ossl_pkey_nogvl_done, (VALUE)&args);
+
+    return args.ret;
+}
+
+/*
+ * Returns once no thread runs an operation on +key+ any more.  Nothing
+ * can start one before the caller gives up the GVL again.
+ */
+void
+ossl_pkey_wait_idle(void *key)
+{
+    struct timeval tv;
+
+    while (st_lookup(ossl_pkey_busy, (st_data_t)key, NULL)) {
+	tv.tv_sec = 0;
+	tv.tv_usec = 1000;
+	rb_thread_wait_for(tv);
+    }
+}
+
 /*
  * Public
  */
@@ -159,26 +332,72 @@ ossl_pkey_initialize(VALUE self)
     return self;
 }
 
+/*
+ * Digesting and the private/public key operation are done without the GVL.
+ */
+struct ossl_pkey_sign_args {
+    const EVP_MD *md;
+    EVP_PKEY *pkey;
+    char *data;
+    long data_len;
+    unsigned char *sig;
+    unsigned int sig_len;
+    int ret;
+};
+
+static void *
+ossl_pkey_sign_func(void *ptr)
+{
+    struct ossl_pkey_sign_args *args = ptr;
+    EVP_MD_CTX ctx;
+
+    EVP_SignInit(&ctx, args->md);
+    EVP_SignUpdate(&ctx, args->data, args->data_len);
+    args->ret = EVP_SignFinal(&ctx, args->sig, &args->sig_len, args->pkey);
+    EVP_MD_CTX_cleanup(&ctx);
+
+    return NULL;
+}
+
+static void *
+ossl_pkey_verify_func(void *ptr)
+{
+    struct ossl_pkey_sign_args *args = ptr;
+    EVP_MD_CTX ctx;
+
+    EVP_VerifyInit(&ctx, args->md);
+    EVP_VerifyUpdate(&ctx, args->data, args->data_len);
+    args->ret = EVP_VerifyFinal(&ctx, args->sig, args->sig_len, args->pkey);
+    EVP_MD_CTX_cleanup(&ctx);
+
+    return NULL;
+}
+
 static VALUE
 ossl_pkey_sign(VALUE self, VALUE digest, VALUE data)
 {
     EVP_PKEY *pkey;
-    EVP_MD_CTX ctx;
-    unsigned int buf_len;
+    struct ossl_pkey_sign_args args;
     VALUE str;
 
     if (rb_funcall(self, id_private_q, 0, NULL) != Qtrue) {
 	ossl_raise(rb_eArgError, "Private key is needed.");
     }
     GetPKey(self, pkey);
-    EVP_SignInit(&ctx, GetDigestPtr(digest));
+    args.md = GetDigestPtr(digest);
     StringValue(data);
-    EVP_SignUpdate(&ctx, RSTRING_PTR(data), RSTRING_LEN(data));
+    data = rb_str_new_frozen(data);
     str = rb_str_new(0, EVP_PKEY_size(pkey)+16);
-    if (!EVP_SignFinal(&ctx, (unsigned char *)RSTRING_PTR(str), &buf_len, pkey))
+    args.pkey = pkey;
+    args.data = RSTRING_PTR(data);
+    args.data_len = RSTRING_LEN(data);
+    args.sig = (unsigned char *)RSTRING_PTR(str);
+    ossl_pkey_nogvl(pkey->pkey.ptr, ossl_pkey_sign_func, &args);
+    if (!args.ret)
 	ossl_raise(ePKeyError, NULL);
-    assert((long)buf_len <= RSTRING_LEN(str));
-    rb_str_set_len(str, buf_len);
+    assert((long)args.sig_len <= RSTRING_LEN(str));
+    rb_str_set_len(str, args.sig_len);
+    RB_GC_GUARD(data);
 
     return str;
 }
@@ -187,14 +406,23 @@ static VALUE
 ossl_pkey_verify(VALUE self, VALUE digest, VALUE sig, VALUE data)
 {
     EVP_PKEY *pkey;
-    EVP_MD_CTX ctx;
+    struct ossl_pkey_sign_args args;
 
     GetPKey(self, pkey);
-    EVP_VerifyInit(&ctx, GetDigestPtr(digest));
+    args.md = GetDigestPtr(digest);
     StringValue(sig);
     StringValue(data);
-    EVP_VerifyUpdate(&ctx, RSTRING_PTR(data), RSTRING_LEN(data));
-    switch (EVP_VerifyFinal(&ctx, (unsigned char *)RSTRING_PTR(sig), RSTRING_LEN(sig), pkey)) {
+    sig = rb_str_new_frozen(sig);
+    data = rb_str_new_frozen(data);
+    args.pkey = pkey;
+    args.data = RSTRING_PTR(data);
+    args.data_len = RSTRING_LEN(data);
+    args.sig = (unsigned char *)RSTRING_PTR(sig);
+    args.sig_len = RSTRING_LEN(sig);
+    ossl_pkey_nogvl(pkey->pkey.ptr, ossl_pkey_verify_func, &args);
+    RB_GC_GUARD(sig);
+    RB_GC_GUARD(data);
+    switch (args.ret) {
     case 0:
 	return Qfalse;
     case 1:
@@ -215,6 +443,8 @@ Init_ossl_pkey()
     mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
 #endif
 
+    ossl_pkey_busy = st_init_numtable();
+
     mPKey = rb_define_module_under(mOSSL, "PKey");
 
     ePKeyError = rb_define_class_under(mPKey, "PKeyError", eOSSLError);
@@ -40,6 +40,24 @@ extern ID id_private_q;
 
 void ossl_generate_cb(int, int, void *);
 
+/*
+ * Key generation without the GVL.  Progress is buffered and yielded in
+ * batches, an interrupt of the calling thread aborts the generation.
+ */
+#define OSSL_GENERATE_CB_BATCH 64
+
+struct ossl_generate_cb_arg {
+    int yield;
+    volatile int interrupted;
+    int nevents;
+    int events[OSSL_GENERATE_CB_BATCH][2];
+};
+
+int ossl_generate_cb_2(int, int, BN_GENCB *);
+void *ossl_generate(void *(*)(void *), void *, struct ossl_generate_cb_arg *, int *);
+void *ossl_pkey_nogvl(void *, void *(*)(void *), void *);
+void ossl_pkey_wait_idle(void *);
+
 VALUE ossl_pkey_new(EVP_PKEY *);
 VALUE ossl_pkey_new_from_file(VALUE);
 EVP_PKEY *GetPKeyPtr(VALUE);
@@ -115,14 +133,17 @@ static VALUE ossl_##keytype##_set_##name(VALUE self, VALUE bignum)	\
 	EVP_PKEY *pkey;							\
 	BIGNUM *bn;							\
 									\
+	rb_check_frozen(self);						\
 	GetPKey(self, pkey);						\
 	if (NIL_P(bignum)) {						\
+		ossl_pkey_wait_idle(pkey->pkey.keytype);		\
 		BN_clear_free(pkey->pkey.keytype->name);		\
 		pkey->pkey.keytype->name = NULL;			\
 		return Qnil;						\
 	}								\
 									\
 	bn = GetBNPtr(bignum);						\
+	ossl_pkey_wait_idle(pkey->pkey.keytype);			\
 	if (pkey->pkey.keytype->name == NULL)				\
 		pkey->pkey.keytype->name = BN_new();			\
 	if (pkey->pkey.keytype->name == NULL)				\
@@ -81,11 +81,51 @@ ossl_dh_new(EVP_PKEY *pkey)
 /*
  * Private
  */
+#if defined(HAVE_DH_GENERATE_PARAMETERS_EX)
+struct dh_blocking_gen_arg {
+    DH *dh;
+    int size;
+    int gen;
+    BN_GENCB *cb;
+};
+
+static void *
+dh_blocking_gen(void *arg)
+{
+    struct dh_blocking_gen_arg *gen = arg;
+
+    if (!DH_generate_parameters_ex(gen->dh, gen->size, gen->gen, gen->cb))
+	return NULL;
+    if (!DH_generate_key(gen->dh))
+	return NULL;
+
+    return gen->dh;
+}
+#endif
+
 static DH *
 dh_generate(int size, int gen)
 {
     DH *dh;
-
+#if defined(HAVE_DH_GENERATE_PARAMETERS_EX)
+    BN_GENCB cb;
+    struct ossl_generate_cb_arg cb_arg;
+    struct dh_blocking_gen_arg gen_arg;
+    int state = 0;
+
+    if (!(gen_arg.dh = DH_new())) return 0;
+    gen_arg.size = size;
+    gen_arg.gen = gen;
+    gen_arg.cb = &cb;
+    BN_GENCB_set(&cb, ossl_generate_cb_2, &cb_arg);
+
+    dh = ossl_generate(dh_blocking_gen, &gen_arg, &cb_arg, &state);
+    if (!dh || state) {
+	DH_free(gen_arg.dh);
+	if (state) rb_jump_tag(state);
+	return 0;
+    }
+#else
     dh = DH_generate_parameters(size, gen,
 	    rb_block_given_p() ? ossl_generate_cb : NULL,
 	    NULL);
@@ -95,6 +135,7 @@ dh_generate(int size, int gen)
 	DH_free(dh);
 	return 0;
     }
+#endif
 
     return dh;
 }
@@ -152,6 +193,7 @@ ossl_dh_initialize(int argc, VALUE *argv, VALUE self)
     BIO *in;
     VALUE arg, gen;
 
+    rb_check_frozen(self);
     GetPKey(self, pkey);
     if(rb_scan_args(argc, argv, "02", &arg, &gen) == 0) {
       dh = DH_new();
@@ -175,6 +217,7 @@ ossl_dh_initialize(int argc, VALUE *argv, VALUE self)
 	BIO_free(in);
 	if (!dh) ossl_raise(eDHError, NULL);
     }
+    ossl_pkey_wait_idle(pkey->pkey.dh);
     if (!EVP_PKEY_assign_DH(pkey, dh)) {
 	DH_free(dh);
 	ossl_raise(eDHError, NULL);
@@ -373,14 +416,33 @@ ossl_dh_generate_key(VALUE self)
     DH *dh;
     EVP_PKEY *pkey;
 
+    rb_check_frozen(self);
     GetPKeyDH(self, pkey);
     dh = pkey->pkey.dh;
+    ossl_pkey_wait_idle(dh);
 
     if (!DH_generate_key(dh))
 	ossl_raise(eDHError, "Failed to generate key");
     return self;
 }
 
+struct ossl_dh_compute_key_args {
+    unsigned char *key;
+    BIGNUM *pub_key;
+    DH *dh;
+    int ret;
+};
+
+static void *
+ossl_dh_compute_key_func(void *ptr)
+{
+    struct ossl_dh_compute_key_args *args = ptr;
+
+    args->ret = DH_compute_key(args->key, args->pub_key, args->dh);
+
+    return NULL;
+}
+
 /*
  *  call-seq:
  *     dh.compute_key(pub_bn) -> aString
@@ -398,19 +460,24 @@ ossl_dh_compute_key(VALUE self, VALUE pub)
 {
     DH *dh;
     EVP_PKEY *pkey;
-    BIGNUM *pub_key;
+    struct ossl_dh_compute_key_args args;
     VALUE str;
-    int len;
 
     GetPKeyDH(self, pkey);
     dh = pkey->pkey.dh;
-    pub_key = GetBNPtr(pub);
-    len = DH_size(dh);
-    str = rb_str_new(0, len);
-    if ((len = DH_compute_key((unsigned char *)RSTRING_PTR(str), pub_key, dh)) < 0) {
+    str = rb_str_new(0, DH_size(dh));
+    /* a private copy, the BN may be a temporary owned by the GC */
+    if (!(args.pub_key = BN_dup(GetBNPtr(pub)))) {
+	ossl_raise(eDHError, NULL);
+    }
+    args.key = (unsigned char *)RSTRING_PTR(str);
+    args.dh = dh;
+    ossl_pkey_nogvl(dh, ossl_dh_compute_key_func, &args);
+    BN_free(args.pub_key);
+    if (args.ret < 0) {
 	ossl_raise(eDHError, NULL);
     }
-    rb_str_set_len(str, len);
+    rb_str_set_len(str, args.ret);
 
     return str;
 }
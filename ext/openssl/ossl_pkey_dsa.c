@@ -75,6 +75,33 @@ ossl_dsa_new(EVP_PKEY *pkey)
 /*
  * Private
  */
+#if defined(HAVE_DSA_GENERATE_PARAMETERS_EX)
+struct dsa_blocking_gen_arg {
+    DSA *dsa;
+    int size;
+    unsigned char *seed;
+    int seed_len;
+    int *counter;
+    unsigned long *h;
+    BN_GENCB *cb;
+};
+
+static void *
+dsa_blocking_gen(void *arg)
+{
+    struct dsa_blocking_gen_arg *gen = arg;
+
+    if (!DSA_generate_parameters_ex(gen->dsa, gen->size, gen->seed,
+				    gen->seed_len, gen->counter, gen->h,
+				    gen->cb))
+	return NULL;
+    if (!DSA_generate_key(gen->dsa))
+	return NULL;
+
+    return gen->dsa;
+}
+#endif
+
 static DSA *
 dsa_generate(int size)
 {
@@ -82,10 +109,35 @@ dsa_generate(int size)
     unsigned char seed[20];
     int seed_len = 20, counter;
     unsigned long h;
+#if defined(HAVE_DSA_GENERATE_PARAMETERS_EX)
+    BN_GENCB cb;
+    struct ossl_generate_cb_arg cb_arg;
+    struct dsa_blocking_gen_arg gen_arg;
+    int state = 0;
+#endif
 
     if (!RAND_bytes(seed, seed_len)) {
 	return 0;
     }
+#if defined(HAVE_DSA_GENERATE_PARAMETERS_EX)
+    if (!(gen_arg.dsa = DSA_new())) {
+	return 0;
+    }
+    gen_arg.size = size;
+    gen_arg.seed = seed;
+    gen_arg.seed_len = seed_len;
+    gen_arg.counter = &counter;
+    gen_arg.h = &h;
+    gen_arg.cb = &cb;
+    BN_GENCB_set(&cb, ossl_generate_cb_2, &cb_arg);
+
+    dsa = ossl_generate(dsa_blocking_gen, &gen_arg, &cb_arg, &state);
+    if (!dsa || state) {
+	DSA_free(gen_arg.dsa);
+	if (state) rb_jump_tag(state);
+	return 0;
+    }
+#else
     dsa = DSA_generate_parameters(size, seed, seed_len, &counter, &h,
 	    rb_block_given_p() ? ossl_generate_cb : NULL,
 	    NULL);
@@ -95,6 +147,7 @@ dsa_generate(int size)
 	DSA_free(dsa);
 	return 0;
     }
+#endif
 
     return dsa;
 }
@@ -146,6 +199,7 @@ ossl_dsa_initialize(int argc, VALUE *argv, VALUE self)
     char *passwd = NULL;
     VALUE arg, pass;
 
+    rb_check_frozen(self);
     GetPKey(self, pkey);
     if(rb_scan_args(argc, argv, "02", &arg, &pass) == 0) {
         dsa = DSA_new();
@@ -179,6 +233,7 @@ ossl_dsa_initialize(int argc, VALUE *argv, VALUE self)
 	BIO_free(in);
 	if (!dsa) ossl_raise(eDSAError, "Neither PUB key nor PRIV key:");
     }
+    ossl_pkey_wait_idle(pkey->pkey.dsa);
     if (!EVP_PKEY_assign_DSA(pkey, dsa)) {
 	DSA_free(dsa);
 	ossl_raise(eDSAError, NULL);
@@ -378,6 +433,27 @@ ossl_dsa_to_public_key(VALUE self)
 
 #define ossl_dsa_buf_size(pkey) (DSA_size((pkey)->pkey.dsa)+16)
 
+struct ossl_dsa_sign_args {
+    unsigned char *dgst;
+    int dlen;
+    unsigned char *sig;
+    unsigned int siglen;
+    DSA *dsa;
+    int ret;
+};
+
+static void *
+ossl_dsa_sign_func(void *ptr)
+{
+    struct ossl_dsa_sign_args *args = ptr;
+
+    /* type is ignored (0) */
+    args->ret = DSA_sign(0, args->dgst, args->dlen, args->sig,
+			 &args->siglen, args->dsa);
+
+    return NULL;
+}
+
 /*
  *  call-seq:
  *    dsa.syssign(string) -> aString
@@ -387,7 +463,7 @@ static VALUE
 ossl_dsa_sign(VALUE self, VALUE data)
 {
     EVP_PKEY *pkey;
-    unsigned int buf_len;
+    struct ossl_dsa_sign_args args;
     VALUE str;
 
     GetPKeyDSA(self, pkey);
@@ -395,13 +471,18 @@ ossl_dsa_sign(VALUE self, VALUE data)
     if (!DSA_PRIVATE(self, pkey->pkey.dsa)) {
 	ossl_raise(eDSAError, "Private DSA key needed!");
     }
+    data = rb_str_new_frozen(data);
     str = rb_str_new(0, ossl_dsa_buf_size(pkey));
-    if (!DSA_sign(0, (unsigned char *)RSTRING_PTR(data), RSTRING_LEN(data),
-		  (unsigned char *)RSTRING_PTR(str),
-		  &buf_len, pkey->pkey.dsa)) { /* type is ignored (0) */
+    args.dgst = (unsigned char *)RSTRING_PTR(data);
+    args.dlen = RSTRING_LEN(data);
+    args.sig = (unsigned char *)RSTRING_PTR(str);
+    args.dsa = pkey->pkey.dsa;
+    ossl_pkey_nogvl(args.dsa, ossl_dsa_sign_func, &args);
+    if (!args.ret) {
 	ossl_raise(eDSAError, NULL);
     }
-    rb_str_set_len(str, buf_len);
+    rb_str_set_len(str, args.siglen);
+    RB_GC_GUARD(data);
 
     return str;
 }
@@ -453,6 +534,7 @@ Init_ossl_dsa()
     eDSAError = rb_define_class_under(mPKey, "DSAError", ePKeyError);
 
     cDSA = rb_define_class_under(mPKey, "DSA", cPKey);
+    ossl_parse_cache_register(cDSA);
 
     rb_define_singleton_method(cDSA, "generate", ossl_dsa_s_generate, 1);
     rb_define_method(cDSA, "initialize", ossl_dsa_initialize, -1);
@@ -164,6 +164,7 @@ static VALUE ossl_ec_key_initialize(int argc, VALUE *argv, VALUE self)
     VALUE arg, pass;
     VALUE group = Qnil;
 
+    rb_check_frozen(self);
     GetPKey(self, pkey);
     if (pkey->pkey.ec)
         rb_raise(eECError, "EC_KEY already initialized");
@@ -287,8 +288,10 @@ static VALUE ossl_ec_key_set_group(VALUE self, VALUE group_v)
     EC_KEY *ec;
     EC_GROUP *group;
 
+    rb_check_frozen(self);
     Require_EC_KEY(self, ec);
     SafeRequire_EC_GROUP(group_v, group);
+    ossl_pkey_wait_idle(ec);
 
     old_group_v = rb_iv_get(self, "@group");
     if (!NIL_P(old_group_v)) {
@@ -338,9 +341,11 @@ static VALUE ossl_ec_key_set_private_key(VALUE self, VALUE private_key)
     EC_KEY *ec;
     BIGNUM *bn = NULL;
 
+    rb_check_frozen(self);
     Require_EC_KEY(self, ec);
     if (!NIL_P(private_key))
         bn = GetBNPtr(private_key);
+    ossl_pkey_wait_idle(ec);
 
     switch (EC_KEY_set_private_key(ec, bn)) {
     case 1:
@@ -410,9 +415,11 @@ static VALUE ossl_ec_key_set_public_key(VALUE self, VALUE public_key)
     EC_KEY *ec;
     EC_POINT *point = NULL;
 
+    rb_check_frozen(self);
     Require_EC_KEY(self, ec);
     if (!NIL_P(public_key))
         SafeRequire_EC_POINT(public_key, point);
+    ossl_pkey_wait_idle(ec);
 
     switch (EC_KEY_set_public_key(ec, point)) {
     case 1:
@@ -593,7 +600,9 @@ static VALUE ossl_ec_key_generate_key(VALUE self)
 {
     EC_KEY *ec;
 
+    rb_check_frozen(self);
     Require_EC_KEY(self, ec);
+    ossl_pkey_wait_idle(ec);
 
     if (EC_KEY_generate_key(ec) != 1)
 	ossl_raise(eECError, "EC_KEY_generate_key");
@@ -621,6 +630,23 @@ static VALUE ossl_ec_key_check_key(VALUE self)
     return Qtrue;
 }
 
+struct ossl_ec_key_dh_compute_key_args {
+    unsigned char *out;
+    int outlen;
+    EC_POINT *point;
+    EC_KEY *ec;
+    int ret;
+};
+
+static void *ossl_ec_key_dh_compute_key_func(void *ptr)
+{
+    struct ossl_ec_key_dh_compute_key_args *args = ptr;
+
+    args->ret = ECDH_compute_key(args->out, args->outlen, args->point, args->ec, NULL);
+
+    return NULL;
+}
+
 /*
  *  call-seq:
  *     key.dh_compute_key(pubkey)   => String
@@ -631,27 +657,60 @@ static VALUE ossl_ec_key_dh_compute_key(VALUE self, VALUE pubkey)
 {
     EC_KEY *ec;
     EC_POINT *point;
-    int buf_len;
+    struct ossl_ec_key_dh_compute_key_args args;
     VALUE str;
 
     Require_EC_KEY(self, ec);
     SafeRequire_EC_POINT(pubkey, point);
 
 /* BUG: need a way to figure out the maximum string size */
-    buf_len = 1024;
-    str = rb_str_new(0, buf_len);
+    args.outlen = 1024;
+    str = rb_str_new(0, args.outlen);
+    args.out = (unsigned char *)RSTRING_PTR(str);
+    args.ec = ec;
+    /* the point may be modified by other threads, work on a copy */
+    if ((args.point = EC_POINT_dup(point, EC_KEY_get0_group(ec))) == NULL)
+         ossl_raise(eECError, "EC_POINT_dup");
 /* BUG: take KDF as a block */
-    buf_len = ECDH_compute_key(RSTRING_PTR(str), buf_len, point, ec, NULL);
-    if (buf_len < 0)
+    ossl_pkey_nogvl(ec, ossl_ec_key_dh_compute_key_func, &args);
+    EC_POINT_free(args.point);
+    if (args.ret < 0)
          ossl_raise(eECError, "ECDH_compute_key");
 
-    rb_str_resize(str, buf_len);
+    rb_str_resize(str, args.ret);
 
     return str;
 }
 
 /* sign_setup */
 
+struct ossl_ec_key_dsa_args {
+    unsigned char *dgst;
+    int dgstlen;
+    unsigned char *sig;
+    unsigned int siglen;
+    EC_KEY *ec;
+    int ret;
+};
+
+static void *ossl_ec_key_dsa_sign_func(void *ptr)
+{
+    struct ossl_ec_key_dsa_args *args = ptr;
+
+    args->ret = ECDSA_sign(0, args->dgst, args->dgstlen, args->sig, &args->siglen, args->ec);
+
+    return NULL;
+}
+
+static void *ossl_ec_key_dsa_verify_func(void *ptr)
+{
+    struct ossl_ec_key_dsa_args *args = ptr;
+
+    args->ret = ECDSA_verify(0, args->dgst, args->dgstlen, args->sig, args->siglen, args->ec);
+
+    return NULL;
+}
+
 /*
  *  call-seq:
  *     key.dsa_sign_asn1(data)   => String
@@ -661,7 +720,7 @@ static VALUE ossl_ec_key_dh_compute_key(VALUE self, VALUE pubkey)
 static VALUE ossl_ec_key_dsa_sign_asn1(VALUE self, VALUE data)
 {
     EC_KEY *ec;
-    unsigned int buf_len;
+    struct ossl_ec_key_dsa_args args;
     VALUE str;
 
     Require_EC_KEY(self, ec);
@@ -670,11 +729,18 @@ static VALUE ossl_ec_key_dsa_sign_asn1(VALUE self, VALUE data)
     if (EC_KEY_get0_private_key(ec) == NULL)
 	ossl_raise(eECError, "Private EC key needed!");
 
+    data = rb_str_new_frozen(data);
     str = rb_str_new(0, ECDSA_size(ec) + 16);
-    if (ECDSA_sign(0, (unsigned char *) RSTRING_PTR(data), RSTRING_LEN(data), (unsigned char *) RSTRING_PTR(str), &buf_len, ec) != 1)
+    args.dgst = (unsigned char *) RSTRING_PTR(data);
+    args.dgstlen = RSTRING_LEN(data);
+    args.sig = (unsigned char *) RSTRING_PTR(str);
+    args.ec = ec;
+    ossl_pkey_nogvl(ec, ossl_ec_key_dsa_sign_func, &args);
+    if (args.ret != 1)
          ossl_raise(eECError, "ECDSA_sign");
 
-    rb_str_resize(str, buf_len);
+    rb_str_resize(str, args.siglen);
+    RB_GC_GUARD(data);
 
     return str;
 }
@@ -688,12 +754,24 @@ static VALUE ossl_ec_key_dsa_sign_asn1(VALUE self, VALUE data)
 static VALUE ossl_ec_key_dsa_verify_asn1(VALUE self, VALUE data, VALUE sig)
 {
     EC_KEY *ec;
+    struct ossl_ec_key_dsa_args args;
 
     Require_EC_KEY(self, ec);
     StringValue(data);
     StringValue(sig);
 
-    switch (ECDSA_verify(0, (unsigned char *) RSTRING_PTR(data), RSTRING_LEN(data), (unsigned char *) RSTRING_PTR(sig), RSTRING_LEN(sig), ec)) {
+    data = rb_str_new_frozen(data);
+    sig = rb_str_new_frozen(sig);
+    args.dgst = (unsigned char *) RSTRING_PTR(data);
+    args.dgstlen = RSTRING_LEN(data);
+    args.sig = (unsigned char *) RSTRING_PTR(sig);
+    args.siglen = RSTRING_LEN(sig);
+    args.ec = ec;
+    ossl_pkey_nogvl(ec, ossl_ec_key_dsa_verify_func, &args);
+    RB_GC_GUARD(data);
+    RB_GC_GUARD(sig);
+
+    switch (args.ret) {
     case 1:	return Qtrue;
     case 0:	return Qfalse;
     default:	break;
@@ -817,7 +895,7 @@ static VALUE ossl_ec_group_initialize(int argc, VALUE *argv, VALUE self)
                 rb_raise(rb_eArgError, "unknown symbol, must be :GFp or :GF2m");
             }
 
-            if ((group = new_curve(p, a, b, ossl_bn_ctx)) == NULL)
+            if ((group = new_curve(p, a, b, ossl_bn_ctx_get())) == NULL)
                 ossl_raise(eEC_GROUP, "EC_GROUP_new_by_GF*");
         } else {
              rb_raise(rb_eArgError, "unknown argument, must be :GFp or :GF2m");
@@ -847,7 +925,7 @@ static VALUE ossl_ec_group_eql(VALUE a, VALUE b)
     Require_EC_GROUP(a, group1);
     SafeRequire_EC_GROUP(b, group2);
 
-    if (EC_GROUP_cmp(group1, group2, ossl_bn_ctx) == 1)
+    if (EC_GROUP_cmp(group1, group2, ossl_bn_ctx_get()) == 1)
        return Qfalse;
 
     return Qtrue;
@@ -908,7 +986,7 @@ static VALUE ossl_ec_group_get_order(VALUE self)
     bn_obj = ossl_bn_new(NULL);
     bn = GetBNPtr(bn_obj);
 
-    if (EC_GROUP_get_order(group, bn, ossl_bn_ctx) != 1)
+    if (EC_GROUP_get_order(group, bn, ossl_bn_ctx_get()) != 1)
         ossl_raise(eEC_GROUP, "EC_GROUP_get_order");
 
     return bn_obj;
@@ -930,7 +1008,7 @@ static VALUE ossl_ec_group_get_cofactor(VALUE self)
     bn_obj = ossl_bn_new(NULL);
     bn = GetBNPtr(bn_obj);
 
-    if (EC_GROUP_get_cofactor(group, bn, ossl_bn_ctx) != 1)
+    if (EC_GROUP_get_cofactor(group, bn, ossl_bn_ctx_get()) != 1)
         ossl_raise(eEC_GROUP, "EC_GROUP_get_cofactor");
 
     return bn_obj;
@@ -1274,7 +1352,7 @@ static VALUE ossl_ec_point_initialize(int argc, VALUE *argv, VALUE self)
         if (rb_obj_is_kind_of(arg2, cBN)) {
             const BIGNUM *bn = GetBNPtr(arg2);
 
-            point = EC_POINT_bn2point(group, bn, NULL, ossl_bn_ctx);
+            point = EC_POINT_bn2point(group, bn, NULL, ossl_bn_ctx_get());
         } else {
             BIO *in = ossl_obj2bio(arg1);
 
@@ -1323,7 +1401,7 @@ static VALUE ossl_ec_point_eql(VALUE a, VALUE b)
     SafeRequire_EC_POINT(b, point2);
     SafeRequire_EC_GROUP(group_v1, group);
 
-    if (EC_POINT_cmp(group, point1, point2, ossl_bn_ctx) == 1)
+    if (EC_POINT_cmp(group, point1, point2, ossl_bn_ctx_get()) == 1)
         return Qfalse;
 
     return Qtrue;
@@ -1364,7 +1442,7 @@ static VALUE ossl_ec_point_is_on_curve(VALUE self)
     Require_EC_POINT(self, point);
     SafeRequire_EC_GROUP(group_v, group);
 
-    switch (EC_POINT_is_on_curve(group, point, ossl_bn_ctx)) {
+    switch (EC_POINT_is_on_curve(group, point, ossl_bn_ctx_get())) {
     case 1: return Qtrue;
     case 0: return Qfalse;
     default: ossl_raise(cEC_POINT, "EC_POINT_is_on_curve");
@@ -1385,7 +1463,7 @@ static VALUE ossl_ec_point_make_affine(VALUE self)
     Require_EC_POINT(self, point);
     SafeRequire_EC_GROUP(group_v, group);
 
-    if (EC_POINT_make_affine(group, point, ossl_bn_ctx) != 1)
+    if (EC_POINT_make_affine(group, point, ossl_bn_ctx_get()) != 1)
         ossl_raise(cEC_POINT, "EC_POINT_make_affine");
 
     return self;
@@ -1405,7 +1483,7 @@ static VALUE ossl_ec_point_invert(VALUE self)
     Require_EC_POINT(self, point);
     SafeRequire_EC_GROUP(group_v, group);
 
-    if (EC_POINT_invert(group, point, ossl_bn_ctx) != 1)
+    if (EC_POINT_invert(group, point, ossl_bn_ctx_get()) != 1)
         ossl_raise(cEC_POINT, "EC_POINT_invert");
 
     return self;
@@ -1454,7 +1532,7 @@ static VALUE ossl_ec_point_to_bn(VALUE self)
     bn_obj = rb_obj_alloc(cBN);
     bn = GetBNPtr(bn_obj);
 
-    if (EC_POINT_point2bn(group, point, form, bn, ossl_bn_ctx) == NULL)
+    if (EC_POINT_point2bn(group, point, form, bn, ossl_bn_ctx_get()) == NULL)
         ossl_raise(eEC_POINT, "EC_POINT_point2bn");
 
     return bn_obj;
@@ -1478,6 +1556,7 @@ void Init_ossl_ec()
     eECError = rb_define_class_under(mPKey, "ECError", ePKeyError);
 
     cEC = rb_define_class_under(mPKey, "EC", cPKey);
+    ossl_parse_cache_register(cEC);
     cEC_GROUP = rb_define_class_under(cEC, "Group", rb_cObject);
     cEC_POINT = rb_define_class_under(cEC, "Point", rb_cObject);
     eEC_GROUP = rb_define_class_under(cEC_GROUP, "Error", eOSSLError);
@@ -76,12 +76,61 @@ ossl_rsa_new(EVP_PKEY *pkey)
 /*
  * Private
  */
+#if defined(HAVE_RSA_GENERATE_KEY_EX)
+struct rsa_blocking_gen_arg {
+    RSA *rsa;
+    BIGNUM *e;
+    int size;
+    BN_GENCB *cb;
+};
+
+static void *
+rsa_blocking_gen(void *arg)
+{
+    struct rsa_blocking_gen_arg *gen = arg;
+
+    if (!RSA_generate_key_ex(gen->rsa, gen->size, gen->e, gen->cb))
+	return NULL;
+
+    return gen->rsa;
+}
+#endif
+
 static RSA *
 rsa_generate(int size, int exp)
 {
+#if defined(HAVE_RSA_GENERATE_KEY_EX)
+    BN_GENCB cb;
+    struct ossl_generate_cb_arg cb_arg;
+    struct rsa_blocking_gen_arg gen_arg;
+    RSA *rsa;
+    int state = 0;
+
+    gen_arg.rsa = RSA_new();
+    gen_arg.e = BN_new();
+    if (!gen_arg.rsa || !gen_arg.e || !BN_set_word(gen_arg.e, exp)) {
+	if (gen_arg.e) BN_free(gen_arg.e);
+	if (gen_arg.rsa) RSA_free(gen_arg.rsa);
+	return 0;
+    }
+    gen_arg.size = size;
+    gen_arg.cb = &cb;
+    BN_GENCB_set(&cb, ossl_generate_cb_2, &cb_arg);
+
+    rsa = ossl_generate(rsa_blocking_gen, &gen_arg, &cb_arg, &state);
+    BN_free(gen_arg.e);
+    if (!rsa || state) {
+	RSA_free(gen_arg.rsa);
+	if (state) rb_jump_tag(state);
+	return 0;
+    }
+
+    return rsa;
+#else
     return RSA_generate_key(size, exp,
 	    rb_block_given_p() ? ossl_generate_cb : NULL,
 	    NULL);
+#endif
 }
 
 /*
@@ -143,6 +192,7 @@ ossl_rsa_initialize(int argc, VALUE *argv, VALUE self)
     char *passwd = NULL;
     VALUE arg, pass;
 
+    rb_check_frozen(self);
     GetPKey(self, pkey);
     if(rb_scan_args(argc, argv, "02", &arg, &pass) == 0) {
 	rsa = RSA_new();
@@ -179,6 +229,7 @@ ossl_rsa_initialize(int argc, VALUE *argv, VALUE self)
 	BIO_free(in);
 	if (!rsa) ossl_raise(eRSAError, "Neither PUB key nor PRIV key:");
     }
+    ossl_pkey_wait_idle(pkey->pkey.rsa);
     if (!EVP_PKEY_assign_RSA(pkey, rsa)) {
 	RSA_free(rsa);
 	ossl_raise(eRSAError, NULL);
@@ -303,6 +354,49 @@ ossl_rsa_to_der(VALUE self)
 
 #define ossl_rsa_buf_size(pkey) (RSA_size((pkey)->pkey.rsa)+16)
 
+/*
+ * Private key operations are run without the GVL.
+ */
+struct ossl_rsa_crypt_args {
+    int (*func)();
+    int flen;
+    unsigned char *from;
+    unsigned char *to;
+    RSA *rsa;
+    int padding;
+    int ret;
+};
+
+static void *
+ossl_rsa_crypt_func(void *ptr)
+{
+    struct ossl_rsa_crypt_args *args = ptr;
+
+    args->ret = args->func(args->flen, args->from, args->to, args->rsa,
+			   args->padding);
+
+    return NULL;
+}
+
+static int
+ossl_rsa_private_crypt(int (*func)(), VALUE buffer, VALUE str, RSA *rsa, int pad)
+{
+    struct ossl_rsa_crypt_args args;
+
+    /* the input must not change under our feet */
+    buffer = rb_str_new_frozen(buffer);
+    args.func = func;
+    args.flen = RSTRING_LEN(buffer);
+    args.from = (unsigned char *)RSTRING_PTR(buffer);
+    args.to = (unsigned char *)RSTRING_PTR(str);
+    args.rsa = rsa;
+    args.padding = pad;
+    ossl_pkey_nogvl(rsa, ossl_rsa_crypt_func, &args);
+    RB_GC_GUARD(buffer);
+
+    return args.ret;
+}
+
 /*
  * call-seq:
  *   rsa.public_encrypt(string)          => String
@@ -384,9 +478,8 @@ ossl_rsa_private_encrypt(int argc, VALUE *argv, VALUE self)
     pad = (argc == 1) ? RSA_PKCS1_PADDING : NUM2INT(padding);
     StringValue(buffer);
     str = rb_str_new(0, ossl_rsa_buf_size(pkey));
-    buf_len = RSA_private_encrypt(RSTRING_LEN(buffer), (unsigned char *)RSTRING_PTR(buffer),
-				  (unsigned char *)RSTRING_PTR(str), pkey->pkey.rsa,
-				  pad);
+    buf_len = ossl_rsa_private_crypt(RSA_private_encrypt, buffer, str,
+				     pkey->pkey.rsa, pad);
     if (buf_len < 0) ossl_raise(eRSAError, NULL);
     rb_str_set_len(str, buf_len);
 
@@ -416,9 +509,8 @@ ossl_rsa_private_decrypt(int argc, VALUE *argv, VALUE self)
     pad = (argc == 1) ? RSA_PKCS1_PADDING : NUM2INT(padding);
     StringValue(buffer);
     str = rb_str_new(0, ossl_rsa_buf_size(pkey));
-    buf_len = RSA_private_decrypt(RSTRING_LEN(buffer), (unsigned char *)RSTRING_PTR(buffer),
-				  (unsigned char *)RSTRING_PTR(str), pkey->pkey.rsa,
-				  pad);
+    buf_len = ossl_rsa_private_crypt(RSA_private_decrypt, buffer, str,
+				     pkey->pkey.rsa, pad);
     if (buf_len < 0) ossl_raise(eRSAError, NULL);
     rb_str_set_len(str, buf_len);
 
@@ -520,9 +612,11 @@ ossl_rsa_blinding_on(VALUE self)
 {
     EVP_PKEY *pkey;
 
+    rb_check_frozen(self);
     GetPKeyRSA(self, pkey);
+    ossl_pkey_wait_idle(pkey->pkey.rsa);
 
-    if (RSA_blinding_on(pkey->pkey.rsa, ossl_bn_ctx) != 1) {
+    if (RSA_blinding_on(pkey->pkey.rsa, ossl_bn_ctx_get()) != 1) {
 	ossl_raise(eRSAError, NULL);
     }
     return self;
@@ -533,7 +627,9 @@ ossl_rsa_blinding_off(VALUE self)
 {
     EVP_PKEY *pkey;
 
+    rb_check_frozen(self);
     GetPKeyRSA(self, pkey);
+    ossl_pkey_wait_idle(pkey->pkey.rsa);
     RSA_blinding_off(pkey->pkey.rsa);
 
     return self;
@@ -565,6 +661,7 @@ Init_ossl_rsa()
     eRSAError = rb_define_class_under(mPKey, "RSAError", ePKeyError);
 
     cRSA = rb_define_class_under(mPKey, "RSA", cPKey);
+    ossl_parse_cache_register(cRSA);
 
     rb_define_singleton_method(cRSA, "generate", ossl_rsa_s_generate, -1);
     rb_define_method(cRSA, "initialize", ossl_rsa_initialize, -1);
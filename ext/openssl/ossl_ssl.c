@@ -15,6 +15,10 @@
 #if defined(HAVE_UNISTD_H)
 #  include <unistd.h> /* for read(), and write() */
 #endif
+#if defined(HAVE_POLL)
+#  include <poll.h>
+#  include <fcntl.h>
+#endif
 
 #define numberof(ary) (int)(sizeof(ary)/sizeof(ary[0]))
 
@@ -28,6 +32,7 @@ VALUE mSSL;
 VALUE eSSLError;
 VALUE cSSLContext;
 VALUE cSSLSocket;
+VALUE cSSLEngine;
 
 #define ossl_sslctx_set_cert(o,v)        rb_iv_set((o),"@cert",(v))
 #define ossl_sslctx_set_key(o,v)         rb_iv_set((o),"@key",(v))
@@ -67,6 +72,7 @@ static const char *ossl_sslctx_attrs[] = {
     "verify_callback", "options", "cert_store", "extra_chain_cert",
     "client_cert_cb", "tmp_dh_callback", "session_id_context",
     "session_get_cb", "session_new_cb", "session_remove_cb",
+    "shared_session_cache",
 #ifdef HAVE_SSL_SET_TLSEXT_HOST_NAME
     "servername_cb",
 #endif
@@ -95,6 +101,9 @@ static const char *ossl_ssl_attrs[] = {
 };
 
 ID ID_callback_state;
+static ID ID_callback_error;
+
+static VALUE sym_exception, sym_wait_readable, sym_wait_writable;
 
 /*
  * SSLContext class
@@ -124,6 +133,10 @@ int ossl_ssl_ex_store_p;
 int ossl_ssl_ex_ptr_idx;
 int ossl_ssl_ex_client_cert_cb_idx;
 int ossl_ssl_ex_tmp_dh_callback_idx;
+int ossl_ssl_ex_stats_idx;
+#if defined(OSSL_NOGVL_ENABLED)
+int ossl_ssl_ex_lock_idx;
+#endif
 
 static void
 ossl_sslctx_free(SSL_CTX *ctx)
@@ -210,6 +223,17 @@ ossl_sslctx_initialize(int argc, VALUE *argv, VALUE self)
     return self;
 }
 
+/*
+ * Remembers that a callback run for +ssl_obj+ raised; the handshake raises
+ * it again once SSL_accept or SSL_connect returns.
+ */
+static void
+ossl_ssl_callback_failed(VALUE ssl_obj, int state)
+{
+    rb_ivar_set(ssl_obj, ID_callback_state, INT2NUM(state));
+    rb_ivar_set(ssl_obj, ID_callback_error, rb_errinfo());
+}
+
 static VALUE
 ossl_call_client_cert_cb(VALUE obj)
 {
@@ -229,20 +253,47 @@ ossl_call_client_cert_cb(VALUE obj)
     return Qtrue;
 }
 
-static int
-ossl_client_cert_cb(SSL *ssl, X509 **x509, EVP_PKEY **pkey)
+struct ossl_client_cert_cb_args {
+    SSL *ssl;
+    X509 **x509;
+    EVP_PKEY **pkey;
+    int ret;
+};
+
+static void *
+ossl_client_cert_cb0(void *ptr)
 {
+    struct ossl_client_cert_cb_args *args = ptr;
     VALUE obj;
     int status, success;
 
-    obj = (VALUE)SSL_get_ex_data(ssl, ossl_ssl_ex_ptr_idx);
+    obj = (VALUE)SSL_get_ex_data(args->ssl, ossl_ssl_ex_ptr_idx);
     success = rb_protect((VALUE(*)_((VALUE)))ossl_call_client_cert_cb,
                          obj, &status);
-    if (status || !success) return 0;
-    *x509 = DupX509CertPtr(ossl_ssl_get_x509(obj));
-    *pkey = DupPKeyPtr(ossl_ssl_get_key(obj));
+    if (status) {
+	ossl_ssl_callback_failed(obj, status);
+	return NULL;
+    }
+    if (!success) return NULL;
+    *args->x509 = DupX509CertPtr(ossl_ssl_get_x509(obj));
+    *args->pkey = DupPKeyPtr(ossl_ssl_get_key(obj));
+    args->ret = 1;
 
-    return 1;
+    return NULL;
+}
+
+static int
+ossl_client_cert_cb(SSL *ssl, X509 **x509, EVP_PKEY **pkey)
+{
+    struct ossl_client_cert_cb_args args;
+
+    args.ssl = ssl;
+    args.x509 = x509;
+    args.pkey = pkey;
+    args.ret = 0;
+    ossl_with_gvl(ossl_client_cert_cb0, &args);
+
+    return args.ret;
 }
 
 #if !defined(OPENSSL_NO_DH)
@@ -264,27 +315,58 @@ ossl_call_tmp_dh_callback(VALUE *args)
     return Qtrue;
 }
 
-static DH*
-ossl_tmp_dh_callback(SSL *ssl, int is_export, int keylength)
+struct ossl_tmp_dh_callback_args {
+    SSL *ssl;
+    int is_export;
+    int keylength;
+};
+
+static void *
+ossl_tmp_dh_callback0(void *ptr)
 {
+    struct ossl_tmp_dh_callback_args *cb_args = ptr;
     VALUE args[3];
     int status, success;
 
-    args[0] = (VALUE)SSL_get_ex_data(ssl, ossl_ssl_ex_ptr_idx);
-    args[1] = INT2FIX(is_export);
-    args[2] = INT2FIX(keylength);
+    args[0] = (VALUE)SSL_get_ex_data(cb_args->ssl, ossl_ssl_ex_ptr_idx);
+    args[1] = INT2FIX(cb_args->is_export);
+    args[2] = INT2FIX(cb_args->keylength);
     success = rb_protect((VALUE(*)_((VALUE)))ossl_call_tmp_dh_callback,
                          (VALUE)args, &status);
-    if (status || !success) return NULL;
+    if (status) {
+	ossl_ssl_callback_failed(args[0], status);
+	return NULL;
+    }
+    if (!success) return NULL;
 
     return GetPKeyPtr(ossl_ssl_get_tmp_dh(args[0]))->pkey.dh;
 }
 
 static DH*
-ossl_default_tmp_dh_callback(SSL *ssl, int is_export, int keylength)
+ossl_tmp_dh_callback(SSL *ssl, int is_export, int keylength)
+{
+    struct ossl_tmp_dh_callback_args args;
+
+    args.ssl = ssl;
+    args.is_export = is_export;
+    args.keylength = keylength;
+
+    return (DH *)ossl_with_gvl(ossl_tmp_dh_callback0, &args);
+}
+
+static void *
+ossl_default_tmp_dh_warning(void *ptr)
 {
     rb_warning("using default DH parameters.");
 
+    return NULL;
+}
+
+static DH*
+ossl_default_tmp_dh_callback(SSL *ssl, int is_export, int keylength)
+{
+    ossl_with_gvl(ossl_default_tmp_dh_warning, NULL);
+
     switch(keylength){
     case 512:
 	return OSSL_DEFAULT_DH_512;
@@ -295,16 +377,61 @@ ossl_default_tmp_dh_callback(SSL *ssl, int is_export, int keylength)
 }
 #endif /* OPENSSL_NO_DH */
 
+struct ossl_ssl_verify_cb_args {
+    int preverify_ok;
+    X509_STORE_CTX *ctx;
+    int ret;
+};
+
+static VALUE
+ossl_call_ssl_verify_cb(VALUE ptr)
+{
+    struct ossl_ssl_verify_cb_args *args = (struct ossl_ssl_verify_cb_args *)ptr;
+
+    args->ret = ossl_verify_cb(args->preverify_ok, args->ctx);
+
+    return Qnil;
+}
+
+static void *
+ossl_ssl_verify_callback0(void *ptr)
+{
+    struct ossl_ssl_verify_cb_args *args = ptr;
+    SSL *ssl;
+    int state = 0;
+
+    rb_protect(ossl_call_ssl_verify_cb, (VALUE)args, &state);
+    if (state) {
+	ssl = X509_STORE_CTX_get_ex_data(args->ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
+	ossl_ssl_callback_failed((VALUE)SSL_get_ex_data(ssl, ossl_ssl_ex_ptr_idx),
+				 state);
+	args->ret = 0;
+    }
+
+    return NULL;
+}
+
+/*
+ * An exception raised by the verify callback is kept on the SSLSocket like
+ * those of the other callbacks, rather than left to ossl_nogvl(), so that
+ * SSLSocket.accept_many can put it down to the one socket.
+ */
 static int
 ossl_ssl_verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
 {
+    struct ossl_ssl_verify_cb_args args;
     VALUE cb;
     SSL *ssl;
 
     ssl = X509_STORE_CTX_get_ex_data(ctx, SSL_get_ex_data_X509_STORE_CTX_idx());
     cb = (VALUE)SSL_get_ex_data(ssl, ossl_ssl_ex_vcb_idx);
     X509_STORE_CTX_set_ex_data(ctx, ossl_verify_cb_idx, (void*)cb);
-    return ossl_verify_cb(preverify_ok, ctx);
+    args.preverify_ok = preverify_ok;
+    args.ctx = ctx;
+    args.ret = 0;
+    ossl_with_gvl(ossl_ssl_verify_callback0, &args);
+
+    return args.ret;
 }
 
 static VALUE
@@ -323,37 +450,60 @@ ossl_call_session_get_cb(VALUE ary)
     return rb_funcall(cb, rb_intern("call"), 1, ary);
 }
 
-/* this method is currently only called for servers (in OpenSSL <= 0.9.8e) */
-static SSL_SESSION *
-ossl_sslctx_session_get_cb(SSL *ssl, unsigned char *buf, int len, int *copy)
+struct ossl_sslctx_session_cb_args {
+    SSL *ssl;
+    SSL_CTX *ctx;
+    SSL_SESSION *sess;
+    unsigned char *buf;
+    int len;
+    int *copy;
+    int ret;
+};
+
+static void *
+ossl_sslctx_session_get_cb0(void *ptr)
 {
+    struct ossl_sslctx_session_cb_args *args = ptr;
     VALUE ary, ssl_obj, ret_obj;
     SSL_SESSION *sess;
-    void *ptr;
     int state = 0;
 
-    OSSL_Debug("SSL SESSION get callback entered");
-    if ((ptr = SSL_get_ex_data(ssl, ossl_ssl_ex_ptr_idx)) == NULL)
+    if ((ptr = SSL_get_ex_data(args->ssl, ossl_ssl_ex_ptr_idx)) == NULL)
     	return NULL;
     ssl_obj = (VALUE)ptr;
     ary = rb_ary_new2(2);
     rb_ary_push(ary, ssl_obj);
-    rb_ary_push(ary, rb_str_new((const char *)buf, len));
+    rb_ary_push(ary, rb_str_new((const char *)args->buf, args->len));
 
     ret_obj = rb_protect((VALUE(*)_((VALUE)))ossl_call_session_get_cb, ary, &state);
     if (state) {
-        rb_ivar_set(ssl_obj, ID_callback_state, INT2NUM(state));
+        ossl_ssl_callback_failed(ssl_obj, state);
         return NULL;
     }
     if (!rb_obj_is_instance_of(ret_obj, cSSLSession))
         return NULL;
 
     SafeGetSSLSession(ret_obj, sess);
-    *copy = 1;
+    *args->copy = 1;
 
     return sess;
 }
 
+/* this method is currently only called for servers (in OpenSSL <= 0.9.8e) */
+static SSL_SESSION *
+ossl_sslctx_session_get_cb(SSL *ssl, unsigned char *buf, int len, int *copy)
+{
+    struct ossl_sslctx_session_cb_args args;
+
+    OSSL_Debug("SSL SESSION get callback entered");
+    args.ssl = ssl;
+    args.buf = buf;
+    args.len = len;
+    args.copy = copy;
+
+    return (SSL_SESSION *)ossl_with_gvl(ossl_sslctx_session_get_cb0, &args);
+}
+
 static VALUE
 ossl_call_session_new_cb(VALUE ary)
 {
@@ -370,18 +520,18 @@ ossl_call_session_new_cb(VALUE ary)
     return rb_funcall(cb, rb_intern("call"), 1, ary);
 }
 
-/* return 1 normal.  return 0 removes the session */
-static int
-ossl_sslctx_session_new_cb(SSL *ssl, SSL_SESSION *sess)
+static void *
+ossl_sslctx_session_new_cb0(void *ptr)
 {
+    struct ossl_sslctx_session_cb_args *args = ptr;
+    SSL_SESSION *sess = args->sess;
     VALUE ary, ssl_obj, sess_obj, ret_obj;
-    void *ptr;
     int state = 0;
 
-    OSSL_Debug("SSL SESSION new callback entered");
-
-    if ((ptr = SSL_get_ex_data(ssl, ossl_ssl_ex_ptr_idx)) == NULL)
-    	return 1;
+    if ((ptr = SSL_get_ex_data(args->ssl, ossl_ssl_ex_ptr_idx)) == NULL) {
+	args->ret = 1;
+    	return NULL;
+    }
     ssl_obj = (VALUE)ptr;
     sess_obj = rb_obj_alloc(cSSLSession);
     CRYPTO_add(&sess->references, 1, CRYPTO_LOCK_SSL_SESSION);
@@ -393,11 +543,28 @@ ossl_sslctx_session_new_cb(SSL *ssl, SSL_SESSION *sess)
 
     ret_obj = rb_protect((VALUE(*)_((VALUE)))ossl_call_session_new_cb, ary, &state);
     if (state) {
-        rb_ivar_set(ssl_obj, ID_callback_state, INT2NUM(state));
-        return 0; /* what should be returned here??? */
+        ossl_ssl_callback_failed(ssl_obj, state);
+        return NULL; /* what should be returned here??? */
     }
+    args->ret = RTEST(ret_obj) ? 1 : 0;
+
+    return NULL;
+}
+
+/* return 1 normal.  return 0 removes the session */
+static int
+ossl_sslctx_session_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    struct ossl_sslctx_session_cb_args args;
+
+    OSSL_Debug("SSL SESSION new callback entered");
+
+    args.ssl = ssl;
+    args.sess = sess;
+    args.ret = 0;
+    ossl_with_gvl(ossl_sslctx_session_new_cb0, &args);
 
-    return RTEST(ret_obj) ? 1 : 0;
+    return args.ret;
 }
 
 #if 0				/* unused */
@@ -416,17 +583,16 @@ ossl_call_session_remove_cb(VALUE ary)
 }
 #endif
 
-static void
-ossl_sslctx_session_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
+static void *
+ossl_sslctx_session_remove_cb0(void *ptr)
 {
+    struct ossl_sslctx_session_cb_args *args = ptr;
+    SSL_SESSION *sess = args->sess;
     VALUE ary, sslctx_obj, sess_obj, ret_obj;
-    void *ptr;
     int state = 0;
 
-    OSSL_Debug("SSL SESSION remove callback entered");
-
-    if ((ptr = SSL_CTX_get_ex_data(ctx, ossl_ssl_ex_ptr_idx)) == NULL)
-    	return;
+    if ((ptr = SSL_CTX_get_ex_data(args->ctx, ossl_ssl_ex_ptr_idx)) == NULL)
+    	return NULL;
     sslctx_obj = (VALUE)ptr;
     sess_obj = rb_obj_alloc(cSSLSession);
     CRYPTO_add(&sess->references, 1, CRYPTO_LOCK_SSL_SESSION);
@@ -444,6 +610,20 @@ ossl_sslctx_session_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
         rb_ivar_set(sslctx_obj, ID_callback_state, INT2NUM(state));
 */
     }
+
+    return NULL;
+}
+
+static void
+ossl_sslctx_session_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+    struct ossl_sslctx_session_cb_args args;
+
+    OSSL_Debug("SSL SESSION remove callback entered");
+
+    args.ctx = ctx;
+    args.sess = sess;
+    ossl_with_gvl(ossl_sslctx_session_remove_cb0, &args);
 }
 
 static VALUE
@@ -493,31 +673,51 @@ ossl_call_servername_cb(VALUE ary)
     return ret_obj;
 }
 
-static int
-ssl_servername_cb(SSL *ssl, int *ad, void *arg)
+struct ssl_servername_cb_args {
+    SSL *ssl;
+    const char *servername;
+    int ret;
+};
+
+static void *
+ssl_servername_cb0(void *ptr)
 {
+    struct ssl_servername_cb_args *args = ptr;
     VALUE ary, ssl_obj, ret_obj;
-    void *ptr;
     int state = 0;
-    const char *servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
-
-    if (!servername)
-        return SSL_TLSEXT_ERR_OK;
 
-    if ((ptr = SSL_get_ex_data(ssl, ossl_ssl_ex_ptr_idx)) == NULL)
-    	return SSL_TLSEXT_ERR_ALERT_FATAL;
+    if ((ptr = SSL_get_ex_data(args->ssl, ossl_ssl_ex_ptr_idx)) == NULL)
+    	return NULL;
     ssl_obj = (VALUE)ptr;
     ary = rb_ary_new2(2);
     rb_ary_push(ary, ssl_obj);
-    rb_ary_push(ary, rb_str_new2(servername));
+    rb_ary_push(ary, rb_str_new2(args->servername));
 
     ret_obj = rb_protect((VALUE(*)_((VALUE)))ossl_call_servername_cb, ary, &state);
     if (state) {
-        rb_ivar_set(ssl_obj, ID_callback_state, INT2NUM(state));
-        return SSL_TLSEXT_ERR_ALERT_FATAL;
+        ossl_ssl_callback_failed(ssl_obj, state);
+        return NULL;
     }
+    args->ret = SSL_TLSEXT_ERR_OK;
 
-    return SSL_TLSEXT_ERR_OK;
+    return NULL;
+}
+
+static int
+ssl_servername_cb(SSL *ssl, int *ad, void *arg)
+{
+    struct ssl_servername_cb_args args;
+    const char *servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+
+    if (!servername)
+        return SSL_TLSEXT_ERR_OK;
+
+    args.ssl = ssl;
+    args.servername = servername;
+    args.ret = SSL_TLSEXT_ERR_ALERT_FATAL;
+    ossl_with_gvl(ssl_servername_cb0, &args);
+
+    return args.ret;
 }
 #endif
 
@@ -645,17 +845,24 @@ ossl_sslctx_setup(VALUE self)
 	}
     }
 
-    if (RTEST(rb_iv_get(self, "@session_get_cb"))) {
-	SSL_CTX_sess_set_get_cb(ctx, ossl_sslctx_session_get_cb);
-	OSSL_Debug("SSL SESSION get callback added");
-    }
-    if (RTEST(rb_iv_get(self, "@session_new_cb"))) {
-	SSL_CTX_sess_set_new_cb(ctx, ossl_sslctx_session_new_cb);
-	OSSL_Debug("SSL SESSION new callback added");
+    val = rb_iv_get(self, "@shared_session_cache");
+    if (!NIL_P(val)) {
+	ossl_ssl_cache_setup(ctx, val);
+	OSSL_Debug("SSL shared session cache added");
     }
-    if (RTEST(rb_iv_get(self, "@session_remove_cb"))) {
-	SSL_CTX_sess_set_remove_cb(ctx, ossl_sslctx_session_remove_cb);
-	OSSL_Debug("SSL SESSION remove callback added");
+    else {
+	if (RTEST(rb_iv_get(self, "@session_get_cb"))) {
+	    SSL_CTX_sess_set_get_cb(ctx, ossl_sslctx_session_get_cb);
+	    OSSL_Debug("SSL SESSION get callback added");
+	}
+	if (RTEST(rb_iv_get(self, "@session_new_cb"))) {
+	    SSL_CTX_sess_set_new_cb(ctx, ossl_sslctx_session_new_cb);
+	    OSSL_Debug("SSL SESSION new callback added");
+	}
+	if (RTEST(rb_iv_get(self, "@session_remove_cb"))) {
+	    SSL_CTX_sess_set_remove_cb(ctx, ossl_sslctx_session_remove_cb);
+	    OSSL_Debug("SSL SESSION remove callback added");
+	}
     }
 
 #ifdef HAVE_SSL_SET_TLSEXT_HOST_NAME
@@ -897,12 +1104,16 @@ ossl_sslctx_set_session_cache_size(VALUE self, VALUE arg)
  * :connect_renegotiate:: Number of start renegotiations in client mode
  * :timeouts:: Number of sessions proposed by clients that were found in the
  *             cache but had expired due to timeouts
+ *
+ * With a #shared_session_cache, the SessionCache#stats of it are included
+ * as :shared_hits, :shared_misses, :shared_stores, :shared_evictions and
+ * :shared_expired.
  */
 static VALUE
 ossl_sslctx_get_session_cache_stats(VALUE self)
 {
     SSL_CTX *ctx;
-    VALUE hash;
+    VALUE hash, val;
 
     Data_Get_Struct(self, SSL_CTX, ctx);
 
@@ -919,6 +1130,9 @@ ossl_sslctx_get_session_cache_stats(VALUE self)
     rb_hash_aset(hash, ID2SYM(rb_intern("cache_misses")), LONG2NUM(SSL_CTX_sess_misses(ctx)));
     rb_hash_aset(hash, ID2SYM(rb_intern("cache_full")), LONG2NUM(SSL_CTX_sess_cache_full(ctx)));
     rb_hash_aset(hash, ID2SYM(rb_intern("timeouts")), LONG2NUM(SSL_CTX_sess_timeouts(ctx)));
+    val = rb_iv_get(self, "@shared_session_cache");
+    if (!NIL_P(val))
+	ossl_ssl_cache_add_stats(val, hash);
 
     return hash;
 }
@@ -973,6 +1187,83 @@ ossl_ssl_free(SSL *ssl)
     SSL_free(ssl);
 }
 
+/*
+ * Write counters.  +bytes+ counts the plaintext written by SSL_write,
+ * +records+ the application data records that went to the socket and
+ * +syscalls+ every write to the socket, handshake included.  The records
+ * are counted by following their headers through what is written; +hdr+
+ * collects a header split across writes, +left+ is what remains of the
+ * body of the current record.
+ */
+struct ossl_ssl_stats {
+    unsigned long bytes;
+    unsigned long records;
+    unsigned long syscalls;
+    unsigned char hdr[SSL3_RT_HEADER_LENGTH];
+    int hlen;
+    long left;
+};
+
+static void
+ossl_ssl_stats_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+		    int idx, long argl, void *argp)
+{
+    if (ptr) OPENSSL_free(ptr);
+}
+
+static void
+ossl_ssl_stats_scan(struct ossl_ssl_stats *stats, const unsigned char *p,
+		    long len)
+{
+    long n;
+
+    while (len > 0) {
+	if (stats->left > 0) {
+	    n = len < stats->left ? len : stats->left;
+	    stats->left -= n;
+	    p += n;
+	    len -= n;
+	    continue;
+	}
+	stats->hdr[stats->hlen++] = *p++;
+	len--;
+	if (stats->hlen == SSL3_RT_HEADER_LENGTH) {
+	    if (stats->hdr[0] == SSL3_RT_APPLICATION_DATA)
+		stats->records++;
+	    stats->left = stats->hdr[3] << 8 | stats->hdr[4];
+	    stats->hlen = 0;
+	}
+    }
+}
+
+/* runs without the GVL, under the lock of the SSL object */
+static long
+ossl_ssl_bio_cb(BIO *bio, int oper, const char *argp, int argi, long argl,
+		long ret)
+{
+    struct ossl_ssl_stats *stats;
+
+    if (oper == (BIO_CB_WRITE | BIO_CB_RETURN) && ret > 0) {
+	stats = (struct ossl_ssl_stats *)BIO_get_callback_arg(bio);
+	stats->syscalls++;
+	ossl_ssl_stats_scan(stats, (const unsigned char *)argp, ret);
+    }
+
+    return ret;
+}
+
+#if defined(OSSL_NOGVL_ENABLED)
+static void
+ossl_ssl_lock_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+		   int idx, long argl, void *argp)
+{
+    if (ptr) {
+	pthread_mutex_destroy((pthread_mutex_t *)ptr);
+	OPENSSL_free(ptr);
+    }
+}
+#endif
+
 static VALUE
 ossl_ssl_s_alloc(VALUE klass)
 {
@@ -1040,17 +1331,52 @@ ossl_ssl_setup(VALUE self)
         }
         DATA_PTR(self) = ssl;
 
+#if defined(OSSL_NOGVL_ENABLED)
+	{
+	    pthread_mutex_t *lock = OPENSSL_malloc(sizeof(pthread_mutex_t));
+
+	    if (!lock || pthread_mutex_init(lock, NULL) != 0) {
+		if (lock) OPENSSL_free(lock);
+		ossl_raise(eSSLError, "cannot initialize SSL lock");
+	    }
+	    SSL_set_ex_data(ssl, ossl_ssl_ex_lock_idx, lock);
+	}
+#endif
+
 #ifdef HAVE_SSL_SET_TLSEXT_HOST_NAME
         if (!NIL_P(hostname)) {
            if (SSL_set_tlsext_host_name(ssl, StringValuePtr(hostname)) != 1)
                ossl_raise(eSSLError, "SSL_set_tlsext_host_name:");
         }
 #endif
-        io = ossl_ssl_get_io(self);
-        GetOpenFile(io, fptr);
-        rb_io_check_readable(fptr);
-        rb_io_check_writable(fptr);
-        SSL_set_fd(ssl, TO_SOCKET(FPTR_TO_FD(fptr)));
+	if (rb_obj_is_kind_of(self, cSSLEngine)) {
+	    BIO *rbio = BIO_new(BIO_s_mem()), *wbio = BIO_new(BIO_s_mem());
+
+	    if (!rbio || !wbio) {
+		if (rbio) BIO_free(rbio);
+		if (wbio) BIO_free(wbio);
+		ossl_raise(eSSLError, NULL);
+	    }
+	    /* running out of input means "wait for more", not EOF */
+	    BIO_set_mem_eof_return(rbio, -1);
+	    SSL_set_bio(ssl, rbio, wbio);
+	}
+	else {
+	    io = ossl_ssl_get_io(self);
+	    GetOpenFile(io, fptr);
+	    rb_io_check_readable(fptr);
+	    rb_io_check_writable(fptr);
+	    SSL_set_fd(ssl, TO_SOCKET(FPTR_TO_FD(fptr)));
+	}
+	{
+	    struct ossl_ssl_stats *stats = OPENSSL_malloc(sizeof(*stats));
+
+	    if (!stats) ossl_raise(eSSLError, NULL);
+	    memset(stats, 0, sizeof(*stats));
+	    SSL_set_ex_data(ssl, ossl_ssl_ex_stats_idx, stats);
+	    BIO_set_callback(SSL_get_wbio(ssl), ossl_ssl_bio_cb);
+	    BIO_set_callback_arg(SSL_get_wbio(ssl), (char *)stats);
+	}
 	SSL_set_ex_data(ssl, ossl_ssl_ex_ptr_idx, (void*)self);
 	cb = ossl_sslctx_get_verify_cb(v_ctx);
 	SSL_set_ex_data(ssl, ossl_ssl_ex_vcb_idx, (void*)cb);
@@ -1069,6 +1395,72 @@ ossl_ssl_setup(VALUE self)
 #define ssl_get_error(ssl, ret) SSL_get_error(ssl, ret)
 #endif
 
+/*
+ * SSL_read, SSL_write, the handshake and the shutdown are run without the
+ * GVL.  A lock per SSL object keeps threads sharing an SSLSocket from
+ * entering OpenSSL concurrently.  Everything needed afterwards is captured
+ * before the lock is given up.
+ */
+struct ossl_ssl_call {
+    SSL *ssl;
+    int (*func)();
+    void *buf;
+    int len;
+    int ret;
+    int err;
+    int saved_errno;
+};
+
+static void *
+ossl_ssl_call_func(void *ptr)
+{
+    struct ossl_ssl_call *call = ptr;
+#if defined(OSSL_NOGVL_ENABLED)
+    pthread_mutex_t *lock;
+
+    lock = SSL_get_ex_data(call->ssl, ossl_ssl_ex_lock_idx);
+    if (lock) pthread_mutex_lock(lock);
+#endif
+    errno = 0;
+    if (call->buf)
+	call->ret = call->func(call->ssl, call->buf, call->len);
+    else
+	call->ret = call->func(call->ssl);
+    call->err = ssl_get_error(call->ssl, call->ret);
+    call->saved_errno = errno;
+#if defined(OSSL_NOGVL_ENABLED)
+    if (lock) pthread_mutex_unlock(lock);
+#endif
+
+    return NULL;
+}
+
+static int
+ossl_ssl_call(struct ossl_ssl_call *call)
+{
+    ossl_nogvl(ossl_ssl_call_func, call, RUBY_UBF_IO, 0);
+    errno = call->saved_errno;
+
+    return call->err;
+}
+
+/*
+ * SSL_pending, under the lock like everything else another thread may be
+ * doing to +ssl+ without the GVL.
+ */
+static int
+ossl_ssl_locked_pending(SSL *ssl)
+{
+    struct ossl_ssl_call call;
+
+    call.ssl = ssl;
+    call.func = SSL_pending;
+    call.buf = NULL;
+    ossl_ssl_call(&call);
+
+    return call.ret;
+}
+
 static void
 write_would_block(int nonblock)
 {
@@ -1089,20 +1481,83 @@ read_would_block(int nonblock)
     }
 }
 
+/*
+ * The descriptor to wait on.  It is looked up only when there is something
+ * to wait for, which never happens for an SSLEngine.
+ */
+static int
+ossl_ssl_get_fd(VALUE self)
+{
+    rb_io_t *fptr;
+
+    GetOpenFile(ossl_ssl_get_io(self), fptr);
+
+    return FPTR_TO_FD(fptr);
+}
+
+/*
+ * Takes a trailing options Hash off +argv+ and returns whether it holds
+ * :exception => false, in which case the *_nonblock methods return
+ * :wait_readable or :wait_writable rather than raising.
+ */
+static int
+ossl_ssl_no_exception_p(int *argc, VALUE *argv)
+{
+    VALUE opts;
+
+    if (*argc > 0 && TYPE(argv[*argc - 1]) == T_HASH) {
+	opts = argv[--*argc];
+	return rb_hash_aref(opts, sym_exception) == Qfalse;
+    }
+
+    return 0;
+}
+
+/*
+ * Calls +meth+ on the underlying IO while the session isn't started,
+ * passing <tt>:exception => false</tt> on if it was given.
+ */
+static VALUE
+ossl_ssl_io_call(VALUE self, ID meth, int argc, VALUE *argv, int no_exception)
+{
+    VALUE args[3], opts;
+    int i;
+
+    rb_warning("SSL session is not started yet.");
+    for (i = 0; i < argc; i++) args[i] = argv[i];
+    if (no_exception) {
+	opts = rb_hash_new();
+	rb_hash_aset(opts, sym_exception, Qfalse);
+	args[argc++] = opts;
+    }
+
+    return rb_funcall2(ossl_ssl_get_io(self), meth, argc, args);
+}
+
+static VALUE
+ossl_ssl_wait_sym(int ret)
+{
+    return ret == OSSL_SSL_WAIT_WRITABLE ? sym_wait_writable : sym_wait_readable;
+}
+
 static VALUE
-ossl_start_ssl(VALUE self, int (*func)(), const char *funcname, int nonblock)
+ossl_start_ssl(VALUE self, int (*func)(), const char *funcname, int nonblock,
+	       int no_exception)
 {
     SSL *ssl;
-    rb_io_t *fptr;
     int ret, ret2;
     VALUE cb_state;
+    struct ossl_ssl_call call;
 
     rb_ivar_set(self, ID_callback_state, Qnil);
 
     Data_Get_Struct(self, SSL, ssl);
-    GetOpenFile(ossl_ssl_get_io(self), fptr);
+    call.ssl = ssl;
+    call.func = func;
+    call.buf = NULL;
     for(;;){
-	ret = func(ssl);
+	ret2 = ossl_ssl_call(&call);
+	ret = call.ret;
 
         cb_state = rb_ivar_get(self, ID_callback_state);
         if (!NIL_P(cb_state))
@@ -1111,16 +1566,22 @@ ossl_start_ssl(VALUE self, int (*func)(), const char *funcname, int nonblock)
 	if (ret > 0)
 	    break;
 
-	switch((ret2 = ssl_get_error(ssl, ret))){
+	switch(ret2){
 	case SSL_ERROR_WANT_WRITE:
+	    if (no_exception) return sym_wait_writable;
             write_would_block(nonblock);
-            rb_io_wait_writable(FPTR_TO_FD(fptr));
+            rb_io_wait_writable(ossl_ssl_get_fd(self));
             continue;
 	case SSL_ERROR_WANT_READ:
+	    if (no_exception) return sym_wait_readable;
             read_would_block(nonblock);
-            rb_io_wait_readable(FPTR_TO_FD(fptr));
+            rb_io_wait_readable(ossl_ssl_get_fd(self));
             continue;
 	case SSL_ERROR_SYSCALL:
+	    if (errno == EINTR) {
+		rb_thread_check_ints();
+		continue;
+	    }
 	    if (errno) rb_sys_fail(funcname);
 	    ossl_raise(eSSLError, "%s SYSCALL returned=%d errno=%d state=%s", funcname, ret2, errno, SSL_state_string_long(ssl));
 	default:
@@ -1142,14 +1603,17 @@ static VALUE
 ossl_ssl_connect(VALUE self)
 {
     ossl_ssl_setup(self);
-    return ossl_start_ssl(self, SSL_connect, "SSL_connect", 0);
+    return ossl_start_ssl(self, SSL_connect, "SSL_connect", 0, 0);
 }
 
 /*
  * call-seq:
- *    ssl.connect_nonblock => self
+ *    ssl.connect_nonblock([options]) => self
  *
  * Initiates the SSL/TLS handshake as a client in non-blocking manner.
+ * With <tt>:exception => false</tt> in +options+, :wait_readable or
+ * :wait_writable is returned instead of raising when the handshake would
+ * block.
  *
  *   # emulates blocking connect
  *   begin
@@ -1164,10 +1628,13 @@ ossl_ssl_connect(VALUE self)
  *
  */
 static VALUE
-ossl_ssl_connect_nonblock(VALUE self)
+ossl_ssl_connect_nonblock(int argc, VALUE *argv, VALUE self)
 {
+    int no_exception = ossl_ssl_no_exception_p(&argc, argv);
+
+    rb_scan_args(argc, argv, "0");
     ossl_ssl_setup(self);
-    return ossl_start_ssl(self, SSL_connect, "SSL_connect", 1);
+    return ossl_start_ssl(self, SSL_connect, "SSL_connect", 1, no_exception);
 }
 
 /*
@@ -1181,14 +1648,15 @@ static VALUE
 ossl_ssl_accept(VALUE self)
 {
     ossl_ssl_setup(self);
-    return ossl_start_ssl(self, SSL_accept, "SSL_accept", 0);
+    return ossl_start_ssl(self, SSL_accept, "SSL_accept", 0, 0);
 }
 
 /*
  * call-seq:
- *    ssl.accept_nonblock => self
+ *    ssl.accept_nonblock([options]) => self
  *
  * Initiates the SSL/TLS handshake as a server in non-blocking manner.
+ * +options+ are as for #connect_nonblock.
  *
  *   # emulates blocking accept
  *   begin
@@ -1203,93 +1671,484 @@ ossl_ssl_accept(VALUE self)
  *
  */
 static VALUE
-ossl_ssl_accept_nonblock(VALUE self)
+ossl_ssl_accept_nonblock(int argc, VALUE *argv, VALUE self)
 {
+    int no_exception = ossl_ssl_no_exception_p(&argc, argv);
+
+    rb_scan_args(argc, argv, "0");
     ossl_ssl_setup(self);
-    return ossl_start_ssl(self, SSL_accept, "SSL_accept", 1);
+    return ossl_start_ssl(self, SSL_accept, "SSL_accept", 1, no_exception);
 }
 
-static VALUE
-ossl_ssl_read_internal(int argc, VALUE *argv, VALUE self, int nonblock)
-{
-    SSL *ssl;
-    int ilen, nread = 0;
-    VALUE len, str;
-    rb_io_t *fptr;
+#if defined(HAVE_POLL)
+/*
+ * One socket of SSLSocket.accept_many.  +ready+ says whether SSL_accept is
+ * to be run in this round; +events+ is what it waits for otherwise.
+ * +flags+ are the file status flags to put back on +fd+, or -1.
+ */
+struct ossl_ssl_accept_entry {
+    VALUE self;
+    struct ossl_ssl_call call;
+    int fd;
+    int flags;
+    short events;
+    int ready;
+    unsigned long errcode;
+};
 
-    rb_scan_args(argc, argv, "11", &len, &str);
-    ilen = NUM2INT(len);
-    if(NIL_P(str)) str = rb_str_new(0, ilen);
-    else{
-        StringValue(str);
-        rb_str_modify(str);
-        rb_str_resize(str, ilen);
+struct ossl_ssl_accept_round {
+    struct ossl_ssl_accept_entry *ents;
+    struct pollfd *pfds;
+    long num;
+    int timeout;
+    int nready;
+};
+
+/*
+ * Polls the sockets that are waiting, if any, and advances every socket
+ * that is ready.  Runs without the GVL, once per round.
+ */
+static void *
+ossl_ssl_accept_round_func(void *ptr)
+{
+    struct ossl_ssl_accept_round *round = ptr;
+    struct ossl_ssl_accept_entry *e;
+    long i, n;
+    int retry = 0;
+
+    for (i = n = 0; i < round->num; i++) {
+	e = &round->ents[i];
+	if (e->ready) retry = 1;
+	if (!e->events) continue;
+	round->pfds[n].fd = e->fd;
+	round->pfds[n].events = e->events;
+	round->pfds[n].revents = 0;
+	n++;
+    }
+    if (n > 0) {
+	/* those interrupted last round go again without waiting */
+	if (poll(round->pfds, n, retry ? 0 : round->timeout) < 0)
+	    return NULL;
+	for (i = n = 0; i < round->num; i++) {
+	    e = &round->ents[i];
+	    if (!e->events) continue;
+	    e->ready = round->pfds[n++].revents != 0;
+	}
+    }
+    for (i = 0; i < round->num; i++) {
+	e = &round->ents[i];
+	if (!e->ready) continue;
+	ossl_ssl_call_func(&e->call);
+	e->errcode = ERR_get_error();
+	ERR_clear_error();
+	round->nready++;
     }
-    if(ilen == 0) return str;
 
-    Data_Get_Struct(self, SSL, ssl);
-    GetOpenFile(ossl_ssl_get_io(self), fptr);
-    if (ssl) {
-	if(!nonblock && SSL_pending(ssl) <= 0)
-	    rb_thread_wait_fd(FPTR_TO_FD(fptr));
-	for (;;){
-	    nread = SSL_read(ssl, RSTRING_PTR(str), RSTRING_LEN(str));
-	    switch(ssl_get_error(ssl, nread)){
+    return NULL;
+}
+
+static VALUE
+ossl_ssl_accept_many_free(VALUE ptr)
+{
+    struct ossl_ssl_accept_round *round = (struct ossl_ssl_accept_round *)ptr;
+    struct ossl_ssl_accept_entry *e;
+    long i;
+
+    for (i = 0; i < round->num; i++) {
+	e = &round->ents[i];
+	if (e->flags != -1)
+	    fcntl(e->fd, F_SETFL, e->flags);
+    }
+    xfree(round->ents);
+    xfree(round->pfds);
+
+    return Qnil;
+}
+
+static VALUE
+ossl_ssl_accept_many_error(struct ossl_ssl_accept_entry *e)
+{
+    SSL *ssl = e->call.ssl;
+
+    if (e->call.err == SSL_ERROR_SYSCALL)
+	return rb_exc_new3(eSSLError,
+	    rb_sprintf("SSL_accept SYSCALL returned=%d errno=%d state=%s",
+		       e->call.ret, e->call.saved_errno,
+		       SSL_state_string_long(ssl)));
+    return rb_exc_new3(eSSLError,
+	rb_sprintf("SSL_accept returned=%d errno=%d state=%s: %s",
+		   e->call.ret, e->call.saved_errno,
+		   SSL_state_string_long(ssl),
+		   e->errcode ? ERR_reason_error_string(e->errcode) : ""));
+}
+
+static VALUE
+ossl_ssl_accept_many_loop(VALUE ptr)
+{
+    struct ossl_ssl_accept_round *round = (struct ossl_ssl_accept_round *)ptr;
+    struct ossl_ssl_accept_entry *e;
+    struct timeval limit, now;
+    VALUE done = rb_ary_new(), failed = rb_hash_new(), cb_state, err;
+    long i;
+    int flags;
+
+    for (i = 0; i < round->num; i++) {
+	e = &round->ents[i];
+	OSSL_Check_Kind(e->self, cSSLSocket);
+	ossl_ssl_setup(e->self);
+	rb_ivar_set(e->self, ID_callback_state, Qnil);
+	rb_ivar_set(e->self, ID_callback_error, Qnil);
+	Data_Get_Struct(e->self, SSL, e->call.ssl);
+	e->call.func = SSL_accept;
+	e->call.buf = NULL;
+	e->fd = ossl_ssl_get_fd(e->self);
+	/* SSL_accept must not wait on one client while others are ready */
+	if ((flags = fcntl(e->fd, F_GETFL)) == -1)
+	    rb_sys_fail("fcntl");
+	if (!(flags & O_NONBLOCK)) {
+	    if (fcntl(e->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		rb_sys_fail("fcntl");
+	    e->flags = flags;
+	}
+	/* wait for what an earlier call stopped on; a fresh one reads */
+	e->events = SSL_want_write(e->call.ssl) ? POLLOUT : POLLIN;
+    }
+    if (round->timeout >= 0) {
+	gettimeofday(&limit, NULL);
+	limit.tv_sec += round->timeout / 1000;
+	limit.tv_usec += (round->timeout % 1000) * 1000;
+    }
+    round->pfds = ALLOC_N(struct pollfd, round->num);
+    for (;;) {
+	round->nready = 0;
+	ossl_nogvl(ossl_ssl_accept_round_func, round, RUBY_UBF_IO, 0);
+	for (i = 0; i < round->num; i++) {
+	    e = &round->ents[i];
+	    if (!e->ready) continue;
+	    e->ready = 0;
+	    cb_state = rb_ivar_get(e->self, ID_callback_state);
+	    if (!NIL_P(cb_state)) {
+		/* a raising callback fails its own socket only */
+		err = rb_ivar_get(e->self, ID_callback_error);
+		if (!rb_obj_is_kind_of(err, rb_eException))
+		    rb_jump_tag(NUM2INT(cb_state));
+		rb_hash_aset(failed, e->self, err);
+		e->events = 0;
+		continue;
+	    }
+	    switch (e->call.ret > 0 ? SSL_ERROR_NONE : e->call.err) {
 	    case SSL_ERROR_NONE:
-		goto end;
-	    case SSL_ERROR_ZERO_RETURN:
-		rb_eof_error();
-	    case SSL_ERROR_WANT_WRITE:
-                write_would_block(nonblock);
-                rb_io_wait_writable(FPTR_TO_FD(fptr));
-                continue;
+		rb_ary_push(done, e->self);
+		e->events = 0;
+		break;
 	    case SSL_ERROR_WANT_READ:
-                read_would_block(nonblock);
-                rb_io_wait_readable(FPTR_TO_FD(fptr));
-		continue;
+		e->events = POLLIN;
+		break;
+	    case SSL_ERROR_WANT_WRITE:
+		e->events = POLLOUT;
+		break;
 	    case SSL_ERROR_SYSCALL:
-		if(ERR_peek_error() == 0 && nread == 0) rb_eof_error();
-		rb_sys_fail(0);
+		if (e->call.saved_errno == EINTR) {
+		    e->ready = 1;
+		    e->events = 0;
+		    break;
+		}
+		/* fall through */
 	    default:
-		ossl_raise(eSSLError, "SSL_read:");
+		rb_hash_aset(failed, e->self, ossl_ssl_accept_many_error(e));
+		e->events = 0;
+		break;
 	    }
-        }
+	}
+	if (RARRAY_LEN(done) > 0 || RHASH_SIZE(failed) > 0)
+	    break;
+	rb_thread_check_ints();
+	if (round->timeout >= 0) {
+	    gettimeofday(&now, NULL);
+	    round->timeout = (limit.tv_sec - now.tv_sec) * 1000 +
+		(limit.tv_usec - now.tv_usec) / 1000;
+	    if (round->timeout <= 0) break;
+	}
+    }
+
+    return rb_assoc_new(done, failed);
+}
+
+/*
+ * call-seq:
+ *    SSLSocket.accept_many(sockets [, timeout]) => [done, failed]
+ *
+ * Performs the server side handshake of all +sockets+ at once.  Each round
+ * waits on every socket with a single poll(2), and the handshakes that can
+ * make progress are advanced without giving the GVL back in between, so
+ * one thread can keep up with a burst of clients no matter how slow some
+ * of them are.  The sockets are in non-blocking mode for the duration of
+ * the call, and a callback of the SSLContext that raises fails only the
+ * socket it was called for.
+ *
+ * Returns as soon as at least one handshake completes or fails, or when
+ * +timeout+ seconds have passed.  +done+ is the Array of sockets that are
+ * ready for use, and +failed+ is a Hash mapping the others that ended to
+ * their SSLError, or to what the callback raised.  Sockets in neither are still handshaking and can be
+ * passed in again:
+ *
+ *   until pending.empty?
+ *     done, failed = OpenSSL::SSL::SSLSocket.accept_many(pending, 1)
+ *     done.each {|ssl| handle(ssl) }
+ *     failed.each_key {|ssl| ssl.close }
+ *     pending -= done + failed.keys
+ *   end
+ */
+static VALUE
+ossl_ssl_s_accept_many(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE sockets, timeout, ret;
+    struct ossl_ssl_accept_round round;
+    struct ossl_ssl_accept_entry *e;
+    struct timeval tv;
+    long i;
+
+    rb_scan_args(argc, argv, "11", &sockets, &timeout);
+    Check_Type(sockets, T_ARRAY);
+    round.num = RARRAY_LEN(sockets);
+    if (round.num == 0)
+	return rb_assoc_new(rb_ary_new(), rb_hash_new());
+    round.timeout = -1;
+    if (!NIL_P(timeout)) {
+	tv = rb_time_interval(timeout);
+	round.timeout = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+    round.pfds = NULL;
+    round.ents = ALLOC_N(struct ossl_ssl_accept_entry, round.num);
+    /* the entries don't mark the sockets; this copy keeps them alive */
+    sockets = rb_ary_dup(sockets);
+    for (i = 0; i < round.num; i++) {
+	e = &round.ents[i];
+	e->self = RARRAY_PTR(sockets)[i];
+	e->fd = -1;
+	e->flags = -1;
+	e->ready = 0;
+	e->events = 0;
+    }
+
+    ret = rb_ensure(ossl_ssl_accept_many_loop, (VALUE)&round,
+		    ossl_ssl_accept_many_free, (VALUE)&round);
+    RB_GC_GUARD(sockets);
+
+    return ret;
+}
+#endif
+
+/*
+ * Reads at most +len+ bytes into +buf+ and returns the number of bytes read,
+ * or 0 at EOF.  +buf+ must neither move nor be freed until this returns,
+ * since SSL_read writes into it without the GVL.  With +no_exception+,
+ * OSSL_SSL_WAIT_READABLE or OSSL_SSL_WAIT_WRITABLE is returned where a
+ * non-blocking read would raise.
+ */
+int
+ossl_ssl_read_raw(VALUE self, char *buf, int len, int nonblock,
+		  int no_exception)
+{
+    SSL *ssl;
+    struct ossl_ssl_call call;
+
+    Data_Get_Struct(self, SSL, ssl);
+    if(!nonblock && ossl_ssl_locked_pending(ssl) <= 0)
+	rb_thread_wait_fd(ossl_ssl_get_fd(self));
+    call.ssl = ssl;
+    call.func = SSL_read;
+    call.buf = buf;
+    call.len = len;
+    for (;;){
+	switch(ossl_ssl_call(&call)){
+	case SSL_ERROR_NONE:
+	    return call.ret;
+	case SSL_ERROR_ZERO_RETURN:
+	    return 0;
+	case SSL_ERROR_WANT_WRITE:
+	    if (no_exception) return OSSL_SSL_WAIT_WRITABLE;
+	    write_would_block(nonblock);
+	    rb_io_wait_writable(ossl_ssl_get_fd(self));
+	    continue;
+	case SSL_ERROR_WANT_READ:
+	    if (no_exception) return OSSL_SSL_WAIT_READABLE;
+	    read_would_block(nonblock);
+	    rb_io_wait_readable(ossl_ssl_get_fd(self));
+	    continue;
+	case SSL_ERROR_SYSCALL:
+	    if(ERR_peek_error() == 0 && call.ret == 0) return 0;
+	    if (errno == EINTR) {
+		rb_thread_check_ints();
+		continue;
+	    }
+	    rb_sys_fail(0);
+	default:
+	    ossl_raise(eSSLError, "SSL_read:");
+	}
+    }
+}
+
+/*
+ * Writes at most +len+ bytes from +buf+ and returns the number of bytes
+ * written.  The same rules as for ossl_ssl_read_raw apply to +buf+ and
+ * +no_exception+.
+ */
+int
+ossl_ssl_write_raw(VALUE self, const char *buf, int len, int nonblock,
+		   int no_exception)
+{
+    SSL *ssl;
+    struct ossl_ssl_call call;
+    struct ossl_ssl_stats *stats;
+
+    Data_Get_Struct(self, SSL, ssl);
+    call.ssl = ssl;
+    call.func = SSL_write;
+    call.buf = (void *)buf;
+    call.len = len;
+    for (;;){
+	switch(ossl_ssl_call(&call)){
+	case SSL_ERROR_NONE:
+	    stats = SSL_get_ex_data(ssl, ossl_ssl_ex_stats_idx);
+	    if (stats) stats->bytes += call.ret;
+	    return call.ret;
+	case SSL_ERROR_WANT_WRITE:
+	    if (no_exception) return OSSL_SSL_WAIT_WRITABLE;
+	    write_would_block(nonblock);
+	    rb_io_wait_writable(ossl_ssl_get_fd(self));
+	    continue;
+	case SSL_ERROR_WANT_READ:
+	    if (no_exception) return OSSL_SSL_WAIT_READABLE;
+	    read_would_block(nonblock);
+	    rb_io_wait_readable(ossl_ssl_get_fd(self));
+	    continue;
+	case SSL_ERROR_SYSCALL:
+	    if (errno == EINTR) {
+		rb_thread_check_ints();
+		continue;
+	    }
+	    if (errno) rb_sys_fail(0);
+	default:
+	    ossl_raise(eSSLError, "SSL_write:");
+	}
+    }
+}
+
+struct ossl_ssl_read_args {
+    VALUE self;
+    char *ptr;
+    int len;
+    int nonblock;
+    int no_exception;
+};
+
+/*
+ * The buffer is locked while SSL_read writes into it without the GVL, so
+ * other threads can neither resize nor free it meanwhile.
+ */
+static VALUE
+ossl_ssl_read_locked(VALUE ptr)
+{
+    struct ossl_ssl_read_args *args = (struct ossl_ssl_read_args *)ptr;
+    int nread;
+
+    nread = ossl_ssl_read_raw(args->self, args->ptr, args->len,
+			      args->nonblock, args->no_exception);
+    if (nread < 0) return ossl_ssl_wait_sym(nread);
+    if (nread == 0) {
+	if (args->no_exception) return Qnil;
+	rb_eof_error();
+    }
+
+    return INT2NUM(nread);
+}
+
+static VALUE
+ossl_ssl_read_internal(int argc, VALUE *argv, VALUE self, int nonblock,
+		       int no_exception)
+{
+    SSL *ssl;
+    int ilen, nread = 0;
+    long offset;
+    VALUE len, str, off, tmp, ret;
+    struct ossl_ssl_read_args args;
+
+    rb_scan_args(argc, argv, "12", &len, &str, &off);
+    ilen = NUM2INT(len);
+    offset = NIL_P(off) ? 0 : NUM2LONG(off);
+    if(NIL_P(str)) {
+	if (offset != 0)
+	    rb_raise(rb_eArgError, "offset given without a buffer");
+	str = rb_str_new(0, 0);
+    }
+    args.ptr = ossl_str_reserve(str, offset, ilen);
+    if(ilen == 0) {
+	rb_str_set_len(str, offset);
+	return str;
+    }
+
+    Data_Get_Struct(self, SSL, ssl);
+    if (ssl) {
+	args.self = self;
+	args.len = ilen;
+	args.nonblock = nonblock;
+	args.no_exception = no_exception;
+	rb_str_locktmp(str);
+	ret = rb_ensure(ossl_ssl_read_locked, (VALUE)&args,
+			rb_str_unlocktmp, str);
+	if (!FIXNUM_P(ret)) return ret;
+	nread = FIX2INT(ret);
     }
     else {
         ID meth = nonblock ? rb_intern("read_nonblock") : rb_intern("sysread");
-        rb_warning("SSL session is not started yet.");
-        return rb_funcall(ossl_ssl_get_io(self), meth, 2, len, str);
+	VALUE args[2];
+
+	args[0] = len;
+	args[1] = str;
+        if (NIL_P(off))
+	    return ossl_ssl_io_call(self, meth, 2, args, no_exception);
+	tmp = ossl_ssl_io_call(self, meth, 1, args, no_exception);
+	/* :wait_readable or nil at EOF */
+	if (TYPE(tmp) != T_STRING) return tmp;
+	nread = RSTRING_LEN(tmp);
+	memcpy(ossl_str_reserve(str, offset, nread), RSTRING_PTR(tmp), nread);
     }
 
-  end:
-    rb_str_set_len(str, nread);
+    rb_str_set_len(str, offset + nread);
     OBJ_TAINT(str);
 
     return str;
 }
 
-
 /*
  * call-seq:
  *    ssl.sysread(length) => string
  *    ssl.sysread(length, buffer) => buffer
+ *    ssl.sysread(length, buffer, offset) => buffer
  *
  * Reads +length+ bytes from the SSL connection.  If a pre-allocated +buffer+
- * is provided the data will be written into it.
+ * is provided the data will be written into it.  With an +offset+ the data
+ * is placed there and what precedes it is kept; pass buffer.bytesize to
+ * append.  The buffer only grows, so reusing it for a stream doesn't
+ * reallocate once it is large enough.
  */
 static VALUE
 ossl_ssl_read(int argc, VALUE *argv, VALUE self)
 {
-    return ossl_ssl_read_internal(argc, argv, self, 0);
+    return ossl_ssl_read_internal(argc, argv, self, 0, 0);
 }
 
 /*
  * call-seq:
  *    ssl.sysread_nonblock(length) => string
  *    ssl.sysread_nonblock(length, buffer) => buffer
+ *    ssl.sysread_nonblock(length, buffer, offset) => buffer
+ *    ssl.sysread_nonblock(..., :exception => false) => buffer, symbol or nil
  *
  * A non-blocking version of #sysread.  Raises an SSLError if reading would
- * block.
+ * block, or returns :wait_readable or :wait_writable with
+ * <tt>:exception => false</tt>; EOF then gives nil instead of EOFError.
  *
  * Reads +length+ bytes from the SSL connection.  If a pre-allocated +buffer+
  * is provided the data will be written into it.
@@ -1297,48 +2156,34 @@ ossl_ssl_read(int argc, VALUE *argv, VALUE self)
 static VALUE
 ossl_ssl_read_nonblock(int argc, VALUE *argv, VALUE self)
 {
-    return ossl_ssl_read_internal(argc, argv, self, 1);
+    int no_exception = ossl_ssl_no_exception_p(&argc, argv);
+
+    return ossl_ssl_read_internal(argc, argv, self, 1, no_exception);
 }
 
 static VALUE
-ossl_ssl_write_internal(VALUE self, VALUE str, int nonblock)
+ossl_ssl_write_internal(VALUE self, VALUE str, int nonblock, int no_exception)
 {
     SSL *ssl;
-    int nwrite = 0;
-    rb_io_t *fptr;
+    int nwrite;
 
     StringValue(str);
     Data_Get_Struct(self, SSL, ssl);
-    GetOpenFile(ossl_ssl_get_io(self), fptr);
 
     if (ssl) {
-	for (;;){
-	    nwrite = SSL_write(ssl, RSTRING_PTR(str), RSTRING_LEN(str));
-	    switch(ssl_get_error(ssl, nwrite)){
-	    case SSL_ERROR_NONE:
-		goto end;
-	    case SSL_ERROR_WANT_WRITE:
-                write_would_block(nonblock);
-                rb_io_wait_writable(FPTR_TO_FD(fptr));
-                continue;
-	    case SSL_ERROR_WANT_READ:
-                read_would_block(nonblock);
-                rb_io_wait_readable(FPTR_TO_FD(fptr));
-                continue;
-	    case SSL_ERROR_SYSCALL:
-		if (errno) rb_sys_fail(0);
-	    default:
-		ossl_raise(eSSLError, "SSL_write:");
-	    }
-        }
+	/* a frozen copy shares the buffer but can't be modified meanwhile */
+	str = rb_str_new_frozen(str);
+	nwrite = ossl_ssl_write_raw(self, RSTRING_PTR(str), RSTRING_LEN(str),
+				    nonblock, no_exception);
+	RB_GC_GUARD(str);
+	if (nwrite < 0) return ossl_ssl_wait_sym(nwrite);
     }
     else {
-        ID id_syswrite = rb_intern("syswrite");
-        rb_warning("SSL session is not started yet.");
-	return rb_funcall(ossl_ssl_get_io(self), id_syswrite, 1, str);
+        ID meth = nonblock ? rb_intern("write_nonblock") : rb_intern("syswrite");
+
+	return ossl_ssl_io_call(self, meth, 1, &str, no_exception);
     }
 
-  end:
     return INT2NUM(nwrite);
 }
 
@@ -1351,20 +2196,197 @@ ossl_ssl_write_internal(VALUE self, VALUE str, int nonblock)
 static VALUE
 ossl_ssl_write(VALUE self, VALUE str)
 {
-    return ossl_ssl_write_internal(self, str, 0);
+    return ossl_ssl_write_internal(self, str, 0, 0);
 }
 
 /*
  * call-seq:
  *    ssl.syswrite_nonblock(string) => Integer
+ *    ssl.syswrite_nonblock(string, :exception => false) => Integer or symbol
  *
  * Writes +string+ to the SSL connection in a non-blocking manner.  Raises an
- * SSLError if writing would block.
+ * SSLError if writing would block, or returns :wait_readable or
+ * :wait_writable with <tt>:exception => false</tt>.
+ */
+static VALUE
+ossl_ssl_write_nonblock(int argc, VALUE *argv, VALUE self)
+{
+    int no_exception = ossl_ssl_no_exception_p(&argc, argv);
+    VALUE str;
+
+    rb_scan_args(argc, argv, "1", &str);
+    return ossl_ssl_write_internal(self, str, 1, no_exception);
+}
+
+/*
+ * Writes +len+ bytes, going round again if SSL_write was partial.
+ */
+static void
+ossl_ssl_write_all(VALUE self, const char *ptr, long len)
+{
+    int n;
+
+    while (len > 0) {
+	n = ossl_ssl_write_raw(self, ptr, len > INT_MAX ? INT_MAX : (int)len,
+			       0, 0);
+	ptr += n;
+	len -= n;
+    }
+}
+
+/*
+ * call-seq:
+ *    ssl.syswritev(string, ...) => Integer
+ *
+ * Writes all the given strings to the SSL connection as if they were one.
+ * The pieces are gathered into full TLS records instead of each ending in
+ * a record of its own.  Returns the total number of bytes written.
+ */
+static VALUE
+ossl_ssl_writev(int argc, VALUE *argv, VALUE self)
+{
+    SSL *ssl;
+    VALUE strs, str, rec;
+    const char *ptr;
+    long len, fill = 0, total = 0, n;
+    int i;
+
+    /* frozen copies so the strings can't change while they are written */
+    strs = rb_ary_new2(argc);
+    for (i = 0; i < argc; i++) {
+	str = argv[i];
+	StringValue(str);
+	rb_ary_push(strs, rb_str_new_frozen(str));
+	total += RSTRING_LEN(str);
+    }
+
+    Data_Get_Struct(self, SSL, ssl);
+    if (!ssl) {
+        rb_warning("SSL session is not started yet.");
+	return rb_funcall(ossl_ssl_get_io(self), rb_intern("syswrite"), 1,
+			  rb_ary_join(strs, rb_str_new(0, 0)));
+    }
+
+    rec = rb_str_new(0, SSL3_RT_MAX_PLAIN_LENGTH);
+    for (i = 0; i < argc; i++) {
+	str = RARRAY_PTR(strs)[i];
+	ptr = RSTRING_PTR(str);
+	len = RSTRING_LEN(str);
+	while (len > 0) {
+	    if (fill == 0 && len >= SSL3_RT_MAX_PLAIN_LENGTH) {
+		/* whole records can go out straight from the string */
+		n = len - len % SSL3_RT_MAX_PLAIN_LENGTH;
+		ossl_ssl_write_all(self, ptr, n);
+	    }
+	    else {
+		n = SSL3_RT_MAX_PLAIN_LENGTH - fill;
+		if (n > len) n = len;
+		memcpy(RSTRING_PTR(rec) + fill, ptr, n);
+		fill += n;
+		if (fill == SSL3_RT_MAX_PLAIN_LENGTH) {
+		    ossl_ssl_write_all(self, RSTRING_PTR(rec), fill);
+		    fill = 0;
+		}
+	    }
+	    ptr += n;
+	    len -= n;
+	}
+    }
+    if (fill > 0)
+	ossl_ssl_write_all(self, RSTRING_PTR(rec), fill);
+    RB_GC_GUARD(strs);
+    RB_GC_GUARD(rec);
+
+    return LONG2NUM(total);
+}
+
+/*
+ * call-seq:
+ *    ssl.write_stats => hash
+ *
+ * Returns counters of what has been written so far: the number of
+ * plaintext bytes (:bytes), of application data records (:records) and of
+ * writes to the underlying socket (:syscalls), handshake included.
+ */
+static VALUE
+ossl_ssl_get_write_stats(VALUE self)
+{
+    SSL *ssl;
+    struct ossl_ssl_stats *stats = NULL;
+    VALUE hash;
+
+    Data_Get_Struct(self, SSL, ssl);
+    if (ssl)
+	stats = SSL_get_ex_data(ssl, ossl_ssl_ex_stats_idx);
+    hash = rb_hash_new();
+    rb_hash_aset(hash, ID2SYM(rb_intern("bytes")),
+		 ULONG2NUM(stats ? stats->bytes : 0));
+    rb_hash_aset(hash, ID2SYM(rb_intern("records")),
+		 ULONG2NUM(stats ? stats->records : 0));
+    rb_hash_aset(hash, ID2SYM(rb_intern("syscalls")),
+		 ULONG2NUM(stats ? stats->syscalls : 0));
+
+    return hash;
+}
+
+static int
+ossl_ssl_shutdown0(SSL *ssl)
+{
+    ossl_ssl_shutdown(ssl);
+
+    return 1;
+}
+
+/*
+ * call-seq:
+ *    ssl.shutdown_nonblock([options]) => true or false
+ *
+ * Sends the close_notify alert in a non-blocking manner without closing the
+ * socket.  Returns true once the close_notify of the peer has arrived too,
+ * and false while it is still to come; call again to wait for it.  Would
+ * block conditions are reported as by #connect_nonblock.
  */
 static VALUE
-ossl_ssl_write_nonblock(VALUE self, VALUE str)
+ossl_ssl_shutdown_internal(VALUE self, int no_exception)
 {
-    return ossl_ssl_write_internal(self, str, 1);
+    SSL *ssl;
+    struct ossl_ssl_call call;
+
+    Data_Get_Struct(self, SSL, ssl);
+    if (!ssl) return Qtrue;
+    call.ssl = ssl;
+    call.func = SSL_shutdown;
+    call.buf = NULL;
+    for (;;){
+	ossl_ssl_call(&call);
+	if (call.ret >= 0)
+	    return call.ret == 1 ? Qtrue : Qfalse;
+	switch(call.err){
+	case SSL_ERROR_WANT_WRITE:
+	    if (no_exception) return sym_wait_writable;
+	    write_would_block(1);
+	case SSL_ERROR_WANT_READ:
+	    if (no_exception) return sym_wait_readable;
+	    read_would_block(1);
+	case SSL_ERROR_SYSCALL:
+	    if (errno == EINTR) {
+		rb_thread_check_ints();
+		continue;
+	    }
+	    if (errno) rb_sys_fail("SSL_shutdown");
+	default:
+	    ossl_raise(eSSLError, "SSL_shutdown:");
+	}
+    }
+}
+
+static VALUE
+ossl_ssl_shutdown_nonblock(int argc, VALUE *argv, VALUE self)
+{
+    int no_exception = ossl_ssl_no_exception_p(&argc, argv);
+
+    rb_scan_args(argc, argv, "0");
+    return ossl_ssl_shutdown_internal(self, no_exception);
 }
 
 /*
@@ -1377,9 +2399,15 @@ static VALUE
 ossl_ssl_close(VALUE self)
 {
     SSL *ssl;
+    struct ossl_ssl_call call;
 
     Data_Get_Struct(self, SSL, ssl);
-    ossl_ssl_shutdown(ssl);
+    if (ssl) {
+	call.ssl = ssl;
+	call.func = ossl_ssl_shutdown0;
+	call.buf = NULL;
+	ossl_ssl_call(&call);
+    }
     if (RTEST(ossl_ssl_get_sync_close(self)))
 	rb_funcall(ossl_ssl_get_io(self), rb_intern("close"), 0);
 
@@ -1416,42 +2444,109 @@ ossl_ssl_get_cert(VALUE self)
     return ossl_x509_new(cert);
 }
 
+/*
+ * What is known about the peer is kept in a hidden instance variable,
+ * out of reach of instance_variable_set: the Certificate
+ * first, then the chain and values derived from the certificate, each
+ * false until asked for.  The Certificate shares the X509 of the session
+ * (see GetX509Mutable()), so the cache is current as long as it still
+ * wraps the X509 the session has.  A renegotiation that brings another
+ * certificate, or somebody changing the Certificate, gives a new one.
+ */
+enum {
+    OSSL_PEER_CERT,
+    OSSL_PEER_CHAIN,
+    OSSL_PEER_SUBJECT,
+    OSSL_PEER_FINGERPRINT,
+    OSSL_PEER_SUBJECT_ALT_NAMES,
+    OSSL_PEER_CACHE_SIZE
+};
+
+static ID id_peer_cache;
+
+#define ossl_ssl_get_peer_cache(o)   rb_attr_get((o),id_peer_cache)
+#define ossl_ssl_set_peer_cache(o,v) rb_ivar_set((o),id_peer_cache,(v))
+
+/*
+ * Returns the peer cache of +self+, or nil if the peer has sent no
+ * certificate (yet).
+ */
+static VALUE
+ossl_ssl_peer_cache(VALUE self)
+{
+    SSL *ssl;
+    X509 *cert;
+    VALUE cache;
+    int i;
+
+    Data_Get_Struct(self, SSL, ssl);
+    if (!ssl) {
+	rb_warning("SSL session is not started yet.");
+	return Qnil;
+    }
+    cert = SSL_get_peer_certificate(ssl); /* Adds a ref => Safe to FREE. */
+    if (!cert) {
+	return Qnil;
+    }
+    cache = ossl_ssl_get_peer_cache(self);
+    if (!NIL_P(cache) &&
+	DATA_PTR(RARRAY_PTR(cache)[OSSL_PEER_CERT]) == cert) {
+	X509_free(cert);
+	return cache;
+    }
+    cache = rb_ary_new2(OSSL_PEER_CACHE_SIZE);
+    rb_ary_push(cache, rb_protect((VALUE(*)_((VALUE)))ossl_x509_new,
+				  (VALUE)cert, &i));
+    X509_free(cert);
+    if (i) rb_jump_tag(i);
+    for (i = 1; i < OSSL_PEER_CACHE_SIZE; i++)
+	rb_ary_push(cache, Qfalse);
+    ossl_ssl_set_peer_cache(self, cache);
+
+    return cache;
+}
+
 /*
  * call-seq:
  *    ssl.peer_cert => cert or nil
  *
- * The X509 certificate for this socket's peer.
+ * The X509 certificate for this socket's peer.  The same Certificate is
+ * returned until the peer presents another one.
  */
 static VALUE
 ossl_ssl_get_peer_cert(VALUE self)
 {
-    SSL *ssl;
-    X509 *cert = NULL;
-    VALUE obj;
+    VALUE cache = ossl_ssl_peer_cache(self);
 
-    Data_Get_Struct(self, SSL, ssl);
-
-    if (!ssl){
-        rb_warning("SSL session is not started yet.");
-        return Qnil;
+    if (NIL_P(cache)) {
+	return Qnil;
     }
 
-    cert = SSL_get_peer_certificate(ssl); /* Adds a ref => Safe to FREE. */
+    return RARRAY_PTR(cache)[OSSL_PEER_CERT];
+}
 
-    if (!cert) {
-        return Qnil;
+/* whether +ary+ still wraps the certificates of +chain+ */
+static int
+ossl_ssl_peer_chain_current(VALUE ary, STACK_OF(X509) *chain)
+{
+    int i, num = sk_X509_num(chain);
+
+    if (RARRAY_LEN(ary) != num) return 0;
+    for (i = 0; i < num; i++) {
+	if (DATA_PTR(RARRAY_PTR(ary)[i]) != sk_X509_value(chain, i))
+	    return 0;
     }
-    obj = ossl_x509_new(cert);
-    X509_free(cert);
 
-    return obj;
+    return 1;
 }
 
 /*
  * call-seq:
  *    ssl.peer_cert_chain => [cert, ...] or nil
  *
- * The X509 certificate chain for this socket's peer.
+ * The X509 certificate chain for this socket's peer.  The Certificates
+ * are built once per chain the peer presents and returned again by later
+ * calls, each in an Array of its own.
  */
 static VALUE
 ossl_ssl_get_peer_cert_chain(VALUE self)
@@ -1459,22 +2554,157 @@ ossl_ssl_get_peer_cert_chain(VALUE self)
     SSL *ssl;
     STACK_OF(X509) *chain;
     X509 *cert;
-    VALUE ary;
+    VALUE cache, ary;
     int i, num;
 
+    cache = ossl_ssl_peer_cache(self);
     Data_Get_Struct(self, SSL, ssl);
-    if(!ssl){
-	rb_warning("SSL session is not started yet.");
-	return Qnil;
-    }
+    if(!ssl) return Qnil;
     chain = SSL_get_peer_cert_chain(ssl);
     if(!chain) return Qnil;
+    /*
+     * a renegotiation may keep the certificate but not the intermediates,
+     * so the cached chain is checked against the session's
+     */
+    if (!NIL_P(cache) && (ary = RARRAY_PTR(cache)[OSSL_PEER_CHAIN]) != Qfalse &&
+	ossl_ssl_peer_chain_current(ary, chain)) {
+	return rb_ary_dup(ary);
+    }
     num = sk_X509_num(chain);
     ary = rb_ary_new2(num);
     for (i = 0; i < num; i++){
 	cert = sk_X509_value(chain, i);
 	rb_ary_push(ary, ossl_x509_new(cert));
     }
+    if (!NIL_P(cache)) {
+	rb_ary_store(cache, OSSL_PEER_CHAIN, ary);
+    }
+
+    return rb_ary_dup(ary);
+}
+
+/*
+ * call-seq:
+ *    ssl.peer_cert_subject => string or nil
+ *
+ * The subject of #peer_cert as X509::Name#to_s formats it, frozen and
+ * computed once.
+ */
+static VALUE
+ossl_ssl_get_peer_cert_subject(VALUE self)
+{
+    VALUE cache = ossl_ssl_peer_cache(self), str;
+    char *buf;
+
+    if (NIL_P(cache)) {
+	return Qnil;
+    }
+    if ((str = RARRAY_PTR(cache)[OSSL_PEER_SUBJECT]) == Qfalse) {
+	buf = X509_NAME_oneline(X509_get_subject_name(
+		GetX509CertPtr(RARRAY_PTR(cache)[OSSL_PEER_CERT])), NULL, 0);
+	if (!buf) ossl_raise(eSSLError, NULL);
+	str = ossl_buf2str(buf, strlen(buf));
+	OBJ_FREEZE(str);
+	rb_ary_store(cache, OSSL_PEER_SUBJECT, str);
+    }
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *    ssl.peer_cert_fingerprint => string or nil
+ *
+ * The SHA-256 digest of #peer_cert in DER form, in lowercase hex, frozen
+ * and computed once.
+ */
+static VALUE
+ossl_ssl_get_peer_cert_fingerprint(VALUE self)
+{
+    VALUE cache = ossl_ssl_peer_cache(self), str;
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    char *hex;
+
+    if (NIL_P(cache)) {
+	return Qnil;
+    }
+    if ((str = RARRAY_PTR(cache)[OSSL_PEER_FINGERPRINT]) == Qfalse) {
+	if (!X509_digest(GetX509CertPtr(RARRAY_PTR(cache)[OSSL_PEER_CERT]),
+			 EVP_sha256(), md, &len)) {
+	    ossl_raise(eSSLError, NULL);
+	}
+	if (string2hex(md, len, &hex, NULL) != 2 * (int)len) {
+	    ossl_raise(eSSLError, "Memory alloc error");
+	}
+	str = ossl_buf2str(hex, 2 * len);
+	OBJ_FREEZE(str);
+	rb_ary_store(cache, OSSL_PEER_FINGERPRINT, str);
+    }
+
+    return str;
+}
+
+static VALUE
+ossl_ssl_general_names(GENERAL_NAMES *names)
+{
+    STACK_OF(CONF_VALUE) *vals;
+    CONF_VALUE *val;
+    VALUE ary, str;
+    int i, j;
+
+    ary = rb_ary_new();
+    for (i = 0; i < sk_GENERAL_NAME_num(names); i++) {
+	vals = i2v_GENERAL_NAME(NULL, sk_GENERAL_NAME_value(names, i), NULL);
+	if (!vals) continue;
+	for (j = 0; j < sk_CONF_VALUE_num(vals); j++) {
+	    val = sk_CONF_VALUE_value(vals, j);
+	    str = rb_str_new2(val->name);
+	    rb_str_cat2(str, ":");
+	    rb_str_cat2(str, val->value ? val->value : "");
+	    OBJ_FREEZE(str);
+	    rb_ary_push(ary, str);
+	}
+	sk_CONF_VALUE_pop_free(vals, X509V3_conf_free);
+    }
+    OBJ_FREEZE(ary);
+
+    return ary;
+}
+
+/*
+ * call-seq:
+ *    ssl.peer_cert_subject_alt_names => [string, ...] or nil
+ *
+ * The subjectAltName entries of #peer_cert, formatted as in the
+ * extension's text ("DNS:example.com", "IP Address:127.0.0.1", ...).
+ * The frozen Array is built once.
+ */
+static VALUE
+ossl_ssl_get_peer_cert_subject_alt_names(VALUE self)
+{
+    VALUE cache = ossl_ssl_peer_cache(self), ary;
+    GENERAL_NAMES *names;
+    int state = 0;
+
+    if (NIL_P(cache)) {
+	return Qnil;
+    }
+    if ((ary = RARRAY_PTR(cache)[OSSL_PEER_SUBJECT_ALT_NAMES]) == Qfalse) {
+	names = X509_get_ext_d2i(GetX509CertPtr(RARRAY_PTR(cache)[OSSL_PEER_CERT]),
+				 NID_subject_alt_name, NULL, NULL);
+	if (names) {
+	    ary = rb_protect((VALUE(*)_((VALUE)))ossl_ssl_general_names,
+			     (VALUE)names, &state);
+	    GENERAL_NAMES_free(names);
+	    if (state) rb_jump_tag(state);
+	}
+	else {
+	    ary = rb_ary_new();
+	    OBJ_FREEZE(ary);
+	}
+	rb_ary_store(cache, OSSL_PEER_SUBJECT_ALT_NAMES, ary);
+    }
 
     return ary;
 }
@@ -1543,7 +2773,7 @@ ossl_ssl_pending(VALUE self)
         return Qnil;
     }
 
-    return INT2NUM(SSL_pending(ssl));
+    return INT2NUM(ossl_ssl_locked_pending(ssl));
 }
 
 /*
@@ -1622,6 +2852,245 @@ ossl_ssl_get_verify_result(VALUE self)
     return INT2FIX(SSL_get_verify_result(ssl));
 }
 
+/*
+ * SSLEngine
+ */
+
+/*
+ * call-seq:
+ *    SSLEngine.new => anSSLEngine
+ *    SSLEngine.new(ctx) => anSSLEngine
+ *
+ * Creates an SSL engine that isn't tied to any IO.  The ciphertext it
+ * receives is handed to it with #inject, and what it sends is taken out
+ * with #extract, so the transport is entirely up to the caller.  Nothing
+ * ever blocks; where an SSLSocket would wait, :wait_readable is returned
+ * and more input has to be injected.
+ *
+ * If +ctx+ is provided the initial parameters are taken from it; the
+ * SSLContext is frozen as for SSLSocket.new.
+ */
+static VALUE
+ossl_ssl_engine_initialize(int argc, VALUE *argv, VALUE self)
+{
+    VALUE ctx;
+
+    if (rb_scan_args(argc, argv, "01", &ctx) == 0) {
+        ctx = rb_funcall(cSSLContext, rb_intern("new"), 0);
+    }
+    OSSL_Check_Kind(ctx, cSSLContext);
+    ossl_ssl_set_ctx(self, ctx);
+    ossl_sslctx_setup(ctx);
+
+    rb_iv_set(self, "@hostname", Qnil);
+
+    return self;
+}
+
+static SSL *
+ossl_ssl_engine_get_ssl(VALUE self)
+{
+    SSL *ssl;
+
+    ossl_ssl_setup(self);
+    Data_Get_Struct(self, SSL, ssl);
+
+    return ssl;
+}
+
+/*
+ * call-seq:
+ *    engine.connect => true or :wait_readable
+ *
+ * Advances the handshake as a client.  Returns true once it is complete.
+ * Whatever the engine produced meanwhile has to be sent with #extract.
+ */
+static VALUE
+ossl_ssl_engine_connect(VALUE self)
+{
+    VALUE ret;
+
+    ossl_ssl_setup(self);
+    ret = ossl_start_ssl(self, SSL_connect, "SSL_connect", 1, 1);
+
+    return ret == self ? Qtrue : ret;
+}
+
+/*
+ * call-seq:
+ *    engine.accept => true or :wait_readable
+ *
+ * Advances the handshake as a server.  See #connect.
+ */
+static VALUE
+ossl_ssl_engine_accept(VALUE self)
+{
+    VALUE ret;
+
+    ossl_ssl_setup(self);
+    ret = ossl_start_ssl(self, SSL_accept, "SSL_accept", 1, 1);
+
+    return ret == self ? Qtrue : ret;
+}
+
+/*
+ * The memory BIOs of an engine are touched by SSL_read and SSL_write too,
+ * so #inject, #extract and #output_pending go through ossl_ssl_call to
+ * take the lock of the SSL object like them.
+ */
+static int
+ossl_ssl_engine_bio_write(SSL *ssl, void *buf, int len)
+{
+    return BIO_write(SSL_get_rbio(ssl), buf, len);
+}
+
+/* 0 rather than an error when another thread took the output first */
+static int
+ossl_ssl_engine_bio_read(SSL *ssl, void *buf, int len)
+{
+    BIO *wbio = SSL_get_wbio(ssl);
+    int n;
+
+    n = BIO_read(wbio, buf, len);
+    if (n <= 0 && BIO_should_retry(wbio)) return 0;
+
+    return n;
+}
+
+static int
+ossl_ssl_engine_bio_pending(SSL *ssl)
+{
+    return (int)BIO_ctrl_pending(SSL_get_wbio(ssl));
+}
+
+static int
+ossl_ssl_engine_call(SSL *ssl, int (*func)(), void *buf, int len)
+{
+    struct ossl_ssl_call call;
+
+    call.ssl = ssl;
+    call.func = func;
+    call.buf = buf;
+    call.len = len;
+    ossl_ssl_call(&call);
+
+    return call.ret;
+}
+
+/*
+ * call-seq:
+ *    engine.inject(string) => Integer
+ *
+ * Feeds ciphertext received from the peer to the engine.  Returns the
+ * number of bytes taken, which is all of them.
+ */
+static VALUE
+ossl_ssl_engine_inject(VALUE self, VALUE str)
+{
+    SSL *ssl = ossl_ssl_engine_get_ssl(self);
+    int n;
+
+    StringValue(str);
+    if (RSTRING_LEN(str) == 0) return INT2FIX(0);
+    str = rb_str_new_frozen(str);
+    n = ossl_ssl_engine_call(ssl, ossl_ssl_engine_bio_write,
+			     RSTRING_PTR(str), (int)RSTRING_LEN(str));
+    if (n <= 0) ossl_raise(eSSLError, "BIO_write:");
+
+    return INT2NUM(n);
+}
+
+/*
+ * call-seq:
+ *    engine.extract([maxlen]) => string or nil
+ *
+ * Takes up to +maxlen+ bytes, or everything, of the ciphertext the engine
+ * produced for the peer.  Returns nil if there is none.
+ */
+static VALUE
+ossl_ssl_engine_extract(int argc, VALUE *argv, VALUE self)
+{
+    SSL *ssl = ossl_ssl_engine_get_ssl(self);
+    VALUE maxlen, str;
+    long len;
+    int n;
+
+    rb_scan_args(argc, argv, "01", &maxlen);
+    len = ossl_ssl_engine_call(ssl, ossl_ssl_engine_bio_pending, NULL, 0);
+    if (!NIL_P(maxlen) && NUM2LONG(maxlen) < len) len = NUM2LONG(maxlen);
+    if (len <= 0) return Qnil;
+    str = rb_str_new(0, len);
+    n = ossl_ssl_engine_call(ssl, ossl_ssl_engine_bio_read,
+			     RSTRING_PTR(str), (int)len);
+    if (n < 0) ossl_raise(eSSLError, "BIO_read:");
+    if (n == 0) return Qnil;
+    rb_str_set_len(str, n);
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *    engine.output_pending => Integer
+ *
+ * Returns the number of ciphertext bytes waiting to be extracted.
+ */
+static VALUE
+ossl_ssl_engine_output_pending(VALUE self)
+{
+    SSL *ssl;
+
+    Data_Get_Struct(self, SSL, ssl);
+    if (!ssl) return INT2FIX(0);
+
+    return INT2NUM(ossl_ssl_engine_call(ssl, ossl_ssl_engine_bio_pending,
+					NULL, 0));
+}
+
+/*
+ * call-seq:
+ *    engine.read(length [, buffer [, offset]]) => string, buffer, :wait_readable or nil
+ *
+ * Decrypts up to +length+ bytes of what has been injected, as
+ * SSLSocket#sysread does.  Returns :wait_readable if more input is needed,
+ * or nil once the peer closed the connection.
+ */
+static VALUE
+ossl_ssl_engine_read(int argc, VALUE *argv, VALUE self)
+{
+    ossl_ssl_setup(self);
+    return ossl_ssl_read_internal(argc, argv, self, 1, 1);
+}
+
+/*
+ * call-seq:
+ *    engine.write(string) => Integer or :wait_readable
+ *
+ * Encrypts +string+ for the peer; extract the result with #extract.
+ * Returns the number of bytes written, or :wait_readable while a
+ * renegotiation needs input first.
+ */
+static VALUE
+ossl_ssl_engine_write(VALUE self, VALUE str)
+{
+    ossl_ssl_setup(self);
+    return ossl_ssl_write_internal(self, str, 1, 1);
+}
+
+/*
+ * call-seq:
+ *    engine.shutdown => true, false or :wait_readable
+ *
+ * Produces the close_notify alert for the peer.  Returns true once the
+ * close_notify of the peer has been injected too, false before that.
+ */
+static VALUE
+ossl_ssl_engine_shutdown(VALUE self)
+{
+    ossl_ssl_setup(self);
+    return ossl_ssl_shutdown_internal(self, 1);
+}
+
 void
 Init_ossl_ssl()
 {
@@ -1633,6 +3102,11 @@ Init_ossl_ssl()
 #endif
 
     ID_callback_state = rb_intern("@callback_state");
+    ID_callback_error = rb_intern("callback_error");
+    id_peer_cache = rb_intern("peer_cache");
+    sym_exception = ID2SYM(rb_intern("exception"));
+    sym_wait_readable = ID2SYM(rb_intern("wait_readable"));
+    sym_wait_writable = ID2SYM(rb_intern("wait_writable"));
 
     ossl_ssl_ex_vcb_idx = SSL_get_ex_new_index(0,(void *)"ossl_ssl_ex_vcb_idx",0,0,0);
     ossl_ssl_ex_store_p = SSL_get_ex_new_index(0,(void *)"ossl_ssl_ex_store_p",0,0,0);
@@ -1641,11 +3115,19 @@ Init_ossl_ssl()
 	SSL_get_ex_new_index(0,(void *)"ossl_ssl_ex_client_cert_cb_idx",0,0,0);
     ossl_ssl_ex_tmp_dh_callback_idx =
 	SSL_get_ex_new_index(0,(void *)"ossl_ssl_ex_tmp_dh_callback_idx",0,0,0);
+    ossl_ssl_ex_stats_idx =
+	SSL_get_ex_new_index(0,(void *)"ossl_ssl_ex_stats_idx",0,0,ossl_ssl_stats_free);
+#if defined(OSSL_NOGVL_ENABLED)
+    ossl_ssl_ex_lock_idx =
+	SSL_get_ex_new_index(0,(void *)"ossl_ssl_ex_lock_idx",0,0,ossl_ssl_lock_free);
+#endif
 
     mSSL = rb_define_module_under(mOSSL, "SSL");
     eSSLError = rb_define_class_under(mSSL, "SSLError", eOSSLError);
 
     Init_ossl_ssl_session();
+    Init_ossl_ssl_cache();
+    Init_ossl_ssl_hostname();
 
     /* Document-class: OpenSSL::SSL::SSLContext
      *
@@ -1791,6 +3273,12 @@ Init_ossl_ssl()
      */
     rb_attr(cSSLContext, rb_intern("session_remove_cb"), 1, 1, Qfalse);
 
+    /*
+     * An OpenSSL::SSL::SessionCache in shared memory to store and look up
+     * sessions in.  When set, the session callbacks above are not called.
+     */
+    rb_attr(cSSLContext, rb_intern("shared_session_cache"), 1, 1, Qfalse);
+
 #ifdef HAVE_SSL_SET_TLSEXT_HOST_NAME
     /*
      * A callback invoked at connect time to distinguish between multiple
@@ -1892,23 +3380,71 @@ Init_ossl_ssl()
     rb_define_alias(cSSLSocket, "to_io", "io");
     rb_define_method(cSSLSocket, "initialize", ossl_ssl_initialize, -1);
     rb_define_method(cSSLSocket, "connect",    ossl_ssl_connect, 0);
-    rb_define_method(cSSLSocket, "connect_nonblock",    ossl_ssl_connect_nonblock, 0);
+    rb_define_method(cSSLSocket, "connect_nonblock",    ossl_ssl_connect_nonblock, -1);
     rb_define_method(cSSLSocket, "accept",     ossl_ssl_accept, 0);
-    rb_define_method(cSSLSocket, "accept_nonblock",     ossl_ssl_accept_nonblock, 0);
+    rb_define_method(cSSLSocket, "accept_nonblock",     ossl_ssl_accept_nonblock, -1);
+#if defined(HAVE_POLL)
+    rb_define_singleton_method(cSSLSocket, "accept_many", ossl_ssl_s_accept_many, -1);
+#endif
     rb_define_method(cSSLSocket, "sysread",    ossl_ssl_read, -1);
     rb_define_private_method(cSSLSocket, "sysread_nonblock",    ossl_ssl_read_nonblock, -1);
     rb_define_method(cSSLSocket, "syswrite",   ossl_ssl_write, 1);
-    rb_define_private_method(cSSLSocket, "syswrite_nonblock",    ossl_ssl_write_nonblock, 1);
+    rb_define_private_method(cSSLSocket, "syswrite_nonblock",    ossl_ssl_write_nonblock, -1);
+    rb_define_method(cSSLSocket, "syswritev",  ossl_ssl_writev, -1);
     rb_define_method(cSSLSocket, "sysclose",   ossl_ssl_close, 0);
+    rb_define_method(cSSLSocket, "shutdown_nonblock", ossl_ssl_shutdown_nonblock, -1);
     rb_define_method(cSSLSocket, "cert",       ossl_ssl_get_cert, 0);
     rb_define_method(cSSLSocket, "peer_cert",  ossl_ssl_get_peer_cert, 0);
     rb_define_method(cSSLSocket, "peer_cert_chain", ossl_ssl_get_peer_cert_chain, 0);
+    rb_define_method(cSSLSocket, "peer_cert_subject", ossl_ssl_get_peer_cert_subject, 0);
+    rb_define_method(cSSLSocket, "peer_cert_fingerprint", ossl_ssl_get_peer_cert_fingerprint, 0);
+    rb_define_method(cSSLSocket, "peer_cert_subject_alt_names", ossl_ssl_get_peer_cert_subject_alt_names, 0);
     rb_define_method(cSSLSocket, "cipher",     ossl_ssl_get_cipher, 0);
     rb_define_method(cSSLSocket, "state",      ossl_ssl_get_state, 0);
     rb_define_method(cSSLSocket, "pending",    ossl_ssl_pending, 0);
     rb_define_method(cSSLSocket, "session_reused?",    ossl_ssl_session_reused, 0);
     rb_define_method(cSSLSocket, "session=",    ossl_ssl_set_session, 1);
     rb_define_method(cSSLSocket, "verify_result", ossl_ssl_get_verify_result, 0);
+    rb_define_method(cSSLSocket, "write_stats", ossl_ssl_get_write_stats, 0);
+
+    Init_ossl_ssl_buffer();
+
+    /*
+     * Document-class: OpenSSL::SSL::SSLEngine
+     *
+     * An SSL/TLS connection driven through memory buffers instead of a
+     * socket.  The following attributes are available but don't show up
+     * in rdoc.
+     * * context, hostname
+     */
+    cSSLEngine = rb_define_class_under(mSSL, "SSLEngine", rb_cObject);
+    rb_define_alloc_func(cSSLEngine, ossl_ssl_s_alloc);
+    rb_attr(cSSLEngine, rb_intern("context"), 1, 0, Qfalse);
+#ifdef HAVE_SSL_SET_TLSEXT_HOST_NAME
+    rb_attr(cSSLEngine, rb_intern("hostname"), 1, 1, Qfalse);
+#endif
+    rb_define_method(cSSLEngine, "initialize", ossl_ssl_engine_initialize, -1);
+    rb_define_method(cSSLEngine, "connect", ossl_ssl_engine_connect, 0);
+    rb_define_method(cSSLEngine, "accept", ossl_ssl_engine_accept, 0);
+    rb_define_method(cSSLEngine, "inject", ossl_ssl_engine_inject, 1);
+    rb_define_method(cSSLEngine, "extract", ossl_ssl_engine_extract, -1);
+    rb_define_method(cSSLEngine, "output_pending", ossl_ssl_engine_output_pending, 0);
+    rb_define_method(cSSLEngine, "read", ossl_ssl_engine_read, -1);
+    rb_define_method(cSSLEngine, "write", ossl_ssl_engine_write, 1);
+    rb_define_method(cSSLEngine, "shutdown", ossl_ssl_engine_shutdown, 0);
+    rb_define_method(cSSLEngine, "cert", ossl_ssl_get_cert, 0);
+    rb_define_method(cSSLEngine, "peer_cert", ossl_ssl_get_peer_cert, 0);
+    rb_define_method(cSSLEngine, "peer_cert_chain", ossl_ssl_get_peer_cert_chain, 0);
+    rb_define_method(cSSLEngine, "peer_cert_subject", ossl_ssl_get_peer_cert_subject, 0);
+    rb_define_method(cSSLEngine, "peer_cert_fingerprint", ossl_ssl_get_peer_cert_fingerprint, 0);
+    rb_define_method(cSSLEngine, "peer_cert_subject_alt_names", ossl_ssl_get_peer_cert_subject_alt_names, 0);
+    rb_define_method(cSSLEngine, "cipher", ossl_ssl_get_cipher, 0);
+    rb_define_method(cSSLEngine, "state", ossl_ssl_get_state, 0);
+    rb_define_method(cSSLEngine, "pending", ossl_ssl_pending, 0);
+    rb_define_method(cSSLEngine, "session_reused?", ossl_ssl_session_reused, 0);
+    rb_define_method(cSSLEngine, "session=", ossl_ssl_set_session, 1);
+    rb_define_method(cSSLEngine, "verify_result", ossl_ssl_get_verify_result, 0);
+    rb_define_method(cSSLEngine, "write_stats", ossl_ssl_get_write_stats, 0);
 
 #define ossl_ssl_def_const(x) rb_define_const(mSSL, #x, INT2NUM(SSL_##x))
 
@@ -26,11 +26,25 @@
 extern VALUE mSSL;
 extern VALUE eSSLError;
 extern VALUE cSSLSocket;
+extern VALUE cSSLEngine;
 extern VALUE cSSLContext;
 extern VALUE cSSLSession;
+extern VALUE cSSLSessionCache;
 
+/* returned by ossl_ssl_{read,write}_raw() in place of raising */
+#define OSSL_SSL_WAIT_READABLE (-1)
+#define OSSL_SSL_WAIT_WRITABLE (-2)
+
+int ossl_ssl_read_raw(VALUE, char *, int, int, int);
+int ossl_ssl_write_raw(VALUE, const char *, int, int, int);
 void Init_ossl_ssl(void);
 void Init_ossl_ssl_session(void);
+void Init_ossl_ssl_buffer(void);
+void Init_ossl_ssl_cache(void);
+void ossl_ssl_cache_setup(SSL_CTX *, VALUE);
+void ossl_ssl_cache_add_stats(VALUE, VALUE);
+void Init_ossl_ssl_hostname(void);
+void ossl_ssl_identity_forget(X509 *);
 
 #endif /* _OSSL_SSL_H_ */
 
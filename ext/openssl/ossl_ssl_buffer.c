@@ -0,0 +1,722 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#include "ossl.h"
+
+/*
+ * Buffered I/O for SSLSocket
+ *
+ * OpenSSL::Buffering keeps its buffers in Ruby Strings and slices them on
+ * every call.  SSLSocket overrides the primitives of the mixin with the
+ * methods below, which decrypt straight into a C buffer and copy into a
+ * String only what is returned to the caller.  The rest of the mixin
+ * (puts, each, getc, ...) is built on these and keeps working unchanged.
+ *
+ * The buffers are kept contiguous: consumed space at the front is reclaimed
+ * by moving the remainder down before a read would run off the end, so a
+ * line can always be searched for in one span.  A mutex per direction keeps
+ * threads from moving a buffer while SSL_read or SSL_write works on it
+ * without the GVL.
+ */
+#define OSSL_SSL_BLOCK_SIZE SSL3_RT_MAX_PLAIN_LENGTH	/* a full record */
+/* how far back a Regexp line end is looked for again after more data */
+#define OSSL_SSL_RE_OVERLAP 1024
+
+struct ossl_ssl_buffer {
+    char *rbuf;
+    long roff, rlen, rcapa;
+    char *wbuf;
+    long woff, wlen, wcapa;
+    int eof;
+    VALUE rlock, wlock;
+};
+
+struct ossl_ssl_buffer_args {
+    VALUE self;
+    struct ossl_ssl_buffer *buf;
+    int argc;
+    VALUE *argv;
+};
+
+static ID id_buffer, id_sync, id_sysread, id_sysread_nonblock, id_syswrite;
+static ID id_chr, id_end;
+
+static void
+ossl_ssl_buffer_mark(struct ossl_ssl_buffer *buf)
+{
+    rb_gc_mark(buf->rlock);
+    rb_gc_mark(buf->wlock);
+}
+
+static void
+ossl_ssl_buffer_free(struct ossl_ssl_buffer *buf)
+{
+    xfree(buf->rbuf);
+    xfree(buf->wbuf);
+    xfree(buf);
+}
+
+static struct ossl_ssl_buffer *
+ossl_ssl_get_buffer(VALUE self)
+{
+    VALUE obj;
+    struct ossl_ssl_buffer *buf;
+
+    obj = rb_attr_get(self, id_buffer);
+    if (NIL_P(obj)) {
+	obj = Data_Make_Struct(rb_cObject, struct ossl_ssl_buffer,
+			       ossl_ssl_buffer_mark, ossl_ssl_buffer_free, buf);
+	buf->rlock = rb_mutex_new();
+	buf->wlock = rb_mutex_new();
+	rb_ivar_set(self, id_buffer, obj);
+    }
+    Data_Get_Struct(obj, struct ossl_ssl_buffer, buf);
+
+    return buf;
+}
+
+static VALUE
+ossl_ssl_buffer_synchronize(VALUE self, int write, VALUE (*func)(VALUE),
+			    int argc, VALUE *argv)
+{
+    struct ossl_ssl_buffer_args args;
+
+    args.self = self;
+    args.buf = ossl_ssl_get_buffer(self);
+    args.argc = argc;
+    args.argv = argv;
+
+    return rb_mutex_synchronize(write ? args.buf->wlock : args.buf->rlock,
+				func, (VALUE)&args);
+}
+
+/*
+ * Searches +pat+ forwards from +from+ in the +len+ bytes at +ptr+.
+ */
+static long
+ossl_ssl_buffer_index(const char *ptr, long len, long from,
+		      const char *pat, long plen)
+{
+    const char *p, *e;
+
+    if (plen == 0) return from;
+    e = ptr + len - plen;
+    for (p = ptr + from; p <= e; p++) {
+	p = memchr(p, pat[0], e - p + 1);
+	if (!p) break;
+	if (memcmp(p, pat, plen) == 0) return p - ptr;
+    }
+
+    return -1;
+}
+
+/*
+ * Searches +pat+ backwards, not looking before +from+.
+ */
+static long
+ossl_ssl_buffer_rindex(const char *ptr, long len, long from,
+		       const char *pat, long plen)
+{
+    const char *p;
+
+    if (plen == 0 || len < plen) return -1;
+    if (from < 0) from = 0;
+    for (p = ptr + len - plen; p >= ptr + from; p--) {
+	if (*p == pat[0] && memcmp(p, pat, plen) == 0) return p - ptr;
+    }
+
+    return -1;
+}
+
+/*
+ * for reading.
+ */
+
+/*
+ * Makes room for at least +len+ more bytes after the buffered data.
+ */
+static void
+ossl_ssl_rbuf_reserve(struct ossl_ssl_buffer *buf, long len)
+{
+    if (buf->rcapa - buf->roff - buf->rlen >= len) return;
+    if (buf->roff > 0) {
+	memmove(buf->rbuf, buf->rbuf + buf->roff, buf->rlen);
+	buf->roff = 0;
+    }
+    if (buf->rcapa - buf->rlen < len) {
+	buf->rcapa = buf->rlen + len;
+	REALLOC_N(buf->rbuf, char, buf->rcapa);
+    }
+}
+
+static VALUE
+ossl_ssl_buffer_sysread(VALUE self)
+{
+    return rb_funcall(self, id_sysread, 1, INT2NUM(OSSL_SSL_BLOCK_SIZE));
+}
+
+static VALUE
+ossl_ssl_buffer_sysread_eof(VALUE self, VALUE exc)
+{
+    return Qnil;
+}
+
+/*
+ * Reads once into the buffer, making room for at least +want+ bytes.
+ * Returns the number of bytes read, or 0 once EOF is reached.
+ */
+static long
+ossl_ssl_rbuf_fill(VALUE self, struct ossl_ssl_buffer *buf, long want)
+{
+    SSL *ssl;
+    VALUE str;
+    long n;
+
+    if (want < OSSL_SSL_BLOCK_SIZE) want = OSSL_SSL_BLOCK_SIZE;
+    ossl_ssl_rbuf_reserve(buf, want);
+    Data_Get_Struct(self, SSL, ssl);
+    if (ssl) {
+	n = buf->rcapa - buf->roff - buf->rlen;
+	if (n > INT_MAX) n = INT_MAX;
+	n = ossl_ssl_read_raw(self, buf->rbuf + buf->roff + buf->rlen,
+			      (int)n, 0, 0);
+    }
+    else {
+	/* #sysread warns and falls back to the underlying io */
+	str = rb_rescue2(ossl_ssl_buffer_sysread, self,
+			 ossl_ssl_buffer_sysread_eof, Qnil, rb_eEOFError, 0);
+	if (NIL_P(str)) {
+	    n = 0;
+	}
+	else {
+	    StringValue(str);
+	    n = RSTRING_LEN(str);
+	    ossl_ssl_rbuf_reserve(buf, n);
+	    memcpy(buf->rbuf + buf->roff + buf->rlen, RSTRING_PTR(str), n);
+	}
+    }
+    if (n == 0)
+	buf->eof = 1;
+    buf->rlen += n;
+
+    return n;
+}
+
+/*
+ * Takes up to +size+ bytes (everything if negative) off the front of the
+ * buffer and stores them in +str+ at +offset+, or in a new String if +str+
+ * is nil.
+ */
+static VALUE
+ossl_ssl_rbuf_consume(struct ossl_ssl_buffer *buf, long size, VALUE str,
+		      long offset)
+{
+    if (size < 0 || size > buf->rlen) size = buf->rlen;
+    if (NIL_P(str)) {
+	str = rb_str_new(buf->rbuf + buf->roff, size);
+    }
+    else {
+	memcpy(ossl_str_reserve(str, offset, size), buf->rbuf + buf->roff,
+	       size);
+	rb_str_set_len(str, offset + size);
+    }
+    buf->roff += size;
+    buf->rlen -= size;
+    if (buf->rlen == 0) {
+	buf->roff = 0;
+	/* don't hold on to the space a single large read needed */
+	if (buf->rcapa > 4 * OSSL_SSL_BLOCK_SIZE) {
+	    buf->rcapa = OSSL_SSL_BLOCK_SIZE;
+	    REALLOC_N(buf->rbuf, char, buf->rcapa);
+	}
+    }
+    OBJ_TAINT(str);
+
+    return str;
+}
+
+static VALUE
+ossl_ssl_buffer_read0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+    struct ossl_ssl_buffer *buf = args->buf;
+    VALUE len, str;
+    long size;
+
+    rb_scan_args(args->argc, args->argv, "02", &len, &str);
+    size = NIL_P(len) ? -1 : NUM2LONG(len);
+    if (!NIL_P(len) && size < 0)
+	rb_raise(rb_eArgError, "negative length %ld given", size);
+    if (!NIL_P(str)) {
+	StringValue(str);
+	rb_str_modify(str);
+    }
+    if (size == 0) {
+	if (NIL_P(str)) return rb_str_new(0, 0);
+	rb_str_set_len(str, 0);
+	return str;
+    }
+    while (!buf->eof) {
+	if (size >= 0 && size <= buf->rlen) break;
+	ossl_ssl_rbuf_fill(args->self, buf,
+			   size >= 0 ? size - buf->rlen : buf->rlen);
+    }
+    if (size >= 0 && buf->rlen == 0) {
+	if (!NIL_P(str)) rb_str_set_len(str, 0);
+	return Qnil;
+    }
+
+    return ossl_ssl_rbuf_consume(buf, size, str, 0);
+}
+
+/*
+ * call-seq:
+ *    ssl.read([length [, buffer]]) => string, buffer, or nil
+ *
+ * Reads +length+ bytes from the SSL connection, or everything up to EOF if
+ * +length+ is omitted.  If +buffer+ is given the data is stored in it.
+ * Returns nil at EOF if +length+ is given.
+ */
+static VALUE
+ossl_ssl_buffer_read(int argc, VALUE *argv, VALUE self)
+{
+    return ossl_ssl_buffer_synchronize(self, 0, ossl_ssl_buffer_read0,
+				       argc, argv);
+}
+
+static VALUE
+ossl_ssl_buffer_readpartial_internal(int argc, VALUE *argv, VALUE self,
+				     int nonblock)
+{
+    struct ossl_ssl_buffer *buf;
+    VALUE len, str, off;
+    long maxlen, offset;
+    int nargc = argc;
+
+    /* options are for #sysread_nonblock */
+    if (nonblock && argc > 0 && TYPE(argv[argc - 1]) == T_HASH) nargc--;
+    rb_scan_args(nargc, argv, "12", &len, &str, &off);
+    maxlen = NUM2LONG(len);
+    offset = NIL_P(off) ? 0 : NUM2LONG(off);
+    if (NIL_P(str)) {
+	if (offset != 0)
+	    rb_raise(rb_eArgError, "offset given without a buffer");
+    }
+    else {
+	ossl_str_reserve(str, offset, 0);
+    }
+    if (maxlen == 0) {
+	if (NIL_P(str)) return rb_str_new(0, 0);
+	rb_str_set_len(str, offset);
+	return str;
+    }
+    buf = ossl_ssl_get_buffer(self);
+    /* nothing buffered: let SSL_read fill the caller's string directly */
+    if (buf->rlen == 0)
+	return rb_funcall2(self, nonblock ? id_sysread_nonblock : id_sysread,
+			   argc, argv);
+
+    return ossl_ssl_rbuf_consume(buf, maxlen, str, offset);
+}
+
+static VALUE
+ossl_ssl_buffer_readpartial0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+
+    return ossl_ssl_buffer_readpartial_internal(args->argc, args->argv,
+						args->self, 0);
+}
+
+static VALUE
+ossl_ssl_buffer_read_nonblock0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+
+    return ossl_ssl_buffer_readpartial_internal(args->argc, args->argv,
+						args->self, 1);
+}
+
+/*
+ * call-seq:
+ *    ssl.readpartial(maxlen [, buffer [, offset]]) => string or buffer
+ *
+ * Reads at most +maxlen+ bytes, blocking only if nothing is available.
+ * Raises EOFError at EOF.  With an +offset+ the data is stored there in
+ * +buffer+, as for SSLSocket#sysread.
+ */
+static VALUE
+ossl_ssl_buffer_readpartial(int argc, VALUE *argv, VALUE self)
+{
+    return ossl_ssl_buffer_synchronize(self, 0, ossl_ssl_buffer_readpartial0,
+				       argc, argv);
+}
+
+/*
+ * call-seq:
+ *    ssl.read_nonblock(maxlen [, buffer [, offset]] [, options]) => string or buffer
+ *
+ * Reads at most +maxlen+ bytes in the non-blocking manner, storing them
+ * at +offset+ in +buffer+ if given.  See
+ * OpenSSL::Buffering#read_nonblock for the exceptions raised when no data
+ * can be read without blocking.  With <tt>:exception => false</tt> in
+ * +options+, :wait_readable or :wait_writable is returned instead, and
+ * nil at EOF.
+ */
+static VALUE
+ossl_ssl_buffer_read_nonblock(int argc, VALUE *argv, VALUE self)
+{
+    return ossl_ssl_buffer_synchronize(self, 0, ossl_ssl_buffer_read_nonblock0,
+				       argc, argv);
+}
+
+static VALUE
+ossl_ssl_buffer_gets0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+    struct ossl_ssl_buffer *buf = args->buf;
+    VALUE eol, lim, tmp = Qnil, backref;
+    long limit, size = -1, scanned = 0, idx;
+
+    rb_scan_args(args->argc, args->argv, "02", &eol, &lim);
+    if (args->argc == 0) {
+	eol = rb_rs;
+    }
+    else if (args->argc == 1 && RTEST(rb_obj_is_kind_of(eol, rb_cInteger))) {
+	lim = eol;
+	eol = rb_rs;
+    }
+    limit = NIL_P(lim) ? -1 : NUM2LONG(lim);
+    if (limit == 0) return rb_str_new(0, 0);
+    if (!NIL_P(eol) && TYPE(eol) != T_REGEXP)
+	StringValue(eol);
+
+    for (;;) {
+	if (NIL_P(eol)) {
+	    /* read up to the limit or EOF */
+	}
+	else if (TYPE(eol) == T_REGEXP) {
+	    /* one String that grows with the buffer, searched from near
+	     * where the last search ended */
+	    if (NIL_P(tmp))
+		tmp = rb_str_new(buf->rbuf + buf->roff, buf->rlen);
+	    else
+		rb_str_cat(tmp, buf->rbuf + buf->roff + RSTRING_LEN(tmp),
+			   buf->rlen - RSTRING_LEN(tmp));
+	    /* $~ is the caller's */
+	    backref = rb_backref_get();
+	    if (rb_reg_search(eol, tmp, scanned, 0) >= 0) {
+		/* a binary String, so the offset is in bytes */
+		size = NUM2LONG(rb_funcall(rb_backref_get(), id_end, 1,
+					   INT2FIX(0)));
+	    }
+	    rb_backref_set(backref);
+	    if (size >= 0) break;
+	    scanned = RSTRING_LEN(tmp) - OSSL_SSL_RE_OVERLAP;
+	    if (scanned < 0) scanned = 0;
+	}
+	else {
+	    idx = ossl_ssl_buffer_index(buf->rbuf + buf->roff, buf->rlen,
+					scanned, RSTRING_PTR(eol),
+					RSTRING_LEN(eol));
+	    if (idx >= 0) {
+		size = idx + RSTRING_LEN(eol);
+		break;
+	    }
+	    scanned = buf->rlen - RSTRING_LEN(eol) + 1;
+	    if (scanned < 0) scanned = 0;
+	}
+	if (limit > 0 && buf->rlen >= limit) break;
+	if (buf->eof) break;
+	ossl_ssl_rbuf_fill(args->self, buf, OSSL_SSL_BLOCK_SIZE);
+    }
+    if (buf->rlen == 0) return Qnil;
+    if (limit > 0 && (size < 0 || size > limit)) size = limit;
+
+    return ossl_ssl_rbuf_consume(buf, size, Qnil, 0);
+}
+
+/*
+ * call-seq:
+ *    ssl.gets(eol=$/, limit=nil) => string or nil
+ *    ssl.gets(limit) => string or nil
+ *
+ * Reads the next line, ending with +eol+, which may be a String or a
+ * Regexp.  At most +limit+ bytes are returned, and no more than that are
+ * waited for.  Returns nil at EOF.  A Regexp is only sure to be found if
+ * what it matches is no longer than 1024 bytes.  $~ is left alone.
+ */
+static VALUE
+ossl_ssl_buffer_gets(int argc, VALUE *argv, VALUE self)
+{
+    return ossl_ssl_buffer_synchronize(self, 0, ossl_ssl_buffer_gets0,
+				       argc, argv);
+}
+
+static VALUE
+ossl_ssl_buffer_ungetc0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+    struct ossl_ssl_buffer *buf = args->buf;
+    VALUE str;
+    long len;
+
+    str = rb_funcall(args->argv[0], id_chr, 0);
+    StringValue(str);
+    len = RSTRING_LEN(str);
+    if (buf->roff < len) {
+	ossl_ssl_rbuf_reserve(buf, len);
+	memmove(buf->rbuf + len, buf->rbuf + buf->roff, buf->rlen);
+	buf->roff = len;
+    }
+    buf->roff -= len;
+    buf->rlen += len;
+    memcpy(buf->rbuf + buf->roff, RSTRING_PTR(str), len);
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *    ssl.ungetc(c) => nil
+ *
+ * Pushes +c+ back so that it is returned by the next read.
+ */
+static VALUE
+ossl_ssl_buffer_ungetc(VALUE self, VALUE c)
+{
+    return ossl_ssl_buffer_synchronize(self, 0, ossl_ssl_buffer_ungetc0,
+				       1, &c);
+}
+
+static VALUE
+ossl_ssl_buffer_eof_p0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+    struct ossl_ssl_buffer *buf = args->buf;
+
+    if (!buf->eof && buf->rlen == 0)
+	ossl_ssl_rbuf_fill(args->self, buf, OSSL_SSL_BLOCK_SIZE);
+
+    return (buf->eof && buf->rlen == 0) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *    ssl.eof? => true or false
+ *
+ * Returns true if the peer closed the connection and everything it sent
+ * has been read.  Blocks until data arrives if nothing is buffered.
+ */
+static VALUE
+ossl_ssl_buffer_eof_p(VALUE self)
+{
+    return ossl_ssl_buffer_synchronize(self, 0, ossl_ssl_buffer_eof_p0, 0, 0);
+}
+
+/*
+ * for writing.
+ */
+
+static void
+ossl_ssl_wbuf_append(struct ossl_ssl_buffer *buf, const char *ptr, long len)
+{
+    if (buf->wcapa - buf->woff - buf->wlen < len) {
+	if (buf->woff > 0) {
+	    memmove(buf->wbuf, buf->wbuf + buf->woff, buf->wlen);
+	    buf->woff = 0;
+	}
+	if (buf->wcapa - buf->wlen < len) {
+	    buf->wcapa = buf->wlen + len;
+	    if (buf->wcapa < OSSL_SSL_BLOCK_SIZE)
+		buf->wcapa = OSSL_SSL_BLOCK_SIZE;
+	    REALLOC_N(buf->wbuf, char, buf->wcapa);
+	}
+    }
+    memcpy(buf->wbuf + buf->woff + buf->wlen, ptr, len);
+    buf->wlen += len;
+}
+
+/*
+ * Writes out the first +len+ buffered bytes.  What has been written is
+ * dropped from the buffer as it goes, so nothing is sent twice if a later
+ * write raises.
+ */
+static void
+ossl_ssl_wbuf_flush(VALUE self, struct ossl_ssl_buffer *buf, long len)
+{
+    SSL *ssl;
+    VALUE n;
+    long nwrote;
+
+    Data_Get_Struct(self, SSL, ssl);
+    while (len > 0) {
+	nwrote = len > INT_MAX ? INT_MAX : len;
+	if (ssl) {
+	    nwrote = ossl_ssl_write_raw(self, buf->wbuf + buf->woff,
+					(int)nwrote, 0, 0);
+	}
+	else {
+	    /* #syswrite warns and falls back to the underlying io */
+	    n = rb_funcall(self, id_syswrite, 1,
+			   rb_str_new(buf->wbuf + buf->woff, nwrote));
+	    nwrote = NUM2LONG(n);
+	}
+	buf->woff += nwrote;
+	buf->wlen -= nwrote;
+	len -= nwrote;
+    }
+    if (buf->wlen == 0) {
+	buf->woff = 0;
+	if (buf->wcapa > 4 * OSSL_SSL_BLOCK_SIZE) {
+	    buf->wcapa = OSSL_SSL_BLOCK_SIZE;
+	    REALLOC_N(buf->wbuf, char, buf->wcapa);
+	}
+    }
+}
+
+static VALUE
+ossl_ssl_buffer_do_write0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+    struct ossl_ssl_buffer *buf = args->buf;
+    VALUE str;
+    long len = 0, idx;
+    int i;
+
+    for (i = 0; i < args->argc; i++) {
+	str = args->argv[i];
+	ossl_ssl_wbuf_append(buf, RSTRING_PTR(str), RSTRING_LEN(str));
+	len += RSTRING_LEN(str);
+    }
+    if (RTEST(rb_attr_get(args->self, id_sync))) {
+	ossl_ssl_wbuf_flush(args->self, buf, buf->wlen);
+	return Qnil;
+    }
+    if (buf->wlen > OSSL_SSL_BLOCK_SIZE) {
+	/* full records first, then the line ends in what is left */
+	ossl_ssl_wbuf_flush(args->self, buf,
+			    buf->wlen - buf->wlen % OSSL_SSL_BLOCK_SIZE);
+    }
+    if (!NIL_P(rb_rs)) {
+	/* everything up to the last line end; older data had none */
+	idx = ossl_ssl_buffer_rindex(buf->wbuf + buf->woff, buf->wlen,
+				     buf->wlen - len - RSTRING_LEN(rb_rs) + 1,
+				     RSTRING_PTR(rb_rs), RSTRING_LEN(rb_rs));
+	if (idx >= 0)
+	    ossl_ssl_wbuf_flush(args->self, buf, idx + RSTRING_LEN(rb_rs));
+    }
+
+    return Qnil;
+}
+
+/*
+ * Appends the Strings in +argv+ to the write buffer and writes out as much
+ * as #sync, the line ends and the buffer size call for.
+ */
+static void
+ossl_ssl_buffer_writev(VALUE self, int argc, VALUE *argv)
+{
+    VALUE strs;
+    int i;
+
+    /* frozen copies, since waiting for the lock lets other threads run */
+    strs = rb_ary_new2(argc);
+    for (i = 0; i < argc; i++)
+	rb_ary_push(strs, rb_str_new_frozen(argv[i]));
+    ossl_ssl_buffer_synchronize(self, 1, ossl_ssl_buffer_do_write0,
+				argc, RARRAY_PTR(strs));
+    RB_GC_GUARD(strs);
+}
+
+static VALUE
+ossl_ssl_buffer_do_write(VALUE self, VALUE str)
+{
+    StringValue(str);
+    ossl_ssl_buffer_writev(self, 1, &str);
+
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *    ssl.write(obj, ...) => integer
+ *
+ * Writes the given objects, converted with to_s, to the SSL connection.
+ * Data is buffered until a line is complete, a TLS record is full, or
+ * #sync is set; several objects are gathered into the same records.
+ * Returns the number of bytes written.
+ */
+static VALUE
+ossl_ssl_buffer_write(int argc, VALUE *argv, VALUE self)
+{
+    VALUE strs;
+    long len = 0;
+    int i;
+
+    strs = rb_ary_new2(argc);
+    for (i = 0; i < argc; i++) {
+	rb_ary_push(strs, rb_obj_as_string(argv[i]));
+	len += RSTRING_LEN(RARRAY_PTR(strs)[i]);
+    }
+    ossl_ssl_buffer_writev(self, argc, RARRAY_PTR(strs));
+    RB_GC_GUARD(strs);
+
+    return LONG2NUM(len);
+}
+
+static VALUE
+ossl_ssl_buffer_flush0(VALUE ptr)
+{
+    struct ossl_ssl_buffer_args *args = (struct ossl_ssl_buffer_args *)ptr;
+
+    ossl_ssl_wbuf_flush(args->self, args->buf, args->buf->wlen);
+
+    return args->self;
+}
+
+/*
+ * call-seq:
+ *    ssl.flush => self
+ *
+ * Writes out everything that is buffered.
+ */
+static VALUE
+ossl_ssl_buffer_flush(VALUE self)
+{
+    return ossl_ssl_buffer_synchronize(self, 1, ossl_ssl_buffer_flush0, 0, 0);
+}
+
+void
+Init_ossl_ssl_buffer()
+{
+#if 0
+    mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
+    mSSL = rb_define_module_under(mOSSL, "SSL");
+    cSSLSocket = rb_define_class_under(mSSL, "SSLSocket", rb_cObject);
+#endif
+
+    id_buffer = rb_intern("buffer");
+    id_sync = rb_intern("@sync");
+    id_sysread = rb_intern("sysread");
+    id_sysread_nonblock = rb_intern("sysread_nonblock");
+    id_syswrite = rb_intern("syswrite");
+    id_chr = rb_intern("chr");
+    id_end = rb_intern("end");
+
+    rb_define_method(cSSLSocket, "read", ossl_ssl_buffer_read, -1);
+    rb_define_method(cSSLSocket, "readpartial", ossl_ssl_buffer_readpartial, -1);
+    rb_define_method(cSSLSocket, "read_nonblock", ossl_ssl_buffer_read_nonblock, -1);
+    rb_define_method(cSSLSocket, "gets", ossl_ssl_buffer_gets, -1);
+    rb_define_method(cSSLSocket, "ungetc", ossl_ssl_buffer_ungetc, 1);
+    rb_define_method(cSSLSocket, "eof?", ossl_ssl_buffer_eof_p, 0);
+    rb_define_alias(cSSLSocket, "eof", "eof?");
+    rb_define_method(cSSLSocket, "write", ossl_ssl_buffer_write, -1);
+    rb_define_method(cSSLSocket, "flush", ossl_ssl_buffer_flush, 0);
+    rb_define_private_method(cSSLSocket, "do_write", ossl_ssl_buffer_do_write, 1);
+}
@@ -0,0 +1,483 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#include "ossl.h"
+
+#if defined(HAVE_MMAP) && defined(HAVE_PTHREAD_H) && \
+    defined(HAVE_PTHREAD_MUTEXATTR_SETPSHARED) && defined(HAVE_SSL_SESSION_GET_ID)
+#  define OSSL_SSL_CACHE_ENABLED
+#  include <sys/mman.h>
+#  include <pthread.h>
+#  if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#    define MAP_ANON MAP_ANONYMOUS
+#  endif
+#endif
+
+VALUE cSSLSessionCache;
+
+#if defined(OSSL_SSL_CACHE_ENABLED)
+/*
+ * Shared session cache
+ *
+ * Sessions are kept DER encoded in an anonymous shared mapping, so that
+ * processes forked after the cache was created all see the same sessions.
+ * The mapping is split into sets of OSSL_SSL_CACHE_WAYS slots; a session
+ * ID hashes to one set and only that set is locked while it is looked up
+ * or stored.  The locks are process-shared and, where supported, robust:
+ * a set whose owner died with the lock held is emptied and used again.
+ *
+ * The callbacks below never call into Ruby, so handshakes that resume from
+ * this cache keep running without the GVL.
+ *
+ * The SessionCache object and every SSL_CTX using it hold a reference to
+ * the struct below; the mapping goes away with the last one, whichever
+ * of them is freed last.
+ */
+#define OSSL_SSL_CACHE_WAYS 8
+#define OSSL_SSL_CACHE_MAX_DER 4096
+
+struct ossl_ssl_cache_slot {
+    time_t expires;
+    unsigned int id_len;
+    unsigned int der_len;
+    unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    unsigned char der[OSSL_SSL_CACHE_MAX_DER];
+};
+
+struct ossl_ssl_cache_set {
+    pthread_mutex_t lock;
+    unsigned long hits, misses, stores, evictions, expired;
+    struct ossl_ssl_cache_slot slots[OSSL_SSL_CACHE_WAYS];
+};
+
+struct ossl_ssl_cache {
+    struct ossl_ssl_cache_set *sets;
+    long nsets;
+    size_t len;
+    int references;
+};
+
+static int ossl_ssl_cache_ex_idx;
+
+static void
+ossl_ssl_cache_free(struct ossl_ssl_cache *cache)
+{
+    if (cache && CRYPTO_add(&cache->references, -1, CRYPTO_LOCK_SSL_CTX) == 0) {
+	munmap((void *)cache->sets, cache->len);
+	free(cache);
+    }
+}
+
+/* drops the reference of an SSL_CTX when it is freed */
+static void
+ossl_ssl_cache_ex_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx,
+		       long argl, void *argp)
+{
+    ossl_ssl_cache_free(ptr);
+}
+
+static VALUE
+ossl_ssl_cache_s_alloc(VALUE klass)
+{
+    return Data_Wrap_Struct(klass, 0, ossl_ssl_cache_free, 0);
+}
+
+#define GetSSLSessionCache(obj, cache) do { \
+	Data_Get_Struct((obj), struct ossl_ssl_cache, (cache)); \
+	if (!(cache)) { \
+		ossl_raise(rb_eRuntimeError, "SessionCache wasn't initialized."); \
+	} \
+} while (0)
+
+/*
+ * Locks +set+ and returns 0, or returns -1 if it can't be locked.  A set
+ * whose holder died is emptied and made usable again; one that can't be
+ * recovered stays out of use for good, in every process.
+ */
+static int
+ossl_ssl_cache_set_lock(struct ossl_ssl_cache_set *set)
+{
+#if defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST)
+    int i;
+#endif
+
+    switch (pthread_mutex_lock(&set->lock)) {
+    case 0:
+	return 0;
+#if defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST)
+    case EOWNERDEAD:
+	/* the slots may be half written */
+	for (i = 0; i < OSSL_SSL_CACHE_WAYS; i++)
+	    set->slots[i].id_len = 0;
+	if (pthread_mutex_consistent(&set->lock) != 0) {
+	    pthread_mutex_unlock(&set->lock);
+	    return -1;
+	}
+	return 0;
+#endif
+    default:
+	return -1;
+    }
+}
+
+/*
+ * Returns the set +id+ belongs in, locked, or NULL if it can't be locked;
+ * a lookup then misses and a store is skipped.
+ */
+static struct ossl_ssl_cache_set *
+ossl_ssl_cache_lock(struct ossl_ssl_cache *cache, const unsigned char *id,
+		    unsigned int len)
+{
+    struct ossl_ssl_cache_set *set;
+    unsigned long h = 2166136261UL;	/* FNV-1a */
+    unsigned int i;
+
+    for (i = 0; i < len; i++)
+	h = (h ^ id[i]) * 16777619UL;
+    set = &cache->sets[h % cache->nsets];
+
+    return ossl_ssl_cache_set_lock(set) == 0 ? set : NULL;
+}
+
+static struct ossl_ssl_cache_slot *
+ossl_ssl_cache_find(struct ossl_ssl_cache_set *set, const unsigned char *id,
+		    unsigned int len)
+{
+    struct ossl_ssl_cache_slot *slot;
+    int i;
+
+    for (i = 0; i < OSSL_SSL_CACHE_WAYS; i++) {
+	slot = &set->slots[i];
+	if (slot->id_len == len && memcmp(slot->id, id, len) == 0)
+	    return slot;
+    }
+
+    return NULL;
+}
+
+static SSL_SESSION *
+ossl_ssl_cache_get_cb(SSL *ssl, unsigned char *id, int len, int *copy)
+{
+    struct ossl_ssl_cache *cache;
+    struct ossl_ssl_cache_set *set;
+    struct ossl_ssl_cache_slot *slot;
+    unsigned char der[OSSL_SSL_CACHE_MAX_DER];
+    const unsigned char *p = der;
+    unsigned int der_len = 0;
+
+    *copy = 0;
+    cache = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ossl_ssl_cache_ex_idx);
+    if (!cache || len <= 0 || len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+	return NULL;
+
+    if (!(set = ossl_ssl_cache_lock(cache, id, len)))
+	return NULL;
+    slot = ossl_ssl_cache_find(set, id, len);
+    if (slot && slot->expires <= time(NULL)) {
+	slot->id_len = 0;
+	set->expired++;
+	slot = NULL;
+    }
+    if (slot) {
+	der_len = slot->der_len;
+	memcpy(der, slot->der, der_len);
+	set->hits++;
+    }
+    else
+	set->misses++;
+    pthread_mutex_unlock(&set->lock);
+
+    return der_len ? d2i_SSL_SESSION(NULL, &p, der_len) : NULL;
+}
+
+static int
+ossl_ssl_cache_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    struct ossl_ssl_cache *cache;
+    struct ossl_ssl_cache_set *set;
+    struct ossl_ssl_cache_slot *slot, *s;
+    unsigned char der[OSSL_SSL_CACHE_MAX_DER], *p = der;
+    unsigned int id_len;
+    const unsigned char *id;
+    time_t now = time(NULL);
+    int der_len, i;
+
+    cache = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ossl_ssl_cache_ex_idx);
+    if (!cache)
+	return 0;
+    id = SSL_SESSION_get_id(sess, &id_len);
+    if (id_len == 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+	return 0;
+    /* too large sessions, e.g. with a long client chain, are not shared */
+    der_len = i2d_SSL_SESSION(sess, NULL);
+    if (der_len <= 0 || der_len > OSSL_SSL_CACHE_MAX_DER)
+	return 0;
+    i2d_SSL_SESSION(sess, &p);
+
+    if (!(set = ossl_ssl_cache_lock(cache, id, id_len)))
+	return 0;
+    slot = ossl_ssl_cache_find(set, id, id_len);
+    for (i = 0; !slot && i < OSSL_SSL_CACHE_WAYS; i++) {
+	s = &set->slots[i];
+	if (s->id_len == 0 || s->expires <= now)
+	    slot = s;
+    }
+    if (!slot) {
+	/* evict whatever expires first */
+	slot = &set->slots[0];
+	for (i = 1; i < OSSL_SSL_CACHE_WAYS; i++) {
+	    if (set->slots[i].expires < slot->expires)
+		slot = &set->slots[i];
+	}
+	set->evictions++;
+    }
+    slot->expires = SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess);
+    slot->id_len = id_len;
+    memcpy(slot->id, id, id_len);
+    slot->der_len = der_len;
+    memcpy(slot->der, der, der_len);
+    set->stores++;
+    pthread_mutex_unlock(&set->lock);
+
+    /* the session isn't kept, OpenSSL may free it */
+    return 0;
+}
+
+/*
+ * Makes +ctx+ store and look up sessions in the SessionCache +obj+.  The
+ * Ruby session callbacks of the SSLContext are not used then.
+ *
+ * Sessions are kept out of the internal cache of +ctx+ and no remove
+ * callback is installed: what one process flushes, evicts or frees with
+ * its SSL_CTX must stay available to the others.  Sessions leave the
+ * shared cache only when they expire, are replaced or SessionCache#flush
+ * is called.
+ */
+void
+ossl_ssl_cache_setup(SSL_CTX *ctx, VALUE obj)
+{
+    struct ossl_ssl_cache *cache, *old;
+
+    OSSL_Check_Kind(obj, cSSLSessionCache);
+    GetSSLSessionCache(obj, cache);
+    old = SSL_CTX_get_ex_data(ctx, ossl_ssl_cache_ex_idx);
+    if (old != cache) {
+	CRYPTO_add(&cache->references, 1, CRYPTO_LOCK_SSL_CTX);
+	SSL_CTX_set_ex_data(ctx, ossl_ssl_cache_ex_idx, cache);
+	ossl_ssl_cache_free(old);
+    }
+    SSL_CTX_set_session_cache_mode(ctx, SSL_CTX_get_session_cache_mode(ctx) |
+				   SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_get_cb(ctx, ossl_ssl_cache_get_cb);
+    SSL_CTX_sess_set_new_cb(ctx, ossl_ssl_cache_new_cb);
+}
+
+/*
+ * call-seq:
+ *    SessionCache.new => cache
+ *    SessionCache.new(size) => cache
+ *
+ * Creates a cache with room for about +size+ sessions, 4096 by default.
+ * The memory is shared with all processes forked afterwards, so create
+ * the cache before forking the workers and assign it to the SSLContext
+ * with SSLContext#shared_session_cache=.
+ *
+ * Sessions whose DER encoding exceeds 4KB, which happens with long client
+ * certificate chains, are not stored.
+ */
+static VALUE
+ossl_ssl_cache_initialize(int argc, VALUE *argv, VALUE self)
+{
+    struct ossl_ssl_cache *cache;
+    pthread_mutexattr_t attr;
+    VALUE size;
+    long nsets, i;
+    size_t len;
+    void *p;
+
+    if (DATA_PTR(self))
+	ossl_raise(rb_eRuntimeError, "SessionCache already initialized");
+    rb_scan_args(argc, argv, "01", &size);
+    nsets = NIL_P(size) ? 4096 : NUM2LONG(size);
+    if (nsets <= 0)
+	rb_raise(rb_eArgError, "size must be positive");
+    nsets = (nsets + OSSL_SSL_CACHE_WAYS - 1) / OSSL_SSL_CACHE_WAYS;
+    len = nsets * sizeof(struct ossl_ssl_cache_set);
+    if (len / sizeof(struct ossl_ssl_cache_set) != (size_t)nsets)
+	rb_raise(rb_eArgError, "size too large");
+
+    p = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+    if (p == MAP_FAILED)
+	rb_sys_fail("mmap");
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#if defined(HAVE_PTHREAD_MUTEXATTR_SETROBUST)
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    for (i = 0; i < nsets; i++)
+	pthread_mutex_init(&((struct ossl_ssl_cache_set *)p)[i].lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    /* malloc, not xmalloc: the last SSL_CTX may be freed without the GVL */
+    if (!(cache = malloc(sizeof(*cache)))) {
+	munmap(p, len);
+	rb_memerror();
+    }
+    cache->sets = p;
+    cache->nsets = nsets;
+    cache->len = len;
+    cache->references = 1;
+    DATA_PTR(self) = cache;
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *    cache.size => Integer
+ *
+ * Returns the number of sessions the cache can hold.
+ */
+static VALUE
+ossl_ssl_cache_size(VALUE self)
+{
+    struct ossl_ssl_cache *cache;
+
+    GetSSLSessionCache(self, cache);
+
+    return LONG2NUM(cache->nsets * OSSL_SSL_CACHE_WAYS);
+}
+
+/*
+ * call-seq:
+ *    cache.stats => Hash
+ *
+ * Returns a Hash with the following keys, counted over all processes:
+ *
+ * :hits:: Number of sessions found in the cache
+ * :misses:: Number of lookups that found nothing
+ * :stores:: Number of sessions stored
+ * :evictions:: Number of sessions dropped to make room for another one
+ * :expired:: Number of sessions found but dropped because they had expired
+ */
+static VALUE
+ossl_ssl_cache_stats(VALUE self)
+{
+    struct ossl_ssl_cache *cache;
+    struct ossl_ssl_cache_set *set;
+    unsigned long hits = 0, misses = 0, stores = 0, evictions = 0, expired = 0;
+    VALUE hash;
+    long i;
+
+    GetSSLSessionCache(self, cache);
+    /* the counters are only read, a torn sum is harmless */
+    for (i = 0; i < cache->nsets; i++) {
+	set = &cache->sets[i];
+	hits += set->hits;
+	misses += set->misses;
+	stores += set->stores;
+	evictions += set->evictions;
+	expired += set->expired;
+    }
+
+    hash = rb_hash_new();
+    rb_hash_aset(hash, ID2SYM(rb_intern("hits")), ULONG2NUM(hits));
+    rb_hash_aset(hash, ID2SYM(rb_intern("misses")), ULONG2NUM(misses));
+    rb_hash_aset(hash, ID2SYM(rb_intern("stores")), ULONG2NUM(stores));
+    rb_hash_aset(hash, ID2SYM(rb_intern("evictions")), ULONG2NUM(evictions));
+    rb_hash_aset(hash, ID2SYM(rb_intern("expired")), ULONG2NUM(expired));
+
+    return hash;
+}
+
+/*
+ * call-seq:
+ *    cache.flush => self
+ *
+ * Removes all sessions from the cache.
+ */
+static VALUE
+ossl_ssl_cache_flush(VALUE self)
+{
+    struct ossl_ssl_cache *cache;
+    struct ossl_ssl_cache_set *set;
+    long i;
+    int j;
+
+    GetSSLSessionCache(self, cache);
+    for (i = 0; i < cache->nsets; i++) {
+	set = &cache->sets[i];
+	if (ossl_ssl_cache_set_lock(set) != 0)
+	    continue;
+	for (j = 0; j < OSSL_SSL_CACHE_WAYS; j++)
+	    set->slots[j].id_len = 0;
+	pthread_mutex_unlock(&set->lock);
+    }
+
+    return self;
+}
+#else
+void
+ossl_ssl_cache_setup(SSL_CTX *ctx, VALUE obj)
+{
+    rb_notimplement();
+}
+#endif /* OSSL_SSL_CACHE_ENABLED */
+
+/*
+ * Adds the counters of the SessionCache +obj+ to +hash+, with their names
+ * prefixed by "shared_".
+ */
+void
+ossl_ssl_cache_add_stats(VALUE obj, VALUE hash)
+{
+#if defined(OSSL_SSL_CACHE_ENABLED)
+    static const char *keys[] = { "hits", "misses", "stores", "evictions", "expired", };
+    VALUE stats = ossl_ssl_cache_stats(obj);
+    char name[32];
+    int i;
+
+    for (i = 0; i < (int)(sizeof(keys)/sizeof(keys[0])); i++) {
+	snprintf(name, sizeof(name), "shared_%s", keys[i]);
+	rb_hash_aset(hash, ID2SYM(rb_intern(name)),
+		     rb_hash_aref(stats, ID2SYM(rb_intern(keys[i]))));
+    }
+#endif
+}
+
+void
+Init_ossl_ssl_cache()
+{
+#if 0
+    mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
+    mSSL = rb_define_module_under(mOSSL, "SSL");
+#endif
+#if defined(OSSL_SSL_CACHE_ENABLED)
+    ossl_ssl_cache_ex_idx =
+	SSL_CTX_get_ex_new_index(0,(void *)"ossl_ssl_cache_ex_idx",0,0,
+				 ossl_ssl_cache_ex_free);
+
+    /*
+     * Document-class: OpenSSL::SSL::SessionCache
+     *
+     * A session cache in shared memory for servers that fork.  All
+     * processes whose SSLContext uses the same SessionCache resume each
+     * other's sessions, without calling into Ruby.
+     *
+     *   cache = OpenSSL::SSL::SessionCache.new(10000)
+     *   ctx.shared_session_cache = cache
+     *   # fork workers ...
+     */
+    cSSLSessionCache = rb_define_class_under(mSSL, "SessionCache", rb_cObject);
+    rb_define_alloc_func(cSSLSessionCache, ossl_ssl_cache_s_alloc);
+    rb_define_method(cSSLSessionCache, "initialize", ossl_ssl_cache_initialize, -1);
+    rb_define_method(cSSLSessionCache, "size", ossl_ssl_cache_size, 0);
+    rb_define_method(cSSLSessionCache, "stats", ossl_ssl_cache_stats, 0);
+    rb_define_method(cSSLSessionCache, "flush", ossl_ssl_cache_flush, 0);
+#endif
+}
@@ -0,0 +1,313 @@
+/*
+ * 'OpenSSL for Ruby' project
+ * All rights reserved.
+ */
+/*
+ * This program is licenced under the same licence as Ruby.
+ * (See the file 'LICENCE'.)
+ */
+#include "ossl.h"
+
+#if defined(HAVE_INET_PTON)
+#  include <arpa/inet.h>
+#endif
+
+/*
+ * Hostname verification
+ *
+ * The names a certificate is for are taken out of it once and kept with
+ * the X509 as ex_data, so checking a host against a certificate again (on
+ * another connection that got the same X509 from the session, or through
+ * another Certificate sharing it) doesn't decode anything.  A Certificate
+ * that is about to be changed drops them; see GetX509Mutable().
+ *
+ * The names are the dNSName and iPAddress entries of subjectAltName, or,
+ * if there are none, the commonName entries of the subject.
+ */
+struct ossl_ssl_identity_name {
+    int type;			/* GEN_DNS or GEN_IPADD */
+    int len;
+    const unsigned char *data;
+};
+
+struct ossl_ssl_identity {
+    int num;
+    struct ossl_ssl_identity_name names[1];
+};
+
+static int ossl_ssl_identity_idx;
+
+static void
+ossl_ssl_identity_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+		       int idx, long argl, void *argp)
+{
+    if (ptr) OPENSSL_free(ptr);
+}
+
+void
+ossl_ssl_identity_forget(X509 *x509)
+{
+    void *id = X509_get_ex_data(x509, ossl_ssl_identity_idx);
+
+    if (id) {
+	X509_set_ex_data(x509, ossl_ssl_identity_idx, NULL);
+	OPENSSL_free(id);
+    }
+}
+
+/*
+ * Adds a name to +id+, or, while +id+ is NULL, only counts it in *num and
+ * *size.
+ */
+static void
+ossl_ssl_identity_add(struct ossl_ssl_identity *id, int *num, size_t *size,
+		      int type, const unsigned char *data, int len)
+{
+    unsigned char *buf;
+
+    if (id) {
+	buf = (unsigned char *)id + *size;
+	memcpy(buf, data, len);
+	id->names[*num].type = type;
+	id->names[*num].len = len;
+	id->names[*num].data = buf;
+    }
+    *num += 1;
+    *size += len;
+}
+
+/*
+ * Goes through the names of +x509+ twice: once to size the block, once
+ * to fill it in.
+ */
+static int
+ossl_ssl_identity_collect(X509 *x509, GENERAL_NAMES *alt,
+			  struct ossl_ssl_identity *id, size_t *size)
+{
+    GENERAL_NAME *gen;
+    X509_NAME *subject;
+    unsigned char *cn;
+    int i, num = 0, len;
+
+    for (i = 0; i < sk_GENERAL_NAME_num(alt); i++) {
+	gen = sk_GENERAL_NAME_value(alt, i);
+	if (gen->type == GEN_DNS) {
+	    ossl_ssl_identity_add(id, &num, size, GEN_DNS,
+				  gen->d.dNSName->data, gen->d.dNSName->length);
+	}
+	else if (gen->type == GEN_IPADD) {
+	    ossl_ssl_identity_add(id, &num, size, GEN_IPADD,
+				  gen->d.iPAddress->data,
+				  gen->d.iPAddress->length);
+	}
+    }
+    if (num > 0) return num;
+
+    subject = X509_get_subject_name(x509);
+    i = -1;
+    while ((i = X509_NAME_get_index_by_NID(subject, NID_commonName, i)) >= 0) {
+	len = ASN1_STRING_to_UTF8(&cn, X509_NAME_ENTRY_get_data(
+				      X509_NAME_get_entry(subject, i)));
+	if (len < 0) continue;
+	ossl_ssl_identity_add(id, &num, size, GEN_DNS, cn, len);
+	OPENSSL_free(cn);
+    }
+
+    return num;
+}
+
+static struct ossl_ssl_identity *
+ossl_ssl_identity_get(X509 *x509)
+{
+    struct ossl_ssl_identity *id;
+    GENERAL_NAMES *alt;
+    size_t size, head;
+    int num;
+
+    if ((id = X509_get_ex_data(x509, ossl_ssl_identity_idx)) != NULL) {
+	return id;
+    }
+    alt = X509_get_ext_d2i(x509, NID_subject_alt_name, NULL, NULL);
+    size = 0;
+    num = ossl_ssl_identity_collect(x509, alt, NULL, &size);
+    head = sizeof(*id) + sizeof(id->names[0]) * (num > 0 ? num - 1 : 0);
+    size += head;
+    if (!(id = OPENSSL_malloc(size))) {
+	GENERAL_NAMES_free(alt);
+	ossl_raise(eSSLError, "Memory alloc error");
+    }
+    size = head;
+    id->num = ossl_ssl_identity_collect(x509, alt, id, &size);
+    GENERAL_NAMES_free(alt);
+    if (!X509_set_ex_data(x509, ossl_ssl_identity_idx, id)) {
+	OPENSSL_free(id);
+	ossl_raise(eSSLError, NULL);
+    }
+
+    return id;
+}
+
+#define ossl_ascii_tolower(c) ((c) >= 'A' && (c) <= 'Z' ? (c) - 'A' + 'a' : (c))
+
+/*
+ * Matches one label of a host name.  A '*' takes one character and then
+ * as many more as the rest of the pattern leaves; only the last '*' seen
+ * ever needs to take more, so this doesn't backtrack any further.
+ */
+static int
+ossl_ssl_match_label(const unsigned char *pat, long plen,
+		     const unsigned char *host, long hlen)
+{
+    long pi = 0, hi = 0, star = -1, mark = 0;
+
+    while (hi < hlen) {
+	if (pi < plen && pat[pi] == '*') {
+	    star = pi++;
+	    mark = ++hi;
+	}
+	else if (pi < plen &&
+		 ossl_ascii_tolower(pat[pi]) == ossl_ascii_tolower(host[hi])) {
+	    pi++;
+	    hi++;
+	}
+	else if (star >= 0) {
+	    pi = star + 1;
+	    hi = ++mark;
+	}
+	else {
+	    return 0;
+	}
+    }
+
+    return pi == plen;
+}
+
+/*
+ * Matches +host+ against the DNS name +pat+ without regard to ASCII case.
+ * A '*' in +pat+ stands for one or more characters other than '.', so the
+ * two are compared label by label.
+ */
+static int
+ossl_ssl_match_dns(const unsigned char *pat, long plen,
+		   const unsigned char *host, long hlen)
+{
+    const unsigned char *pdot, *hdot;
+    long pl, hl;
+
+    for (;;) {
+	pdot = memchr(pat, '.', plen);
+	hdot = memchr(host, '.', hlen);
+	pl = pdot ? pdot - pat : plen;
+	hl = hdot ? hdot - host : hlen;
+	if (!ossl_ssl_match_label(pat, pl, host, hl))
+	    return 0;
+	if (!pdot || !hdot)
+	    return !pdot && !hdot;
+	pat += pl + 1; plen -= pl + 1;
+	host += hl + 1; hlen -= hl + 1;
+    }
+}
+
+#if !defined(HAVE_INET_PTON)
+/*
+ * Formats an iPAddress the way the subjectAltName extension prints it,
+ * for comparing with +host+ as text.
+ */
+static int
+ossl_ssl_format_ip(const unsigned char *ip, int len, char *buf)
+{
+    int i;
+
+    if (len == 4) {
+	return sprintf(buf, "%d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
+    }
+    if (len == 16) {
+	buf[0] = '\0';
+	for (i = 0; i < 16; i += 2) {
+	    sprintf(buf + strlen(buf), "%s%X", i ? ":" : "",
+		    ip[i] << 8 | ip[i + 1]);
+	}
+	return (int)strlen(buf);
+    }
+
+    return -1;
+}
+#endif
+
+/*
+ * call-seq:
+ *    OpenSSL::SSL.verify_certificate_identity(cert, hostname) => true or false
+ *
+ * Returns whether +cert+ is a certificate for +hostname+.  +hostname+ is
+ * matched against the DNS names and IP addresses in the subjectAltName
+ * extension of +cert+, or against the commonName of its subject if there
+ * are none.  DNS names are compared without regard to ASCII case and may
+ * contain '*', which matches one or more characters other than '.'.  IP
+ * addresses are compared in binary form.
+ */
+static VALUE
+ossl_ssl_verify_certificate_identity(VALUE self, VALUE cert, VALUE hostname)
+{
+    struct ossl_ssl_identity *id;
+    struct ossl_ssl_identity_name *name;
+    const unsigned char *host;
+    long hlen;
+    int i, iplen = 0;
+#if defined(HAVE_INET_PTON)
+    unsigned char ip[16];
+    char buf[64];
+#else
+    char ip[64];
+#endif
+
+    id = ossl_ssl_identity_get(GetX509CertPtr(cert));
+    StringValue(hostname);
+    host = (const unsigned char *)RSTRING_PTR(hostname);
+    hlen = RSTRING_LEN(hostname);
+#if defined(HAVE_INET_PTON)
+    if (hlen < (long)sizeof(buf) && !memchr(host, '\0', hlen)) {
+	memcpy(buf, host, hlen);
+	buf[hlen] = '\0';
+	if (inet_pton(AF_INET, buf, ip) == 1)
+	    iplen = 4;
+	else if (inet_pton(AF_INET6, buf, ip) == 1)
+	    iplen = 16;
+    }
+#endif
+
+    for (i = 0; i < id->num; i++) {
+	name = &id->names[i];
+	if (name->type == GEN_DNS) {
+	    if (ossl_ssl_match_dns(name->data, name->len, host, hlen))
+		return Qtrue;
+	}
+#if defined(HAVE_INET_PTON)
+	else if (iplen && name->len == iplen &&
+		 memcmp(name->data, ip, iplen) == 0) {
+	    return Qtrue;
+	}
+#else
+	else if ((iplen = ossl_ssl_format_ip(name->data, name->len, ip)) >= 0 &&
+		 iplen == hlen && memcmp(ip, host, hlen) == 0) {
+	    return Qtrue;
+	}
+#endif
+    }
+
+    return Qfalse;
+}
+
+void
+Init_ossl_ssl_hostname(void)
+{
+#if 0
+    mOSSL = rb_define_module("OpenSSL"); /* let rdoc know about mOSSL */
+    mSSL = rb_define_module_under(mOSSL, "SSL");
+#endif
+
+    ossl_ssl_identity_idx =
+	X509_get_ex_new_index(0,(void *)"ossl_ssl_identity_idx",0,0,ossl_ssl_identity_free);
+
+    rb_define_module_function(mSSL, "verify_certificate_identity",
+			      ossl_ssl_verify_certificate_identity, 2);
+}
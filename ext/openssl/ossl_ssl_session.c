@@ -27,10 +27,10 @@ static VALUE ossl_ssl_session_alloc(VALUE klass)
 
 /*
  * call-seq:
- *    Session.new(SSLSocket | string) => session
+ *    Session.new(SSLSocket | SSLEngine | string) => session
  *
  * === Parameters
- * +SSLSocket+ is an OpenSSL::SSL::SSLSocket
+ * +SSLSocket+ is an OpenSSL::SSL::SSLSocket or OpenSSL::SSL::SSLEngine
  * +string+ must be a DER or PEM encoded Session.
 */
 static VALUE ossl_ssl_session_initialize(VALUE self, VALUE arg1)
@@ -40,7 +40,8 @@ static VALUE ossl_ssl_session_initialize(VALUE self, VALUE arg1)
 	if (RDATA(self)->data)
 		ossl_raise(eSSLSession, "SSL Session already initialized");
 
-	if (rb_obj_is_instance_of(arg1, cSSLSocket)) {
+	if (rb_obj_is_instance_of(arg1, cSSLSocket) ||
+	    rb_obj_is_instance_of(arg1, cSSLEngine)) {
 		SSL *ssl;
 
 		Data_Get_Struct(arg1, SSL, ssl);
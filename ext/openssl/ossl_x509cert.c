@@ -26,6 +26,21 @@
     OSSL_Check_Kind(obj, cX509Cert); \
     GetX509(obj, x509); \
 } while (0)
+/*
+ * Certificates are shared, not copied: every Certificate wrapping the same
+ * X509, and OpenSSL itself, hold a reference to it.  Methods that change
+ * the certificate get it through GetX509Mutable(), which first swaps in a
+ * private copy if anybody else holds a reference, and drops the names
+ * hostname verification has kept with it.
+ */
+#define GetX509Mutable(obj, x509) do { \
+    rb_check_frozen(obj); \
+    GetX509(obj, x509); \
+    if (x509->references > 1) { \
+	x509 = ossl_x509_unshare(obj, x509); \
+    } \
+    ossl_ssl_identity_forget(x509); \
+} while (0)
 
 /*
  * Classes
@@ -33,6 +48,20 @@
 VALUE cX509Cert;
 VALUE eX509CertError;
 
+static X509 *
+ossl_x509_unshare(VALUE obj, X509 *x509)
+{
+    X509 *new;
+
+    if (!(new = X509_dup(x509))) {
+	ossl_raise(eX509CertError, NULL);
+    }
+    DATA_PTR(obj) = new;
+    X509_free(x509);
+
+    return new;
+}
+
 /*
  * Public
  */
@@ -45,7 +74,8 @@ ossl_x509_new(X509 *x509)
     if (!x509) {
 	new = X509_new();
     } else {
-	new = X509_dup(x509);
+	CRYPTO_add(&x509->references, 1, CRYPTO_LOCK_X509);
+	new = x509;
     }
     if (!new) {
 	ossl_raise(eX509CertError, NULL);
@@ -134,13 +164,15 @@ static VALUE
 ossl_x509_initialize(int argc, VALUE *argv, VALUE self)
 {
     BIO *in;
-    X509 *x509, *x = DATA_PTR(self);
+    X509 *x509, *x;
     VALUE arg;
 
     if (rb_scan_args(argc, argv, "01", &arg) == 0) {
 	/* create just empty X509Cert */
 	return self;
     }
+    /* the certificate is decoded into the X509 we have */
+    GetX509Mutable(self, x);
     arg = ossl_to_der_if_possible(arg);
     in = ossl_obj2bio(arg);
     x509 = PEM_read_bio_X509(in, &x, NULL, NULL);
@@ -167,8 +199,8 @@ ossl_x509_copy(VALUE self, VALUE other)
     GetX509(self, a);
     SafeGetX509(other, b);
 
-    x509 = X509_dup(b);
-    if (!x509) ossl_raise(eX509CertError, NULL);
+    x509 = b;
+    CRYPTO_add(&x509->references, 1, CRYPTO_LOCK_X509);
 
     DATA_PTR(self) = x509;
     X509_free(a);
@@ -298,7 +330,7 @@ ossl_x509_set_version(VALUE self, VALUE version)
     if ((ver = NUM2LONG(version)) < 0) {
 	ossl_raise(eX509CertError, "version must be >= 0!");
     }
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     if (!X509_set_version(x509, ver)) {
 	ossl_raise(eX509CertError, NULL);
     }
@@ -329,7 +361,7 @@ ossl_x509_set_serial(VALUE self, VALUE num)
 {
     X509 *x509;
 
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
 
     x509->cert_info->serialNumber =
 	num_to_asn1integer(num, X509_get_serialNumber(x509));
@@ -376,7 +408,7 @@ ossl_x509_get_subject(VALUE self)
 	ossl_raise(eX509CertError, NULL);
     }
 
-    return ossl_x509name_new(name);
+    return ossl_x509name_intern(name);
 }
 
 /*
@@ -388,7 +420,7 @@ ossl_x509_set_subject(VALUE self, VALUE subject)
 {
     X509 *x509;
 
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     if (!X509_set_subject_name(x509, GetX509NamePtr(subject))) { /* DUPs name */
 	ossl_raise(eX509CertError, NULL);
     }
@@ -411,7 +443,7 @@ ossl_x509_get_issuer(VALUE self)
 	ossl_raise(eX509CertError, NULL);
     }
 
-    return ossl_x509name_new(name);
+    return ossl_x509name_intern(name);
 }
 
 /*
@@ -423,7 +455,7 @@ ossl_x509_set_issuer(VALUE self, VALUE issuer)
 {
     X509 *x509;
 
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     if (!X509_set_issuer_name(x509, GetX509NamePtr(issuer))) { /* DUPs name */
 	ossl_raise(eX509CertError, NULL);
     }
@@ -460,7 +492,7 @@ ossl_x509_set_not_before(VALUE self, VALUE time)
     time_t sec;
 
     sec = time_to_time_t(time);
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     if (!X509_time_adj(X509_get_notBefore(x509), 0, &sec)) {
 	ossl_raise(eX509CertError, NULL);
     }
@@ -497,7 +529,7 @@ ossl_x509_set_not_after(VALUE self, VALUE time)
     time_t sec;
 
     sec = time_to_time_t(time);
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     if (!X509_time_adj(X509_get_notAfter(x509), 0, &sec)) {
 	ossl_raise(eX509CertError, NULL);
     }
@@ -532,7 +564,7 @@ ossl_x509_set_public_key(VALUE self, VALUE key)
 {
     X509 *x509;
 
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     if (!X509_set_pubkey(x509, GetPKeyPtr(key))) { /* DUPs pkey */
 	ossl_raise(eX509CertError, NULL);
     }
@@ -553,7 +585,7 @@ ossl_x509_sign(VALUE self, VALUE key, VALUE digest)
 
     pkey = GetPrivPKeyPtr(key); /* NO NEED TO DUP */
     md = GetDigestPtr(digest);
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     if (!X509_sign(x509, pkey, md)) {
 	ossl_raise(eX509CertError, NULL);
     }
@@ -651,7 +683,7 @@ ossl_x509_set_extensions(VALUE self, VALUE ary)
     for (i=0; i<RARRAY_LEN(ary); i++) {
 	OSSL_Check_Kind(RARRAY_PTR(ary)[i], cX509Ext);
     }
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     sk_X509_EXTENSION_pop_free(x509->cert_info->extensions, X509_EXTENSION_free);
     x509->cert_info->extensions = NULL;
     for (i=0; i<RARRAY_LEN(ary); i++) {
@@ -677,7 +709,7 @@ ossl_x509_add_extension(VALUE self, VALUE extension)
     X509 *x509;
     X509_EXTENSION *ext;
 
-    GetX509(self, x509);
+    GetX509Mutable(self, x509);
     ext = DupX509ExtPtr(extension);
     if (!X509_add_ext(x509, ext, -1)) { /* DUPs ext - FREE it */
 	X509_EXTENSION_free(ext);
@@ -733,6 +765,7 @@ Init_ossl_x509cert()
     cX509Cert = rb_define_class_under(mX509, "Certificate", rb_cObject);
 
     rb_define_alloc_func(cX509Cert, ossl_x509_alloc);
+    ossl_parse_cache_register(cX509Cert);
     rb_define_method(cX509Cert, "initialize", ossl_x509_initialize, -1);
     rb_define_copy_func(cX509Cert, ossl_x509_copy);
 
@@ -26,6 +26,14 @@
     OSSL_Check_Kind(obj, cX509CRL); \
     GetX509CRL(obj, crl); \
 } while (0)
+/* shared like certificates, see GetX509Mutable() */
+#define GetX509CRLMutable(obj, crl) do { \
+    rb_check_frozen(obj); \
+    GetX509CRL(obj, crl); \
+    if (crl->references > 1) { \
+	crl = ossl_x509crl_unshare(obj, crl); \
+    } \
+} while (0)
 
 /*
  * Classes
@@ -33,6 +41,20 @@
 VALUE cX509CRL;
 VALUE eX509CRLError;
 
+static X509_CRL *
+ossl_x509crl_unshare(VALUE obj, X509_CRL *crl)
+{
+    X509_CRL *new;
+
+    if (!(new = X509_CRL_dup(crl))) {
+	ossl_raise(eX509CRLError, NULL);
+    }
+    DATA_PTR(obj) = new;
+    X509_CRL_free(crl);
+
+    return new;
+}
+
 /*
  * PUBLIC
  */
@@ -63,7 +85,13 @@ ossl_x509crl_new(X509_CRL *crl)
     X509_CRL *tmp;
     VALUE obj;
 
-    tmp = crl ? X509_CRL_dup(crl) : X509_CRL_new();
+    if (crl) {
+	CRYPTO_add(&crl->references, 1, CRYPTO_LOCK_X509_CRL);
+	tmp = crl;
+    }
+    else {
+	tmp = X509_CRL_new();
+    }
     if(!tmp) ossl_raise(eX509CRLError, NULL);
     WrapX509CRL(cX509CRL, obj, tmp);
 
@@ -91,12 +119,13 @@ static VALUE
 ossl_x509crl_initialize(int argc, VALUE *argv, VALUE self)
 {
     BIO *in;
-    X509_CRL *crl, *x = DATA_PTR(self);
+    X509_CRL *crl, *x;
     VALUE arg;
 
     if (rb_scan_args(argc, argv, "01", &arg) == 0) {
 	return self;
     }
+    GetX509CRLMutable(self, x);
     arg = ossl_to_der_if_possible(arg);
     in = ossl_obj2bio(arg);
     crl = PEM_read_bio_X509_CRL(in, &x, NULL, NULL);
@@ -121,9 +150,8 @@ ossl_x509crl_copy(VALUE self, VALUE other)
     if (self == other) return self;
     GetX509CRL(self, a);
     SafeGetX509CRL(other, b);
-    if (!(crl = X509_CRL_dup(b))) {
-	ossl_raise(eX509CRLError, NULL);
-    }
+    crl = b;
+    CRYPTO_add(&crl->references, 1, CRYPTO_LOCK_X509_CRL);
     X509_CRL_free(a);
     DATA_PTR(self) = crl;
 
@@ -151,7 +179,7 @@ ossl_x509crl_set_version(VALUE self, VALUE version)
     if ((ver = NUM2LONG(version)) < 0) {
 	ossl_raise(eX509CRLError, "version must be >= 0!");
     }
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     if (!X509_CRL_set_version(crl, ver)) {
 	ossl_raise(eX509CRLError, NULL);
     }
@@ -188,7 +216,7 @@ ossl_x509crl_get_issuer(VALUE self)
 
     GetX509CRL(self, crl);
 
-    return ossl_x509name_new(X509_CRL_get_issuer(crl)); /* NO DUP - don't free */
+    return ossl_x509name_intern(X509_CRL_get_issuer(crl)); /* NO DUP - don't free */
 }
 
 static VALUE
@@ -196,7 +224,7 @@ ossl_x509crl_set_issuer(VALUE self, VALUE issuer)
 {
     X509_CRL *crl;
 
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
 
     if (!X509_CRL_set_issuer_name(crl, GetX509NamePtr(issuer))) { /* DUPs name */
 	ossl_raise(eX509CRLError, NULL);
@@ -221,7 +249,7 @@ ossl_x509crl_set_last_update(VALUE self, VALUE time)
     time_t sec;
 
     sec = time_to_time_t(time);
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     if (!X509_time_adj(crl->crl->lastUpdate, 0, &sec)) {
 	ossl_raise(eX509CRLError, NULL);
     }
@@ -246,7 +274,7 @@ ossl_x509crl_set_next_update(VALUE self, VALUE time)
     time_t sec;
 
     sec = time_to_time_t(time);
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     /* This must be some thinko in OpenSSL */
     if (!(crl->crl->nextUpdate = X509_time_adj(crl->crl->nextUpdate, 0, &sec))){
 	ossl_raise(eX509CRLError, NULL);
@@ -292,7 +320,7 @@ ossl_x509crl_set_revoked(VALUE self, VALUE ary)
     for (i=0; i<RARRAY_LEN(ary); i++) {
 	OSSL_Check_Kind(RARRAY_PTR(ary)[i], cX509Rev);
     }
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     sk_X509_REVOKED_pop_free(crl->crl->revoked, X509_REVOKED_free);
     crl->crl->revoked = NULL;
     for (i=0; i<RARRAY_LEN(ary); i++) {
@@ -312,7 +340,7 @@ ossl_x509crl_add_revoked(VALUE self, VALUE revoked)
     X509_CRL *crl;
     X509_REVOKED *rev;
 
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     rev = DupX509RevokedPtr(revoked);
     if (!X509_CRL_add0_revoked(crl, rev)) { /* NO DUP - don't free! */
 	ossl_raise(eX509CRLError, NULL);
@@ -329,7 +357,7 @@ ossl_x509crl_sign(VALUE self, VALUE key, VALUE digest)
     EVP_PKEY *pkey;
     const EVP_MD *md;
 
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     pkey = GetPrivPKeyPtr(key); /* NO NEED TO DUP */
     md = GetDigestPtr(digest);
     if (!X509_CRL_sign(crl, pkey, md)) {
@@ -466,7 +494,7 @@ ossl_x509crl_set_extensions(VALUE self, VALUE ary)
     for (i=0; i<RARRAY_LEN(ary); i++) {
 	OSSL_Check_Kind(RARRAY_PTR(ary)[i], cX509Ext);
     }
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     sk_X509_EXTENSION_pop_free(crl->crl->extensions, X509_EXTENSION_free);
     crl->crl->extensions = NULL;
     for (i=0; i<RARRAY_LEN(ary); i++) {
@@ -487,7 +515,7 @@ ossl_x509crl_add_extension(VALUE self, VALUE extension)
     X509_CRL *crl;
     X509_EXTENSION *ext;
 
-    GetX509CRL(self, crl);
+    GetX509CRLMutable(self, crl);
     ext = DupX509ExtPtr(extension);
     if (!X509_CRL_add_ext(crl, ext, -1)) { /* DUPs ext - FREE it */
 	X509_EXTENSION_free(ext);
@@ -509,6 +537,7 @@ Init_ossl_x509crl()
     cX509CRL = rb_define_class_under(mX509, "CRL", rb_cObject);
 
     rb_define_alloc_func(cX509CRL, ossl_x509crl_alloc);
+    ossl_parse_cache_register(cX509CRL);
     rb_define_method(cX509CRL, "initialize", ossl_x509crl_initialize, -1);
     rb_define_copy_func(cX509CRL, ossl_x509crl_copy);
 
@@ -103,6 +103,27 @@ ossl_x509extfactory_free(X509V3_CTX *ctx)
     OPENSSL_free(ctx);
 }
 
+/*
+ * The certificates, request and CRL are only kept in instance variables
+ * and looked up when an extension is created: a Certificate or CRL that
+ * is changed while shared gets a new X509 or X509_CRL, and the one seen
+ * when it was assigned may be gone by then.
+ */
+static void
+ossl_x509extfactory_resolve(VALUE self, X509V3_CTX *ctx)
+{
+    VALUE obj;
+
+    obj = rb_attr_get(self, rb_intern("@issuer_certificate"));
+    ctx->issuer_cert = NIL_P(obj) ? NULL : GetX509CertPtr(obj);
+    obj = rb_attr_get(self, rb_intern("@subject_certificate"));
+    ctx->subject_cert = NIL_P(obj) ? NULL : GetX509CertPtr(obj);
+    obj = rb_attr_get(self, rb_intern("@subject_request"));
+    ctx->subject_req = NIL_P(obj) ? NULL : GetX509ReqPtr(obj);
+    obj = rb_attr_get(self, rb_intern("@crl"));
+    ctx->crl = NIL_P(obj) ? NULL : GetX509CRLPtr(obj);
+}
+
 static VALUE
 ossl_x509extfactory_alloc(VALUE klass)
 {
@@ -121,8 +142,8 @@ ossl_x509extfactory_set_issuer_cert(VALUE self, VALUE cert)
     X509V3_CTX *ctx;
 
     GetX509ExtFactory(self, ctx);
+    OSSL_Check_Kind(cert, cX509Cert);
     rb_iv_set(self, "@issuer_certificate", cert);
-    ctx->issuer_cert = GetX509CertPtr(cert); /* NO DUP NEEDED */
 
     return cert;
 }
@@ -133,8 +154,8 @@ ossl_x509extfactory_set_subject_cert(VALUE self, VALUE cert)
     X509V3_CTX *ctx;
 
     GetX509ExtFactory(self, ctx);
+    OSSL_Check_Kind(cert, cX509Cert);
     rb_iv_set(self, "@subject_certificate", cert);
-    ctx->subject_cert = GetX509CertPtr(cert); /* NO DUP NEEDED */
 
     return cert;
 }
@@ -145,8 +166,8 @@ ossl_x509extfactory_set_subject_req(VALUE self, VALUE req)
     X509V3_CTX *ctx;
 
     GetX509ExtFactory(self, ctx);
+    OSSL_Check_Kind(req, cX509Req);
     rb_iv_set(self, "@subject_request", req);
-    ctx->subject_req = GetX509ReqPtr(req); /* NO DUP NEEDED */
 
     return req;
 }
@@ -157,8 +178,8 @@ ossl_x509extfactory_set_crl(VALUE self, VALUE crl)
     X509V3_CTX *ctx;
 
     GetX509ExtFactory(self, ctx);
+    OSSL_Check_Kind(crl, cX509CRL);
     rb_iv_set(self, "@crl", crl);
-    ctx->crl = GetX509CRLPtr(crl); /* NO DUP NEEDED */
 
     return crl;
 }
@@ -236,6 +257,7 @@ ossl_x509extfactory_create_ext(int argc, VALUE *argv, VALUE self)
     valstr = rb_str_new2(RTEST(critical) ? "critical," : "");
     rb_str_append(valstr, value);
     GetX509ExtFactory(self, ctx);
+    ossl_x509extfactory_resolve(self, ctx);
 #ifdef HAVE_X509V3_EXT_NCONF_NID
     rconf = rb_iv_get(self, "@config");
     conf = NIL_P(rconf) ? NULL : GetConfigPtr(rconf);
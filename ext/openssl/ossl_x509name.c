@@ -60,6 +60,54 @@ ossl_x509name_new(X509_NAME *name)
     return obj;
 }
 
+/*
+ * Names from certificates, CRLs and requests go through here, so that with
+ * X509::Name.intern_cache_size set a name that comes up again (the issuer
+ * of every certificate from one CA, say) is one frozen Name instead of a
+ * new copy each time.  The cache is a table indexed by a hash of the DER
+ * encoding; a name that hashes to a slot in use replaces what was there.
+ */
+static VALUE ossl_x509name_interned;
+
+static int
+ossl_x509name_same_der(X509_NAME *a, X509_NAME *b)
+{
+    if (i2d_X509_NAME(a, NULL) <= 0 || i2d_X509_NAME(b, NULL) <= 0) {
+	ossl_raise(eX509NameError, NULL);
+    }
+
+    return a->bytes->length == b->bytes->length &&
+	memcmp(a->bytes->data, b->bytes->data, a->bytes->length) == 0;
+}
+
+VALUE
+ossl_x509name_intern(X509_NAME *name)
+{
+    long size = RARRAY_LEN(ossl_x509name_interned), i;
+    X509_NAME *cached;
+    VALUE obj;
+
+    if (size == 0 || !name) {
+	return ossl_x509name_new(name);
+    }
+    if (i2d_X509_NAME(name, NULL) <= 0) { /* brings name->bytes up to date */
+	ossl_raise(eX509NameError, NULL);
+    }
+    i = rb_memhash(name->bytes->data, name->bytes->length) & (size - 1);
+    obj = RARRAY_PTR(ossl_x509name_interned)[i];
+    if (!NIL_P(obj)) {
+	GetX509Name(obj, cached);
+	if (ossl_x509name_same_der(name, cached)) {
+	    return obj;
+	}
+    }
+    obj = ossl_x509name_new(name);
+    OBJ_FREEZE(obj);
+    rb_ary_store(ossl_x509name_interned, i, obj);
+
+    return obj;
+}
+
 X509_NAME *
 GetX509NamePtr(VALUE obj)
 {
@@ -122,6 +170,7 @@ ossl_x509name_initialize(int argc, VALUE *argv, VALUE self)
     X509_NAME *name;
     VALUE arg, template;
 
+    rb_check_frozen(self);
     GetX509Name(self, name);
     if (rb_scan_args(argc, argv, "02", &arg, &template) == 0) {
 	return self;
@@ -161,6 +210,7 @@ VALUE ossl_x509name_add_entry(int argc, VALUE *argv, VALUE self)
     X509_NAME *name;
     VALUE oid, value, type;
 
+    rb_check_frozen(self);
     rb_scan_args(argc, argv, "21", &oid, &value, &type);
     StringValue(oid);
     StringValue(value);
@@ -174,6 +224,220 @@ VALUE ossl_x509name_add_entry(int argc, VALUE *argv, VALUE self)
     return self;
 }
 
+/*
+ * call-seq:
+ *    X509::Name.parse_openssl(string [, template]) => name
+ *    X509::Name.parse(string [, template]) => name
+ *
+ * Parses a name in the form X509::Name#to_s gives it, as in
+ * "/DC=org/DC=ruby-lang/CN=localhost".  Entries may also be separated by
+ * ','.
+ */
+static VALUE
+ossl_x509name_s_parse_openssl(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE str, template, ary, pair;
+    const char *p, *end, *seg, *eq;
+
+    rb_scan_args(argc, argv, "11", &str, &template);
+    if (argc < 2) template = OBJECT_TYPE_TEMPLATE;
+    StringValue(str);
+    ary = rb_ary_new();
+    p = RSTRING_PTR(str);
+    end = RSTRING_END(str);
+    while (p < end) {
+	if (*p == '/' || *p == ',') {
+	    p++;
+	    continue;
+	}
+	seg = p;
+	while (p < end && *p != '/' && *p != ',') p++;
+	/* leading white space goes, as long as something is left */
+	while (seg < p - 1 && ISSPACE(*seg)) seg++;
+	if ((eq = memchr(seg, '=', p - seg)) != NULL) {
+	    pair = rb_ary_new3(2, rb_str_new(seg, eq - seg),
+			       rb_str_new(eq + 1, p - eq - 1));
+	}
+	else {
+	    pair = rb_ary_new3(1, rb_str_new(seg, p - seg));
+	}
+	rb_ary_push(ary, pair);
+    }
+
+    return rb_funcall(klass, rb_intern("new"), 2, ary, template);
+}
+
+#define OSSL_RFC2253_SPECIAL ",=+<>#;"
+
+static int
+ossl_x509name_hexval(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * Appends the character escaped by the backslash before +p+ to +buf+ and
+ * returns where the value goes on, or NULL if it isn't a valid escape.
+ */
+static const char *
+ossl_x509name_rfc2253_pair(const char *p, const char *end, VALUE buf)
+{
+    char c;
+
+    if (p < end && *p && strchr(OSSL_RFC2253_SPECIAL "\\\"", *p)) {
+	rb_str_cat(buf, p, 1);
+	return p + 1;
+    }
+    if (end - p >= 2 && ossl_x509name_hexval(p[0]) >= 0 &&
+	ossl_x509name_hexval(p[1]) >= 0) {
+	c = (char)(ossl_x509name_hexval(p[0]) << 4 | ossl_x509name_hexval(p[1]));
+	rb_str_cat(buf, &c, 1);
+	return p + 2;
+    }
+
+    return NULL;
+}
+
+/*
+ * call-seq:
+ *    X509::Name::RFC2253DN.scan(dn) => [[type, value], ...]
+ *
+ * Splits an RFC 2253 distinguished name into [type, value] pairs, in the
+ * order X509::Name.new takes them (the reverse of the string).  A value
+ * given as #hexstring is the content of the DER encoded string, and its
+ * pair gets the ASN.1 tag as a third element.
+ */
+static VALUE
+ossl_x509name_rfc2253_scan(VALUE self, VALUE dn)
+{
+    const char *p, *end, *rdn, *start;
+    const unsigned char *der;
+    VALUE ary, type, value, hex;
+    long len;
+    int tag, xclass, ret;
+    char c;
+
+    StringValue(dn);
+    p = RSTRING_PTR(dn);
+    end = RSTRING_END(dn);
+    ary = rb_ary_new();
+    for (;;) {
+	rdn = p;
+	/* AttributeType: a keyword or a dotted OID */
+	if (p < end && ISALPHA(*p)) {
+	    while (++p < end && ISALNUM(*p));
+	}
+	else if (p < end && ISDIGIT(*p)) {
+	    for (;;) {
+		while (++p < end && ISDIGIT(*p));
+		if (end - p < 2 || *p != '.' || !ISDIGIT(p[1])) break;
+		p++;
+	    }
+	}
+	if (p == rdn || p >= end || *p != '=') goto malformed;
+	type = rb_str_new(rdn, p - rdn);
+	p++;
+
+	value = rb_str_new(0, 0);
+	tag = -1;
+	if (p < end && *p == '#') {
+	    hex = value;
+	    start = ++p;
+	    while (end - p >= 2 && ossl_x509name_hexval(p[0]) >= 0 &&
+		   ossl_x509name_hexval(p[1]) >= 0) {
+		c = (char)(ossl_x509name_hexval(p[0]) << 4 |
+			   ossl_x509name_hexval(p[1]));
+		rb_str_cat(hex, &c, 1);
+		p += 2;
+	    }
+	    if (p == start) goto malformed;
+	    der = (const unsigned char *)RSTRING_PTR(hex);
+	    ret = ASN1_get_object(&der, &len, &tag, &xclass, RSTRING_LEN(hex));
+	    if ((ret & 0x80) || (ret & V_ASN1_CONSTRUCTED) ||
+		xclass != V_ASN1_UNIVERSAL ||
+		(const char *)der + len != RSTRING_END(hex)) {
+		goto malformed;
+	    }
+	    value = rb_str_new((const char *)der, len);
+	}
+	else if (p < end && *p == '"') {
+	    p++;
+	    for (;;) {
+		if (p >= end) goto malformed;
+		if (*p == '"') break;
+		if (*p == '\\') {
+		    if (!(p = ossl_x509name_rfc2253_pair(p + 1, end, value)))
+			goto malformed;
+		    continue;
+		}
+		start = p;
+		while (p < end && *p != '"' && *p != '\\') p++;
+		rb_str_cat(value, start, p - start);
+	    }
+	    p++;
+	}
+	else {
+	    for (;;) {
+		if (p < end && *p == '\\') {
+		    if (!(p = ossl_x509name_rfc2253_pair(p + 1, end, value)))
+			goto malformed;
+		    continue;
+		}
+		start = p;
+		while (p < end && *p != '\\' && *p != '"' &&
+		       !memchr(OSSL_RFC2253_SPECIAL, *p, 7)) {
+		    p++;
+		}
+		if (p == start) break;
+		rb_str_cat(value, start, p - start);
+	    }
+	}
+
+	if (tag < 0) {
+	    rb_ary_unshift(ary, rb_ary_new3(2, type, value));
+	}
+	else {
+	    rb_ary_unshift(ary, rb_ary_new3(3, type, value, INT2FIX(tag)));
+	}
+	if (p == end) break;
+	if (*p == '+') {
+	    ossl_raise(eX509NameError, "multi-valued RDN is not supported: %.*s",
+		       (int)RSTRING_LEN(dn), RSTRING_PTR(dn));
+	}
+	if (*p != ',') goto malformed;
+	p++;
+    }
+
+    return ary;
+
+  malformed:
+    ERR_clear_error();
+    ossl_raise(eX509NameError, "malformed RDN: %.*s =>%.*s",
+	       (int)(rdn - RSTRING_PTR(dn)), RSTRING_PTR(dn),
+	       (int)(end - rdn), rdn);
+
+    return Qnil; /* not reached */
+}
+
+/*
+ * call-seq:
+ *    X509::Name.parse_rfc2253(string [, template]) => name
+ */
+static VALUE
+ossl_x509name_s_parse_rfc2253(int argc, VALUE *argv, VALUE klass)
+{
+    VALUE str, template;
+
+    rb_scan_args(argc, argv, "11", &str, &template);
+    if (argc < 2) template = OBJECT_TYPE_TEMPLATE;
+
+    return rb_funcall(klass, rb_intern("new"), 2,
+		      ossl_x509name_rfc2253_scan(Qnil, str), template);
+}
+
 static VALUE
 ossl_x509name_to_s_old(VALUE self)
 {
@@ -218,9 +482,41 @@ ossl_x509name_to_s(int argc, VALUE *argv, VALUE self)
     return str;
 }
 
+/*
+ * The short names of known OIDs, as frozen Strings by NID, so that every
+ * entry doesn't need a new one.
+ */
+static VALUE ossl_x509name_short_names;
+
+static VALUE
+ossl_x509name_short_name(ASN1_OBJECT *obj)
+{
+    char oid[128];
+    int nid;
+    VALUE str;
+
+    if ((nid = OBJ_obj2nid(obj)) == NID_undef) {
+	if (OBJ_obj2txt(oid, sizeof(oid), obj, 1) <= 0) {
+	    ossl_raise(eX509NameError, NULL);
+	}
+	return rb_str_new2(oid);
+    }
+    str = rb_hash_lookup(ossl_x509name_short_names, INT2FIX(nid));
+    if (NIL_P(str)) {
+	str = rb_str_new2(OBJ_nid2sn(nid));
+	OBJ_FREEZE(str);
+	rb_hash_aset(ossl_x509name_short_names, INT2FIX(nid), str);
+    }
+
+    return str;
+}
+
 /*
  * call-seq:
  *    name.to_a => [[name, data, type], ...]
+ *
+ * +name+ is the short name of the attribute, frozen and shared between
+ * calls, or its OID in dotted form if OpenSSL doesn't know it.
  */
 static VALUE
 ossl_x509name_to_a(VALUE self)
@@ -228,8 +524,6 @@ ossl_x509name_to_a(VALUE self)
     X509_NAME *name;
     X509_NAME_ENTRY *entry;
     int i,entries;
-    char long_name[512];
-    const char *short_name;
     VALUE ary, ret;
 
     GetX509Name(self, name);
@@ -243,11 +537,7 @@ ossl_x509name_to_a(VALUE self)
 	if (!(entry = X509_NAME_get_entry(name, i))) {
 	    ossl_raise(eX509NameError, NULL);
 	}
-	if (!i2t_ASN1_OBJECT(long_name, sizeof(long_name), entry->object)) {
-	    ossl_raise(eX509NameError, NULL);
-	}
-	short_name = OBJ_nid2sn(OBJ_ln2nid(long_name));
-	ary = rb_ary_new3(3, rb_str_new2(short_name),
+	ary = rb_ary_new3(3, ossl_x509name_short_name(entry->object),
         		  rb_str_new((const char *)entry->value->data, entry->value->length),
         		  INT2FIX(entry->value->type));
 	rb_ary_push(ret, ary);
@@ -255,6 +545,165 @@ ossl_x509name_to_a(VALUE self)
     return ret;
 }
 
+/*
+ * call-seq:
+ *    name.each_entry {|nid, data, type| ... } => self
+ *
+ * Yields the entries of the name in order, like #to_a, but with the NID
+ * of the attribute in place of its name (0 for OIDs OpenSSL doesn't know;
+ * see X509::Name.nid).
+ */
+static VALUE
+ossl_x509name_each_entry(VALUE self)
+{
+    X509_NAME *name;
+    X509_NAME_ENTRY *entry;
+    int i;
+
+    RETURN_ENUMERATOR(self, 0, 0);
+    GetX509Name(self, name);
+    for (i = 0; i < X509_NAME_entry_count(name); i++) {
+	if (!(entry = X509_NAME_get_entry(name, i))) {
+	    ossl_raise(eX509NameError, NULL);
+	}
+	rb_yield_values(3, INT2FIX(OBJ_obj2nid(entry->object)),
+			rb_str_new((const char *)entry->value->data,
+				   entry->value->length),
+			INT2FIX(entry->value->type));
+    }
+
+    return self;
+}
+
+/* the ASN1_OBJECT for a NID, or for a Symbol or String naming an OID */
+static ASN1_OBJECT *
+ossl_x509name_key2obj(VALUE key)
+{
+    ASN1_OBJECT *obj;
+    const char *txt;
+
+    if (FIXNUM_P(key)) {
+	if (!(obj = OBJ_nid2obj(FIX2INT(key)))) {
+	    ossl_raise(eX509NameError, "unknown NID %d", FIX2INT(key));
+	}
+	return obj;
+    }
+    txt = SYMBOL_P(key) ? rb_id2name(SYM2ID(key)) : StringValueCStr(key);
+    if (!(obj = OBJ_txt2obj(txt, 0))) {
+	ossl_raise(eX509NameError, "unknown OID `%s'", txt);
+    }
+
+    return obj;
+}
+
+/*
+ * call-seq:
+ *    name[oid] => string or nil
+ *
+ * The data of the last entry of +name+ for the attribute +oid+, which is
+ * a NID, or a Symbol or String holding a short name, long name or dotted
+ * OID, as in <code>name[:CN]</code>.  Raises X509::NameError if +oid+ is
+ * not an OID at all.
+ */
+static VALUE
+ossl_x509name_aref(VALUE self, VALUE key)
+{
+    X509_NAME *name;
+    X509_NAME_ENTRY *entry;
+    ASN1_OBJECT *obj;
+    int i, last = -1;
+
+    GetX509Name(self, name);
+    obj = ossl_x509name_key2obj(key);
+    i = -1;
+    while ((i = X509_NAME_get_index_by_OBJ(name, obj, i)) >= 0) {
+	last = i;
+    }
+    ASN1_OBJECT_free(obj);
+    if (last < 0 || !(entry = X509_NAME_get_entry(name, last))) {
+	return Qnil;
+    }
+
+    return rb_str_new((const char *)entry->value->data, entry->value->length);
+}
+
+/*
+ * call-seq:
+ *    X509::Name.nid(oid) => integer or nil
+ *
+ * The NID #each_entry yields for +oid+, a short name, long name or dotted
+ * OID, or nil if OpenSSL doesn't know it.
+ */
+static VALUE
+ossl_x509name_s_nid(VALUE klass, VALUE oid)
+{
+    const char *txt;
+    int nid;
+
+    txt = SYMBOL_P(oid) ? rb_id2name(SYM2ID(oid)) : StringValueCStr(oid);
+    if ((nid = OBJ_txt2nid(txt)) == NID_undef) {
+	return Qnil;
+    }
+
+    return INT2FIX(nid);
+}
+
+/*
+ * call-seq:
+ *    X509::Name.intern(name) => name
+ *
+ * A frozen Name equal to +name+, the same object each time as long as it
+ * stays in the cache; see X509::Name.intern_cache_size=.  With the cache
+ * off this is a frozen copy of +name+.
+ */
+static VALUE
+ossl_x509name_s_intern(VALUE klass, VALUE name)
+{
+    VALUE obj = ossl_x509name_intern(GetX509NamePtr(name));
+
+    OBJ_FREEZE(obj);
+
+    return obj;
+}
+
+/*
+ * call-seq:
+ *    X509::Name.intern_cache_size => integer
+ */
+static VALUE
+ossl_x509name_s_get_intern_cache_size(VALUE klass)
+{
+    return LONG2NUM(RARRAY_LEN(ossl_x509name_interned));
+}
+
+/*
+ * call-seq:
+ *    X509::Name.intern_cache_size = integer
+ *
+ * Makes Certificate#subject and #issuer, CRL#issuer and Request#subject
+ * return frozen Names shared through a cache of (at most) +integer+ of
+ * them, rounded up to a power of two.  0, the default, turns the cache
+ * off.  Setting the size empties the cache.
+ */
+static VALUE
+ossl_x509name_s_set_intern_cache_size(VALUE klass, VALUE size)
+{
+    long n = NUM2LONG(size), len = 0;
+
+    if (n < 0) {
+	ossl_raise(rb_eArgError, "negative cache size");
+    }
+    if (n > 0) {
+	for (len = 1; len < n; len <<= 1);
+    }
+    rb_ary_clear(ossl_x509name_interned);
+    if (len > 0) {
+	rb_ary_store(ossl_x509name_interned, len - 1, Qnil);
+    }
+
+    return size;
+}
+
 static int
 ossl_x509name_cmp0(VALUE self, VALUE other)
 {
@@ -347,7 +796,7 @@ ossl_x509name_to_der(VALUE self)
 void
 Init_ossl_x509name()
 {
-    VALUE utf8str, ptrstr, ia5str, hash;
+    VALUE utf8str, ptrstr, ia5str, hash, mRFC2253DN;
 
     id_aref = rb_intern("[]");
     eX509NameError = rb_define_class_under(mX509, "NameError", eOSSLError);
@@ -355,11 +804,25 @@ Init_ossl_x509name()
 
     rb_include_module(cX509Name, rb_mComparable);
 
+    ossl_x509name_short_names = rb_hash_new();
+    rb_global_variable(&ossl_x509name_short_names);
+    ossl_x509name_interned = rb_ary_new();
+    rb_global_variable(&ossl_x509name_interned);
+
     rb_define_alloc_func(cX509Name, ossl_x509name_alloc);
+    rb_define_singleton_method(cX509Name, "parse_openssl", ossl_x509name_s_parse_openssl, -1);
+    rb_define_singleton_method(cX509Name, "parse", ossl_x509name_s_parse_openssl, -1);
+    rb_define_singleton_method(cX509Name, "parse_rfc2253", ossl_x509name_s_parse_rfc2253, -1);
+    rb_define_singleton_method(cX509Name, "nid", ossl_x509name_s_nid, 1);
+    rb_define_singleton_method(cX509Name, "intern", ossl_x509name_s_intern, 1);
+    rb_define_singleton_method(cX509Name, "intern_cache_size", ossl_x509name_s_get_intern_cache_size, 0);
+    rb_define_singleton_method(cX509Name, "intern_cache_size=", ossl_x509name_s_set_intern_cache_size, 1);
     rb_define_method(cX509Name, "initialize", ossl_x509name_initialize, -1);
     rb_define_method(cX509Name, "add_entry", ossl_x509name_add_entry, -1);
     rb_define_method(cX509Name, "to_s", ossl_x509name_to_s, -1);
     rb_define_method(cX509Name, "to_a", ossl_x509name_to_a, 0);
+    rb_define_method(cX509Name, "each_entry", ossl_x509name_each_entry, 0);
+    rb_define_method(cX509Name, "[]", ossl_x509name_aref, 1);
     rb_define_method(cX509Name, "cmp", ossl_x509name_cmp, 1);
     rb_define_alias(cX509Name, "<=>", "cmp");
     rb_define_method(cX509Name, "eql?", ossl_x509name_eql, 1);
@@ -385,4 +848,7 @@ Init_ossl_x509name()
     rb_define_const(cX509Name, "RFC2253", ULONG2NUM(XN_FLAG_RFC2253));
     rb_define_const(cX509Name, "ONELINE", ULONG2NUM(XN_FLAG_ONELINE));
     rb_define_const(cX509Name, "MULTILINE", ULONG2NUM(XN_FLAG_MULTILINE));
+
+    mRFC2253DN = rb_define_module_under(cX509Name, "RFC2253DN");
+    rb_define_module_function(mRFC2253DN, "scan", ossl_x509name_rfc2253_scan, 1);
 }
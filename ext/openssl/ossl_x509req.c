@@ -264,7 +264,7 @@ ossl_x509req_get_subject(VALUE self)
 	ossl_raise(eX509ReqError, NULL);
     }
 
-    return ossl_x509name_new(name);
+    return ossl_x509name_intern(name);
 }
 
 static VALUE
@@ -25,6 +25,12 @@
 #define rb_io_t OpenFile
 #endif
 
+#if defined(HAVE_RB_IO_T_RBUF_LEN)
+#define FPTR_RBUF_LEN(fptr) ((fptr)->rbuf_len)
+#else
+#define FPTR_RBUF_LEN(fptr) ((fptr)->rbuf.len)
+#endif
+
 #ifndef HAVE_RB_STR_SET_LEN
 /* these methods should probably be backported to 1.8 */
 #define rb_str_set_len(str, length) do {	\
@@ -38,4 +44,11 @@
 #define rb_block_call(arg1, arg2, arg3, arg4, arg5, arg6) rb_iterate(rb_each, arg1, arg5, arg6)
 #endif /* ! HAVE_RB_BLOCK_CALL */
 
+#ifdef HAVE_RUBY_THREAD_H
+#include <ruby/thread.h>
+#elif defined(HAVE_RB_THREAD_CALL_WITH_GVL)
+/* exported by 1.9, but not declared in any public header */
+void *rb_thread_call_with_gvl(void *(*func)(void *), void *data1);
+#endif
+
 #endif /* _OSSL_RUBY_MISSING_H_ */
@@ -8,11 +8,72 @@ class OpenSSL::TestBN < Test::Unit::TestCase
     assert_equal((2 ** 107 - 1).to_bn, OpenSSL::BN.new((2 ** 107 - 1).to_s(16), 16))
   end
 
+  def test_integer_conversion
+    [0, 1, -1, 2 ** 62, -(2 ** 62), 2 ** 63 - 1, 2 ** 63, 2 ** 64 - 1, 2 ** 64,
+     -(2 ** 64), 3 ** 200, -(3 ** 200), 2 ** 1024 + 1].each {|i|
+      bn = OpenSSL::BN.new(i.to_s)
+      assert_equal(bn, i.to_bn, i.to_s)
+      assert_equal(bn, OpenSSL::BN.new(i), i.to_s)
+      assert_equal(i, bn.to_i, i.to_s)
+      assert_equal(i + 1, (bn + 1).to_i, i.to_s)
+    }
+    assert_equal([5, 6], 6.to_bn.coerce(5))
+  end
+
   def test_prime_p
     assert_equal(true, OpenSSL::BN.new((2 ** 107 - 1).to_s(16), 16).prime?)
     assert_equal(true, OpenSSL::BN.new((2 ** 127 - 1).to_s(16), 16).prime?(1))
   end
 
+  def test_threads
+    m = OpenSSL::BN.new((2 ** 127 - 1).to_s)
+    expected = (1..4).map {|i| (3 ** (1000 + i)) % (2 ** 127 - 1) }
+    results = (1..4).map {|i|
+      Thread.new { 3.to_bn.mod_exp((1000 + i).to_bn, m).to_i }
+    }.map(&:value)
+    assert_equal(expected, results)
+  end
+
+  def test_mont_context
+    m = 2 ** 127 - 1
+    mont = OpenSSL::BN::MontContext.new(m)
+    assert_equal(m, mont.modulus.to_i)
+    assert_equal(3.to_bn.mod_exp(1000, m), mont.mod_exp(3, 1000))
+    assert_equal((-5 * (m + 7)) % m, mont.mod_mul(-5, m + 7).to_i)
+    bases = (1..20).map {|i| (i * 7919) ** 3 }
+    assert_equal(bases.map {|b| b.to_bn.mod_exp(65537, m) }, mont.mod_exp_many(bases, 65537))
+    exps = (1..20).map {|i| 2 ** i + 1 }
+    assert_equal(bases.zip(exps).map {|b, e| b.to_bn.mod_exp(e, m) }, mont.mod_exp_many(bases, exps))
+    product = bases.zip(exps).inject(1) {|acc, (b, e)| acc * b.to_bn.mod_exp(e, m).to_i % m }
+    assert_equal(product, mont.multi_exp(bases, exps).to_i)
+    assert_equal(product * 5.to_bn.mod_exp(3, m).to_i % m, mont.multi_exp(bases + [5], exps + [3]).to_i)
+    assert_equal(1, mont.multi_exp([], []).to_i)
+    assert_raise(ArgumentError) { mont.mod_exp_many(bases, exps[1..-1]) }
+    assert_raise(ArgumentError) { OpenSSL::BN::MontContext.new(2 ** 127) }
+  end
+
+  def test_in_place
+    m = 2 ** 127 - 1
+    bn = OpenSSL::BN.new("12345")
+    assert_same(bn, bn.add!(5))
+    assert_equal(12350, bn.to_i)
+    assert_equal(12340, bn.sub!(10).to_i)
+    assert_equal(12340 * 3, bn.mul!(3).to_i)
+    assert_equal((12340 * 3) ** 2, bn.sqr!.to_i)
+    assert_equal((12340 * 3) ** 2 % 1000, bn.mod!(1000).to_i)
+    x = 3.to_bn
+    assert_equal(3.to_bn.mod_exp(2 ** 100, m), x.mod_exp!(2 ** 100, m))
+    y = x.to_i
+    assert_equal(y * y % m, x.mod_mul!(x, m).to_i)
+    x = m.to_bn
+    assert_equal(5, x.mod_add!(5, x).to_i)
+    x = 7.to_bn
+    assert_equal(7 ** 7 % 1000, x.mod_exp!(x, 1000).to_i)
+    assert_equal(6, 1.to_bn.add_all!([1, 2, 2.to_bn]).to_i)
+    assert_equal(120, 1.to_bn.mul_all!((1..5).to_a).to_i)
+    assert_equal(120 % 7, 1.to_bn.mul_all!((1..5).to_a, 7).to_i)
+  end
+
   def test_cmp_nil
     bn = OpenSSL::BN.new('1')
     assert_equal(false, bn == nil)
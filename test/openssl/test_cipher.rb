@@ -59,6 +59,18 @@ class OpenSSL::TestCipher < Test::Unit::TestCase
     assert_equal(s1, s2, "encrypt reset")
   end
 
+  def test_update_with_offset
+    @c1.encrypt.pkcs5_keyivgen(@key, @iv)
+    @c2.encrypt.pkcs5_keyivgen(@key, @iv)
+    expected = @c2.update(@data) + @c2.update(@data)
+    buf = "head"
+    assert_same(buf, @c1.update(@data, buf, buf.bytesize))
+    @c1.update(@data, buf, buf.bytesize)
+    assert_equal("head" + expected, buf)
+    assert_raise(ArgumentError) { @c1.update(@data, buf, buf.bytesize + 1) }
+    assert_raise(ArgumentError) { @c1.update(@data, nil, 1) }
+  end
+
   def test_empty_data
     @c1.encrypt
     assert_raise(ArgumentError){ @c1.update("") }
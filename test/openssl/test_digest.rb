@@ -47,6 +47,86 @@ class OpenSSL::TestDigest < Test::Unit::TestCase
     assert_equal(@d1.digest, @d1.clone.digest, "clone .digest")
   end
 
+  def test_digest_many
+    msgs = ["", @data, "x" * 100]
+    expected = msgs.map {|m| OpenSSL::Digest::MD5.digest(m) }
+    assert_equal(expected, OpenSSL::Digest.digest_many("MD5", msgs))
+    assert_equal(expected, OpenSSL::Digest::MD5.digest_many(msgs))
+    assert_equal(expected.join, OpenSSL::Digest.digest_many(@d1, msgs, :packed => true))
+    assert_equal([], OpenSSL::Digest.digest_many("MD5", []))
+    # large enough to be hashed without the GVL
+    msgs = (1..200).map {|i| i.to_s * 1000 }
+    assert_equal(msgs.map {|m| OpenSSL::Digest::MD5.digest(m) },
+                 OpenSSL::Digest::MD5.digest_many(msgs))
+    long = "y" * 200000
+    shrink = Object.new
+    shrink.define_singleton_method(:to_str) { long.replace("y"); "z" }
+    assert_equal([OpenSSL::Digest::MD5.digest("y" * 200000),
+                  OpenSSL::Digest::MD5.digest("z")],
+                 OpenSSL::Digest::MD5.digest_many([long, shrink]))
+    assert_raise(TypeError) { OpenSSL::Digest.digest_many("MD5", [1]) }
+  end
+
+  def test_tree
+    md5 = OpenSSL::Digest::MD5
+    leaves = %w[abcd efgh ij].map {|c| md5.digest("\0" + c) }
+    root = md5.digest("\1" + md5.digest("\1" + leaves[0] + leaves[1]) + leaves[2])
+    tree = OpenSSL::Digest::Tree.new("MD5", 4)
+    assert_nil(tree.root)
+    assert_equal(root, tree.digest("abcdefghij"))
+    assert_equal(root, tree.root)
+    assert_equal(leaves, tree.leaves)
+
+    # only leaf 1 is hashed again; a stale leaf 0 would show in the root
+    assert_equal(OpenSSL::Digest::Tree.new("MD5", 4).digest("abcdXXghij"),
+                 tree.digest("abcdXXghij", [1]))
+    assert_equal(OpenSSL::Digest::Tree.new("MD5", 4).digest("abcdXXghijklm"),
+                 tree.digest("abcdXXghijklm", []))
+    assert_equal([md5.digest("\0")], OpenSSL::Digest::Tree.new("MD5").tap {|t| t.digest("") }.leaves)
+
+    # the leaves must not be touched while they are being hashed
+    changed = Object.new
+    changed.define_singleton_method(:to_a) { tree.digest("abcd") }
+    assert_raise(RuntimeError) { tree.digest("abcdXXghij", changed) }
+    assert_equal(root, tree.digest("abcdefghij"))
+
+    Tempfile.open("tree") {|f|
+      f.write("abcdefghij")
+      f.flush
+      assert_equal(root, OpenSSL::Digest::Tree.new(@d1, 4).file(f.path))
+      assert_equal(root, OpenSSL::Digest::Tree.new(@d1, 4).file(f))
+    }
+  end
+
+  def test_file
+    data = @data * 100000
+    Tempfile.open("digest") {|f|
+      f.write(data)
+      f.flush
+      assert_same(@d1, @d1.file(f.path))
+      assert_equal(@md.update(data).digest, @d1.digest)
+      @d2 << "x"
+      File.open(f.path) {|io|
+        assert_equal(Digest::MD5.digest("x" + data), @d2.file(io).digest)
+        assert_equal(data.size, io.pos)
+      }
+      File.open(f.path) {|io|
+        io.seek(5000)
+        assert_equal(Digest::MD5.digest(data[5000..-1]),
+                     OpenSSL::Digest::MD5.new.file(io).digest)
+        io.seek(0)
+        io.getc
+        assert_raise(IOError) { OpenSSL::Digest::MD5.new.file(io) }
+      }
+    }
+    r, w = IO.pipe
+    th = Thread.new { w.write(data); w.close }
+    assert_equal(Digest::MD5.digest(data), OpenSSL::Digest::MD5.new.file(r).digest)
+    th.join
+    r.close
+    assert_raise(Errno::ENOENT) { @d1.file("/nonexistent/file") }
+  end
+
   def test_reset
     @d1.update(@data)
     dig1 = @d1.digest
@@ -77,6 +157,16 @@ class OpenSSL::TestDigest < Test::Unit::TestCase
       assert_equal(sha384_a, encode16(OpenSSL::Digest::SHA384.digest("a")))
       assert_equal(sha512_a, encode16(OpenSSL::Digest::SHA512.digest("a")))
     end
+
+    def test_digest_many_sha256
+      # lengths around the padding boundaries, in groups of uneven sizes
+      msgs = [0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 1000, 3].map {|n| "a" * n }
+      assert_equal(msgs.map {|m| OpenSSL::Digest::SHA256.digest(m) },
+                   OpenSSL::Digest::SHA256.digest_many(msgs))
+      msgs = (1..1000).map {|i| i.to_s * 20 }
+      assert_equal(msgs.map {|m| OpenSSL::Digest::SHA256.digest(m) }.join,
+                   OpenSSL::Digest::SHA256.digest_many(msgs, :packed => true))
+    end
   end
 end
 
@@ -24,6 +24,58 @@ class OpenSSL::TestHMAC < Test::Unit::TestCase
     assert_equal(OpenSSL::HMAC.hexdigest("MD5", @key, @data), @h2.hexdigest, "hexdigest")
   end
 
+  def test_file
+    Tempfile.open("hmac") {|f|
+      f.write(@data * 1000)
+      f.flush
+      expected = OpenSSL::HMAC.digest("MD5", @key, @data * 1000)
+      assert_equal(expected, @h1.file(f.path).digest)
+      File.open(f.path) {|io| assert_equal(expected, @h2.file(io).digest) }
+    }
+  end
+
+  def test_verify
+    mac = OpenSSL::HMAC.digest("SHA1", @key, @data)
+    assert_equal(true, OpenSSL::HMAC.verify("SHA1", @key, @data, mac))
+    assert_equal(true, OpenSSL::HMAC.verify("SHA1", @key, @data, mac.unpack("H*")[0], :encoding => :hex))
+    assert_equal(true, OpenSSL::HMAC.verify("SHA1", @key, @data, mac.unpack("H*")[0].upcase, :encoding => :hex))
+    assert_equal(true, OpenSSL::HMAC.verify("SHA1", @key, @data, [mac].pack("m0"), :encoding => :base64))
+    assert_equal(true, OpenSSL::HMAC.verify("SHA1", @key, @data, [mac].pack("m0").chomp("="), :encoding => :base64))
+    assert_equal(false, OpenSSL::HMAC.verify("SHA1", @key, @data + "x", mac))
+    assert_equal(false, OpenSSL::HMAC.verify("SHA1", @key, @data, mac[0, 10]))
+    assert_equal(false, OpenSSL::HMAC.verify("SHA1", @key, @data, "zz" * 20, :encoding => :hex))
+    assert_equal(false, OpenSSL::HMAC.verify("SHA1", @key, @data, mac, :encoding => :base64))
+    assert_raise(ArgumentError) { OpenSSL::HMAC.verify("SHA1", @key, @data, mac, :encoding => :rot13) }
+  end
+
+  def test_key
+    key = OpenSSL::HMAC::Key.new(@key * 30, "SHA256")
+    msgs = ["", @data, "x" * 100000, @data * 20000]
+    expected = msgs.map {|m| OpenSSL::HMAC.digest("SHA256", @key * 30, m) }
+    assert_equal(expected[1], key.digest(@data))
+    assert_equal(expected[1], key.digest(@data))
+    assert_equal(OpenSSL::HMAC.hexdigest("SHA256", @key * 30, @data), key.hexdigest(@data))
+    assert_equal(expected, key.sign_many(msgs))
+    assert_equal(expected.join, key.sign_many(msgs, :packed => true))
+    assert_equal([], key.sign_many([]))
+    long = "y" * 200000
+    shrink = Object.new
+    shrink.define_singleton_method(:to_str) { long.replace("y"); "z" }
+    assert_equal([OpenSSL::HMAC.digest("SHA256", @key * 30, "y" * 200000),
+                  OpenSSL::HMAC.digest("SHA256", @key * 30, "z")],
+                 key.sign_many([long, shrink]))
+    assert_equal(true, key.verify(@data, expected[1]))
+    assert_equal(false, key.verify(@data, expected[0]))
+    assert_equal(false, key.verify(@data, expected[1][0, 16]))
+    macs = expected.dup
+    macs[2] = macs[3]
+    assert_equal([true, true, false, true], key.verify_many(msgs, macs))
+    assert_raise(ArgumentError) { key.verify_many(msgs, macs[0, 2]) }
+    assert_raise(RuntimeError) { OpenSSL::HMAC::Key.allocate.digest(@data) }
+    assert_raise(RuntimeError) { key.send(:initialize, "other", "SHA1") }
+    assert_equal(expected[1], key.digest(@data))
+  end
+
   def test_dup
     @h1.update(@data)
     h = @h1.dup
@@ -3,6 +3,7 @@ require_relative 'utils'
 if defined?(OpenSSL)
 
 require 'socket'
+require 'fcntl'
 require_relative '../ruby/ut_eof'
 
 module SSLPair
@@ -103,6 +104,58 @@ class OpenSSL::TestPair < Test::Unit::TestCase
     }
   end
 
+  def test_gets_limit
+    ssl_pair {|s1, s2|
+      s2.write "abcdef\nghi\r\njkl"
+      s2.close
+      assert_equal("abc", s1.gets(3))
+      assert_equal("def\n", s1.gets("\n", 10))
+      assert_equal("ghi\r\n", s1.gets("\r\n"))
+      s1.ungetc("x")
+      assert_equal("xj", s1.gets(/j/))
+      assert_equal("kl", s1.gets)
+      assert_nil(s1.gets)
+      assert(s1.eof?)
+    }
+  end
+
+  def test_gets_regexp
+    ssl_pair {|s1, s2|
+      line = "x" * 100000 + "\r\n"
+      th = Thread.new { s2.write(line + "y\n"); s2.close }
+      "abc" =~ /b/
+      assert_equal(line, s1.gets(/\r?\n/))
+      assert_equal("y\n", s1.gets(/\r?\n/))
+      assert_equal("b", $~[0])
+      th.join
+    }
+  end
+
+  def test_read_large
+    ssl_pair {|s1, s2|
+      str = "x" * 100000
+      th = Thread.new { s2.write(str); s2.close }
+      buf = ""
+      assert_same(buf, s1.read(60000, buf))
+      assert_equal(60000, buf.size)
+      assert_equal(40000, s1.read.size)
+      th.join
+    }
+  end
+
+  def test_sysread_with_offset
+    ssl_pair {|s1, s2|
+      s2.write "abc"
+      buf = "12"
+      assert_same(buf, s1.sysread(10, buf, 2))
+      assert_equal("12abc", buf)
+      s2.write "def"
+      s1.readpartial(10, buf, buf.bytesize)
+      assert_equal("12abcdef", buf)
+      assert_raise(ArgumentError) { s1.sysread(10, buf, 100) }
+    }
+  end
+
   def test_readall
     ssl_pair {|s1, s2|
       s2.close
@@ -177,6 +230,37 @@ class OpenSSL::TestPair < Test::Unit::TestCase
     }
   end
 
+  def test_nonblock_without_exception
+    ssl_pair {|s1, s2|
+      assert_equal(:wait_readable, s2.read_nonblock(10, :exception => false))
+      s1.write "abc"
+      IO.select([s2])
+      assert_equal("abc", s2.read_nonblock(10, :exception => false))
+      ret = nil
+      100.times {
+        ret = s1.write_nonblock("a" * 100000, :exception => false)
+        break if Symbol === ret
+      }
+      assert_equal(:wait_writable, ret)
+      assert_equal(false, s2.shutdown_nonblock(:exception => false))
+    }
+  end
+
+  def test_nonblock_without_exception_before_handshake
+    s1, s2 = UNIXSocket.pair
+    ssl = OpenSSL::SSL::SSLSocket.new(s1, OpenSSL::SSL::SSLContext.new)
+    verbose, $VERBOSE = $VERBOSE, nil
+    assert_equal(:wait_readable, ssl.read_nonblock(10, :exception => false))
+    s2.write("abc")
+    assert_equal("abc", ssl.read_nonblock(10, :exception => false))
+    assert_equal(3, ssl.write_nonblock("def", :exception => false))
+    assert_equal("def", s2.read(3))
+  ensure
+    $VERBOSE = verbose
+    s1.close if s1
+    s2.close if s2
+  end
+
   def test_write_nonblock_with_buffered_data
     ssl_pair {|s1, s2|
       s1.write "foo"
@@ -187,6 +271,194 @@ class OpenSSL::TestPair < Test::Unit::TestCase
     }
   end
 
+  def test_write_long_line_without_sync
+    ssl_pair {|s1, s2|
+      s1.sync = false
+      line = "x" * 20000 + "\n"
+      s1.write(line)
+      assert_equal(line, s2.gets)
+      s1.puts("y" * 40000)
+      assert_equal("y" * 40000 + "\n", s2.gets)
+    }
+  end
+
+  def test_syswritev
+    ssl_pair {|s1, s2|
+      pieces = ["a" * 100, "b" * 20000, "c" * 100]
+      stats = s1.write_stats
+      assert_equal(20200, s1.syswritev(*pieces))
+      assert_equal(stats[:bytes] + 20200, s1.write_stats[:bytes])
+      assert_equal(stats[:records] + 2, s1.write_stats[:records])
+      assert_operator(s1.write_stats[:syscalls], :>, stats[:syscalls])
+      assert_equal(3, s1.write("x", :y, 1))
+      s1.close
+      assert_equal(pieces.join + "xy1", s2.read)
+    }
+  end
+
+  def test_engine
+    sctx = OpenSSL::SSL::SSLContext.new
+    sctx.ciphers = "ADH"
+    sctx.tmp_dh_callback = proc { DHParam }
+    cctx = OpenSSL::SSL::SSLContext.new
+    cctx.ciphers = "ADH"
+    server = OpenSSL::SSL::SSLEngine.new(sctx)
+    client = OpenSSL::SSL::SSLEngine.new(cctx)
+    pump = proc {
+      while data = client.extract
+        server.inject(data)
+      end
+      while data = server.extract
+        client.inject(data)
+      end
+    }
+    done = 0
+    10.times {
+      done = [client.connect, server.accept].count(true)
+      break if done == 2
+      pump.call
+    }
+    assert_equal(2, done)
+    assert_equal(:wait_readable, server.read(10))
+    assert_equal(3, client.write("abc"))
+    assert_operator(client.output_pending, :>, 0)
+    pump.call
+    assert_equal(0, client.output_pending)
+    assert_equal("abc", server.read(10))
+    assert_equal(false, client.shutdown)
+    pump.call
+    assert_nil(server.read(10))
+  end
+
+  def test_read_and_write_from_different_threads
+    ssl_pair {|s1, s2|
+      str = "x" * 1000 + "\n"
+      echo = Thread.new { 100.times { s2.write(s2.gets) } }
+      reader = Thread.new { (1..100).map { s1.gets } }
+      100.times { s1.write(str) }
+      assert_equal([str] * 100, reader.value)
+      echo.join
+    }
+  end
+
+  def test_accept_many
+    ctx = OpenSSL::SSL::SSLContext.new
+    ctx.ciphers = "ADH"
+    ctx.tmp_dh_callback = proc { DHParam }
+    serv = TCPServer.new("127.0.0.1", 0)
+    port = serv.connect_address.ip_port
+    clients = (1..3).map {
+      Thread.new { client(port) }
+    }
+    pending = (1..3).map { OpenSSL::SSL::SSLSocket.new(serv.accept, ctx) }
+    garbage = TCPSocket.new("127.0.0.1", port)
+    garbage.write("not a handshake\r\n" * 10)
+    pending << OpenSSL::SSL::SSLSocket.new(serv.accept, ctx)
+    accepted, errors = [], {}
+    until pending.empty?
+      done, failed = OpenSSL::SSL::SSLSocket.accept_many(pending, 10)
+      assert_not_equal(0, done.size + failed.size)
+      accepted.concat(done)
+      errors.update(failed)
+      pending -= done + failed.keys
+    end
+    assert_equal(3, accepted.size)
+    assert_equal(1, errors.size)
+    assert_kind_of(OpenSSL::SSL::SSLError, errors.values.first)
+    clients.each_with_index {|th, i|
+      th.value.puts(i.to_s)
+    }
+    assert_equal(%w[0 1 2], accepted.map {|s| s.gets.chomp }.sort)
+    assert_equal([[], {}], OpenSSL::SSL::SSLSocket.accept_many([], 0))
+  ensure
+    serv.close if serv && !serv.closed?
+    garbage.close if garbage && !garbage.closed?
+    accepted.each(&:close) if accepted
+    clients.each {|th| th.value.close } if clients
+  end
+
+  def test_accept_many_with_raising_verify_callback
+    key = OpenSSL::TestUtils::TEST_KEY_RSA1024
+    now = Time.now
+    cert = OpenSSL::TestUtils.issue_cert(
+      OpenSSL::X509::Name.parse("/DC=org/DC=ruby-lang/CN=localhost"), key,
+      1, now, now + 3600, [], nil, nil, OpenSSL::Digest::SHA1.new)
+    ctxs = [proc { true }, proc { raise "verify failed" }].map {|cb|
+      ctx = OpenSSL::SSL::SSLContext.new
+      ctx.cert = cert
+      ctx.key = key
+      ctx.verify_mode = OpenSSL::SSL::VERIFY_PEER
+      ctx.verify_callback = cb
+      ctx
+    }
+    serv = TCPServer.new("127.0.0.1", 0)
+    port = serv.connect_address.ip_port
+    clients = (1..3).map {
+      Thread.new {
+        ctx = OpenSSL::SSL::SSLContext.new
+        ctx.cert = cert
+        ctx.key = key
+        ssl = OpenSSL::SSL::SSLSocket.new(TCPSocket.new("127.0.0.1", port), ctx)
+        ssl.sync_close = true
+        begin
+          ssl.connect
+        rescue OpenSSL::SSL::SSLError, SystemCallError
+          ssl.close
+          nil
+        end
+      }
+    }
+    pending = (0..2).map {|i|
+      OpenSSL::SSL::SSLSocket.new(serv.accept, ctxs[i == 1 ? 1 : 0])
+    }
+    bad = pending[1]
+    accepted, errors = [], {}
+    until pending.empty?
+      done, failed = OpenSSL::SSL::SSLSocket.accept_many(pending, 10)
+      assert_not_equal(0, done.size + failed.size)
+      accepted.concat(done)
+      errors.update(failed)
+      pending -= done + failed.keys
+    end
+    assert_equal(2, accepted.size)
+    assert_equal([bad], errors.keys)
+    assert_kind_of(RuntimeError, errors[bad])
+    assert_equal("verify failed", errors[bad].message)
+    live = clients.map(&:value).compact
+    assert_equal(2, live.size)
+    live.each_with_index {|ssl, i| ssl.puts(i.to_s) }
+    assert_equal(%w[0 1], accepted.map {|s| s.gets.chomp }.sort)
+  ensure
+    serv.close if serv && !serv.closed?
+    bad.to_io.close if bad
+    accepted.each(&:close) if accepted
+    live.each(&:close) if live
+  end
+
+  def test_accept_many_with_idle_client
+    ctx = OpenSSL::SSL::SSLContext.new
+    ctx.ciphers = "ADH"
+    ctx.tmp_dh_callback = proc { DHParam }
+    serv = TCPServer.new("127.0.0.1", 0)
+    port = serv.connect_address.ip_port
+    idle = TCPSocket.new("127.0.0.1", port)
+    idle_ssl = OpenSSL::SSL::SSLSocket.new(serv.accept, ctx)
+    flags = idle_ssl.to_io.fcntl(Fcntl::F_GETFL)
+    client = Thread.new { client(port) }
+    live_ssl = OpenSSL::SSL::SSLSocket.new(serv.accept, ctx)
+    done, failed = OpenSSL::SSL::SSLSocket.accept_many([idle_ssl, live_ssl], 10)
+    assert_equal([live_ssl], done)
+    assert_equal({}, failed)
+    assert_equal(flags, idle_ssl.to_io.fcntl(Fcntl::F_GETFL))
+    assert_equal([[], {}], OpenSSL::SSL::SSLSocket.accept_many([idle_ssl], 0))
+  ensure
+    serv.close if serv && !serv.closed?
+    idle.close if idle && !idle.closed?
+    idle_ssl.to_io.close if idle_ssl
+    live_ssl.close if live_ssl
+    client.value.close if client
+  end
+
   def test_connect_accept_nonblock
     host = "127.0.0.1"
     port = 0
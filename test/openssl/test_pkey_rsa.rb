@@ -39,6 +39,81 @@ class OpenSSL::TestPKeyRSA < Test::Unit::TestCase
     key4 = OpenSSL::PKey::RSA.new(key3.to_der)
     assert(!key4.private?)
   end
+
+  def test_generate_progress
+    events = []
+    key = OpenSSL::PKey::RSA.generate(512) {|p, n| events << p }
+    assert(key.private?)
+    assert(!events.empty?)
+    assert(events.all? {|p| (0..3).include?(p) })
+  end
+
+  def test_generate_can_be_killed
+    th = Thread.new { OpenSSL::PKey::RSA.generate(8192) }
+    sleep 0.1
+    th.kill
+    assert(th.join(10), "key generation did not stop")
+  end
+
+  def test_sign_verify_in_threads
+    key = OpenSSL::TestUtils::TEST_KEY_RSA1024
+    digest = OpenSSL::Digest::SHA1.new
+    threads = (1..4).map {|i|
+      Thread.new {
+        data = "data#{i}" * 100
+        (1..10).map { key.verify(digest, key.sign(digest, data), data) }
+      }
+    }
+    threads.each {|th| assert_equal([true] * 10, th.value) }
+    plain = "x" * 10
+    threads = (1..4).map {
+      Thread.new { key.private_decrypt(key.public_encrypt(plain)) }
+    }
+    threads.each {|th| assert_equal(plain, th.value) }
+  end
+
+  def test_set_bn_during_private_encrypt
+    key = OpenSSL::PKey::RSA.new(OpenSSL::TestUtils::TEST_KEY_RSA1024.to_der)
+    d = key.d
+    plain = "x" * 10
+    th = Thread.new {
+      (1..50).map { key.public_decrypt(key.private_encrypt(plain)) }
+    }
+    # the setters wait for the operations on the key to finish
+    200.times {
+      key.n = key.n
+      key.d = nil
+      key.d = d
+    }
+    assert_equal([plain] * 50, th.value)
+  end
+
+  def test_parse_cache
+    key = OpenSSL::TestUtils::TEST_KEY_RSA1024
+    OpenSSL::ParseCache.size = 4
+    OpenSSL::ParseCache.clear
+    pub = OpenSSL::PKey::RSA.new(key.public_key.to_der)
+    assert_same(pub, OpenSSL::PKey::RSA.new(key.public_key.to_der))
+    assert(pub.frozen?)
+    assert_raise(RuntimeError) { pub.blinding_off! }
+    assert_raise(RuntimeError) { pub.n = 3 }
+    assert_raise(RuntimeError) { pub.send(:initialize, key.to_der) }
+    assert_equal(key.public_key.to_der, pub.to_der)
+
+    # private keys are never shared, encrypted or not
+    priv = OpenSSL::PKey::RSA.new(key.to_der)
+    assert_not_same(priv, OpenSSL::PKey::RSA.new(key.to_der))
+    assert(!priv.frozen?)
+    pem = key.to_pem(OpenSSL::Cipher::Cipher.new("AES-128-CBC"), "secret")
+    assert_equal(key.to_der, OpenSSL::PKey::RSA.new(pem) { "secret" }.to_der)
+    assert_raise(OpenSSL::PKey::RSAError) {
+      OpenSSL::PKey::RSA.new(pem) { "wrong" }
+    }
+    assert_equal(1, OpenSSL::ParseCache.stats[:size])
+  ensure
+    OpenSSL::ParseCache.size = 0
+    OpenSSL::ParseCache.clear
+  end
 end
 
 end
@@ -361,6 +361,21 @@ class OpenSSL::TestSSL < Test::Unit::TestCase
     }
   end
 
+  def test_exception_in_verify_callback
+    start_server(PORT, OpenSSL::SSL::VERIFY_NONE, true){|server, port|
+      sock = TCPSocket.new("127.0.0.1", port)
+      ctx = OpenSSL::SSL::SSLContext.new
+      ctx.set_params(
+        :verify_callback => Proc.new do |preverify_ok, store_ctx|
+          raise RuntimeError, "verify_callback failed"
+        end
+      )
+      ssl = OpenSSL::SSL::SSLSocket.new(sock, ctx)
+      assert_raise(RuntimeError){ ssl.connect }
+      sock.close
+    }
+  end
+
   def test_sslctx_set_params
     start_server(PORT, OpenSSL::SSL::VERIFY_NONE, true){|server, port|
       sock = TCPSocket.new("127.0.0.1", port)
@@ -445,6 +460,74 @@ class OpenSSL::TestSSL < Test::Unit::TestCase
     }
   end
 
+  def test_verify_certificate_identity
+    now = Time.now
+    issue = proc {|serial, sans|
+      exts = [["subjectAltName", sans, false]] if sans
+      issue_cert(@svr, @svr_key, serial, now, now+1800, exts || [],
+                 @ca_cert, @ca_key, OpenSSL::Digest::SHA1.new)
+    }
+    cert = issue.call(10, "DNS:*.example.com,DNS:f*o.example.org,IP:10.0.0.1,IP:2001:db8::1,email:x@example.net")
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "www.example.com"))
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "WWW.Example.COM"))
+    assert(!OpenSSL::SSL.verify_certificate_identity(cert, "example.com"))
+    assert(!OpenSSL::SSL.verify_certificate_identity(cert, "a.b.example.com"))
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "fxxo.example.org"))
+    assert(!OpenSSL::SSL.verify_certificate_identity(cert, "fo.example.org"))
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "10.0.0.1"))
+    assert(!OpenSSL::SSL.verify_certificate_identity(cert, "10.0.0.2"))
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "2001:DB8:0:0::1"))
+    assert(!OpenSSL::SSL.verify_certificate_identity(cert, "localhost"))
+    assert(!OpenSSL::SSL.verify_certificate_identity(cert, "x@example.net"))
+
+    # without DNS or IP names the commonName is used
+    cert = issue.call(11, "email:x@example.net")
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "localhost"))
+    cert = issue.call(12, nil)
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "localhost"))
+
+    # the names kept for the certificate are dropped when it changes
+    cert.subject = OpenSSL::X509::Name.parse("/CN=example.com")
+    assert(!OpenSSL::SSL.verify_certificate_identity(cert, "localhost"))
+    assert(OpenSSL::SSL.verify_certificate_identity(cert, "example.com"))
+  end
+
+  def test_peer_cert_cache
+    now = Time.now
+    exts = [
+      ["keyUsage","keyEncipherment,digitalSignature",true],
+      ["subjectAltName","DNS:localhost.localdomain,IP:127.0.0.1",false],
+    ]
+    @svr_cert = issue_cert(@svr, @svr_key, 6, now, now+1800, exts,
+                           @ca_cert, @ca_key, OpenSSL::Digest::SHA1.new)
+    start_server(PORT, OpenSSL::SSL::VERIFY_NONE, true){|server, port|
+      sock = TCPSocket.new("127.0.0.1", port)
+      ssl = OpenSSL::SSL::SSLSocket.new(sock)
+      assert_nil(ssl.peer_cert_fingerprint)
+      ssl.connect
+
+      cert = ssl.peer_cert
+      assert_same(cert, ssl.peer_cert)
+      assert_equal(@svr_cert.to_der, cert.to_der)
+      chain = ssl.peer_cert_chain
+      assert_not_same(chain, ssl.peer_cert_chain)
+      assert_same(chain[0], ssl.peer_cert_chain[0])
+      chain.clear
+      assert_not_equal([], ssl.peer_cert_chain)
+      ssl.instance_variable_set(:@peer_cache, [1])
+      assert_same(cert, ssl.peer_cert)
+      assert_equal(cert.subject.to_s, ssl.peer_cert_subject)
+      assert_same(ssl.peer_cert_subject, ssl.peer_cert_subject)
+      assert_equal(OpenSSL::Digest::SHA256.hexdigest(cert.to_der),
+                   ssl.peer_cert_fingerprint)
+      assert_same(ssl.peer_cert_fingerprint, ssl.peer_cert_fingerprint)
+      assert_equal(["DNS:localhost.localdomain", "IP Address:127.0.0.1"],
+                   ssl.peer_cert_subject_alt_names)
+      assert(ssl.peer_cert_subject_alt_names.frozen?)
+      ssl.close
+    }
+  end
+
   def test_client_session
     last_session = nil
     start_server(PORT, OpenSSL::SSL::VERIFY_NONE, true) do |server, port|
@@ -567,6 +650,95 @@ class OpenSSL::TestSSL < Test::Unit::TestCase
     end
   end
 
+  def test_shared_session_cache
+    return unless defined?(OpenSSL::SSL::SessionCache)
+    cache = OpenSSL::SSL::SessionCache.new(16)
+    assert_equal(16, cache.size)
+
+    ctx_proc = Proc.new do |ctx, ssl|
+      ctx.shared_session_cache = cache
+      # make every lookup go to the shared cache
+      ctx.session_cache_mode = OpenSSL::SSL::SSLContext::SESSION_CACHE_SERVER |
+        OpenSSL::SSL::SSLContext::SESSION_CACHE_NO_INTERNAL_LOOKUP
+    end
+
+    first_session = nil
+    start_server(PORT, OpenSSL::SSL::VERIFY_NONE, true, :ctx_proc => ctx_proc) do |server, port|
+      3.times do |i|
+        sock = TCPSocket.new("127.0.0.1", port)
+        ctx = OpenSSL::SSL::SSLContext.new
+        ctx.options = OpenSSL::SSL::OP_NO_TICKET if defined?(OpenSSL::SSL::OP_NO_TICKET)
+        ssl = OpenSSL::SSL::SSLSocket.new(sock, ctx)
+        ssl.sync_close = true
+        cache.flush if i == 2
+        ssl.session = first_session if first_session
+        ssl.connect
+        assert_equal(i == 1, ssl.session_reused?)
+        first_session ||= ssl.session
+        ssl.puts("x")
+        assert_equal("x\n", ssl.gets)
+        ssl.close
+      end
+    end
+
+    stats = cache.stats
+    assert_equal(1, stats[:hits])
+    assert_equal(1, stats[:misses])
+    assert_equal(2, stats[:stores])
+    assert_equal(0, stats[:evictions])
+  end
+
+  def test_shared_session_cache_across_fork
+    return unless defined?(OpenSSL::SSL::SessionCache)
+    return unless Process.respond_to?(:fork)
+    cache = OpenSSL::SSL::SessionCache.new(16)
+    serv = TCPServer.new("127.0.0.1", 0)
+    port = serv.addr[1]
+    worker = lambda {
+      fork {
+        begin
+          ctx = OpenSSL::SSL::SSLContext.new
+          ctx.cert = @svr_cert
+          ctx.key = @svr_key
+          ctx.shared_session_cache = cache
+          ssl = OpenSSL::SSL::SSLSocket.new(serv.accept, ctx)
+          ssl.sync_close = true
+          ssl.accept
+          ssl.puts(ssl.gets)
+          ssl.close
+          # what one worker drops must stay available to the next one
+          ctx.flush_sessions(Time.now + 5000)
+          exit!(0)
+        rescue Exception
+          exit!(1)
+        end
+      }
+    }
+
+    first_session = nil
+    2.times do |i|
+      pid = worker.call
+      sock = TCPSocket.new("127.0.0.1", port)
+      ctx = OpenSSL::SSL::SSLContext.new
+      ctx.options = OpenSSL::SSL::OP_NO_TICKET if defined?(OpenSSL::SSL::OP_NO_TICKET)
+      ssl = OpenSSL::SSL::SSLSocket.new(sock, ctx)
+      ssl.sync_close = true
+      ssl.session = first_session if first_session
+      ssl.connect
+      assert_equal(i == 1, ssl.session_reused?)
+      first_session ||= ssl.session
+      ssl.puts("x")
+      assert_equal("x\n", ssl.gets)
+      ssl.close
+      Process.wait(pid)
+      assert($?.success?)
+    end
+
+    assert_equal(1, cache.stats[:hits])
+  ensure
+    serv.close if serv && !serv.closed?
+  end
+
   def test_tlsext_hostname
     return unless OpenSSL::SSL::SSLSocket.instance_methods.include?(:hostname)
 
@@ -171,6 +171,64 @@ class OpenSSL::TestX509Certificate < Test::Unit::TestCase
     }
   end
   
+  def test_copy_on_write
+    cert = issue_cert(@ca, @rsa2048, 1, Time.now, Time.now+3600, [],
+                      nil, nil, OpenSSL::Digest::SHA1.new)
+    der = cert.to_der
+    copy = cert.dup
+    assert_equal(der, copy.to_der)
+    copy.serial = 2
+    copy.subject = @ee1
+    assert_equal(1, cert.serial)
+    assert_equal(@ca.to_der, cert.subject.to_der)
+    assert_equal(der, cert.to_der)
+    assert_equal(true, cert.verify(@rsa2048))
+    assert_equal(2, copy.serial)
+
+    store = OpenSSL::X509::Store.new
+    store.add_cert(cert)
+    ctx = OpenSSL::X509::StoreContext.new(store, cert)
+    assert_equal(true, ctx.verify)
+    chained = ctx.chain.first
+    chained.serial = 3
+    assert_equal(1, ctx.chain.first.serial)
+    assert_equal(1, cert.serial)
+  end
+
+  def test_parse_cache
+    cert = issue_cert(@ca, @rsa2048, 1, Time.now, Time.now+3600, [],
+                      nil, nil, OpenSSL::Digest::SHA1.new)
+    der, pem = cert.to_der, cert.to_pem
+    assert_not_same(OpenSSL::X509::Certificate.new(der),
+                    OpenSSL::X509::Certificate.new(der))
+
+    OpenSSL::ParseCache.size = 2
+    OpenSSL::ParseCache.clear
+    parsed = OpenSSL::X509::Certificate.new(der)
+    assert(parsed.frozen?)
+    assert_same(parsed, OpenSSL::X509::Certificate.new(der))
+    assert_not_same(parsed, OpenSSL::X509::Certificate.new(pem))
+    assert_equal(der, OpenSSL::X509::Certificate.new(pem).to_der)
+    assert_raise(RuntimeError) { parsed.serial = 2 }
+    assert_equal(2, parsed.dup.tap {|c| c.serial = 2 }.serial)
+    assert_not_same(parsed, OpenSSL::X509::Certificate.new)
+
+    other = pem + "\n"
+    assert_same(OpenSSL::X509::Certificate.new(other),
+                OpenSSL::X509::Certificate.new(other))
+
+    stats = OpenSSL::ParseCache.stats
+    assert_equal(2, stats[:size])
+    assert_equal(3, stats[:misses])
+    assert_equal(3, stats[:hits])
+    assert_equal(1, stats[:evictions])
+    assert_equal(0.5, stats[:hit_rate])
+    assert_not_same(parsed, OpenSSL::X509::Certificate.new(der))
+  ensure
+    OpenSSL::ParseCache.size = 0
+    OpenSSL::ParseCache.clear
+  end
+
   private
   
   def certificate_error_returns_false
@@ -64,6 +64,24 @@ class OpenSSL::TestX509Extension < Test::Unit::TestCase
       %r{URI:ldap://ldap.example.com/cn=ca\?certificateRevocationList;binary},
       cdp.value)
   end
+
+  def test_factory_follows_changed_certificate
+    cert = OpenSSL::X509::Certificate.new
+    cert.public_key = OpenSSL::TestUtils::TEST_KEY_RSA1024.public_key
+    shared = [cert.dup]
+    ef = OpenSSL::X509::ExtensionFactory.new
+    ef.subject_certificate = cert
+    # cert gets an X509 of its own; the one ef saw goes with the last dup
+    cert.public_key = OpenSSL::TestUtils::TEST_KEY_RSA2048.public_key
+    shared.clear
+    GC.start
+    ski = ef.create_extension("subjectKeyIdentifier", "hash")
+
+    fresh = OpenSSL::X509::ExtensionFactory.new
+    fresh.subject_certificate = cert
+    assert_equal(fresh.create_extension("subjectKeyIdentifier", "hash").value,
+                 ski.value)
+  end
 end
 
 end
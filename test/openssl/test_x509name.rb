@@ -271,6 +271,61 @@ class OpenSSL::TestX509Name < Test::Unit::TestCase
 
     assert_equal -1, n1 <=> n2
   end
+
+  def test_aref
+    name = OpenSSL::X509::Name.parse("/DC=org/DC=ruby-lang/O=Ruby/CN=www.ruby-lang.org")
+    assert_equal("www.ruby-lang.org", name[:CN])
+    assert_equal("www.ruby-lang.org", name["commonName"])
+    assert_equal("www.ruby-lang.org", name["2.5.4.3"])
+    assert_equal("Ruby", name[OpenSSL::X509::Name.nid("O")])
+    assert_equal("ruby-lang", name[:DC])
+    assert_nil(name[:OU])
+    assert_raise(OpenSSL::X509::NameError) { name[:foo] }
+    assert_nil(OpenSSL::X509::Name.nid("foo"))
+
+    ary = name.to_a
+    assert_same(ary[0][0], name.to_a[0][0])
+    assert(ary[0][0].frozen?)
+  end
+
+  def test_each_entry
+    name = OpenSSL::X509::Name.parse("/C=JP/CN=www.example.jp")
+    entries = []
+    assert_same(name, name.each_entry {|*e| entries << e })
+    assert_equal([
+        [OpenSSL::X509::Name.nid("C"), "JP", OpenSSL::ASN1::PRINTABLESTRING],
+        [OpenSSL::X509::Name.nid("CN"), "www.example.jp", OpenSSL::ASN1::UTF8STRING],
+      ], entries)
+    assert_equal(entries, name.each_entry.to_a)
+  end
+
+  def test_intern
+    assert_equal(0, OpenSSL::X509::Name.intern_cache_size)
+    name = OpenSSL::X509::Name.parse("/DC=org/DC=ruby-lang/CN=CA")
+    assert_not_same(OpenSSL::X509::Name.intern(name), OpenSSL::X509::Name.intern(name))
+
+    OpenSSL::X509::Name.intern_cache_size = 100
+    assert_equal(128, OpenSSL::X509::Name.intern_cache_size)
+    interned = OpenSSL::X509::Name.intern(name)
+    assert(interned.frozen?)
+    assert_equal(name, interned)
+    assert_same(interned, OpenSSL::X509::Name.intern(OpenSSL::X509::Name.new(name.to_der)))
+    assert_raise(RuntimeError) { interned.add_entry("O", "Ruby") }
+
+    key = OpenSSL::TestUtils::TEST_KEY_RSA1024
+    now = Time.now
+    certs = (1..2).map {|serial|
+      OpenSSL::TestUtils.issue_cert(
+        OpenSSL::X509::Name.parse("/CN=host#{serial}"), key, serial,
+        now, now + 3600, [], nil, nil, OpenSSL::Digest::SHA1.new)
+    }
+    certs.each {|cert| cert.issuer = name }
+    assert_same(certs[0].issuer, certs[1].issuer)
+    assert_same(interned, certs[0].issuer)
+    assert_not_same(certs[0].subject, certs[1].subject)
+  ensure
+    OpenSSL::X509::Name.intern_cache_size = 0
+  end
 end
 
 end